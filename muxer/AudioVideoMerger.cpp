@@ -1,99 +1,1495 @@
 #include "AudioVideoMerger.h"
+#include "ContainerRules.h"
+#include "FileClone.h"
+#include "IsoBmff.h"
+#include "NativeMp4Remuxer.h"
+#include "PacketTap.h"
+#include "SeekIndex.h"
+#include "SegmentedMerger.h"
+#include "TranscodeLibraries.h"
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
 #include <iostream>
 #include <sstream>
 extern "C"
 {
+#include <libavutil/audio_fifo.h>
 #include <libavutil/opt.h>
 #include <libavutil/pixdesc.h>
 }
 
+// 续写分片输出：不再写全局sidx和mfra（只能覆盖续写的部分），分片的解码时间取自数据包的DTS
+static const char *const kResumeMovflags = "+frag_keyframe+empty_moov+default_base_moof+frag_discont+skip_trailer";
+// 读取各输入流第一个DTS时最多读取的数据包数
+static const int kFirstTimestampPackets = 10000;
+
+// 自某一时刻起经过的秒数，并把时刻更新为当前时间
+static double lapSeconds(std::chrono::steady_clock::time_point &since)
+{
+    auto now = std::chrono::steady_clock::now();
+    double seconds = std::chrono::duration<double>(now - since).count();
+    since = now;
+    return seconds;
+}
+
 AudioVideoMerger::~AudioVideoMerger()
 {
-    if (videoFormatContext)
-        avformat_close_input(&videoFormatContext);
-    if (audioFormatContext)
-        avformat_close_input(&audioFormatContext);
-    if (outputFormatContext)
+    cleanup();
+}
+
+void AudioVideoMerger::cleanup()
+{
+    for (auto &item : decoderContexts)
+        avcodec_free_context(&item.second);
+    for (auto &item : encoderContexts)
+        avcodec_free_context(&item.second);
+    for (auto &item : scalerContexts)
+        transcodeLibs->swsFreeContext(item.second);
+    for (auto &item : resamplerContexts)
+        transcodeLibs->swrFree(&item.second);
+    for (auto &item : audioFifos)
+        av_audio_fifo_free(item.second);
+    decoderContexts.clear();
+    encoderContexts.clear();
+    scalerContexts.clear();
+    resamplerContexts.clear();
+    audioFifos.clear();
+    nextAudioPts.clear();
+    bitstreamFilters.clear();
+    resumeStreams.clear();
+    resuming = false;
+    thumbnailExtractor.reset();
+    loudnessAnalyzer.reset();
+
+    if (videoFormatContext)
+        avformat_close_input(&videoFormatContext);
+    if (audioFormatContext)
+        avformat_close_input(&audioFormatContext);
+    // 自定义IO不由avformat_close_input释放
+    videoChecksumInput.close();
+    audioChecksumInput.close();
+    if (outputFormatContext)
+    {
+        if (outputBuffered)
+        {
+            discardOutputBuffer();
+        }
+        else if (checksumOutput.isOpen())
+        {
+            // pb属于checksumOutput，不能由avio_closep释放
+            outputFormatContext->pb = nullptr;
+            checksumOutput.close();
+        }
+        else if (!(outputFormatContext->oformat->flags & AVFMT_NOFILE))
+        {
+            avio_closep(&outputFormatContext->pb);
+        }
+        avformat_free_context(outputFormatContext);
+        outputFormatContext = nullptr;
+    }
+    // 释放输出上下文时封装器可能还会关闭分片文件
+    segmentWriter.reset();
+    streamFormat = nullptr;
+}
+
+int AudioVideoMerger::interruptCallback(void *opaque)
+{
+    AudioVideoMerger *merger = static_cast<AudioVideoMerger *>(opaque);
+    return merger->cancelRequested ? 1 : 0;
+}
+
+void AudioVideoMerger::cancel()
+{
+    cancelRequested = true;
+    std::lock_guard<std::mutex> lock(segmentedMutex);
+    if (activeSegmentedMerger)
+    {
+        activeSegmentedMerger->cancel();
+    }
+}
+
+void AudioVideoMerger::setProgressCallback(ProgressCallback callback, double minIntervalSeconds)
+{
+    progressCallback = callback;
+    progressInterval = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+        std::chrono::duration<double>(std::max(0.0, minIntervalSeconds)));
+}
+
+int64_t AudioVideoMerger::inputRangeDuration(AVFormatContext *formatContext) const
+{
+    if (formatContext->duration == AV_NOPTS_VALUE || formatContext->duration <= 0)
+    {
+        return 0;
+    }
+
+    int64_t rangeEnd = formatContext->duration;
+    if (options.endTime >= 0)
+    {
+        rangeEnd = std::min(rangeEnd, secondsToTimestamp(options.endTime));
+    }
+    int64_t rangeStart = options.startTime > 0 ? secondsToTimestamp(options.startTime) : 0;
+    return std::max<int64_t>(0, rangeEnd - rangeStart);
+}
+
+void AudioVideoMerger::setPacketTap(std::shared_ptr<PacketTap> tap)
+{
+    packetTap = std::move(tap);
+}
+
+void AudioVideoMerger::finishPacketTap(bool success)
+{
+    if (packetTap)
+    {
+        packetTap->finish(success ? std::string() : lastError);
+        packetTap->setCancelFlag(nullptr);
+        packetTap.reset();
+    }
+}
+
+void AudioVideoMerger::startThumbnails()
+{
+    int streamIndex = av_find_best_stream(videoFormatContext, AVMEDIA_TYPE_VIDEO, -1, -1, nullptr, 0);
+    std::string error = "No video stream";
+    if (streamIndex >= 0)
+    {
+        thumbnailExtractor.reset(new ThumbnailExtractor());
+        if (thumbnailExtractor->open(videoFormatContext->streams[streamIndex], options.thumbnailInterval,
+                                     options.thumbnailWidth, options.thumbnailFormat, options.thumbnailQuality,
+                                     options.thumbnailPattern) == 0)
+        {
+            return;
+        }
+        error = thumbnailExtractor->getLastError();
+        thumbnailExtractor.reset();
+    }
+    // 缩略图是附带的输出，失败不影响合并
+    if (options.verbose)
+    {
+        std::cout << "Thumbnails disabled: " << error << std::endl;
+    }
+}
+
+void AudioVideoMerger::startLoudness()
+{
+    int streamIndex = av_find_best_stream(audioFormatContext, AVMEDIA_TYPE_AUDIO, -1, -1, nullptr, 0);
+    std::string error = "No audio stream";
+    if (streamIndex >= 0)
+    {
+        loudnessAnalyzer.reset(new LoudnessAnalyzer());
+        if (loudnessAnalyzer->open(audioFormatContext->streams[streamIndex]) == 0)
+        {
+            return;
+        }
+        error = loudnessAnalyzer->getLastError();
+        loudnessAnalyzer.reset();
+    }
+    if (options.verbose)
+    {
+        std::cout << "Loudness measurement disabled: " << error << std::endl;
+    }
+}
+
+void AudioVideoMerger::writeSeekIndex(const std::string &outputPath)
+{
+    SeekIndex index;
+    if (!index.build(outputPath) || !index.save(options.seekIndexPath))
+    {
+        // 索引是附带的输出，失败不影响合并
+        if (options.verbose)
+        {
+            std::cout << "Seek index not written: " << index.getLastError() << std::endl;
+        }
+        return;
+    }
+    stats.seekIndexWritten = true;
+    stats.seekPoints = (int64_t)index.getPoints().size();
+}
+
+int64_t AudioVideoMerger::secondsToTimestamp(double seconds)
+{
+    return (int64_t)std::llround(seconds * AV_TIME_BASE);
+}
+
+std::string AudioVideoMerger::partialOutputPath(const std::string &outputPath, const std::string &suffix)
+{
+    std::string partial = suffix.empty() ? ".partial" : ".partial." + suffix;
+    // 保留扩展名，未指定输出格式时仍由扩展名推断
+    size_t dot = outputPath.find_last_of('.');
+    size_t separator = outputPath.find_last_of("/\\");
+    if (dot == std::string::npos || (separator != std::string::npos && dot < separator) || dot == separator + 1)
+    {
+        return outputPath + partial;
+    }
+    return outputPath.substr(0, dot) + partial + outputPath.substr(dot);
+}
+
+bool AudioVideoMerger::publishOutput(const std::string &workPath, const std::string &outputPath)
+{
+    // 先落盘再改名：断电后输出路径上要么是原来的文件，要么是完整的新文件
+    if (!syncFile(workPath) || !renameFile(workPath, outputPath))
+    {
+        removeFile(workPath);
+        setError("Failed to move " + workPath + " to " + outputPath);
+        return false;
+    }
+    // 改名记录在目录中，目录也要落盘；个别文件系统不支持同步目录，此时输出已就位，不算失败
+    if (!syncParentDirectory(outputPath) && options.verbose)
+    {
+        std::cout << "Failed to sync directory of " << outputPath << std::endl;
+    }
+    return true;
+}
+
+void AudioVideoMerger::startPacketChecks()
+{
+    std::vector<double> secondsPerTick;
+    for (unsigned int i = 0; i < outputFormatContext->nb_streams; i++)
+    {
+        secondsPerTick.push_back(av_q2d(outputFormatContext->streams[i]->time_base));
+    }
+    packetChecker.reset(secondsPerTick);
+}
+
+bool AudioVideoMerger::finishChecksum()
+{
+    stats.streams = packetChecker.getStreams();
+    if (!checksumOutput.isOpen())
+    {
+        return true;
+    }
+    outputFormatContext->pb = nullptr;
+    if (checksumOutput.close() < 0)
+    {
+        setError("Failed to write output file");
+        return false;
+    }
+    stats.checksumValid = true;
+    stats.outputCrc32c = checksumOutput.getChecksum();
+    return true;
+}
+
+void AudioVideoMerger::printIntegrity() const
+{
+    if (stats.checksumValid)
+    {
+        char text[16];
+        snprintf(text, sizeof(text), "%08x", stats.outputCrc32c);
+        std::cout << "Output CRC32C: " << text << std::endl;
+    }
+    for (size_t i = 0; i < stats.streams.size(); i++)
+    {
+        const StreamIntegrity &stream = stats.streams[i];
+        char text[16];
+        snprintf(text, sizeof(text), "%08x", stream.crc32c);
+        std::cout << "Stream #" << i << ": " << stream.packets << " packets, " << stream.bytes << " bytes, CRC32C "
+                  << text;
+        if (stream.nonMonotonicDts > 0 || stream.droppedPackets > 0 || stream.gaps > 0)
+        {
+            std::cout << ", " << stream.nonMonotonicDts << " non-monotonic DTS, " << stream.droppedPackets
+                      << " dropped, " << stream.gaps << " gaps (" << stream.gapSeconds << "s)";
+        }
+        std::cout << std::endl;
+    }
+}
+
+void AudioVideoMerger::computeTimeShifts()
+{
+    AVFormatContext *inputs[] = {videoFormatContext, audioFormatContext};
+    const double offsets[] = {options.videoOffset, options.audioOffset};
+    int64_t shifts[2];
+    int64_t lowestStart = 0;
+    for (int i = 0; i < 2; i++)
+    {
+        int64_t start = inputs[i]->start_time != AV_NOPTS_VALUE ? inputs[i]->start_time : 0;
+        shifts[i] = secondsToTimestamp(offsets[i]) - (options.alignStartTimes ? start : 0);
+        lowestStart = std::min(lowestStart, start + shifts[i]);
+    }
+
+    // 负偏移使某个输入早于0时，所有输入一起后移，保持相对同步且不产生负时间戳
+    timelineLift = 0;
+    if (options.alignStartTimes || options.videoOffset != 0.0 || options.audioOffset != 0.0)
+    {
+        timelineLift = -lowestStart;
+    }
+    videoTimeShift = shifts[0] + timelineLift;
+    audioTimeShift = shifts[1] + timelineLift;
+
+    shortestEnd = AV_NOPTS_VALUE;
+    if (options.trimToShortest)
+    {
+        const int64_t timeShifts[] = {videoTimeShift, audioTimeShift};
+        for (int i = 0; i < 2; i++)
+        {
+            if (inputs[i]->duration == AV_NOPTS_VALUE || inputs[i]->duration <= 0)
+            {
+                continue;
+            }
+            int64_t start = inputs[i]->start_time != AV_NOPTS_VALUE ? inputs[i]->start_time : 0;
+            int64_t end = start + inputs[i]->duration + timeShifts[i];
+            shortestEnd = shortestEnd == AV_NOPTS_VALUE ? end : std::min(shortestEnd, end);
+        }
+    }
+
+    stats.videoShiftSeconds = videoTimeShift / (double)AV_TIME_BASE;
+    stats.audioShiftSeconds = audioTimeShift / (double)AV_TIME_BASE;
+    if (options.verbose && (videoTimeShift != 0 || audioTimeShift != 0 || shortestEnd != AV_NOPTS_VALUE))
+    {
+        std::cout << "Timestamp shift: video " << stats.videoShiftSeconds << "s, audio " << stats.audioShiftSeconds
+                  << "s";
+        if (shortestEnd != AV_NOPTS_VALUE)
+        {
+            std::cout << ", trimmed to " << shortestEnd / (double)AV_TIME_BASE << "s";
+        }
+        std::cout << std::endl;
+    }
+}
+
+int64_t AudioVideoMerger::timelineOrigin(AVFormatContext *formatContext, int64_t timeShift) const
+{
+    if (options.alignStartTimes)
+    {
+        return timelineLift;
+    }
+    int64_t start = formatContext->start_time != AV_NOPTS_VALUE ? formatContext->start_time : 0;
+    return start + timeShift;
+}
+
+void AudioVideoMerger::reportProgress(int64_t position, bool force)
+{
+    if (!progressCallback)
+    {
+        return;
+    }
+
+    // 每64个数据包才读取一次时钟，避免影响吞吐
+    if (!force && (++progressCounter & 63) != 0)
+    {
+        return;
+    }
+
+    auto now = std::chrono::steady_clock::now();
+    if (!force && now - lastProgressTime < progressInterval)
+    {
+        return;
+    }
+    lastProgressTime = now;
+
+    double progress = 0.0;
+    if (progressTotal > 0)
+    {
+        progress = (progressCompleted + std::max<int64_t>(0, position)) / (double)progressTotal;
+    }
+    progressCallback(std::min(1.0, std::max(0.0, progress)));
+}
+
+bool AudioVideoMerger::merge(const std::string &videoPath, const std::string &audioPath, const std::string &outputPath,
+                             const MergeOptions &options)
+{
+    lastError.clear();
+    cleanup();
+    this->options = options;
+    stats = MergeStats();
+    timestampOffset = AV_NOPTS_VALUE;
+
+    auto mergeStartTime = std::chrono::steady_clock::now();
+
+    // 分接数据包、提取缩略图和测量响度都需要由libavformat逐包处理
+    if (packetTap || options.thumbnailInterval > 0 || options.loudness)
+    {
+        // 续写时它们只能看到续写的部分
+        this->options.resume = false;
+        this->options.nativeRemux = false;
+        this->options.parallelSegments = 0;
+        this->options.cloneUnchangedInput = false;
+        this->options.cacheDirectory.clear();
+    }
+    if (!options.packaging.empty())
+    {
+        if (options.packaging != "hls" && options.packaging != "dash")
+        {
+            setError("Unsupported packaging: " + options.packaging);
+            finishPacketTap(false);
+            return false;
+        }
+        if (options.segmentType != "fmp4" && options.segmentType != "mpegts")
+        {
+            setError("Unsupported segment type: " + options.segmentType);
+            finishPacketTap(false);
+            return false;
+        }
+        // 精简构建的FFmpeg（build_minimal_ffmpeg.sh）可能不含打包所需的封装器
+        const char *segmentMuxer = options.packaging == "hls" && options.segmentType == "mpegts" ? "mpegts" : "mp4";
+        for (const char *muxer : {options.packaging.c_str(), segmentMuxer})
+        {
+            if (!av_guess_format(muxer, nullptr, nullptr))
+            {
+                setError(std::string("Output format not available in the linked FFmpeg: ") + muxer);
+                finishPacketTap(false);
+                return false;
+            }
+        }
+        // 输出是一组文件，只能由HLS/DASH封装器逐包写出
+        this->options.nativeRemux = false;
+        this->options.parallelSegments = 0;
+        this->options.cloneUnchangedInput = false;
+        this->options.cacheDirectory.clear();
+        this->options.faststart = false;
+        this->options.sidx = false;
+        this->options.seekIndexPath.clear();
+    }
+    // 原生封装和直接复制输入都只能得到非分片文件
+    if (this->options.sidx)
+    {
+        this->options.nativeRemux = false;
+        this->options.cloneUnchangedInput = false;
+    }
+    if (packetTap)
+    {
+        packetTap->setCancelFlag(&cancelRequested);
+    }
+
+    if (options.startTime >= 0 && options.endTime >= 0 && options.endTime <= options.startTime)
+    {
+        setError("Invalid time range: end must be greater than start");
+        finishPacketTap(false);
+        return false;
+    }
+
+    // 显式指定的输出格式可以是封装器名称或别名（mkv、ts），统一为封装器名称，与扩展名无关
+    if (!options.outputFormat.empty())
+    {
+        const AVOutputFormat *format = findOutputFormat(options.outputFormat);
+        if (!format)
+        {
+            setError("Unknown output format or not available in the linked FFmpeg: " + options.outputFormat);
+            finishPacketTap(false);
+            return false;
+        }
+        this->options.outputFormat = format->name;
+    }
+
+    // 各条路径都先写到同目录的临时文件，完成后改名。临时文件名带进程号和计数，同时合并到同一输出的
+    // 任务互不干扰（最后完成的改名生效）；续写时临时文件就是上次中断留下的输出，名称固定，
+    // 加锁防止两个任务同时续写
+    bool keepPartial = this->options.resume && this->options.sidx;
+    std::string workPath = outputPath;
+    FileLock partialLock;
+    if (this->options.atomicOutput && this->options.packaging.empty())
+    {
+        workPath = partialOutputPath(outputPath, keepPartial ? std::string() : uniqueFileSuffix());
+        if (keepPartial && !partialLock.lock(workPath + ".lock", false))
+        {
+            setError("Output is being written by another merge: " + workPath);
+            finishPacketTap(false);
+            return false;
+        }
+    }
+
+    // 合并结果缓存：输入指纹和选项都相同时直接取用缓存的输出
+    MergeCache *cache = nullptr;
+    std::string cacheKey;
+    if (!this->options.cacheDirectory.empty())
+    {
+        // 输入无法读取时不使用缓存，由合并报告错误
+        if (MergeCache::makeKey({videoPath, audioPath}, cacheOptionsKey(outputPath), cacheKey))
+        {
+            cache = &MergeCache::forDirectory(options.cacheDirectory);
+            cache->setMaxBytes(options.cacheMaxBytes);
+            CloneMethod method = CloneMethod::Failed;
+            if (cache->fetch(cacheKey, {videoPath, audioPath}, workPath, options.cacheVerifyInputs, method))
+            {
+                if (!publishOutput(workPath, outputPath))
+                {
+                    return false;
+                }
+                int64_t modifiedTime = 0;
+                ProbeCache::statFile(outputPath, stats.bytesWritten, modifiedTime);
+                stats.cacheHit = true;
+                stats.cloneMethod = method;
+                stats.totalSeconds = lapSeconds(mergeStartTime);
+                if (options.verbose)
+                {
+                    std::cout << "Merge cache hit (" << cloneMethodName(method) << "): " << outputPath << std::endl;
+                }
+                if (!options.seekIndexPath.empty())
+                {
+                    writeSeekIndex(outputPath);
+                }
+                return true;
+            }
+        }
+        // 之前命中时输出可能是缓存文件的硬链接，不能原地改写（写临时文件后改名时不会改写）
+        if (workPath == outputPath)
+        {
+            removeFile(outputPath);
+        }
+    }
+
+    // 只读取部分输入时补读剩余部分的代价过高，不记录输入校验和
+    hashInputs = cache != nullptr && options.startTime < 0 && options.endTime < 0;
+    inputChecksums.clear();
+    bool success = mergeInputs(videoPath, audioPath, workPath, mergeStartTime);
+    finishPacketTap(success);
+    if (workPath != outputPath)
+    {
+        // 改名前关闭输出文件（Windows上不能改名打开中的文件）
+        cleanup();
+        if (!success && !keepPartial)
+        {
+            removeFile(workPath);
+        }
+        success = success && publishOutput(workPath, outputPath);
+    }
+    if (!success)
+    {
+        return false;
+    }
+    // 复制输入得到的输出再次复制同样廉价，不占用缓存空间
+    if (cache && !stats.inputCloned && !cache->store(cacheKey, outputPath, inputChecksums) && options.verbose)
+    {
+        std::cout << "Failed to add output to merge cache: " << options.cacheDirectory << std::endl;
+    }
+    // 各条路径（原生、分段、复制输入、libavformat）写出的文件都从样本表读取索引
+    if (!options.seekIndexPath.empty())
+    {
+        writeSeekIndex(outputPath);
+    }
+    return true;
+}
+
+bool AudioVideoMerger::mergeInputs(const std::string &videoPath, const std::string &audioPath,
+                                   const std::string &outputPath, std::chrono::steady_clock::time_point mergeStartTime)
+{
+    auto phaseStartTime = mergeStartTime;
+
+    // 一个输入没有任何流、另一个已是目标封装格式时，输出就是该输入本身
+    if (options.cloneUnchangedInput && cloneUnchangedInput(videoPath, audioPath, outputPath))
+    {
+        stats.totalSeconds = lapSeconds(mergeStartTime);
+        return true;
+    }
+
+    // 并行分段模式：由SegmentedMerger切分时间轴，各段仍由AudioVideoMerger处理
+    if (options.parallelSegments > 1)
+    {
+        SegmentedMerger segmentedMerger(options.parallelSegments);
+        if (progressCallback)
+        {
+            segmentedMerger.setProgressCallback(progressCallback,
+                                                std::chrono::duration<double>(progressInterval).count());
+        }
+        {
+            std::lock_guard<std::mutex> lock(segmentedMutex);
+            activeSegmentedMerger = &segmentedMerger;
+        }
+        // 注册之前已请求的取消
+        if (cancelRequested)
+        {
+            segmentedMerger.cancel();
+        }
+        bool success = segmentedMerger.merge(videoPath, audioPath, outputPath, options);
+        {
+            std::lock_guard<std::mutex> lock(segmentedMutex);
+            activeSegmentedMerger = nullptr;
+        }
+        stats.totalSeconds = lapSeconds(mergeStartTime);
+        if (!success)
+        {
+            setError(segmentedMerger.getLastError());
+            return false;
+        }
+        stats.checksumValid = segmentedMerger.hasChecksum();
+        stats.outputCrc32c = segmentedMerger.getOutputChecksum();
+        stats.streams = segmentedMerger.getStreamIntegrity();
+        // 各段的合并器各自计数，这里取拼接时的数量，与单次合并的含义一致
+        stats.packetsRead = segmentedMerger.getPacketsRead();
+        stats.packetsWritten = segmentedMerger.getPacketsWritten();
+        stats.bytesRead = segmentedMerger.getBytesRead();
+        int64_t modifiedTime = 0;
+        ProbeCache::statFile(outputPath, stats.bytesWritten, modifiedTime);
+        return true;
+    }
+
+    // 初始化FFmpeg库（在新版本中已弃用，但为了兼容性保留）
+#if LIBAVFORMAT_VERSION_INT < AV_VERSION_INT(58, 9, 100)
+    av_register_all();
+#endif
+
+    // fMP4输入的原生流复制路径，不适用时继续使用libavformat
+    if (options.nativeRemux)
+    {
+        int result = remuxNatively(videoPath, audioPath, outputPath);
+        if (result <= 0)
+        {
+            stats.totalSeconds = lapSeconds(mergeStartTime);
+            return result == 0;
+        }
+    }
+
+    // 分片输出可以从上次中断留下的最后一个完整分片续写；裁剪起点时已有分片的时间轴无法与输入对应
+    if (options.resume && options.sidx && options.startTime < 0)
+    {
+        prepareResume(outputPath);
+    }
+
+    // 打开视频文件
+    if (openInputFile(videoPath, &videoFormatContext, hashInputs ? &videoChecksumInput : nullptr) < 0)
+    {
+        setError("Failed to open video file: " + videoPath);
+        return false;
+    }
+
+    // 打开音频文件
+    if (openInputFile(audioPath, &audioFormatContext, hashInputs ? &audioChecksumInput : nullptr) < 0)
+    {
+        setError("Failed to open audio file: " + audioPath);
+        return false;
+    }
+
+    computeTimeShifts();
+
+    // 定位到起始时间之前最近的关键帧，避免读取并丢弃前面的数据；
+    // 对齐起点时裁剪时间在共同的时间轴上，各输入按自己的偏移换算
+    if (options.startTime > 0)
+    {
+        double videoSeek = options.startTime - (options.alignStartTimes ? options.videoOffset : 0.0);
+        double audioSeek = options.startTime - (options.alignStartTimes ? options.audioOffset : 0.0);
+        if (seekInput(videoFormatContext, std::max(0.0, videoSeek)) < 0)
+        {
+            setError("Failed to seek video file: " + videoPath);
+            return false;
+        }
+        if (seekInput(audioFormatContext, std::max(0.0, audioSeek)) < 0)
+        {
+            setError("Failed to seek audio file: " + audioPath);
+            return false;
+        }
+    }
+
+    // 创建输出文件
+    if (createOutputFile(outputPath) < 0)
+    {
+        setError("Failed to create output file: " + outputPath);
+        return false;
+    }
+
+    // format test
+    // Print input files codec information
+    if (options.verbose)
+    {
+        printCodecInfo(videoFormatContext, "Video Input File (" + videoPath + ")");
+        printCodecInfo(audioFormatContext, "Audio Input File (" + audioPath + ")");
+    }
+
+    // 复制视频流
+    if (copyOrCvtStreams(videoFormatContext, 0) < 0)
+    {
+        setError("Failed to copy video streams");
+        return false;
+    }
+
+    // 复制音频流
+    int audioStreamOffset = videoFormatContext->nb_streams;
+    if (copyOrCvtStreams(audioFormatContext, audioStreamOffset) < 0)
+    {
+        setError("Failed to copy audio streams");
+        return false;
+    }
+
+    // 续写需要已有分片与各输出流一一对应；不能续写时从头合并，输出改为正常打开（截断已有文件）
+    if (resuming)
+    {
+        int result = matchResumeInputs();
+        if (result < 0)
+        {
+            setError("Failed to rewind input files");
+            return false;
+        }
+        if (result > 0)
+        {
+            resuming = false;
+            discardOutputBuffer();
+            if (openOutputIO(outputPath) < 0)
+            {
+                setError("Failed to create output file: " + outputPath);
+                return false;
+            }
+        }
+    }
+
+    stats.transcodedStreams = (int)encoderContexts.size();
+    stats.openSeconds = lapSeconds(phaseStartTime);
+
+    // 写入输出文件头部
+    AVDictionary *muxerOptions = nullptr;
+    if (!options.packaging.empty())
+    {
+        setupPackaging(outputPath, &muxerOptions);
+    }
+    else if (resuming)
+    {
+        // 续写的分片接着已有分片编号，时间戳已换算到已有分片的时间轴，不能再平移
+        av_dict_set(&muxerOptions, "movflags", kResumeMovflags, 0);
+        av_dict_set_int(&muxerOptions, "fragment_index", fragmentResume.getNextSequence(), 0);
+        outputFormatContext->avoid_negative_ts = AVFMT_AVOID_NEG_TS_DISABLED;
+    }
+    else if (options.sidx)
+    {
+        // 分片输出的moov本来就在开头，不需要faststart
+        av_dict_set(&muxerOptions, "movflags", kSidxMovflags, 0);
+    }
+    else if (options.faststart)
+    {
+        setupFaststart(&muxerOptions);
+    }
+    int headerResult = avformat_write_header(outputFormatContext, &muxerOptions);
+    av_dict_free(&muxerOptions);
+    if (headerResult < 0)
+    {
+        setError("Failed to write file header");
+        return false;
+    }
+    if (resuming)
+    {
+        int result = startResume(outputPath);
+        if (result < 0)
+        {
+            return false;
+        }
+        if (result > 0)
+        {
+            // 已有分片不是这些输入的输出：关闭所有上下文后从头合并，已有文件随之被截断
+            cleanup();
+            options.resume = false;
+            return mergeInputs(videoPath, audioPath, outputPath, mergeStartTime);
+        }
+    }
+    stats.headerSeconds = lapSeconds(phaseStartTime);
+    if (options.checksum)
+    {
+        startPacketChecks();
+    }
+    if (packetTap)
+    {
+        packetTap->setStreams(outputFormatContext);
+    }
+    if (options.thumbnailInterval > 0)
+    {
+        startThumbnails();
+    }
+    if (options.loudness)
+    {
+        startLoudness();
+    }
+
+    // 读取并写入数据包
+    if (!processPackets(audioStreamOffset))
+    {
+        setError(cancelRequested ? "Merge cancelled" : "Failed to process packets");
+        return false;
+    }
+
+    // 冲刷转码器中缓存的帧
+    if (!flushTranscoders())
+    {
+        setError("Failed to flush transcoders");
+        return false;
+    }
+    if (!flushBitstreamFilters())
+    {
+        setError("Failed to flush bitstream filters");
+        return false;
+    }
+
+    stats.packetSeconds = lapSeconds(phaseStartTime);
+
+    // 写入文件尾部；失败时输出不完整，不能发布
+    if (av_write_trailer(outputFormatContext) < 0)
+    {
+        setError("Failed to write file trailer");
+        return false;
+    }
+    reportProgress(progressTotal - progressCompleted, true);
+    if (outputFormatContext->pb)
+    {
+        stats.bytesWritten = std::max<int64_t>(0, avio_size(outputFormatContext->pb));
+    }
+    if (options.checksum && !finishChecksum())
+    {
+        return false;
+    }
+    // 等待写线程写完剩余的分片
+    if (segmentWriter)
+    {
+        if (segmentWriter->finish() < 0)
+        {
+            setError(segmentWriter->getLastError());
+            return false;
+        }
+        stats.bytesWritten = segmentWriter->getBytesWritten();
+        stats.segmentFiles = segmentWriter->getFilesWritten();
+    }
+    if (thumbnailExtractor)
+    {
+        stats.thumbnails = thumbnailExtractor->takeThumbnails();
+        stats.thumbnailFailures = thumbnailExtractor->getFailures();
+    }
+    // 测量线程与写文件尾并行，到这里才等待它处理完剩余的数据包
+    if (loudnessAnalyzer)
+    {
+        stats.loudness = loudnessAnalyzer->finish();
+    }
+    if (hashInputs)
+    {
+        uint32_t videoCrc = 0;
+        uint32_t audioCrc = 0;
+        if (videoChecksumInput.finish(videoCrc) && audioChecksumInput.finish(audioCrc))
+        {
+            inputChecksums = {videoCrc, audioCrc};
+        }
+    }
+    stats.trailerSeconds = lapSeconds(phaseStartTime);
+    stats.totalSeconds = lapSeconds(mergeStartTime);
+
+    // Print output file codec information
+    if (options.verbose)
+    {
+        printOutputCodecInfo();
+        if (options.checksum)
+        {
+            printIntegrity();
+        }
+    }
+    return true;
+}
+std::string AudioVideoMerger::cacheOptionsKey(const std::string &outputPath) const
+{
+    // 输出格式未指定时由扩展名推断
+    std::string extension;
+    size_t dot = outputPath.find_last_of('.');
+    size_t separator = outputPath.find_last_of("/\\");
+    if (dot != std::string::npos && (separator == std::string::npos || dot > separator))
+    {
+        extension = outputPath.substr(dot);
+    }
+
+    std::ostringstream key;
+    key.precision(17);
+    key << options.startTime << ' ' << options.endTime << ' ' << options.rebaseTimestamps << ' '
+        << options.alignStartTimes << ' ' << options.videoOffset << ' ' << options.audioOffset << ' '
+        << options.trimToShortest << ' ' << options.outputFormat << ' ' << extension << ' '
+        << options.parallelSegments << ' ' << options.forceTranscode << ' ' << options.nativeRemux << ' '
+        << options.faststart << ' ' << options.cloneUnchangedInput << ' ' << options.sidx;
+    return key.str();
+}
+
+int AudioVideoMerger::remuxNatively(const std::string &videoPath, const std::string &audioPath,
+                                    const std::string &outputPath)
+{
+    if (options.startTime >= 0 || options.endTime >= 0 || options.forceTranscode || options.trimToShortest)
+    {
+        return 1;
+    }
+    const char *formatName = options.outputFormat.empty() ? nullptr : options.outputFormat.c_str();
+    const AVOutputFormat *outFormat = av_guess_format(formatName, outputPath.c_str(), nullptr);
+    if (!outFormat || strcmp(outFormat->name, "mp4") != 0)
+    {
+        return 1;
+    }
+
+    auto phaseStartTime = std::chrono::steady_clock::now();
+    NativeMp4Remuxer remuxer;
+    remuxer.setStartAlignment(options.alignStartTimes, {options.videoOffset, options.audioOffset});
+    remuxer.setComputeChecksums(options.checksum);
+    remuxer.setComputeInputChecksums(hashInputs);
+    if (!remuxer.open({videoPath, audioPath}))
+    {
+        if (options.verbose)
+        {
+            std::cout << "Native remux not applicable (" << remuxer.getLastError() << "), using libavformat"
+                      << std::endl;
+        }
+        return 1;
+    }
+    stats.openSeconds = lapSeconds(phaseStartTime);
+
+    if (options.verbose)
+    {
+        std::cout << "Native remux: " << remuxer.getTrackCount() << " tracks, " << remuxer.getTotalSamples()
+                  << " samples, sample index " << remuxer.getIndexBytes() / 1024 << " KB" << std::endl;
+    }
+
+    // 进度按已复制的样本字节数计算
+    progressCompleted = 0;
+    progressTotal = remuxer.getTotalSampleBytes();
+    remuxer.setCancelFlag(&cancelRequested);
+    remuxer.setProgressCallback([this](int64_t copiedBytes, int64_t) {
+        // 每个复制块都检查时间间隔，不按数据包计数节流
+        progressCounter = 63;
+        reportProgress(copiedBytes);
+    });
+
+    if (!remuxer.write(outputPath, options.faststart))
+    {
+        setError(remuxer.getLastError());
+        return -1;
+    }
+    stats.packetSeconds = lapSeconds(phaseStartTime);
+    reportProgress(progressTotal, true);
+
+    stats.nativeRemux = true;
+    stats.packetsRead = remuxer.getTotalSamples();
+    stats.packetsWritten = stats.packetsRead;
+    stats.bytesRead = remuxer.getTotalSampleBytes();
+    stats.bytesWritten = remuxer.getOutputBytes();
+    stats.videoShiftSeconds = remuxer.getTimeShift(0);
+    stats.audioShiftSeconds = remuxer.getTimeShift(1);
+    uint32_t videoCrc = 0;
+    uint32_t audioCrc = 0;
+    if (hashInputs && remuxer.getInputChecksum(0, videoCrc) && remuxer.getInputChecksum(1, audioCrc))
+    {
+        inputChecksums = {videoCrc, audioCrc};
+    }
+    if (options.checksum)
+    {
+        stats.checksumValid = true;
+        stats.outputCrc32c = remuxer.getOutputChecksum();
+        stats.streams = remuxer.getStreamIntegrity();
+        if (options.verbose)
+        {
+            printIntegrity();
+        }
+    }
+
+    if (options.validateNativeRemux && validateNativeOutput(outputPath, remuxer) < 0)
+    {
+        return -1;
+    }
+    stats.trailerSeconds = lapSeconds(phaseStartTime);
+    return 0;
+}
+
+// 由libavformat的mov封装器处理、支持moov_size和faststart的格式
+static bool isMovMuxer(const AVOutputFormat *format)
+{
+    static const char *const names[] = {"mp4", "mov", "ipod", "3gp", "3g2", "psp", "f4v"};
+    for (const char *name : names)
+    {
+        if (strcmp(format->name, name) == 0)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+// 输入的解封装器名称（如"mov,mp4,m4a,3gp,3g2,mj2"）是否包含输出封装格式
+static bool isSameContainer(const std::string &inputFormatName, const AVOutputFormat *outFormat)
+{
+    std::istringstream names(inputFormatName);
+    std::string name;
+    while (std::getline(names, name, ','))
+    {
+        if (name == outFormat->name)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+// 非分片的ISO-BMFF文件：没有moof且moov中没有mvex；requireFaststart时moov还须在mdat之前
+static bool isPlainMovFile(const std::string &path, bool requireFaststart)
+{
+    IsoBmffReader reader;
+    if (!reader.open(path))
+    {
+        return false;
+    }
+    int64_t fileSize = reader.getFileSize();
+    bool haveMoov = false;
+    bool mdatFirst = false;
+    int64_t offset = 0;
+    BoxHeader box;
+    for (int count = 0; count < 64 && reader.readBoxHeader(offset, fileSize, box); count++)
+    {
+        if (box.type == boxType("moof"))
+        {
+            return false;
+        }
+        if (box.type == boxType("moov"))
+        {
+            BoxHeader mvex;
+            if (reader.findChild(box.payloadOffset(), box.end(), boxType("mvex"), mvex))
+            {
+                return false;
+            }
+            haveMoov = true;
+        }
+        else if (box.type == boxType("mdat") && !haveMoov)
+        {
+            mdatFirst = true;
+        }
+        offset = box.end();
+    }
+    // 顶层盒子过多时没有检查完整个文件
+    return offset >= fileSize && haveMoov && !(requireFaststart && mdatFirst);
+}
+
+bool AudioVideoMerger::cloneUnchangedInput(const std::string &videoPath, const std::string &audioPath,
+                                           const std::string &outputPath)
+{
+    // 任何改变时间戳或数据的选项都需要真正合并；校验需要逐包统计
+    if (options.startTime >= 0 || options.endTime >= 0 || options.forceTranscode || options.trimToShortest ||
+        options.videoOffset != 0.0 || options.audioOffset != 0.0 || options.checksum)
+    {
+        return false;
+    }
+    const char *formatName = options.outputFormat.empty() ? nullptr : options.outputFormat.c_str();
+    const AVOutputFormat *outFormat = av_guess_format(formatName, outputPath.c_str(), nullptr);
+    if (!outFormat || (outFormat->flags & AVFMT_NOFILE))
+    {
+        return false;
+    }
+
+    // 探测结果进入ProbeCache，不适用时之后的合并不再重复解析
+    MediaInfo audioInfo;
+    MediaInfo videoInfo;
+    if (probeInput(audioPath, outFormat, true, true, audioInfo) < 0 ||
+        probeInput(videoPath, outFormat, true, true, videoInfo) < 0)
+    {
+        return false;
+    }
+    const MediaInfo *source = nullptr;
+    if (audioInfo.streams.empty())
+    {
+        source = &videoInfo;
+    }
+    else if (videoInfo.streams.empty())
+    {
+        source = &audioInfo;
+    }
+    if (!source || source->streams.empty() || source->transcodeStreams > 0 ||
+        !isSameContainer(source->formatName, outFormat))
+    {
+        return false;
+    }
+    // 分片MP4仍需重新封装为普通MP4
+    if (isMovMuxer(outFormat) && !isPlainMovFile(source->path, options.faststart))
+    {
+        return false;
+    }
+    // 对齐开始时间会把输入的时间戳整体前移，开始时间非0时输出与输入不同
+    if (options.alignStartTimes)
+    {
+        MediaInfo fullInfo;
+        const MediaInfo *timing = source;
+        if (!source->startTimeKnown)
+        {
+            if (probeInput(source->path, outFormat, false, false, fullInfo) < 0)
+            {
+                return false;
+            }
+            timing = &fullInfo;
+        }
+        if (timing->startSeconds != 0.0)
+        {
+            return false;
+        }
+    }
+
+    CloneMethod method = cloneFile(source->path, outputPath, false);
+    if (method == CloneMethod::Failed)
+    {
+        return false;
+    }
+    stats.inputCloned = true;
+    stats.cloneMethod = method;
+    stats.bytesWritten = source->fileSize;
+    if (options.verbose)
+    {
+        std::cout << "Output is identical to " << source->path << ", cloned (" << cloneMethodName(method)
+                  << ")" << std::endl;
+    }
+    return true;
+}
+
+static int indexEntryCount(AVStream *stream)
+{
+#if LIBAVFORMAT_VERSION_INT >= AV_VERSION_INT(58, 78, 100)
+    return avformat_index_get_entries_count(stream);
+#else
+    return stream->nb_index_entries;
+#endif
+}
+
+static const AVIndexEntry *indexEntry(AVStream *stream, int index)
+{
+#if LIBAVFORMAT_VERSION_INT >= AV_VERSION_INT(58, 78, 100)
+    return avformat_index_get_entry(stream, index);
+#else
+    return &stream->index_entries[index];
+#endif
+}
+
+int64_t AudioVideoMerger::estimateMoovSize() const
+{
+    // 转码后的样本数与输入不同
+    if (!encoderContexts.empty())
+    {
+        return 0;
+    }
+
+    // 固定部分：ftyp之后的mvhd、udta等
+    int64_t total = 16 * 1024;
+    AVFormatContext *inputs[] = {videoFormatContext, audioFormatContext};
+    for (AVFormatContext *input : inputs)
+    {
+        for (unsigned int i = 0; i < input->nb_streams; i++)
+        {
+            AVStream *stream = input->streams[i];
+            int entries = indexEntryCount(stream);
+            if (entries <= 0)
+            {
+                return 0;
+            }
+
+            // 分片输入只索引了已解析的分片，索引覆盖的时长明显短于流时长时无法估计
+            if (stream->duration > 0 && entries > 1)
+            {
+                int64_t covered = indexEntry(stream, entries - 1)->timestamp - indexEntry(stream, 0)->timestamp;
+                if (covered < stream->duration * 9 / 10)
+                {
+                    return 0;
+                }
+            }
+
+            // 每个样本的上限：stsz 4、stts 8、每样本一块时的stsc 12和co64 8；视频另有ctts 8和stss 4
+            bool video = stream->codecpar->codec_type == AVMEDIA_TYPE_VIDEO;
+            int64_t perSample = 32 + (video ? 12 : 0);
+            total += 2048 + 2 * (int64_t)stream->codecpar->extradata_size + (int64_t)entries * perSample;
+        }
+    }
+    return total;
+}
+
+void AudioVideoMerger::setupFaststart(AVDictionary **muxerOptions)
+{
+    if (!isMovMuxer(outputFormatContext->oformat))
+    {
+        return;
+    }
+
+    // 预留的空间写入moov后剩余部分成为free盒子，mdat只写一遍
+    int64_t moovSize = estimateMoovSize();
+    if (moovSize > 0 && moovSize <= INT_MAX)
+    {
+        av_dict_set_int(muxerOptions, "moov_size", moovSize, 0);
+        if (options.verbose)
+        {
+            std::cout << "Faststart: reserving " << moovSize << " bytes for moov" << std::endl;
+        }
+        return;
+    }
+
+    av_dict_set(muxerOptions, "movflags", "+faststart", 0);
+    if (options.verbose)
+    {
+        std::cout << "Faststart: input index incomplete, moov will be moved after writing" << std::endl;
+    }
+}
+
+void AudioVideoMerger::setupPackaging(const std::string &outputPath, AVDictionary **muxerOptions)
+{
+    // 分片文件名以清单文件名（不含扩展名）开头
+    size_t separator = outputPath.find_last_of("/\\");
+    std::string name = separator == std::string::npos ? outputPath : outputPath.substr(separator + 1);
+    std::string directory = separator == std::string::npos ? std::string() : outputPath.substr(0, separator + 1);
+    size_t dot = name.find_last_of('.');
+    std::string stem = dot == std::string::npos || dot == 0 ? name : name.substr(0, dot);
+
+    if (options.packaging == "hls")
     {
-        if (!(outputFormatContext->oformat->flags & AVFMT_NOFILE))
+        bool fmp4 = options.segmentType == "fmp4";
+        av_dict_set(muxerOptions, "hls_time", std::to_string(options.segmentDuration).c_str(), 0);
+        av_dict_set(muxerOptions, "hls_playlist_type", "vod", 0);
+        av_dict_set_int(muxerOptions, "hls_list_size", 0, 0);
+        av_dict_set(muxerOptions, "hls_segment_type", fmp4 ? "fmp4" : "mpegts", 0);
+        av_dict_set(muxerOptions, "hls_flags", "independent_segments", 0);
+        // 分片路径相对当前目录，初始化分片的文件名相对播放列表所在目录
+        av_dict_set(muxerOptions, "hls_segment_filename",
+                    (directory + stem + (fmp4 ? "_%05d.m4s" : "_%05d.ts")).c_str(), 0);
+        if (fmp4)
         {
-            avio_closep(&outputFormatContext->pb);
+            av_dict_set(muxerOptions, "hls_fmp4_init_filename", (stem + "_init.mp4").c_str(), 0);
         }
-        avformat_free_context(outputFormatContext);
+    }
+    else
+    {
+        // DASH的分片名相对清单所在目录
+        av_dict_set(muxerOptions, "seg_duration", std::to_string(options.segmentDuration).c_str(), 0);
+        av_dict_set(muxerOptions, "init_seg_name", (stem + "_init_$RepresentationID$.m4s").c_str(), 0);
+        av_dict_set(muxerOptions, "media_seg_name", (stem + "_$RepresentationID$_$Number%05d$.m4s").c_str(), 0);
+        av_dict_set_int(muxerOptions, "use_timeline", 1, 0);
+        av_dict_set_int(muxerOptions, "use_template", 1, 0);
+    }
+
+    if (options.verbose)
+    {
+        std::cout << "Packaging " << options.packaging << ": " << options.segmentDuration << "s segments, "
+                  << (segmentWriter ? "asynchronous" : "synchronous") << " writes" << std::endl;
     }
 }
 
-bool AudioVideoMerger::merge(const std::string &videoPath, const std::string &audioPath, const std::string &outputPath)
+int AudioVideoMerger::validateNativeOutput(const std::string &outputPath, const NativeMp4Remuxer &remuxer)
 {
-    lastError.clear();
+    AVFormatContext *formatContext = nullptr;
+    if (openInputFile(outputPath, &formatContext) < 0)
+    {
+        setError("Native remux validation: failed to open " + outputPath);
+        return -1;
+    }
 
-    // 初始化FFmpeg库（在新版本中已弃用，但为了兼容性保留）
-#if LIBAVFORMAT_VERSION_INT < AV_VERSION_INT(58, 9, 100)
-    av_register_all();
-#endif
+    int result = 0;
+    if ((int)formatContext->nb_streams != remuxer.getTrackCount())
+    {
+        setError("Native remux validation: stream count mismatch");
+        result = -1;
+    }
 
-    // 打开视频文件
-    if (openInputFile(videoPath, &videoFormatContext) < 0)
+    std::vector<int64_t> packets(formatContext->nb_streams, 0);
+    std::vector<int64_t> bytes(formatContext->nb_streams, 0);
+    AVPacket *packet = av_packet_alloc();
+    while (result == 0 && packet && av_read_frame(formatContext, packet) >= 0)
     {
-        setError("Failed to open video file: " + videoPath);
-        return false;
+        packets[packet->stream_index]++;
+        bytes[packet->stream_index] += packet->size;
+        av_packet_unref(packet);
     }
+    av_packet_free(&packet);
 
-    // 打开音频文件
-    if (openInputFile(audioPath, &audioFormatContext) < 0)
+    for (unsigned int i = 0; result == 0 && i < formatContext->nb_streams; i++)
     {
-        setError("Failed to open audio file: " + audioPath);
-        return false;
+        if (packets[i] != remuxer.getSampleCount((int)i) || bytes[i] != remuxer.getSampleBytes((int)i))
+        {
+            std::ostringstream message;
+            message << "Native remux validation: stream " << i << " has " << packets[i] << " packets / " << bytes[i]
+                    << " bytes, expected " << remuxer.getSampleCount((int)i) << " / " << remuxer.getSampleBytes((int)i);
+            setError(message.str());
+            result = -1;
+        }
     }
 
-    // 创建输出文件
-    if (createOutputFile(outputPath) < 0)
+    avformat_close_input(&formatContext);
+    return result;
+}
+
+bool AudioVideoMerger::estimate(const std::string &videoPath, const std::string &audioPath,
+                                const std::string &outputPath, const MergeOptions &options, MergeEstimate &estimate)
+{
+    lastError.clear();
+    cleanup();
+    this->options = options;
+    estimate = MergeEstimate();
+
+    const char *formatName = options.outputFormat.empty() ? nullptr : options.outputFormat.c_str();
+    const AVOutputFormat *outFormat = av_guess_format(formatName, outputPath.c_str(), nullptr);
+    if (!outFormat)
     {
-        setError("Failed to create output file: " + outputPath);
+        setError("Unknown output format: " + outputPath);
         return false;
     }
 
-    // format test
-    // Print input files codec information
-    printCodecInfo(videoFormatContext, "Video Input File (" + videoPath + ")");
-    printCodecInfo(audioFormatContext, "Audio Input File (" + audioPath + ")");
+    const std::string paths[] = {videoPath, audioPath};
+    for (const auto &path : paths)
+    {
+        MediaInfo info;
+        if (probeInput(path, outFormat, true, true, info) < 0)
+        {
+            setError("Failed to open input file: " + path);
+            return false;
+        }
 
-    // 复制视频流
-    if (copyOrCvtStreams(videoFormatContext, 0) < 0)
+        estimate.inputBytes += info.fileSize;
+        estimate.durationSeconds = std::max(estimate.durationSeconds, info.durationSeconds);
+        estimate.transcodeStreams += info.transcodeStreams;
+        for (const auto &stream : info.streams)
+        {
+            if (stream.mediaType == "video")
+            {
+                estimate.maxWidth = std::max(estimate.maxWidth, stream.width);
+                estimate.maxHeight = std::max(estimate.maxHeight, stream.height);
+            }
+            else if (stream.mediaType == "audio" && (!stream.copyCompatible || options.forceTranscode))
+            {
+                estimate.transcodeAudioStreams++;
+            }
+        }
+    }
+
+    // 按裁剪范围缩放时长和数据量
+    if (estimate.durationSeconds > 0 && (options.startTime > 0 || options.endTime >= 0))
     {
-        setError("Failed to copy video streams");
-        return false;
+        double start = std::max(0.0, options.startTime);
+        double end = options.endTime >= 0 ? std::min(options.endTime, estimate.durationSeconds)
+                                           : estimate.durationSeconds;
+        double fraction = std::max(0.0, end - start) / estimate.durationSeconds;
+        estimate.inputBytes = (int64_t)(estimate.inputBytes * fraction);
+        estimate.durationSeconds *= fraction;
     }
 
-    // 复制音频流
-    int audioStreamOffset = videoFormatContext->nb_streams;
-    if (copyOrCvtStreams(audioFormatContext, audioStreamOffset) < 0)
+    return true;
+}
+
+bool AudioVideoMerger::probe(const std::string &path, const std::string &targetFormat, MediaInfo &info,
+                             bool useCache, bool fastProbe)
+{
+    lastError.clear();
+    info = MediaInfo();
+    // 探测只返回结构化信息，不打印流信息
+    options = MergeOptions();
+    options.verbose = false;
+
+    // 既接受格式名（"mp4"、"mkv"）也接受文件名（"out.mkv"）
+    const AVOutputFormat *outFormat = findOutputFormat(targetFormat);
+    if (!outFormat)
     {
-        setError("Failed to copy audio streams");
+        outFormat = av_guess_format(nullptr, targetFormat.c_str(), nullptr);
+    }
+    if (!outFormat)
+    {
+        setError("Unknown target format: " + targetFormat);
         return false;
     }
 
-    // 写入输出文件头部
-    if (avformat_write_header(outputFormatContext, nullptr) < 0)
+    if (probeInput(path, outFormat, useCache, fastProbe, info) < 0)
     {
-        setError("Failed to write file header");
+        setError("Failed to open input file: " + path);
         return false;
     }
+    return true;
+}
 
-    // 读取并写入数据包
-    if (!processPackets(audioStreamOffset))
+int AudioVideoMerger::probeInput(const std::string &path, const AVOutputFormat *outFormat, bool useCache,
+                                 bool fastProbe, MediaInfo &info)
+{
+    // 无法stat的输入（如URL）不进入缓存，也不做快速探测
+    int64_t size = 0;
+    int64_t modifiedTime = 0;
+    bool localFile = ProbeCache::statFile(path, size, modifiedTime);
+    bool cacheable = useCache && localFile;
+
+    if (!cacheable || !ProbeCache::shared().lookup(path, size, modifiedTime, info))
     {
-        setError("Failed to process packets");
-        return false;
+        info = MediaInfo();
+        info.path = path;
+
+        IsoBmffProbe isoProbe;
+        if (!fastProbe || !localFile || !isoProbe.probe(path, info))
+        {
+            AVFormatContext *formatContext = nullptr;
+            if (openInputFile(path, &formatContext) < 0)
+            {
+                return -1;
+            }
+            info = MediaInfo();
+            info.path = path;
+            describeInput(formatContext, info);
+            avformat_close_input(&formatContext);
+        }
+
+        if (cacheable)
+        {
+            ProbeCache::shared().insert(path, size, modifiedTime, info);
+        }
     }
 
-    // 写入文件尾部
-    av_write_trailer(outputFormatContext);
+    info.transcodeStreams = 0;
+    for (auto &stream : info.streams)
+    {
+        stream.copyCompatible = isCodecCompatible((AVCodecID)stream.codecId, outFormat);
+        if (!stream.copyCompatible)
+        {
+            info.transcodeStreams++;
+        }
+    }
+    return 0;
+}
 
-    // Print output file codec information
-    printOutputCodecInfo();
-    return true;
+void AudioVideoMerger::describeInput(AVFormatContext *formatContext, MediaInfo &info)
+{
+    info.formatName = formatContext->iformat->name;
+    if (formatContext->pb)
+    {
+        info.fileSize = std::max<int64_t>(0, avio_size(formatContext->pb));
+    }
+    if (formatContext->duration != AV_NOPTS_VALUE && formatContext->duration > 0)
+    {
+        info.durationSeconds = formatContext->duration / (double)AV_TIME_BASE;
+    }
+    if (formatContext->start_time != AV_NOPTS_VALUE)
+    {
+        info.startSeconds = formatContext->start_time / (double)AV_TIME_BASE;
+    }
+    info.startTimeKnown = true;
+    info.bitRate = formatContext->bit_rate;
+
+    for (unsigned int i = 0; i < formatContext->nb_streams; i++)
+    {
+        AVStream *stream = formatContext->streams[i];
+        AVCodecParameters *codecpar = stream->codecpar;
+        StreamInfo streamInfo;
+        streamInfo.index = (int)i;
+        streamInfo.codecId = codecpar->codec_id;
+        streamInfo.codecName = avcodec_get_name(codecpar->codec_id);
+        streamInfo.bitRate = codecpar->bit_rate;
+        if (stream->duration != AV_NOPTS_VALUE && stream->duration > 0)
+        {
+            streamInfo.durationSeconds = stream->duration * av_q2d(stream->time_base);
+        }
+        else
+        {
+            streamInfo.durationSeconds = info.durationSeconds;
+        }
+
+        switch (codecpar->codec_type)
+        {
+        case AVMEDIA_TYPE_VIDEO:
+        {
+            streamInfo.mediaType = "video";
+            streamInfo.width = codecpar->width;
+            streamInfo.height = codecpar->height;
+            const char *pixelFormat = av_get_pix_fmt_name((AVPixelFormat)codecpar->format);
+            streamInfo.pixelFormat = pixelFormat ? pixelFormat : "";
+            streamInfo.frameRate = stream->avg_frame_rate.den > 0 ? av_q2d(stream->avg_frame_rate) : 0.0;
+            break;
+        }
+        case AVMEDIA_TYPE_AUDIO:
+        {
+            streamInfo.mediaType = "audio";
+            streamInfo.sampleRate = codecpar->sample_rate;
+            streamInfo.channels = codecpar->ch_layout.nb_channels;
+            const char *sampleFormat = av_get_sample_fmt_name((AVSampleFormat)codecpar->format);
+            streamInfo.sampleFormat = sampleFormat ? sampleFormat : "";
+            break;
+        }
+        case AVMEDIA_TYPE_SUBTITLE:
+            streamInfo.mediaType = "subtitle";
+            break;
+        case AVMEDIA_TYPE_DATA:
+            streamInfo.mediaType = "data";
+            break;
+        default:
+            streamInfo.mediaType = "other";
+            break;
+        }
+        info.streams.push_back(streamInfo);
+    }
 }
+
 void AudioVideoMerger::printCodecInfo(AVFormatContext *formatContext, const std::string &fileName)
 {
     std::cout << "\n=== Codec Information for " << fileName << " ===" << std::endl;
@@ -180,9 +1576,29 @@ void AudioVideoMerger::printOutputCodecInfo()
         }
     }
 }
-int AudioVideoMerger::openInputFile(const std::string &filename, AVFormatContext **formatContext)
+int AudioVideoMerger::openInputFile(const std::string &filename, AVFormatContext **formatContext,
+                                    ChecksumInput *checksumInput)
 {
-    *formatContext = nullptr;
+    // 预先分配上下文以便在打开前设置中断回调
+    *formatContext = avformat_alloc_context();
+    if (!*formatContext)
+    {
+        return -1;
+    }
+    (*formatContext)->interrupt_callback.callback = interruptCallback;
+    (*formatContext)->interrupt_callback.opaque = this;
+    if (checksumInput)
+    {
+        if (checksumInput->open(filename) < 0)
+        {
+            avformat_free_context(*formatContext);
+            *formatContext = nullptr;
+            return -1;
+        }
+        (*formatContext)->pb = checksumInput->getContext();
+        (*formatContext)->flags |= AVFMT_FLAG_CUSTOM_IO;
+    }
+
     if (avformat_open_input(formatContext, filename.c_str(), nullptr, nullptr) < 0)
     {
         return -1;
@@ -194,50 +1610,288 @@ int AudioVideoMerger::openInputFile(const std::string &filename, AVFormatContext
         return -1;
     }
 
-    av_dump_format(*formatContext, 0, filename.c_str(), 0);
+    if (options.verbose)
+    {
+        av_dump_format(*formatContext, 0, filename.c_str(), 0);
+    }
     return 0;
 }
 
-int AudioVideoMerger::createOutputFile(const std::string &filename)
+int AudioVideoMerger::seekInput(AVFormatContext *formatContext, double seconds)
+{
+    int64_t timestamp = secondsToTimestamp(seconds);
+    if (formatContext->start_time != AV_NOPTS_VALUE)
+    {
+        timestamp += formatContext->start_time;
+    }
+
+    // max_ts = timestamp 保证落在目标时间之前（或正好在其上）的关键帧
+    if (avformat_seek_file(formatContext, -1, INT64_MIN, timestamp, timestamp, 0) < 0)
+    {
+        return -1;
+    }
+    return 0;
+}
+
+void AudioVideoMerger::prepareResume(const std::string &outputPath)
 {
-    if (avformat_alloc_output_context2(&outputFormatContext, nullptr, nullptr, filename.c_str()) < 0)
+    if (!fragmentResume.scan(outputPath))
+    {
+        if (options.verbose)
+        {
+            std::cout << "Not resuming: " << fragmentResume.getLastError() << std::endl;
+        }
+        return;
+    }
+    resuming = true;
+    // 只读取输入的后一部分，不能计算完整的输入校验和
+    hashInputs = false;
+}
+
+int AudioVideoMerger::matchResumeInputs()
+{
+    const std::vector<FragmentResume::Track> &tracks = fragmentResume.getTracks();
+    std::string reason;
+    if (!decoderContexts.empty())
+    {
+        // 编码器的输出与上次不一定逐包相同
+        reason = "streams are transcoded";
+    }
+    else if (tracks.size() != outputFormatContext->nb_streams)
+    {
+        reason = "track count differs from the inputs";
+    }
+    else
+    {
+        resumeStreams.assign(outputFormatContext->nb_streams, ResumeStream());
+        if (!readFirstTimestamps(videoFormatContext, 0, videoTimeShift) ||
+            !readFirstTimestamps(audioFormatContext, videoFormatContext->nb_streams, audioTimeShift))
+        {
+            reason = "input timestamps not found";
+        }
+    }
+    if (reason.empty())
+    {
+        return 0;
+    }
+
+    if (options.verbose)
+    {
+        std::cout << "Not resuming: " << reason << std::endl;
+    }
+    resumeStreams.clear();
+    if (seekInput(videoFormatContext, 0.0) < 0 || seekInput(audioFormatContext, 0.0) < 0)
     {
         return -1;
     }
+    return 1;
+}
+
+bool AudioVideoMerger::readFirstTimestamps(AVFormatContext *formatContext, int streamIndexOffset, int64_t timeShift)
+{
+    const std::vector<FragmentResume::Track> &tracks = fragmentResume.getTracks();
+    unsigned int found = 0;
+    AVPacket packet;
+    for (int count = 0; found < formatContext->nb_streams && count < kFirstTimestampPackets &&
+                        av_read_frame(formatContext, &packet) >= 0;
+         count++)
+    {
+        if (packet.stream_index < (int)formatContext->nb_streams && packet.dts != AV_NOPTS_VALUE)
+        {
+            ResumeStream &stream = resumeStreams[packet.stream_index + streamIndexOffset];
+            if (stream.firstDts == AV_NOPTS_VALUE)
+            {
+                // 与readSourcePacket中的平移一致
+                AVRational timeBase = formatContext->streams[packet.stream_index]->time_base;
+                stream.firstDts = packet.dts + av_rescale_q(timeShift, AV_TIME_BASE_Q, timeBase);
+                found++;
+            }
+        }
+        av_packet_unref(&packet);
+    }
+
+    // 已有分片中没有样本的流（例如很晚才开始的流）没有数据包也无妨
+    for (unsigned int i = streamIndexOffset; i < streamIndexOffset + formatContext->nb_streams; i++)
+    {
+        if (tracks[i].haveSamples && resumeStreams[i].firstDts == AV_NOPTS_VALUE)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+int AudioVideoMerger::startResume(const std::string &outputPath)
+{
+    const std::vector<FragmentResume::Track> &tracks = fragmentResume.getTracks();
+    AVFormatContext *inputs[] = {videoFormatContext, audioFormatContext};
+    const int64_t timeShifts[] = {videoTimeShift, audioTimeShift};
+    int64_t seekTargets[] = {INT64_MAX, INT64_MAX};
+
+    // 相同的输入由封装器生成相同的轨道时间刻度和stsd，不一致说明输入已不是上次的输入
+    uint8_t *header = nullptr;
+    int headerSize = avio_get_dyn_buf(outputFormatContext->pb, &header);
+    bool matched = headerSize > 0 && fragmentResume.matchesHeader(header, (size_t)headerSize);
+    for (unsigned int i = 0; i < outputFormatContext->nb_streams && matched; i++)
+    {
+        AVStream *outStream = outputFormatContext->streams[i];
+        matched = outStream->time_base.num == 1 && outStream->time_base.den == (int)tracks[i].timescale;
+    }
+    if (!matched)
+    {
+        if (options.verbose)
+        {
+            std::cout << "Not resuming: interrupted output does not match the inputs" << std::endl;
+        }
+        return 1;
+    }
+
+    for (unsigned int i = 0; i < outputFormatContext->nb_streams; i++)
+    {
+        const FragmentResume::Track &track = tracks[i];
+        AVStream *outStream = outputFormatContext->streams[i];
+
+        int input = i < videoFormatContext->nb_streams ? 0 : 1;
+        AVStream *inStream = inputs[input]->streams[input == 0 ? i : i - videoFormatContext->nb_streams];
+        ResumeStream &resume = resumeStreams[i];
+        if (resume.firstDts == AV_NOPTS_VALUE)
+        {
+            continue;
+        }
+
+        // 上次写出时封装器让每个轨道从第一个数据包开始计时
+        int64_t firstDts = av_rescale_q_rnd(resume.firstDts, inStream->time_base, outStream->time_base,
+                                            (AVRounding)(AV_ROUND_NEAR_INF | AV_ROUND_PASS_MINMAX));
+        resume.offset = firstDts - (track.haveSamples ? (int64_t)track.firstDecodeTime : 0);
+        resume.endDts = track.haveSamples ? (int64_t)track.endDecodeTime : INT64_MIN;
+
+        // 续写起点在输入中的位置（AV_TIME_BASE单位，平移前）
+        int64_t target = track.haveSamples ? resume.endDts + resume.offset : firstDts;
+        target = av_rescale_q(target, outStream->time_base, AV_TIME_BASE_Q) - timeShifts[input];
+        seekTargets[input] = std::min(seekTargets[input], target);
+    }
 
-    if (!(outputFormatContext->oformat->flags & AVFMT_NOFILE))
+    // 定位到各输入续写起点之前的关键帧，起点之前的数据包由writeCopiedPacket丢弃
+    for (int i = 0; i < 2; i++)
     {
-        if (avio_open(&outputFormatContext->pb, filename.c_str(), AVIO_FLAG_WRITE) < 0)
+        if (seekTargets[i] != INT64_MAX &&
+            avformat_seek_file(inputs[i], -1, INT64_MIN, seekTargets[i], seekTargets[i], 0) < 0)
         {
+            setError("Failed to seek input files");
             return -1;
         }
     }
 
+    // 丢弃内存中的文件头，截掉不完整的分片后追加写入
+    discardOutputBuffer();
+    if (!fragmentResume.truncate(outputPath))
+    {
+        setError("Failed to truncate " + outputPath);
+        return -1;
+    }
+    AVDictionary *ioOptions = nullptr;
+    av_dict_set(&ioOptions, "truncate", "0", 0);
+    int result = avio_open2(&outputFormatContext->pb, outputPath.c_str(), AVIO_FLAG_WRITE,
+                            &outputFormatContext->interrupt_callback, &ioOptions);
+    av_dict_free(&ioOptions);
+    if (result < 0 || avio_seek(outputFormatContext->pb, fragmentResume.getDataEnd(), SEEK_SET) < 0)
+    {
+        setError("Failed to open " + outputPath);
+        return -1;
+    }
+
+    stats.resumedFragments = fragmentResume.getFragmentCount();
+    stats.resumedBytes = fragmentResume.getDataEnd();
+    if (options.verbose)
+    {
+        std::cout << "Resuming after " << stats.resumedFragments << " fragments (" << stats.resumedBytes
+                  << " bytes): " << outputPath << std::endl;
+    }
     return 0;
 }
 
-bool AudioVideoMerger::isStreamCompatible(AVStream *inStream, const AVOutputFormat *outFormat)
+int AudioVideoMerger::createOutputFile(const std::string &filename)
 {
-    // 1. 使用官方API检查
-    int result = avformat_query_codec(outFormat, inStream->codecpar->codec_id, FF_COMPLIANCE_NORMAL);
-    if (result == 1)
+    std::string format = options.packaging.empty() ? options.outputFormat : options.packaging;
+    const char *formatName = format.empty() ? nullptr : format.c_str();
+    if (avformat_alloc_output_context2(&outputFormatContext, nullptr, formatName, filename.c_str()) < 0)
     {
-        return true;
+        return -1;
     }
 
-    // 2. 检查编解码器标签支持
-    if (outFormat->codec_tag)
+    outputFormatContext->interrupt_callback.callback = interruptCallback;
+    outputFormatContext->interrupt_callback.opaque = this;
+
+    streamFormat = outputFormatContext->oformat;
+    if (!options.packaging.empty())
     {
-        unsigned int tag = av_codec_get_tag(outFormat->codec_tag, inStream->codecpar->codec_id);
-        if (tag != 0)
+        // HLS/DASH封装器把流交给分片封装器，能否直接复制取决于分片格式
+        const char *segmentFormat = options.packaging == "hls" && options.segmentType == "mpegts" ? "mpegts" : "mp4";
+        if (const AVOutputFormat *segmentMuxer = av_guess_format(segmentFormat, nullptr, nullptr))
         {
-            return true;
+            streamFormat = segmentMuxer;
+        }
+        if (options.asyncSegmentWrites)
+        {
+            segmentWriter.reset(new SegmentWriter());
+            segmentWriter->install(outputFormatContext);
         }
     }
 
-    // 3. 特殊情况处理 - 某些格式可能需要转码
-    // 例如用户可能想要强制转码以改变编码参数
-    return false;
+    if (outputFormatContext->oformat->flags & AVFMT_NOFILE)
+    {
+        return 0;
+    }
+    // 续写时文件头只用于初始化封装器，写在内存中丢弃，已有文件保持不变
+    if (resuming)
+    {
+        if (avio_open_dyn_buf(&outputFormatContext->pb) < 0)
+        {
+            return -1;
+        }
+        outputBuffered = true;
+        return 0;
+    }
+    return openOutputIO(filename);
+}
+
+int AudioVideoMerger::openOutputIO(const std::string &filename)
+{
+    if (options.checksum)
+    {
+        if (checksumOutput.open(filename) < 0)
+        {
+            return -1;
+        }
+        outputFormatContext->pb = checksumOutput.getContext();
+        return 0;
+    }
+    return avio_open2(&outputFormatContext->pb, filename.c_str(), AVIO_FLAG_WRITE,
+                      &outputFormatContext->interrupt_callback, nullptr) < 0
+               ? -1
+               : 0;
+}
+
+void AudioVideoMerger::discardOutputBuffer()
+{
+    uint8_t *buffer = nullptr;
+    avio_close_dyn_buf(outputFormatContext->pb, &buffer);
+    av_free(buffer);
+    outputFormatContext->pb = nullptr;
+    outputBuffered = false;
+}
+
+bool AudioVideoMerger::isStreamCompatible(AVStream *inStream, const AVOutputFormat *outFormat)
+{
+    // 码流形式需要转换（如avcC写入MPEG-TS）时，所用的FFmpeg还须带有对应的比特流过滤器
+    return isCodecCompatible(inStream->codecpar->codec_id, outFormat) &&
+           areBitstreamFiltersAvailable(copyBitstreamFilters(inStream->codecpar, outFormat));
+}
+
+bool AudioVideoMerger::isCodecCompatible(AVCodecID codecId, const AVOutputFormat *outFormat)
+{
+    // 有专门规则的封装格式按规则判断，其余使用libavformat的通用判断（见ContainerRules）
+    return isCopyAllowed(codecId, outFormat);
 }
 
 int AudioVideoMerger::copyOrCvtStreams(AVFormatContext *inputFormatCtx, int streamIndexOffset)
@@ -253,19 +1907,21 @@ int AudioVideoMerger::copyOrCvtStreams(AVFormatContext *inputFormatCtx, int stre
 
 
         // print input stream info and codec info
+        if (options.verbose)
+        {
+            std::cout << "\n=== Start Input File Stream Information ===" << std::endl;
+            const AVCodec *codec = avcodec_find_decoder(inStream->codecpar->codec_id);
+            std::string codecName = codec ? codec->name : "Unknown";
+            std::cout << "Stream #" << i << " - " << "Video" << ": " << codecName << std::endl;
+            std::cout << "  Resolution: " << inStream->codecpar->width << "x" << inStream->codecpar->height << std::endl;
+            std::cout << "  Sample rate: " << inStream->codecpar->sample_rate << " Hz" << std::endl;
+            std::cout << "  Sample format: " << av_get_sample_fmt_name((AVSampleFormat)inStream->codecpar->format) << std::endl;
+            std::cout << "  Bit rate: " << (inStream->codecpar->bit_rate > 0 ? std::to_string(inStream->codecpar->bit_rate) + " bps" : "Unknown") << std::endl;
+            std::cout << "  Pixel format: " << av_get_pix_fmt_name((AVPixelFormat)inStream->codecpar->format) << std::endl;
+            std::cout << "\n=== End Input File Stream Information ===" << std::endl;
+        }
 
-        std::cout << "\n=== Start Input File Stream Information ===" << std::endl;
-        const AVCodec *codec = avcodec_find_decoder(inStream->codecpar->codec_id);
-        std::string codecName = codec ? codec->name : "Unknown";
-        std::cout << "Stream #" << i << " - " << "Video" << ": " << codecName << std::endl;
-        std::cout << "  Resolution: " << inStream->codecpar->width << "x" << inStream->codecpar->height << std::endl;
-        std::cout << "  Sample rate: " << inStream->codecpar->sample_rate << " Hz" << std::endl;
-        std::cout << "  Sample format: " << av_get_sample_fmt_name((AVSampleFormat)inStream->codecpar->format) << std::endl;
-        std::cout << "  Bit rate: " << (inStream->codecpar->bit_rate > 0 ? std::to_string(inStream->codecpar->bit_rate) + " bps" : "Unknown") << std::endl;
-        std::cout << "  Pixel format: " << av_get_pix_fmt_name((AVPixelFormat)inStream->codecpar->format) << std::endl;
-        std::cout << "\n=== End Input File Stream Information ===" << std::endl;
-
-        bool isCompatible = isStreamCompatible(inStream, outputFormatContext->oformat);
+        bool isCompatible = !options.forceTranscode && isStreamCompatible(inStream, streamFormat);
         // 正确的转码判断：基于编解码器兼容性而不是容器格式
         if (isCompatible)
         {
@@ -277,11 +1933,37 @@ int AudioVideoMerger::copyOrCvtStreams(AVFormatContext *inputFormatCtx, int stre
             outStream->codecpar->codec_tag = 0;
             outStream->time_base = inStream->time_base;
 
-            std::cout << "Copying stream parameters for stream " << i << " to " << streamIndexOffset << std::endl;
+            // 输入与输出的码流形式不同（Annex B/avcC、ADTS/原始AAC）时在复制路径上转换，不需要转码
+            std::string filters = copyBitstreamFilters(inStream->codecpar, streamFormat);
+            if (!filters.empty())
+            {
+                std::unique_ptr<BitstreamFilterChain> chain(new BitstreamFilterChain());
+                if (chain->open(filters, inStream->codecpar, inStream->time_base) < 0 ||
+                    avcodec_parameters_copy(outStream->codecpar, chain->getOutputParameters()) < 0)
+                {
+                    std::cerr << "Failed to initialize bitstream filters: " << filters << std::endl;
+                    return -1;
+                }
+                outStream->codecpar->codec_tag = 0;
+                outStream->time_base = chain->getOutputTimeBase();
+                bitstreamFilters[outStream->index] = std::move(chain);
+                stats.filteredStreams++;
+            }
+
+            if (options.verbose)
+            {
+                std::cout << "Copying stream parameters for stream " << i << " to " << streamIndexOffset;
+                if (!filters.empty())
+                {
+                    std::cout << " (" << filters << ")";
+                }
+                std::cout << std::endl;
+            }
         }
         else
         {
-            std::cout << "Transcoding stream " << i << std::endl;
+            if (options.verbose)
+                std::cout << "Transcoding stream " << i << std::endl;
             // 需要转码 - 设置编解码器上下文
             // 这里需要实现实际的转码设置逻辑
             if (setupTranscoding(inStream, outStream) < 0)
@@ -296,6 +1978,15 @@ int AudioVideoMerger::copyOrCvtStreams(AVFormatContext *inputFormatCtx, int stre
 
 int AudioVideoMerger::setupTranscoding(AVStream *inStream, AVStream *outStream)
 {
+    // 像素格式转换和重采样库只在需要转码时加载
+    std::string loadError;
+    transcodeLibs = TranscodeLibraries::load(&loadError);
+    if (!transcodeLibs)
+    {
+        std::cerr << loadError << std::endl;
+        return -1;
+    }
+
     // Create decoder context
     const AVCodec *decoder = avcodec_find_decoder(inStream->codecpar->codec_id);
     if (!decoder)
@@ -318,6 +2009,7 @@ int AudioVideoMerger::setupTranscoding(AVStream *inStream, AVStream *outStream)
         avcodec_free_context(&decCodecCtx);
         return -1;
     }
+    decCodecCtx->pkt_timebase = inStream->time_base;
 
     // Open decoder
     if (avcodec_open2(decCodecCtx, decoder, nullptr) < 0)
@@ -329,9 +2021,26 @@ int AudioVideoMerger::setupTranscoding(AVStream *inStream, AVStream *outStream)
 
     // Create encoder context
     const AVCodec *encoder = nullptr;
+    bool isVideo = inStream->codecpar->codec_type == AVMEDIA_TYPE_VIDEO;
+    bool isAudio = inStream->codecpar->codec_type == AVMEDIA_TYPE_AUDIO;
 
+    // 封装格式有专门规则时按规则选择编码器（如WebM只能写VP8/VP9/AV1和Opus/Vorbis）
+    const ContainerRules *rules = isVideo || isAudio ? findContainerRules(streamFormat) : nullptr;
+    if (rules)
+    {
+        for (const char *const *name = isVideo ? rules->videoEncoders : rules->audioEncoders; *name && !encoder;
+             name++)
+        {
+            encoder = avcodec_find_encoder_by_name(*name);
+        }
+        // 都不可用时使用封装器的默认编解码器
+        if (!encoder)
+        {
+            encoder = avcodec_find_encoder(isVideo ? streamFormat->video_codec : streamFormat->audio_codec);
+        }
+    }
     // Choose appropriate encoder based on media type
-    if (inStream->codecpar->codec_type == AVMEDIA_TYPE_VIDEO)
+    else if (isVideo)
     {
         // For video, try to find a suitable encoder
         // You can make this configurable based on your needs
@@ -345,7 +2054,7 @@ int AudioVideoMerger::setupTranscoding(AVStream *inStream, AVStream *outStream)
             encoder = avcodec_find_encoder(AV_CODEC_ID_MPEG4);
         }
     }
-    else if (inStream->codecpar->codec_type == AVMEDIA_TYPE_AUDIO)
+    else if (isAudio)
     {
         // For audio, try to find a suitable encoder
         encoder = avcodec_find_encoder_by_name("aac"); // AAC
@@ -385,6 +2094,10 @@ int AudioVideoMerger::setupTranscoding(AVStream *inStream, AVStream *outStream)
         encCodecCtx->width = inStream->codecpar->width;
         encCodecCtx->height = inStream->codecpar->height;
         encCodecCtx->sample_aspect_ratio = inStream->codecpar->sample_aspect_ratio;
+        if (inStream->avg_frame_rate.num > 0 && inStream->avg_frame_rate.den > 0)
+        {
+            encCodecCtx->framerate = inStream->avg_frame_rate;
+        }
 
 // Choose pixel format
 // 使用更现代的方法确定像素格式
@@ -415,6 +2128,30 @@ int AudioVideoMerger::setupTranscoding(AVStream *inStream, AVStream *outStream)
     {
         // Audio encoding parameters
         encCodecCtx->sample_rate = inStream->codecpar->sample_rate;
+#pragma warning(push)
+#pragma warning(disable : 4996)
+        // 编码器只支持部分采样率（如Opus）时优先48kHz，由重采样器转换
+        if (encoder->supported_samplerates)
+        {
+            const int *rate = encoder->supported_samplerates;
+            while (*rate && *rate != encCodecCtx->sample_rate)
+            {
+                rate++;
+            }
+            if (!*rate)
+            {
+                encCodecCtx->sample_rate = encoder->supported_samplerates[0];
+                for (rate = encoder->supported_samplerates; *rate; rate++)
+                {
+                    if (*rate == 48000)
+                    {
+                        encCodecCtx->sample_rate = 48000;
+                    }
+                }
+            }
+        }
+#pragma warning(pop)
+        encCodecCtx->time_base = av_make_q(1, encCodecCtx->sample_rate);
 
         if (inStream->codecpar->ch_layout.nb_channels > 0)
         {
@@ -444,6 +2181,12 @@ int AudioVideoMerger::setupTranscoding(AVStream *inStream, AVStream *outStream)
         encCodecCtx->bit_rate = inStream->codecpar->bit_rate > 0 ? inStream->codecpar->bit_rate : 128000;
     }
 
+    // 输出格式要求全局头（如MP4）时，编码器需把SPS/PPS等放入extradata
+    if ((outputFormatContext->oformat->flags | streamFormat->flags) & AVFMT_GLOBALHEADER)
+    {
+        encCodecCtx->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+    }
+
     // Open encoder
     if (avcodec_open2(encCodecCtx, encoder, nullptr) < 0)
     {
@@ -465,79 +2208,593 @@ int AudioVideoMerger::setupTranscoding(AVStream *inStream, AVStream *outStream)
     outStream->time_base = encCodecCtx->time_base;
     outStream->codecpar->codec_tag = 0;
 
-    // Store codec contexts for later use in processPackets
-    // You'll need to add member variables to store these contexts
-    // For example:
+    // Store codec contexts for later use in processPackets, released in cleanup()
     decoderContexts[outStream->index] = decCodecCtx;
     encoderContexts[outStream->index] = encCodecCtx;
 
-    // For now, we'll just free them since we don't have member variables yet
-    // In a complete implementation, you'd store these contexts
-    avcodec_free_context(&decCodecCtx);
-    avcodec_free_context(&encCodecCtx);
+    if (encCodecCtx->codec_type == AVMEDIA_TYPE_AUDIO)
+    {
+        AVAudioFifo *fifo = av_audio_fifo_alloc(encCodecCtx->sample_fmt, encCodecCtx->ch_layout.nb_channels, 1);
+        if (!fifo)
+        {
+            std::cerr << "Failed to allocate audio FIFO" << std::endl;
+            return -1;
+        }
+        audioFifos[outStream->index] = fifo;
+        nextAudioPts[outStream->index] = AV_NOPTS_VALUE;
+    }
 
     return 0;
 }
 
 bool AudioVideoMerger::processPackets(int audioStreamOffset)
 {
-    AVPacket packet;
+    // 两个输入交错写出，进度按较长输入的时长计算
+    progressCompleted = 0;
+    progressTotal = std::max(inputRangeDuration(videoFormatContext), inputRangeDuration(audioFormatContext));
+    progressCounter = 0;
+    lastProgressTime = std::chrono::steady_clock::now();
+
+    PacketSource video;
+    PacketSource audio;
+    bool success = openPacketSource(video, videoFormatContext, 0, videoTimeShift) &&
+                   openPacketSource(audio, audioFormatContext, audioStreamOffset, audioTimeShift);
+    if (success)
+    {
+        // 先读视频：裁剪起点时以视频的第一个数据包（关键帧）为基准
+        readSourcePacket(video);
+        readSourcePacket(audio);
+    }
+
+    // 只靠av_interleaved_write_frame交错不够：先读完一个输入时，另一个输入的数据包
+    // 超过max_interleave_delta后被强制写出，分片和各段只有一种流
+    while (success && (video.pending || audio.pending))
+    {
+        PacketSource *next = &video;
+        if (!video.pending)
+        {
+            next = &audio;
+        }
+        else if (audio.pending && audio.packet->dts != AV_NOPTS_VALUE &&
+                 (video.packet->dts == AV_NOPTS_VALUE ||
+                  av_compare_ts(audio.packet->dts, audioFormatContext->streams[audio.packet->stream_index]->time_base,
+                                video.packet->dts,
+                                videoFormatContext->streams[video.packet->stream_index]->time_base) < 0))
+        {
+            next = &audio;
+        }
+        success = writeSourcePacket(*next);
+        if (success)
+        {
+            readSourcePacket(*next);
+        }
+    }
+
+    av_packet_free(&video.packet);
+    av_packet_free(&audio.packet);
+    // 中断回调使av_read_frame提前返回，不能当作正常结束
+    return success && !cancelRequested;
+}
+
+bool AudioVideoMerger::openPacketSource(PacketSource &source, AVFormatContext *inputFormatCtx, int streamIndexOffset,
+                                        int64_t timeShift)
+{
+    source.formatContext = inputFormatCtx;
+    source.streamIndexOffset = streamIndexOffset;
+    int64_t origin = timelineOrigin(inputFormatCtx, timeShift);
+
+    if (options.endTime >= 0)
+    {
+        source.endTimestamp = secondsToTimestamp(options.endTime) + origin;
+    }
+    if (shortestEnd != AV_NOPTS_VALUE)
+    {
+        source.endTimestamp =
+            source.endTimestamp == AV_NOPTS_VALUE ? shortestEnd : std::min(source.endTimestamp, shortestEnd);
+    }
+
+    source.rangeStart = origin;
+    if (options.startTime > 0)
+    {
+        source.rangeStart += secondsToTimestamp(options.startTime);
+    }
+
+    source.streamShifts.assign(inputFormatCtx->nb_streams, 0);
+    for (unsigned int i = 0; i < inputFormatCtx->nb_streams; i++)
+    {
+        source.streamShifts[i] = av_rescale_q(timeShift, AV_TIME_BASE_Q, inputFormatCtx->streams[i]->time_base);
+    }
+    source.streamFinished.assign(inputFormatCtx->nb_streams, false);
+    source.packet = av_packet_alloc();
+    return source.packet != nullptr;
+}
+
+bool AudioVideoMerger::readSourcePacket(PacketSource &source)
+{
+    AVFormatContext *inputFormatCtx = source.formatContext;
+    AVPacket *packet = source.packet;
+    source.pending = false;
+    while (source.finishedCount < inputFormatCtx->nb_streams && !cancelRequested &&
+           av_read_frame(inputFormatCtx, packet) >= 0)
+    {
+        if (packet->stream_index >= (int)inputFormatCtx->nb_streams)
+        {
+            av_packet_unref(packet);
+            continue;
+        }
+        stats.packetsRead++;
+        stats.bytesRead += packet->size;
+
+        int64_t shift = source.streamShifts[packet->stream_index];
+        if (shift != 0)
+        {
+            if (packet->pts != AV_NOPTS_VALUE)
+                packet->pts += shift;
+            if (packet->dts != AV_NOPTS_VALUE)
+                packet->dts += shift;
+        }
+
+        AVStream *inStream = inputFormatCtx->streams[packet->stream_index];
+        if (packet->dts != AV_NOPTS_VALUE)
+        {
+            reportProgress(av_rescale_q(packet->dts, inStream->time_base, AV_TIME_BASE_Q) - source.rangeStart);
+        }
+
+        // 丢弃结束时间之后的数据包
+        if (source.endTimestamp != AV_NOPTS_VALUE)
+        {
+            int64_t packetTs = packet->pts != AV_NOPTS_VALUE ? packet->pts : packet->dts;
+            if (packet->dts != AV_NOPTS_VALUE &&
+                av_compare_ts(packet->dts, inStream->time_base, source.endTimestamp, AV_TIME_BASE_Q) >= 0 &&
+                !source.streamFinished[packet->stream_index])
+            {
+                source.streamFinished[packet->stream_index] = true;
+                source.finishedCount++;
+            }
+            if (packetTs != AV_NOPTS_VALUE &&
+                av_compare_ts(packetTs, inStream->time_base, source.endTimestamp, AV_TIME_BASE_Q) >= 0)
+            {
+                av_packet_unref(packet);
+                continue;
+            }
+        }
+
+        // 裁剪时以第一个写出的数据包（视频关键帧）为基准，使输出从0开始；
+        // 不重设时间戳时仍以其为界丢弃之前的数据包
+        if (options.startTime > 0)
+        {
+            int64_t packetTs = packet->dts != AV_NOPTS_VALUE ? packet->dts : packet->pts;
+            if (timestampOffset == AV_NOPTS_VALUE && packetTs != AV_NOPTS_VALUE)
+            {
+                timestampOffset = av_rescale_q(packetTs, inStream->time_base, AV_TIME_BASE_Q);
+            }
+            if (timestampOffset != AV_NOPTS_VALUE)
+            {
+                // 丢弃基准之前的数据包（例如音频在关键帧之前的部分）
+                if (packetTs != AV_NOPTS_VALUE &&
+                    av_compare_ts(packetTs, inStream->time_base, timestampOffset, AV_TIME_BASE_Q) < 0)
+                {
+                    av_packet_unref(packet);
+                    continue;
+                }
+
+                if (options.rebaseTimestamps)
+                {
+                    int64_t offset = av_rescale_q(timestampOffset, AV_TIME_BASE_Q, inStream->time_base);
+                    if (packet->pts != AV_NOPTS_VALUE)
+                        packet->pts -= offset;
+                    if (packet->dts != AV_NOPTS_VALUE)
+                        packet->dts -= offset;
+                }
+            }
+        }
+
+        source.pending = true;
+        return true;
+    }
+    return false;
+}
+
+bool AudioVideoMerger::writeSourcePacket(PacketSource &source)
+{
+    AVPacket *packet = source.packet;
+    source.pending = false;
+    int outStreamIndex = packet->stream_index + source.streamIndexOffset;
+    AVStream *inStream = source.formatContext->streams[packet->stream_index];
+
+    // 缩略图只取视频输入的关键帧，不影响数据包本身
+    if (thumbnailExtractor && source.formatContext == videoFormatContext)
+    {
+        thumbnailExtractor->onPacket(packet);
+    }
+    if (loudnessAnalyzer && source.formatContext == audioFormatContext)
+    {
+        loudnessAnalyzer->onPacket(packet);
+    }
+
+    // 需要转码的流交给解码器，时间戳保持输入流时间基
+    if (decoderContexts.count(outStreamIndex))
+    {
+        bool transcoded = transcodePacket(packet, outStreamIndex);
+        av_packet_unref(packet);
+        return transcoded;
+    }
+
+    // 需要转换码流形式的流先经过比特流过滤器，数据包按引用传递
+    return bitstreamFilters.count(outStreamIndex) ? filterCopiedPacket(packet, outStreamIndex)
+                                                  : writeCopiedPacket(packet, inStream->time_base, outStreamIndex);
+}
 
-    // 处理视频数据包
-    while (av_read_frame(videoFormatContext, &packet) >= 0)
+bool AudioVideoMerger::writeCopiedPacket(AVPacket *packet, AVRational timeBase, int outStreamIndex)
+{
+    AVStream *outStream = outputFormatContext->streams[outStreamIndex];
+    packet->stream_index = outStreamIndex;
+
+    // 转换时间戳
+    packet->pts = av_rescale_q_rnd(packet->pts, timeBase, outStream->time_base,
+                                   (AVRounding)(AV_ROUND_NEAR_INF | AV_ROUND_PASS_MINMAX));
+    packet->dts = av_rescale_q_rnd(packet->dts, timeBase, outStream->time_base,
+                                   (AVRounding)(AV_ROUND_NEAR_INF | AV_ROUND_PASS_MINMAX));
+    packet->duration = av_rescale_q(packet->duration, timeBase, outStream->time_base);
+    packet->pos = -1;
+
+    // 续写时换算到已有分片的时间轴，丢弃已经写出过的数据包
+    if (resuming)
     {
-        if (packet.stream_index < (int)videoFormatContext->nb_streams)
+        const ResumeStream &resume = resumeStreams[outStreamIndex];
+        if (packet->dts != AV_NOPTS_VALUE && packet->dts - resume.offset < resume.endDts)
         {
-            AVStream *inStream = videoFormatContext->streams[packet.stream_index];
-            AVStream *outStream = outputFormatContext->streams[packet.stream_index];
+            av_packet_unref(packet);
+            return true;
+        }
+        if (packet->pts != AV_NOPTS_VALUE)
+            packet->pts -= resume.offset;
+        if (packet->dts != AV_NOPTS_VALUE)
+            packet->dts -= resume.offset;
+    }
+
+    if (options.checksum)
+    {
+        packetChecker.onPacket(outStreamIndex, packet->data, packet->size, packet->dts != AV_NOPTS_VALUE, packet->dts,
+                               packet->duration);
+    }
+    if (packetTap)
+    {
+        packetTap->push(packet);
+    }
 
-            // 转换时间戳
-            packet.pts = av_rescale_q_rnd(packet.pts, inStream->time_base, outStream->time_base,
-                                          (AVRounding)(AV_ROUND_NEAR_INF | AV_ROUND_PASS_MINMAX));
-            packet.dts = av_rescale_q_rnd(packet.dts, inStream->time_base, outStream->time_base,
-                                          (AVRounding)(AV_ROUND_NEAR_INF | AV_ROUND_PASS_MINMAX));
-            packet.duration = av_rescale_q(packet.duration, inStream->time_base, outStream->time_base);
-            packet.pos = -1;
+    // 写入数据包
+    if (av_interleaved_write_frame(outputFormatContext, packet) < 0)
+    {
+        av_packet_unref(packet);
+        return false;
+    }
+    stats.packetsWritten++;
+    av_packet_unref(packet);
+    return true;
+}
+
+bool AudioVideoMerger::filterCopiedPacket(AVPacket *packet, int outStreamIndex)
+{
+    BitstreamFilterChain &chain = *bitstreamFilters[outStreamIndex];
 
-            // 写入数据包
-            if (av_interleaved_write_frame(outputFormatContext, &packet) < 0)
+    // 没有数据也没有附加数据的包会被过滤器当作输入结束
+    if (packet && !packet->data && packet->side_data_elems == 0)
+    {
+        av_packet_unref(packet);
+        return true;
+    }
+    // 过滤器接管数据包的引用，负载不复制
+    if (chain.send(packet) < 0)
+    {
+        // 单个损坏的数据包不应中断整个合并
+        std::cerr << "Failed to send packet to bitstream filter " << chain.getFilters() << " for stream "
+                  << outStreamIndex << std::endl;
+        if (packet)
+        {
+            av_packet_unref(packet);
+            if (options.checksum)
             {
-                av_packet_unref(&packet);
-                return false;
+                packetChecker.onDropped(outStreamIndex);
             }
         }
-        av_packet_unref(&packet);
+        return packet != nullptr;
+    }
+
+    AVPacket *filtered = av_packet_alloc();
+    if (!filtered)
+    {
+        return false;
+    }
+    bool success = true;
+    int ret;
+    while ((ret = chain.receive(filtered)) >= 0)
+    {
+        if (!writeCopiedPacket(filtered, chain.getOutputTimeBase(), outStreamIndex))
+        {
+            success = false;
+            break;
+        }
+    }
+    if (success && ret != AVERROR(EAGAIN) && ret != AVERROR_EOF)
+    {
+        // 单个损坏的数据包不应中断整个合并
+        std::cerr << "Bitstream filter " << chain.getFilters() << " dropped a packet for stream " << outStreamIndex
+                  << std::endl;
+        if (options.checksum)
+        {
+            packetChecker.onDropped(outStreamIndex);
+        }
+    }
+    av_packet_free(&filtered);
+    return success;
+}
+
+bool AudioVideoMerger::flushBitstreamFilters()
+{
+    for (auto &item : bitstreamFilters)
+    {
+        if (!filterCopiedPacket(nullptr, item.first))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool AudioVideoMerger::transcodePacket(AVPacket *packet, int outStreamIndex)
+{
+    AVCodecContext *decCodecCtx = decoderContexts[outStreamIndex];
+
+    int ret = avcodec_send_packet(decCodecCtx, packet);
+    if (ret < 0 && ret != AVERROR_EOF)
+    {
+        // 单个损坏的数据包不应中断整个合并
+        std::cerr << "Failed to send packet to decoder for stream " << outStreamIndex << std::endl;
+        if (packet && options.checksum)
+        {
+            packetChecker.onDropped(outStreamIndex);
+        }
+        return packet != nullptr;
+    }
+
+    AVFrame *frame = av_frame_alloc();
+    if (!frame)
+    {
+        return false;
+    }
+
+    bool success = true;
+    while (success)
+    {
+        ret = avcodec_receive_frame(decCodecCtx, frame);
+        if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF)
+        {
+            break;
+        }
+        if (ret < 0)
+        {
+            success = false;
+            break;
+        }
+
+        success = encodeFrame(frame, outStreamIndex);
+        av_frame_unref(frame);
     }
 
-    // 处理音频数据包
-    while (av_read_frame(audioFormatContext, &packet) >= 0)
+    av_frame_free(&frame);
+    return success;
+}
+
+bool AudioVideoMerger::encodeFrame(AVFrame *frame, int outStreamIndex)
+{
+    AVCodecContext *encCodecCtx = encoderContexts[outStreamIndex];
+
+    if (encCodecCtx->codec_type == AVMEDIA_TYPE_VIDEO)
     {
-        if (packet.stream_index < (int)audioFormatContext->nb_streams)
+        if (!frame)
         {
-            // 为音频流重新计算输出流索引
-            int outStreamIndex = packet.stream_index + audioStreamOffset;
-            AVStream *inStream = audioFormatContext->streams[packet.stream_index];
-            AVStream *outStream = outputFormatContext->streams[outStreamIndex];
+            if (avcodec_send_frame(encCodecCtx, nullptr) < 0)
+            {
+                return false;
+            }
+            return writeEncodedPackets(outStreamIndex);
+        }
 
-            packet.stream_index = outStreamIndex;
+        AVFrame *encodeInput = frame;
+        AVFrame *scaledFrame = nullptr;
 
-            // 转换时间戳
-            packet.pts = av_rescale_q_rnd(packet.pts, inStream->time_base, outStream->time_base,
-                                          (AVRounding)(AV_ROUND_NEAR_INF | AV_ROUND_PASS_MINMAX));
-            packet.dts = av_rescale_q_rnd(packet.dts, inStream->time_base, outStream->time_base,
-                                          (AVRounding)(AV_ROUND_NEAR_INF | AV_ROUND_PASS_MINMAX));
-            packet.duration = av_rescale_q(packet.duration, inStream->time_base, outStream->time_base);
-            packet.pos = -1;
+        // 解码输出的像素格式或尺寸与编码器不一致时用swscale转换
+        if (frame->format != encCodecCtx->pix_fmt || frame->width != encCodecCtx->width ||
+            frame->height != encCodecCtx->height)
+        {
+            SwsContext *&scaler = scalerContexts[outStreamIndex];
+            if (!scaler)
+            {
+                scaler = transcodeLibs->swsGetContext(frame->width, frame->height, (AVPixelFormat)frame->format,
+                                                      encCodecCtx->width, encCodecCtx->height, encCodecCtx->pix_fmt,
+                                                      SWS_BICUBIC, nullptr, nullptr, nullptr);
+                if (!scaler)
+                {
+                    return false;
+                }
+            }
 
-            // 写入数据包
-            if (av_interleaved_write_frame(outputFormatContext, &packet) < 0)
+            scaledFrame = av_frame_alloc();
+            if (!scaledFrame)
+            {
+                return false;
+            }
+            scaledFrame->format = encCodecCtx->pix_fmt;
+            scaledFrame->width = encCodecCtx->width;
+            scaledFrame->height = encCodecCtx->height;
+            if (av_frame_get_buffer(scaledFrame, 0) < 0)
             {
-                av_packet_unref(&packet);
+                av_frame_free(&scaledFrame);
                 return false;
             }
+            transcodeLibs->swsScale(scaler, frame->data, frame->linesize, 0, frame->height,
+                                    scaledFrame->data, scaledFrame->linesize);
+            scaledFrame->pts = frame->pts;
+            encodeInput = scaledFrame;
         }
-        av_packet_unref(&packet);
+
+        // 由编码器自行决定帧类型
+        encodeInput->pict_type = AV_PICTURE_TYPE_NONE;
+        int ret = avcodec_send_frame(encCodecCtx, encodeInput);
+        av_frame_free(&scaledFrame);
+        if (ret < 0)
+        {
+            return false;
+        }
+        return writeEncodedPackets(outStreamIndex);
+    }
+
+    // 音频：重采样到编码器格式，经FIFO按编码器帧长切分
+    AVAudioFifo *fifo = audioFifos[outStreamIndex];
+    int64_t &nextPts = nextAudioPts[outStreamIndex];
+
+    if (frame)
+    {
+        SwrContext *&resampler = resamplerContexts[outStreamIndex];
+        if (!resampler)
+        {
+            if (transcodeLibs->swrAllocSetOpts2(&resampler, &encCodecCtx->ch_layout, encCodecCtx->sample_fmt,
+                                                encCodecCtx->sample_rate, &frame->ch_layout,
+                                                (AVSampleFormat)frame->format, frame->sample_rate, 0, nullptr) < 0 ||
+                transcodeLibs->swrInit(resampler) < 0)
+            {
+                return false;
+            }
+        }
+
+        if (nextPts == AV_NOPTS_VALUE && frame->pts != AV_NOPTS_VALUE)
+        {
+            AVCodecContext *decCodecCtx = decoderContexts[outStreamIndex];
+            nextPts = av_rescale_q(frame->pts, decCodecCtx->pkt_timebase, encCodecCtx->time_base);
+        }
+
+        uint8_t **converted = nullptr;
+        int outSamples = transcodeLibs->swrGetOutSamples(resampler, frame->nb_samples);
+        if (av_samples_alloc_array_and_samples(&converted, nullptr, encCodecCtx->ch_layout.nb_channels,
+                                               outSamples, encCodecCtx->sample_fmt, 0) < 0)
+        {
+            return false;
+        }
+        int convertedSamples = transcodeLibs->swrConvert(resampler, converted, outSamples,
+                                                         (const uint8_t **)frame->extended_data, frame->nb_samples);
+        bool written = convertedSamples >= 0 &&
+                       av_audio_fifo_write(fifo, (void **)converted, convertedSamples) >= convertedSamples;
+        av_freep(&converted[0]);
+        av_freep(&converted);
+        if (!written)
+        {
+            return false;
+        }
+    }
+
+    int frameSize = encCodecCtx->frame_size > 0 ? encCodecCtx->frame_size : 1024;
+    while (av_audio_fifo_size(fifo) >= frameSize || (!frame && av_audio_fifo_size(fifo) > 0))
+    {
+        int samples = std::min(av_audio_fifo_size(fifo), frameSize);
+        AVFrame *audioFrame = av_frame_alloc();
+        if (!audioFrame)
+        {
+            return false;
+        }
+        audioFrame->nb_samples = samples;
+        audioFrame->format = encCodecCtx->sample_fmt;
+        audioFrame->sample_rate = encCodecCtx->sample_rate;
+        av_channel_layout_copy(&audioFrame->ch_layout, &encCodecCtx->ch_layout);
+        if (av_frame_get_buffer(audioFrame, 0) < 0 ||
+            av_audio_fifo_read(fifo, (void **)audioFrame->data, samples) < samples)
+        {
+            av_frame_free(&audioFrame);
+            return false;
+        }
+
+        audioFrame->pts = nextPts == AV_NOPTS_VALUE ? 0 : nextPts;
+        nextPts = audioFrame->pts + samples;
+
+        int ret = avcodec_send_frame(encCodecCtx, audioFrame);
+        av_frame_free(&audioFrame);
+        if (ret < 0 || !writeEncodedPackets(outStreamIndex))
+        {
+            return false;
+        }
+    }
+
+    if (!frame)
+    {
+        if (avcodec_send_frame(encCodecCtx, nullptr) < 0)
+        {
+            return false;
+        }
+        return writeEncodedPackets(outStreamIndex);
+    }
+    return true;
+}
+
+bool AudioVideoMerger::writeEncodedPackets(int outStreamIndex)
+{
+    AVCodecContext *encCodecCtx = encoderContexts[outStreamIndex];
+    AVStream *outStream = outputFormatContext->streams[outStreamIndex];
+
+    AVPacket *encodedPacket = av_packet_alloc();
+    if (!encodedPacket)
+    {
+        return false;
+    }
+
+    bool success = true;
+    while (true)
+    {
+        int ret = avcodec_receive_packet(encCodecCtx, encodedPacket);
+        if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF)
+        {
+            break;
+        }
+        if (ret < 0)
+        {
+            success = false;
+            break;
+        }
+
+        encodedPacket->stream_index = outStreamIndex;
+        av_packet_rescale_ts(encodedPacket, encCodecCtx->time_base, outStream->time_base);
+        encodedPacket->pos = -1;
+
+        if (options.checksum)
+        {
+            packetChecker.onPacket(outStreamIndex, encodedPacket->data, encodedPacket->size,
+                                   encodedPacket->dts != AV_NOPTS_VALUE, encodedPacket->dts, encodedPacket->duration);
+        }
+        if (packetTap)
+        {
+            packetTap->push(encodedPacket);
+        }
+
+        if (av_interleaved_write_frame(outputFormatContext, encodedPacket) < 0)
+        {
+            success = false;
+            break;
+        }
+        stats.packetsWritten++;
     }
 
+    av_packet_free(&encodedPacket);
+    return success;
+}
+
+bool AudioVideoMerger::flushTranscoders()
+{
+    for (auto &item : decoderContexts)
+    {
+        // 冲刷解码器，再冲刷音频FIFO和编码器
+        if (!transcodePacket(nullptr, item.first) || !encodeFrame(nullptr, item.first))
+        {
+            return false;
+        }
+    }
     return true;
-}
\ No newline at end of file
+}
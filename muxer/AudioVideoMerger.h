@@ -1,15 +1,191 @@
 ﻿#ifndef AUDIO_VIDEO_MERGER_H
 #define AUDIO_VIDEO_MERGER_H
 
+#include <atomic>
+#include <chrono>
+#include <functional>
 #include <map>
+#include <memory>
+#include <mutex>
 #include <string>
 #include <vector>
+#include "BitstreamFilterChain.h"
+#include "FragmentResume.h"
+#include "IntegrityCheck.h"
+#include "LoudnessMeter.h"
+#include "MediaProbe.h"
+#include "MergeCache.h"
+#include "SegmentWriter.h"
+#include "ThumbnailExtractor.h"
 extern "C"
 {
 #include <libavformat/avformat.h>
 #include <libavcodec/avcodec.h>
 }
 
+struct SwsContext;
+struct SwrContext;
+struct AVAudioFifo;
+struct TranscodeLibraries;
+class NativeMp4Remuxer;
+class PacketTap;
+class SegmentedMerger;
+
+/**
+ * 合并选项
+ */
+struct MergeOptions
+{
+    // 起始时间（秒），小于0表示从头开始；实际起点为该时间之前最近的关键帧
+    double startTime = -1.0;
+    // 结束时间（秒），小于0表示直到文件结尾
+    double endTime = -1.0;
+    // 裁剪后是否将输出时间戳重设为从0开始（分段合并的中间文件保留原始时间戳）
+    bool rebaseTimestamps = true;
+    // 把每个输入的起始时间（start_time）对齐到0，修正音视频起点不同造成的空白或不同步
+    bool alignStartTimes = true;
+    // 各输入额外的时间偏移（秒，类似ffmpeg的-itsoffset），可为负；整体出现负时间时所有输入一起后移
+    double videoOffset = 0.0;
+    double audioOffset = 0.0;
+    // 把较长的输入裁剪到较短输入的结束位置
+    bool trimToShortest = false;
+    // 输出封装格式名称（如 "mp4"、"matroska"、"webm"、"mpegts"，也接受别名 "mkv"、"ts"），
+    // 为空时根据输出文件扩展名推断；能否直接复制和转码用的编码器按该格式的规则（见ContainerRules）
+    std::string outputFormat;
+    // 并行分段数：大于1时按关键帧把时间轴切成多段，每段在独立线程中处理后再拼接；
+    // 需要转码音频时仍单线程合并
+    int parallelSegments = 0;
+    // 强制转码所有流（用于改变编码参数或测量转码开销）
+    bool forceTranscode = false;
+    // 是否打印输入/输出流信息，批量处理时关闭可减少控制台输出
+    bool verbose = true;
+    // 输入都是fMP4（H.264/HEVC、AAC）且输出mp4、不裁剪不转码时，直接解析分片并整块复制样本数据；
+    // 条件不满足或分片无法解析时仍使用libavformat
+    bool nativeRemux = false;
+    // 原生封装完成后用libavformat读取输出，核对各流的数据包数量和字节数
+    bool validateNativeRemux = false;
+    // 把moov放在文件开头（渐进下载）。原生路径和输入索引完整的流复制预先计算moov大小只写一遍，
+    // 其余情况使用封装器的faststart（写完后再整体移动一次）
+    bool faststart = false;
+    // 合并时计算输出文件和各流数据包的CRC32C并检查时间戳（结果见MergeStats），
+    // 不需要合并后再读一遍输出来校验
+    bool checksum = false;
+    // 一个输入没有任何流、另一个输入已是目标封装格式（非分片）且不需要改动时，
+    // 直接复制该输入作为输出（写时复制，不支持时copy_file_range或普通复制），不再逐包处理
+    bool cloneUnchangedInput = true;
+    // 合并结果缓存目录，为空时不使用缓存。输入内容和影响输出的选项都相同时直接取用缓存的输出；
+    // 命中时输出可能是缓存文件的只读硬链接，合并前会先删除已有的输出文件
+    std::string cacheDirectory;
+    // 缓存总大小上限（字节），超出时淘汰最久未使用的输出
+    int64_t cacheMaxBytes = 10LL * 1024 * 1024 * 1024;
+    // 命中前读取输入核对合并时顺带记录的完整CRC32C（快速指纹只采样部分数据，
+    // 只改动了未采样区域的输入会误命中）；核对需读取整个输入，只在输入可能原地改写时开启
+    bool cacheVerifyInputs = false;
+    // 缩略图间隔（秒），大于0时在合并的同时从视频输入的关键帧提取缩略图（只解码选中的关键帧）
+    double thumbnailInterval = 0.0;
+    // 缩略图宽度（高度按比例），0表示保持原始尺寸
+    int thumbnailWidth = 320;
+    // 缩略图格式："jpeg" 或 "webp"
+    std::string thumbnailFormat = "jpeg";
+    // 缩略图质量（0~100）
+    int thumbnailQuality = 80;
+    // 缩略图文件名模板（%d或%04d等为序号），为空时缩略图保存在MergeStats::thumbnails的data中
+    std::string thumbnailPattern;
+    // 合并的同时在独立线程中解码音频输入，测量EBU R128响度（结果见MergeStats::loudness），
+    // 不需要合并后再解码一遍
+    bool loudness = false;
+    // 关键帧索引旁路文件路径（见SeekIndex），为空时不生成。合并完成后从输出的样本表读取，不读取样本数据
+    std::string seekIndexPath;
+    // mp4/mov输出按关键帧分片并在文件开头写入全局sidx，播放器不下载整个索引即可定位；
+    // 输出为分片文件，不使用原生封装和直接复制输入，faststart不再需要
+    bool sidx = false;
+    // 分片打包输出："hls" 或 "dash"，输出路径为清单文件（.m3u8/.mpd），分片文件写在同一目录并以清单文件名开头；
+    // 为空时输出单个文件。打包时不使用原生封装、并行分段、直接复制输入和缓存
+    std::string packaging;
+    // 目标分片时长（秒），在到达该时长后的第一个视频关键帧处切分
+    double segmentDuration = 6.0;
+    // HLS分片格式："fmp4" 或 "mpegts"（DASH总是fMP4）
+    std::string segmentType = "fmp4";
+    // 打包时由独立线程写分片文件，读取和封装不等待磁盘
+    bool asyncSegmentWrites = true;
+    // 先写到同一目录的临时文件（见AudioVideoMerger::partialOutputPath），完成并落盘后改名为输出路径；
+    // 合并中断时输出路径上不会出现截断的文件。打包输出是一组文件，不适用
+    bool atomicOutput = true;
+    // 分片输出（sidx）时从上次中断留下的文件的最后一个完整分片续写，只处理之后的输入；
+    // 要求所有流直接复制且不裁剪起点，否则从头合并。失败或取消时保留该文件供下次续写
+    bool resume = false;
+};
+
+/**
+ * 最近一次合并的统计信息
+ */
+struct MergeStats
+{
+    // 各阶段耗时（秒）：打开输入/创建输出/建立流、写文件头、处理数据包、写文件尾
+    double openSeconds = 0.0;
+    double headerSeconds = 0.0;
+    double packetSeconds = 0.0;
+    double trailerSeconds = 0.0;
+    double totalSeconds = 0.0;
+    // 读取和写出的数据包数量
+    int64_t packetsRead = 0;
+    int64_t packetsWritten = 0;
+    // 输入数据包负载字节数和输出文件字节数
+    int64_t bytesRead = 0;
+    int64_t bytesWritten = 0;
+    // 转码的流数量
+    int transcodedStreams = 0;
+    // 是否由原生fMP4封装路径完成
+    bool nativeRemux = false;
+    // 起点对齐和偏移后实际加到视频、音频时间戳上的平移量（秒）
+    double videoShiftSeconds = 0.0;
+    double audioShiftSeconds = 0.0;
+    // 输出文件的CRC32C，checksumValid为false时无效（未开启校验或输出不是普通文件）
+    bool checksumValid = false;
+    uint32_t outputCrc32c = 0;
+    // 各输出流的数据包校验和及时间戳检查结果（开启校验时）
+    std::vector<StreamIntegrity> streams;
+    // 输出取自合并结果缓存（此时不合并，也不计算校验和）
+    bool cacheHit = false;
+    // 输出是复制的输入文件（见MergeOptions::cloneUnchangedInput）
+    bool inputCloned = false;
+    // 缓存命中或复制输入时输出文件的复制方式
+    CloneMethod cloneMethod = CloneMethod::Failed;
+    // 提取的缩略图（开启thumbnailInterval时），以及提取失败的关键帧数量
+    std::vector<Thumbnail> thumbnails;
+    int thumbnailFailures = 0;
+    // 音频响度（开启loudness时）
+    LoudnessStats loudness;
+    // 是否写出了关键帧索引旁路文件，以及其中的关键帧数量
+    bool seekIndexWritten = false;
+    int64_t seekPoints = 0;
+    // 打包输出写出的文件数（分片、初始化分片和清单，开启asyncSegmentWrites时统计）
+    int segmentFiles = 0;
+    // 经比特流过滤器转换码流形式后直接复制的流数量
+    int filteredStreams = 0;
+    // 续写时沿用的已有分片数量和字节数（从头合并时为0）
+    int resumedFragments = 0;
+    int64_t resumedBytes = 0;
+};
+
+/**
+ * 合并任务的开销估计（仅读取文件头，不处理数据包）
+ */
+struct MergeEstimate
+{
+    // 需要转码的流数量，为0表示纯流复制
+    int transcodeStreams = 0;
+    // 其中（或因forceTranscode）需要转码的音频流数量
+    int transcodeAudioStreams = 0;
+    // 输入文件总字节数
+    int64_t inputBytes = 0;
+    // 输入中最长的时长（秒），未知时为0
+    double durationSeconds = 0.0;
+    // 视频流的最大分辨率
+    int maxWidth = 0;
+    int maxHeight = 0;
+};
+
 class AudioVideoMerger
 {
 private:
@@ -18,6 +194,11 @@ private:
     AVFormatContext *outputFormatContext = nullptr;
 
 public:
+    /**
+     * 进度回调，参数为0~1之间的完成比例
+     */
+    typedef std::function<void(double progress)> ProgressCallback;
+
     ~AudioVideoMerger();
 
     /**
@@ -25,9 +206,11 @@ public:
      * @param videoPath 视频文件路径
      * @param audioPath 音频文件路径
      * @param outputPath 输出文件路径
+     * @param options 合并选项（时间范围等）
      * @return 是否合并成功
      */
-    bool merge(const std::string &videoPath, const std::string &audioPath, const std::string &outputPath);
+    bool merge(const std::string &videoPath, const std::string &audioPath, const std::string &outputPath,
+               const MergeOptions &options = MergeOptions());
 
     /**
      * 获取错误信息
@@ -35,19 +218,326 @@ public:
      */
     std::string getLastError() const { return lastError; }
 
+    /**
+     * 获取最近一次合并的统计信息
+     * @return 各阶段耗时及数据量
+     */
+    const MergeStats &getLastStats() const { return stats; }
+
+    /**
+     * 开启atomicOutput时合并过程中写入的临时文件：同一目录，在扩展名前加".partial"
+     * 续写（MergeOptions::resume）使用不带后缀的固定名称，其他合并带上进程号和计数作为后缀
+     * @param outputPath 输出文件路径
+     * @param suffix 后缀，为空时返回续写使用的名称
+     * @return 临时文件路径，如 out.mp4 对应 out.partial.mp4，后缀为"12-0"时对应 out.partial.12-0.mp4
+     */
+    static std::string partialOutputPath(const std::string &outputPath, const std::string &suffix = std::string());
+
+    /**
+     * 秒转换为AV_TIME_BASE单位，四舍五入保证往返转换不丢失精度
+     */
+    static int64_t secondsToTimestamp(double seconds);
+
+    /**
+     * 探测输入并估计合并开销（是否需要转码、数据量和时长）
+     * @param videoPath 视频文件路径
+     * @param audioPath 音频文件路径
+     * @param outputPath 输出文件路径（用于推断输出格式）
+     * @param options 合并选项
+     * @param estimate 输出的开销估计
+     * @return 是否探测成功
+     */
+    bool estimate(const std::string &videoPath, const std::string &audioPath, const std::string &outputPath,
+                  const MergeOptions &options, MergeEstimate &estimate);
+
+    /**
+     * 只读取文件头获取流元数据，不进行合并
+     * 结果按（路径、大小、修改时间）缓存在ProbeCache::shared()中
+     * @param path 输入文件路径
+     * @param targetFormat 判断能否流复制所用的目标封装格式（格式名或文件名，如"mp4"）
+     * @param info 输出的元数据
+     * @param useCache 是否使用缓存
+     * @param fastProbe 对ISO-BMFF文件直接解析moov等盒子，无法解析时退回libavformat
+     * @return 是否探测成功
+     */
+    bool probe(const std::string &path, const std::string &targetFormat, MediaInfo &info, bool useCache = true,
+               bool fastProbe = true);
+
+    /**
+     * 设置进度回调（在执行合并的线程中调用）
+     * 进度按当前输出DTS与输入时长之比计算，两次回调间隔不少于minIntervalSeconds
+     * @param callback 进度回调，为空时关闭进度报告
+     * @param minIntervalSeconds 最小回调间隔（秒）
+     */
+    void setProgressCallback(ProgressCallback callback, double minIntervalSeconds = 0.5);
+
+    /**
+     * 设置下一次合并的数据包分接：写入输出的每个数据包（输出流索引和时间基）同时交给tap，
+     * 合并结束时调用tap->finish()并解除。分接时不使用原生封装、并行分段、输入复制和合并缓存
+     * @param tap 数据包分接，为空时取消
+     */
+    void setPacketTap(std::shared_ptr<PacketTap> tap);
+
+    /**
+     * 请求取消合并，可从任意线程调用
+     * 通过AVIOInterruptCB中断阻塞中的读写，合并随后以失败返回；取消状态对之后的合并同样有效。
+     * 并行分段合并时同时取消各段
+     */
+    void cancel();
+
+    /**
+     * 是否已请求取消
+     */
+    bool isCancelled() const { return cancelRequested; }
+
 private:
     std::string lastError;
+    MergeOptions options;
+    MergeStats stats;
+
+    // 裁剪时的时间戳基准（AV_TIME_BASE单位），输出时间戳减去该值后从0开始
+    int64_t timestampOffset = AV_NOPTS_VALUE;
+
+    // 读取后立即加到各输入时间戳上的平移量（AV_TIME_BASE单位），由computeTimeShifts计算
+    int64_t videoTimeShift = 0;
+    int64_t audioTimeShift = 0;
+    // 负偏移时所有输入一起后移的量，对齐起点时也是裁剪时间的原点
+    int64_t timelineLift = 0;
+    // trimToShortest时较短输入在平移后时间轴上的结束位置
+    int64_t shortestEnd = AV_NOPTS_VALUE;
+
+    // 开启校验时代替avio_open2创建的输出，以及写出数据包的检查
+    ChecksumOutput checksumOutput;
+    PacketChecker packetChecker;
+
+    // 使用合并结果缓存时在读取输入的同时计算输入的完整CRC32C，供命中时核对
+    bool hashInputs = false;
+    ChecksumInput videoChecksumInput;
+    ChecksumInput audioChecksumInput;
+    std::vector<uint32_t> inputChecksums;
+
+    std::atomic<bool> cancelRequested{false};
+    // 正在进行的并行分段合并，cancel()转发给它
+    std::mutex segmentedMutex;
+    SegmentedMerger *activeSegmentedMerger = nullptr;
+
+    // 下一次合并的数据包分接
+    std::shared_ptr<PacketTap> packetTap;
+
+    // 开启缩略图时从视频输入的数据包中提取关键帧
+    std::unique_ptr<ThumbnailExtractor> thumbnailExtractor;
+
+    // 开启响度测量时解码音频输入的第一个音频流
+    std::unique_ptr<LoudnessAnalyzer> loudnessAnalyzer;
+
+    // 打包输出时接管分片文件的写入
+    std::unique_ptr<SegmentWriter> segmentWriter;
+    // 实际存放流的封装格式（打包时为分片格式），用于判断能否直接复制
+    const AVOutputFormat *streamFormat = nullptr;
+
+    // 续写的流：输入流第一个数据包的DTS（输入流时间基，已平移），
+    // 以及输出流时间基下换算到已有分片时间轴的平移量和续写起点
+    struct ResumeStream
+    {
+        int64_t firstDts = AV_NOPTS_VALUE;
+        int64_t offset = 0;
+        int64_t endDts = INT64_MIN;
+    };
+    // 续写中断的分片输出（MergeOptions::resume）
+    FragmentResume fragmentResume;
+    bool resuming = false;
+    std::vector<ResumeStream> resumeStreams;
+    // 续写时文件头写在内存中丢弃，输出IO为动态缓冲区
+    bool outputBuffered = false;
+
+    // 进度报告状态（AV_TIME_BASE单位）
+    ProgressCallback progressCallback;
+    std::chrono::steady_clock::duration progressInterval = std::chrono::milliseconds(500);
+    std::chrono::steady_clock::time_point lastProgressTime;
+    int64_t progressTotal = 0;
+    int64_t progressCompleted = 0;
+    unsigned int progressCounter = 0;
+
+    /**
+     * FFmpeg阻塞操作的中断回调，返回非0时中止读写
+     */
+    static int interruptCallback(void *opaque);
+
+    /**
+     * 合并的主体（不含缓存查找），由merge调用
+     * @param mergeStartTime 合并开始时间，用于统计总耗时
+     * @return 是否合并成功
+     */
+    bool mergeInputs(const std::string &videoPath, const std::string &audioPath, const std::string &outputPath,
+                     std::chrono::steady_clock::time_point mergeStartTime);
+
+    /**
+     * 探测输入，输出与某个输入完全相同时直接复制该输入
+     * @return 已复制返回true，不适用或复制失败时返回false（由调用者正常合并）
+     */
+    bool cloneUnchangedInput(const std::string &videoPath, const std::string &audioPath,
+                             const std::string &outputPath);
+
+    /**
+     * 影响输出内容的合并选项，作为缓存键的一部分
+     */
+    std::string cacheOptionsKey(const std::string &outputPath) const;
+
+    /**
+     * 结束并解除数据包分接
+     * @param success 合并是否成功，失败时把错误信息交给分接
+     */
+    void finishPacketTap(bool success);
+
+    /**
+     * 按选项为视频输入的第一个视频流创建缩略图提取器，失败时只打印警告
+     */
+    void startThumbnails();
+
+    /**
+     * 为音频输入的第一个音频流启动响度测量线程，失败时只打印警告
+     */
+    void startLoudness();
+
+    /**
+     * 从输出文件生成关键帧索引并写出旁路文件，失败时只打印警告
+     */
+    void writeSeekIndex(const std::string &outputPath);
+
+    /**
+     * 把完整的临时文件落盘后改名为输出路径
+     * @return 失败时删除临时文件并返回false
+     */
+    bool publishOutput(const std::string &workPath, const std::string &outputPath);
+
+    /**
+     * 扫描上次中断留下的输出，有完整分片时设置resuming
+     */
+    void prepareResume(const std::string &outputPath);
+
+    /**
+     * 建立输出流后核对已有分片的轨道并读取各输入流第一个数据包的DTS；不能续写时把输入退回开头
+     * @return 可以续写返回0，不能续写返回1，退回开头失败返回负数
+     */
+    int matchResumeInputs();
+
+    /**
+     * 读取输入开头的数据包，记录各流第一个DTS
+     * @return 已有分片中有样本的流都找到时返回true
+     */
+    bool readFirstTimestamps(AVFormatContext *formatContext, int streamIndexOffset, int64_t timeShift);
+
+    /**
+     * 写文件头之后开始续写：换算各流的续写起点、定位输入、截掉不完整的分片并以追加方式打开输出
+     * @param outputPath 输出文件路径
+     * @return 成功返回0，新的文件头与已有分片的轨道或编码参数不符时返回1（应从头合并），失败返回负数
+     */
+    int startResume(const std::string &outputPath);
+
+    /**
+     * 开始检查写出的数据包（写文件头之后，输出流的时间基已确定）
+     */
+    void startPacketChecks();
+
+    /**
+     * 关闭带校验的输出并把校验结果写入统计信息
+     * @return 输出写入失败返回false
+     */
+    bool finishChecksum();
+
+    /**
+     * 打印校验和及时间戳检查结果
+     */
+    void printIntegrity() const;
+
+    /**
+     * 根据起点对齐、各输入偏移和trimToShortest计算时间戳平移量和结束位置
+     */
+    void computeTimeShifts();
+
+    /**
+     * 输入在平移后时间轴上的裁剪原点（AV_TIME_BASE单位）
+     * 对齐起点时所有输入共用同一原点，否则为各自平移后的start_time
+     */
+    int64_t timelineOrigin(AVFormatContext *formatContext, int64_t timeShift) const;
+
+    /**
+     * 计算输入在裁剪范围内的时长
+     * @param formatContext 输入格式上下文
+     * @return 时长（AV_TIME_BASE单位），未知时返回0
+     */
+    int64_t inputRangeDuration(AVFormatContext *formatContext) const;
+
+    /**
+     * 按限频规则报告进度
+     * @param position 当前输入中已处理到的位置（AV_TIME_BASE单位，相对于范围起点）
+     * @param force 是否忽略限频立即报告
+     */
+    void reportProgress(int64_t position, bool force = false);
 
     void printCodecInfo(AVFormatContext *formatContext, const std::string &fileName);
+
+    /**
+     * 探测输入并填写各流的流复制兼容性
+     * @param path 输入文件路径
+     * @param outFormat 目标封装格式
+     * @param useCache 是否使用缓存
+     * @param fastProbe 是否先尝试ISO-BMFF快速探测
+     * @param info 输出的元数据
+     * @return 成功返回0，失败返回负数
+     */
+    int probeInput(const std::string &path, const AVOutputFormat *outFormat, bool useCache, bool fastProbe,
+                   MediaInfo &info);
+
+    /**
+     * 把已打开输入的格式和流参数整理为MediaInfo（与printCodecInfo输出的内容相同）
+     */
+    static void describeInput(AVFormatContext *formatContext, MediaInfo &info);
     void printOutputCodecInfo();
 
+    /**
+     * 原生fMP4到MP4流复制（NativeMp4Remuxer）
+     * @param videoPath 视频文件路径
+     * @param audioPath 音频文件路径
+     * @param outputPath 输出文件路径
+     * @return 成功返回0，失败返回负数，输入或选项不适用时返回1（由调用者使用libavformat）
+     */
+    int remuxNatively(const std::string &videoPath, const std::string &audioPath, const std::string &outputPath);
+
+    /**
+     * 用libavformat读取原生封装的输出，核对各流的数据包数量和字节数
+     * @return 一致返回0，否则返回负数
+     */
+    int validateNativeOutput(const std::string &outputPath, const NativeMp4Remuxer &remuxer);
+
+    /**
+     * 根据输入的索引估计输出moov大小的上限（纯流复制的mov/mp4输出）
+     * @return moov大小上限（字节），索引不完整或需要转码时返回0
+     */
+    int64_t estimateMoovSize() const;
+
+    /**
+     * 设置快速启动所需的封装器选项：能估计moov大小时在文件头预留空间（moov_size），否则使用movflags=+faststart
+     * @param muxerOptions 传给avformat_write_header的选项
+     */
+    void setupFaststart(AVDictionary **muxerOptions);
+
+    /**
+     * 设置HLS/DASH封装器的分片时长和分片、清单文件名
+     * @param outputPath 清单文件路径
+     * @param muxerOptions 传给avformat_write_header的选项
+     */
+    void setupPackaging(const std::string &outputPath, AVDictionary **muxerOptions);
+
     /**
      * 打开输入文件
      * @param filename 文件路径
      * @param formatContext 格式上下文指针
+     * @param checksumInput 不为空时通过它读取文件，同时计算CRC32C
      * @return 成功返回0，失败返回负数
      */
-    int openInputFile(const std::string &filename, AVFormatContext **formatContext);
+    int openInputFile(const std::string &filename, AVFormatContext **formatContext,
+                      ChecksumInput *checksumInput = nullptr);
 
     /**
      * 创建输出文件
@@ -56,6 +546,17 @@ private:
      */
     int createOutputFile(const std::string &filename);
 
+    /**
+     * 打开输出文件的IO（开启校验时为计算CRC32C的输出）
+     * @return 成功返回0，失败返回负数
+     */
+    int openOutputIO(const std::string &filename);
+
+    /**
+     * 关闭并丢弃写文件头所用的动态缓冲区
+     */
+    void discardOutputBuffer();
+
     /**
      * 复制流到输出文件
      * @param inputFormatCtx 输入格式上下文
@@ -65,12 +566,65 @@ private:
     int copyOrCvtStreams(AVFormatContext *inputFormatCtx, int streamIndexOffset);
 
     /**
-     * 处理并写入数据包
+     * 交错读取时一个输入的状态：时间范围、各流的平移量，以及已读出、等待写出的下一个数据包
+     */
+    struct PacketSource
+    {
+        AVFormatContext *formatContext = nullptr;
+        int streamIndexOffset = 0;
+        // 结束时间和进度位置的起点（AV_TIME_BASE单位，平移后的时间轴）
+        int64_t endTimestamp = AV_NOPTS_VALUE;
+        int64_t rangeStart = 0;
+        // 各流时间基下的平移量
+        std::vector<int64_t> streamShifts;
+        // 已越过结束时间的流，全部越过后停止读取
+        std::vector<bool> streamFinished;
+        unsigned int finishedCount = 0;
+        AVPacket *packet = nullptr;
+        bool pending = false;
+    };
+
+    /**
+     * 处理并写入数据包：两个输入交错读取，总是先写出DTS较小的数据包，
+     * 使分片、HLS/DASH分片和MPEG-TS等输出的每一段都同时包含音视频
      * @param audioStreamOffset 音频流索引偏移量
      * @return 成功返回true，失败返回false
      */
     bool processPackets(int audioStreamOffset = 0);
 
+    /**
+     * 初始化一个输入的读取状态
+     * @param source 读取状态
+     * @param inputFormatCtx 输入格式上下文
+     * @param streamIndexOffset 流索引偏移量
+     * @param timeShift 加到时间戳上的平移量（AV_TIME_BASE单位）
+     * @return 分配数据包失败返回false
+     */
+    bool openPacketSource(PacketSource &source, AVFormatContext *inputFormatCtx, int streamIndexOffset,
+                          int64_t timeShift);
+
+    /**
+     * 读取输入的下一个要写出的数据包放到source.packet，按时间范围丢弃并重设时间戳
+     * @param source 读取状态
+     * @return 读到数据包返回true，输入结束（或取消）返回false
+     */
+    bool readSourcePacket(PacketSource &source);
+
+    /**
+     * 写出source中等待的数据包（转码、比特流过滤或直接复制）
+     * @param source 读取状态
+     * @return 成功返回true，失败返回false
+     */
+    bool writeSourcePacket(PacketSource &source);
+
+    /**
+     * 将输入定位到指定时间之前最近的关键帧
+     * @param formatContext 输入格式上下文
+     * @param seconds 相对于文件起点的时间（秒）
+     * @return 成功返回0，失败返回负数
+     */
+    int seekInput(AVFormatContext *formatContext, double seconds);
+
     /**
      * 设置错误信息
      * @param error 错误信息
@@ -85,12 +639,92 @@ private:
      */
     bool isStreamCompatible(AVStream *inStream, const AVOutputFormat *outFormat);
 
+    /**
+     * 判断编码格式能否直接写入输出格式
+     * @param codecId 编码格式
+     * @param outFormat 输出格式
+     * @return 兼容返回true，不兼容返回false
+     */
+    static bool isCodecCompatible(AVCodecID codecId, const AVOutputFormat *outFormat);
+
     /**
      * 设置转码参数
      */
     std::map<int, AVCodecContext*> decoderContexts;
     std::map<int, AVCodecContext*> encoderContexts;
     int setupTranscoding(AVStream *inStream, AVStream *outStream);
+
+    /**
+     * 转码用的像素格式/音频重采样上下文及音频帧缓冲（按输出流索引）
+     */
+    std::map<int, SwsContext*> scalerContexts;
+    std::map<int, SwrContext*> resamplerContexts;
+    std::map<int, AVAudioFifo*> audioFifos;
+    std::map<int, int64_t> nextAudioPts;
+
+    /**
+     * 直接复制时转换码流形式的比特流过滤器链（按输出流索引，只有需要转换的流才有）
+     */
+    std::map<int, std::unique_ptr<BitstreamFilterChain>> bitstreamFilters;
+    // swscale/swresample函数表，第一次建立转码时加载
+    const TranscodeLibraries *transcodeLibs = nullptr;
+
+    /**
+     * 解码一个数据包并将得到的帧编码写入输出
+     * @param packet 输入数据包（时间戳为输入流时间基），为nullptr时冲刷解码器
+     * @param outStreamIndex 输出流索引
+     * @return 成功返回true，失败返回false
+     */
+    bool transcodePacket(AVPacket *packet, int outStreamIndex);
+
+    /**
+     * 将解码后的帧转换为编码器格式并送入编码器
+     * @param frame 解码后的帧，为nullptr时冲刷编码器
+     * @param outStreamIndex 输出流索引
+     * @return 成功返回true，失败返回false
+     */
+    bool encodeFrame(AVFrame *frame, int outStreamIndex);
+
+    /**
+     * 取出编码器中已完成的数据包并写入输出
+     * @param outStreamIndex 输出流索引
+     * @return 成功返回true，失败返回false
+     */
+    bool writeEncodedPackets(int outStreamIndex);
+
+    /**
+     * 冲刷所有转码流的解码器、音频缓冲和编码器
+     * @return 成功返回true，失败返回false
+     */
+    bool flushTranscoders();
+
+    /**
+     * 写出一个直接复制的数据包：时间戳换算到输出流的时间基后交给封装器，写出后释放数据包的引用
+     * @param packet 数据包
+     * @param timeBase 数据包时间戳的时间基
+     * @param outStreamIndex 输出流索引
+     * @return 成功返回true，失败返回false
+     */
+    bool writeCopiedPacket(AVPacket *packet, AVRational timeBase, int outStreamIndex);
+
+    /**
+     * 把数据包送入输出流的比特流过滤器链，写出得到的数据包
+     * @param packet 输入数据包（过滤器接管其引用），为nullptr时冲刷过滤器链
+     * @param outStreamIndex 输出流索引
+     * @return 成功返回true，失败返回false
+     */
+    bool filterCopiedPacket(AVPacket *packet, int outStreamIndex);
+
+    /**
+     * 冲刷所有比特流过滤器链
+     * @return 成功返回true，失败返回false
+     */
+    bool flushBitstreamFilters();
+
+    /**
+     * 释放所有输入、输出及转码上下文
+     */
+    void cleanup();
 };
 
 #endif // AUDIO_VIDEO_MERGER_H
\ No newline at end of file
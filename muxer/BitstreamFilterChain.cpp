@@ -0,0 +1,36 @@
+#include "BitstreamFilterChain.h"
+
+BitstreamFilterChain::~BitstreamFilterChain()
+{
+    av_bsf_free(&context);
+}
+
+int BitstreamFilterChain::open(const std::string &filters, const AVCodecParameters *codecpar, AVRational timeBase)
+{
+    av_bsf_free(&context);
+    this->filters = filters;
+
+    // 单个过滤器时av_bsf_list_parse_str直接返回该过滤器的上下文，不额外包一层
+    int result = av_bsf_list_parse_str(filters.c_str(), &context);
+    if (result < 0)
+    {
+        return result;
+    }
+    result = avcodec_parameters_copy(context->par_in, codecpar);
+    if (result < 0)
+    {
+        return result;
+    }
+    context->time_base_in = timeBase;
+    return av_bsf_init(context);
+}
+
+int BitstreamFilterChain::send(AVPacket *packet)
+{
+    return av_bsf_send_packet(context, packet);
+}
+
+int BitstreamFilterChain::receive(AVPacket *packet)
+{
+    return av_bsf_receive_packet(context, packet);
+}
@@ -0,0 +1,61 @@
+#ifndef BITSTREAM_FILTER_CHAIN_H
+#define BITSTREAM_FILTER_CHAIN_H
+
+#include <string>
+extern "C"
+{
+#include <libavcodec/avcodec.h>
+#if LIBAVCODEC_VERSION_MAJOR >= 59
+#include <libavcodec/bsf.h>
+#endif
+}
+
+/**
+ * 一个流复制流的比特流过滤器链（如 "h264_mp4toannexb"、"aac_adtstoasc"）
+ * 数据包按引用在过滤器间传递，负载不复制；一个输入包可能产生零个或多个输出包
+ */
+class BitstreamFilterChain
+{
+public:
+    BitstreamFilterChain() = default;
+    ~BitstreamFilterChain();
+
+    BitstreamFilterChain(const BitstreamFilterChain &) = delete;
+    BitstreamFilterChain &operator=(const BitstreamFilterChain &) = delete;
+
+    /**
+     * 创建并初始化过滤器链
+     * @param filters 过滤器链（av_bsf_list_parse_str的格式，以逗号分隔）
+     * @param codecpar 输入流的参数
+     * @param timeBase 输入数据包的时间基
+     * @return 成功返回0，失败返回负数
+     */
+    int open(const std::string &filters, const AVCodecParameters *codecpar, AVRational timeBase);
+
+    /**
+     * 过滤后的流参数（如转换后的extradata），用于建立输出流
+     */
+    const AVCodecParameters *getOutputParameters() const { return context->par_out; }
+    AVRational getOutputTimeBase() const { return context->time_base_out; }
+
+    const std::string &getFilters() const { return filters; }
+
+    /**
+     * 送入一个数据包，过滤器接管其引用（调用后packet为空）
+     * @param packet 数据包，nullptr表示输入结束
+     * @return 成功返回0，失败返回负数
+     */
+    int send(AVPacket *packet);
+
+    /**
+     * 取出一个过滤后的数据包
+     * @return 成功返回0；需要更多输入返回AVERROR(EAGAIN)，全部取完返回AVERROR_EOF
+     */
+    int receive(AVPacket *packet);
+
+private:
+    AVBSFContext *context = nullptr;
+    std::string filters;
+};
+
+#endif // BITSTREAM_FILTER_CHAIN_H
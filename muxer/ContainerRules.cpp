@@ -0,0 +1,158 @@
+#include "ContainerRules.h"
+#include <sstream>
+#if LIBAVCODEC_VERSION_MAJOR >= 59
+extern "C"
+{
+#include <libavcodec/bsf.h>
+}
+#endif
+
+static const AVCodecID kMp4Codecs[] = {
+    AV_CODEC_ID_H264, AV_CODEC_ID_HEVC, AV_CODEC_ID_AV1,  AV_CODEC_ID_VP9,  AV_CODEC_ID_MPEG4,
+    AV_CODEC_ID_AAC,  AV_CODEC_ID_MP3,  AV_CODEC_ID_AC3,  AV_CODEC_ID_EAC3, AV_CODEC_ID_OPUS,
+    AV_CODEC_ID_FLAC, AV_CODEC_ID_ALAC, AV_CODEC_ID_NONE};
+static const AVCodecID kWebmCodecs[] = {AV_CODEC_ID_VP8,  AV_CODEC_ID_VP9,    AV_CODEC_ID_AV1,
+                                        AV_CODEC_ID_OPUS, AV_CODEC_ID_VORBIS, AV_CODEC_ID_NONE};
+static const AVCodecID kMpegtsCodecs[] = {
+    AV_CODEC_ID_H264, AV_CODEC_ID_HEVC, AV_CODEC_ID_MPEG2VIDEO, AV_CODEC_ID_MPEG4, AV_CODEC_ID_AAC,
+    AV_CODEC_ID_MP3,  AV_CODEC_ID_MP2,  AV_CODEC_ID_AC3,        AV_CODEC_ID_EAC3,  AV_CODEC_ID_OPUS,
+    AV_CODEC_ID_NONE};
+static const AVCodecID kFlvCodecs[] = {AV_CODEC_ID_H264, AV_CODEC_ID_AAC, AV_CODEC_ID_MP3, AV_CODEC_ID_NONE};
+
+static const char *const kH264Encoders[] = {"libx264", "libopenh264", nullptr};
+static const char *const kAacEncoders[] = {"aac", "libfdk_aac", nullptr};
+static const char *const kTsVideoEncoders[] = {"libx264", "libopenh264", "mpeg2video", nullptr};
+static const char *const kTsAudioEncoders[] = {"aac", "mp2", nullptr};
+static const char *const kWebmVideoEncoders[] = {"libvpx-vp9", "libvpx", "libsvtav1", "libaom-av1", nullptr};
+static const char *const kWebmAudioEncoders[] = {"libopus", "libvorbis", nullptr};
+
+static const ContainerRules kRules[] = {
+    {"mp4,ismv", kMp4Codecs, kH264Encoders, kAacEncoders, false, true},
+    // mov和matroska几乎能容纳所有编解码器，复制判断沿用libavformat的标签表
+    {"mov,matroska", nullptr, kH264Encoders, kAacEncoders, false, true},
+    {"webm", kWebmCodecs, kWebmVideoEncoders, kWebmAudioEncoders, false, false},
+    {"mpegts", kMpegtsCodecs, kTsVideoEncoders, kTsAudioEncoders, true, false},
+    {"flv", kFlvCodecs, kH264Encoders, kAacEncoders, false, true},
+};
+
+// 输出格式别名（扩展名式的简称）
+static const char *const kFormatAliases[][2] = {
+    {"mkv", "matroska"}, {"mka", "matroska"}, {"ts", "mpegts"}, {"m4a", "ipod"}, {"m4v", "mp4"},
+};
+
+static bool containsName(const char *names, const char *name)
+{
+    std::istringstream list(names);
+    std::string item;
+    while (std::getline(list, item, ','))
+    {
+        if (item == name)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+const ContainerRules *findContainerRules(const AVOutputFormat *format)
+{
+    if (!format)
+    {
+        return nullptr;
+    }
+    for (const ContainerRules &rules : kRules)
+    {
+        if (containsName(rules.muxers, format->name))
+        {
+            return &rules;
+        }
+    }
+    return nullptr;
+}
+
+const AVOutputFormat *findOutputFormat(const std::string &name)
+{
+    std::string muxerName = name;
+    for (const auto &alias : kFormatAliases)
+    {
+        if (name == alias[0])
+        {
+            muxerName = alias[1];
+            break;
+        }
+    }
+    return av_guess_format(muxerName.c_str(), nullptr, nullptr);
+}
+
+bool isCopyAllowed(AVCodecID codecId, const AVOutputFormat *format)
+{
+    const ContainerRules *rules = findContainerRules(format);
+    if (rules && rules->copyCodecs)
+    {
+        for (const AVCodecID *codec = rules->copyCodecs; *codec != AV_CODEC_ID_NONE; codec++)
+        {
+            if (*codec == codecId)
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // 没有专门规则：使用官方API检查，再查编解码器标签表
+    if (avformat_query_codec(format, codecId, FF_COMPLIANCE_NORMAL) == 1)
+    {
+        return true;
+    }
+    return format->codec_tag && av_codec_get_tag(format->codec_tag, codecId) != 0;
+}
+
+// extradata是否以Annex B起始码开头（否则为avcC/hvcC配置记录）
+static bool startsWithStartCode(const AVCodecParameters *codecpar)
+{
+    const uint8_t *data = codecpar->extradata;
+    int size = codecpar->extradata_size;
+    return size >= 3 && data[0] == 0 && data[1] == 0 && (data[2] == 1 || (size >= 4 && data[2] == 0 && data[3] == 1));
+}
+
+std::string copyBitstreamFilters(const AVCodecParameters *codecpar, const AVOutputFormat *format)
+{
+    const ContainerRules *rules = findContainerRules(format);
+    if (!rules)
+    {
+        return std::string();
+    }
+
+    // 长度前缀形式的H.264/HEVC写入需要起始码的封装格式
+    bool lengthPrefixed = codecpar->extradata_size > 0 && !startsWithStartCode(codecpar);
+    if (rules->annexB && lengthPrefixed && codecpar->codec_id == AV_CODEC_ID_H264)
+    {
+        return "h264_mp4toannexb";
+    }
+    if (rules->annexB && lengthPrefixed && codecpar->codec_id == AV_CODEC_ID_HEVC)
+    {
+        return "hevc_mp4toannexb";
+    }
+    // 没有AudioSpecificConfig的AAC来自ADTS（.aac、MPEG-TS）
+    if (rules->rawAac && codecpar->codec_id == AV_CODEC_ID_AAC && codecpar->extradata_size == 0)
+    {
+        return "aac_adtstoasc";
+    }
+    return std::string();
+}
+
+bool areBitstreamFiltersAvailable(const std::string &filters)
+{
+    std::istringstream list(filters);
+    std::string name;
+    while (std::getline(list, name, ','))
+    {
+        // 过滤器名称后可以带"=选项"
+        name = name.substr(0, name.find('='));
+        if (!av_bsf_get_by_name(name.c_str()))
+        {
+            return false;
+        }
+    }
+    return true;
+}
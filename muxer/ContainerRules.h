@@ -0,0 +1,62 @@
+#ifndef CONTAINER_RULES_H
+#define CONTAINER_RULES_H
+
+#include <string>
+extern "C"
+{
+#include <libavformat/avformat.h>
+#include <libavcodec/avcodec.h>
+}
+
+/**
+ * 一类封装格式的流复制和转码规则
+ * libavformat的标签表只说明封装器能否写出某种编解码器，不区分规范是否允许、播放器能否播放，
+ * 也不说明码流形式（Annex B/avcC、ADTS/原始AAC）是否需要转换；这里按封装格式明确列出
+ */
+struct ContainerRules
+{
+    // 适用的封装器名称，逗号分隔
+    const char *muxers;
+    // 可以直接复制的编解码器，以AV_CODEC_ID_NONE结尾；为空指针时使用libavformat的通用判断
+    const AVCodecID *copyCodecs;
+    // 转码时依次尝试的视频、音频编码器名称，以空指针结尾
+    const char *const *videoEncoders;
+    const char *const *audioEncoders;
+    // H.264/HEVC必须是Annex B（起始码）形式，avcC/hvcC输入需要转换
+    bool annexB;
+    // AAC必须是原始帧（配置在extradata中），ADTS输入需要转换
+    bool rawAac;
+};
+
+/**
+ * 查找封装器的规则
+ * @return 没有专门规则时返回nullptr，此时使用libavformat的通用判断和默认编码器
+ */
+const ContainerRules *findContainerRules(const AVOutputFormat *format);
+
+/**
+ * 解析输出格式名称：接受封装器名称和常用别名（mkv、ts、m2ts等）
+ * @param name 格式名称或别名
+ * @return 封装器，未知名称返回nullptr
+ */
+const AVOutputFormat *findOutputFormat(const std::string &name);
+
+/**
+ * 编解码器能否直接复制到封装格式中
+ */
+bool isCopyAllowed(AVCodecID codecId, const AVOutputFormat *format);
+
+/**
+ * 直接复制时需要的比特流过滤器链（av_bsf_list_parse_str的格式，多个过滤器以逗号分隔）
+ * @param codecpar 输入流的参数，根据extradata判断码流形式
+ * @param format 存放流的封装器
+ * @return 不需要转换时返回空字符串
+ */
+std::string copyBitstreamFilters(const AVCodecParameters *codecpar, const AVOutputFormat *format);
+
+/**
+ * 过滤器链中的过滤器是否都包含在所用的FFmpeg中
+ */
+bool areBitstreamFiltersAvailable(const std::string &filters);
+
+#endif // CONTAINER_RULES_H
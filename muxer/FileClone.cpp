@@ -0,0 +1,455 @@
+#include "FileClone.h"
+#include "IsoBmff.h"
+#include <atomic>
+#include <cerrno>
+#include <vector>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+#endif
+#if defined(__linux__)
+#include <sys/ioctl.h>
+#ifndef FICLONE
+#define FICLONE _IOW(0x94, 9, int)
+#endif
+#elif defined(__APPLE__)
+#include <sys/clonefile.h>
+#endif
+
+// 复制数据时每次读写的大小
+static const size_t kCopyBlockSize = 1024 * 1024;
+
+#ifdef _WIN32
+static std::wstring toWidePath(const std::string &path)
+{
+    int length = MultiByteToWideChar(CP_UTF8, 0, path.c_str(), -1, nullptr, 0);
+    if (length <= 0)
+    {
+        return std::wstring();
+    }
+    std::wstring widePath(length, L'\0');
+    MultiByteToWideChar(CP_UTF8, 0, path.c_str(), -1, &widePath[0], length);
+    widePath.resize(length - 1);
+    return widePath;
+}
+#endif
+
+static bool reflinkFile(const std::string &source, const std::string &destination)
+{
+#if defined(__linux__)
+    int input = ::open(source.c_str(), O_RDONLY | O_CLOEXEC);
+    if (input < 0)
+    {
+        return false;
+    }
+    int output = ::open(destination.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (output < 0)
+    {
+        ::close(input);
+        return false;
+    }
+    bool success = ::ioctl(output, FICLONE, input) == 0;
+    ::close(input);
+    if (::close(output) != 0)
+    {
+        success = false;
+    }
+    if (!success)
+    {
+        ::unlink(destination.c_str());
+    }
+    return success;
+#elif defined(__APPLE__)
+    removeFile(destination);
+    return clonefile(source.c_str(), destination.c_str(), 0) == 0;
+#else
+    (void)source;
+    (void)destination;
+    return false;
+#endif
+}
+
+static bool hardlinkFile(const std::string &source, const std::string &destination)
+{
+    if (!removeFile(destination))
+    {
+        return false;
+    }
+#ifdef _WIN32
+    return CreateHardLinkW(toWidePath(destination).c_str(), toWidePath(source).c_str(), nullptr) != 0;
+#else
+    return ::link(source.c_str(), destination.c_str()) == 0;
+#endif
+}
+
+#if defined(__linux__) && defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 27))
+#define HAVE_COPY_FILE_RANGE 1
+#endif
+
+// 内核内复制（copy_file_range），数据不经过用户空间，同一文件系统上可能由文件系统直接共享数据块
+static bool copyFileRange(const std::string &source, const std::string &destination)
+{
+#ifdef HAVE_COPY_FILE_RANGE
+    int input = ::open(source.c_str(), O_RDONLY | O_CLOEXEC);
+    if (input < 0)
+    {
+        return false;
+    }
+    struct stat info;
+    if (::fstat(input, &info) != 0)
+    {
+        ::close(input);
+        return false;
+    }
+    int output = ::open(destination.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (output < 0)
+    {
+        ::close(input);
+        return false;
+    }
+
+    bool success = true;
+    for (off_t remaining = info.st_size; remaining > 0;)
+    {
+        ssize_t copied = ::copy_file_range(input, nullptr, output, nullptr, (size_t)remaining, 0);
+        if (copied < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        // 不支持（EXDEV、ENOSYS、EINVAL等）或文件被截短时由调用者退回普通复制
+        if (copied <= 0)
+        {
+            success = false;
+            break;
+        }
+        remaining -= copied;
+    }
+    ::close(input);
+    if (::close(output) != 0)
+    {
+        success = false;
+    }
+    if (!success)
+    {
+        ::unlink(destination.c_str());
+    }
+    return success;
+#else
+    (void)source;
+    (void)destination;
+    return false;
+#endif
+}
+
+static bool copyFileData(const std::string &source, const std::string &destination)
+{
+    std::FILE *input = openFileUtf8(source, "rb");
+    if (!input)
+    {
+        return false;
+    }
+    std::FILE *output = openFileUtf8(destination, "wb");
+    if (!output)
+    {
+        std::fclose(input);
+        return false;
+    }
+
+    std::vector<char> buffer(kCopyBlockSize);
+    bool success = true;
+    size_t bytesRead;
+    while ((bytesRead = std::fread(buffer.data(), 1, buffer.size(), input)) > 0)
+    {
+        if (std::fwrite(buffer.data(), 1, bytesRead, output) != bytesRead)
+        {
+            success = false;
+            break;
+        }
+    }
+    if (std::ferror(input))
+    {
+        success = false;
+    }
+    std::fclose(input);
+    if (std::fclose(output) != 0)
+    {
+        success = false;
+    }
+    if (!success)
+    {
+        removeFile(destination);
+    }
+    return success;
+}
+
+CloneMethod cloneFile(const std::string &source, const std::string &destination, bool allowHardlink)
+{
+    // 先删除已有的目标，避免它与其他文件硬链接时被原地改写；目标就是源文件时不能删除
+    if (isSameFile(source, destination) || !removeFile(destination))
+    {
+        return CloneMethod::Failed;
+    }
+    if (reflinkFile(source, destination))
+    {
+        return CloneMethod::Reflink;
+    }
+    if (allowHardlink && hardlinkFile(source, destination))
+    {
+        return CloneMethod::Hardlink;
+    }
+    if (copyFileRange(source, destination))
+    {
+        return CloneMethod::CopyRange;
+    }
+    if (copyFileData(source, destination))
+    {
+        return CloneMethod::Copy;
+    }
+    return CloneMethod::Failed;
+}
+
+const char *cloneMethodName(CloneMethod method)
+{
+    switch (method)
+    {
+    case CloneMethod::Reflink: return "reflink";
+    case CloneMethod::Hardlink: return "hardlink";
+    case CloneMethod::CopyRange: return "copy_file_range";
+    case CloneMethod::Copy: return "copy";
+    default: return "failed";
+    }
+}
+
+bool isSameFile(const std::string &first, const std::string &second)
+{
+    if (first == second)
+    {
+        return true;
+    }
+#ifdef _WIN32
+    bool same = false;
+    HANDLE handles[2];
+    BY_HANDLE_FILE_INFORMATION info[2];
+    const std::string *paths[2] = {&first, &second};
+    for (int i = 0; i < 2; i++)
+    {
+        handles[i] = CreateFileW(toWidePath(*paths[i]).c_str(), 0, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                                 nullptr, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS, nullptr);
+    }
+    if (handles[0] != INVALID_HANDLE_VALUE && handles[1] != INVALID_HANDLE_VALUE &&
+        GetFileInformationByHandle(handles[0], &info[0]) && GetFileInformationByHandle(handles[1], &info[1]))
+    {
+        same = info[0].dwVolumeSerialNumber == info[1].dwVolumeSerialNumber &&
+               info[0].nFileIndexHigh == info[1].nFileIndexHigh && info[0].nFileIndexLow == info[1].nFileIndexLow;
+    }
+    for (HANDLE handle : handles)
+    {
+        if (handle != INVALID_HANDLE_VALUE)
+        {
+            CloseHandle(handle);
+        }
+    }
+    return same;
+#else
+    struct stat firstInfo;
+    struct stat secondInfo;
+    return ::stat(first.c_str(), &firstInfo) == 0 && ::stat(second.c_str(), &secondInfo) == 0 &&
+           firstInfo.st_dev == secondInfo.st_dev && firstInfo.st_ino == secondInfo.st_ino;
+#endif
+}
+
+bool removeFile(const std::string &path)
+{
+#ifdef _WIN32
+    return DeleteFileW(toWidePath(path).c_str()) != 0 || GetLastError() == ERROR_FILE_NOT_FOUND;
+#else
+    return ::unlink(path.c_str()) == 0 || errno == ENOENT;
+#endif
+}
+
+bool renameFile(const std::string &from, const std::string &to)
+{
+#ifdef _WIN32
+    // 写穿：返回时改名已落盘，不需要再同步目录
+    return MoveFileExW(toWidePath(from).c_str(), toWidePath(to).c_str(),
+                       MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+    return ::rename(from.c_str(), to.c_str()) == 0;
+#endif
+}
+
+bool truncateFile(const std::string &path, int64_t size)
+{
+#ifdef _WIN32
+    HANDLE file = CreateFileW(toWidePath(path).c_str(), GENERIC_WRITE, 0, nullptr, OPEN_EXISTING,
+                              FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+    {
+        return false;
+    }
+    LARGE_INTEGER position;
+    position.QuadPart = size;
+    bool success = SetFilePointerEx(file, position, nullptr, FILE_BEGIN) != 0 && SetEndOfFile(file) != 0;
+    CloseHandle(file);
+    return success;
+#else
+    return ::truncate(path.c_str(), (off_t)size) == 0;
+#endif
+}
+
+bool syncFile(const std::string &path)
+{
+#ifdef _WIN32
+    std::wstring widePath = toWidePath(path);
+    HANDLE file = CreateFileW(widePath.c_str(), GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr,
+                              OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+    {
+        // FlushFileBuffers需要写权限；只读文件（如缓存命中时硬链接的缓存文件）不是本次写出的，
+        // 数据早已落盘，确认文件存在即可
+        return GetLastError() == ERROR_ACCESS_DENIED &&
+               GetFileAttributesW(widePath.c_str()) != INVALID_FILE_ATTRIBUTES;
+    }
+    bool success = FlushFileBuffers(file) != 0;
+    CloseHandle(file);
+    return success;
+#else
+    int file = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (file < 0)
+    {
+        return false;
+    }
+    bool success = ::fsync(file) == 0;
+    ::close(file);
+    return success;
+#endif
+}
+
+bool syncParentDirectory(const std::string &path)
+{
+#ifdef _WIN32
+    (void)path;
+    return true;
+#else
+    size_t separator = path.find_last_of('/');
+    std::string directory = separator == std::string::npos ? "." : path.substr(0, separator == 0 ? 1 : separator);
+    int file = ::open(directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (file < 0)
+    {
+        return false;
+    }
+    bool success = ::fsync(file) == 0;
+    ::close(file);
+    return success;
+#endif
+}
+
+bool createDirectory(const std::string &path)
+{
+#ifdef _WIN32
+    return CreateDirectoryW(toWidePath(path).c_str(), nullptr) != 0 || GetLastError() == ERROR_ALREADY_EXISTS;
+#else
+    return ::mkdir(path.c_str(), 0755) == 0 || errno == EEXIST;
+#endif
+}
+
+std::string uniqueFileSuffix()
+{
+    static std::atomic<unsigned int> counter(0);
+#ifdef _WIN32
+    unsigned long processId = GetCurrentProcessId();
+#else
+    unsigned long processId = (unsigned long)::getpid();
+#endif
+    return std::to_string(processId) + "-" + std::to_string(counter++);
+}
+
+bool FileLock::lock(const std::string &path, bool wait)
+{
+    unlock();
+#ifdef _WIN32
+    std::wstring widePath = toWidePath(path);
+    for (;;)
+    {
+        // 不共享打开即为独占；关闭（包括进程退出）时删除锁文件
+        HANDLE file = CreateFileW(widePath.c_str(), GENERIC_READ | GENERIC_WRITE, 0, nullptr, OPEN_ALWAYS,
+                                  FILE_ATTRIBUTE_NORMAL | FILE_FLAG_DELETE_ON_CLOSE, nullptr);
+        if (file != INVALID_HANDLE_VALUE)
+        {
+            handle = file;
+            this->path = path;
+            return true;
+        }
+        // 其他进程打开着（共享冲突），或刚关闭、正在删除（拒绝访问）
+        DWORD error = GetLastError();
+        if (!wait || (error != ERROR_SHARING_VIOLATION && error != ERROR_ACCESS_DENIED))
+        {
+            return false;
+        }
+        Sleep(10);
+    }
+#else
+    for (;;)
+    {
+        int file = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+        if (file < 0)
+        {
+            return false;
+        }
+        int result;
+        do
+        {
+            result = ::flock(file, LOCK_EX | (wait ? 0 : LOCK_NB));
+        } while (result != 0 && errno == EINTR);
+        if (result != 0)
+        {
+            ::close(file);
+            return false;
+        }
+        // 上一个持有者解锁时删除了锁文件：锁住的是已删除的文件，重新打开
+        struct stat opened;
+        struct stat current;
+        if (::fstat(file, &opened) == 0 && ::stat(path.c_str(), &current) == 0 && opened.st_dev == current.st_dev &&
+            opened.st_ino == current.st_ino)
+        {
+            descriptor = file;
+            this->path = path;
+            return true;
+        }
+        ::close(file);
+    }
+#endif
+}
+
+void FileLock::unlock()
+{
+#ifdef _WIN32
+    if (handle)
+    {
+        CloseHandle((HANDLE)handle);
+        handle = nullptr;
+    }
+#else
+    if (descriptor >= 0)
+    {
+        // 先删除再关闭：等待中的进程拿到锁后会发现文件已删除并重新打开
+        ::unlink(path.c_str());
+        ::close(descriptor);
+        descriptor = -1;
+    }
+#endif
+}
+
+bool FileLock::isLocked() const
+{
+#ifdef _WIN32
+    return handle != nullptr;
+#else
+    return descriptor >= 0;
+#endif
+}
@@ -0,0 +1,109 @@
+#ifndef FILE_CLONE_H
+#define FILE_CLONE_H
+
+#include <cstdint>
+#include <string>
+
+/**
+ * 文件复制所用的方式
+ */
+enum class CloneMethod
+{
+    Failed,
+    // 写时复制（Linux FICLONE、macOS clonefile），不复制数据，之后修改任一方互不影响
+    Reflink,
+    // 硬链接，两个路径共享同一文件
+    Hardlink,
+    // 内核内复制（Linux copy_file_range），不经过用户空间缓冲区
+    CopyRange,
+    // 复制数据
+    Copy
+};
+
+/**
+ * 把source复制为destination，destination已存在时替换
+ * 依次尝试写时复制、硬链接（allowHardlink时）、copy_file_range和复制数据
+ * @param source 源文件路径（UTF-8）
+ * @param destination 目标文件路径（UTF-8）
+ * @param allowHardlink 是否允许硬链接
+ * @return 实际使用的方式，失败（包括两个路径指向同一文件）返回CloneMethod::Failed
+ */
+CloneMethod cloneFile(const std::string &source, const std::string &destination, bool allowHardlink);
+
+const char *cloneMethodName(CloneMethod method);
+
+/**
+ * 两个路径是否指向同一文件（包括硬链接）
+ */
+bool isSameFile(const std::string &first, const std::string &second);
+
+/**
+ * 删除文件，文件不存在也返回true
+ */
+bool removeFile(const std::string &path);
+
+/**
+ * 重命名文件，目标已存在时替换
+ */
+bool renameFile(const std::string &from, const std::string &to);
+
+/**
+ * 把文件截短为size字节
+ */
+bool truncateFile(const std::string &path, int64_t size);
+
+/**
+ * 把文件已写入的数据刷到磁盘（fsync），改名发布前调用，断电后不会得到改了名却没有数据的文件
+ */
+bool syncFile(const std::string &path);
+
+/**
+ * 把文件所在目录的内容刷到磁盘，改名发布后调用，断电后改名不会丢失
+ * （Windows上renameFile直接写穿，总是返回true）
+ */
+bool syncParentDirectory(const std::string &path);
+
+/**
+ * 创建目录（只创建最后一级），目录已存在也返回true
+ */
+bool createDirectory(const std::string &path);
+
+/**
+ * 进程号加进程内计数，用作同一目录下临时文件名的一部分，并发的进程和线程互不冲突
+ */
+std::string uniqueFileSuffix();
+
+/**
+ * 基于锁文件的进程间互斥锁（POSIX flock，Windows独占打开），持有进程退出时由系统释放
+ * 解锁时删除锁文件
+ */
+class FileLock
+{
+public:
+    FileLock() = default;
+    ~FileLock() { unlock(); }
+    FileLock(const FileLock &) = delete;
+    FileLock &operator=(const FileLock &) = delete;
+
+    /**
+     * 加锁，锁文件不存在时创建
+     * @param path 锁文件路径（UTF-8）
+     * @param wait 被其他进程持有时是否等待；为false时立即返回false
+     * @return 成功返回true
+     */
+    bool lock(const std::string &path, bool wait);
+
+    void unlock();
+
+    bool isLocked() const;
+
+private:
+#ifdef _WIN32
+    void *handle = nullptr;
+#else
+    int descriptor = -1;
+#endif
+    std::string path;
+};
+
+#endif // FILE_CLONE_H
@@ -0,0 +1,232 @@
+#include "FixtureGenerator.h"
+#include <cmath>
+extern "C"
+{
+#include <libavutil/opt.h>
+}
+
+bool FixtureGenerator::generate(const FixtureOptions &options, const std::string &videoPath,
+                                const std::string &audioPath)
+{
+    lastError.clear();
+    return generateStream(options, AVMEDIA_TYPE_VIDEO, videoPath) &&
+           generateStream(options, AVMEDIA_TYPE_AUDIO, audioPath);
+}
+
+bool FixtureGenerator::generateStream(const FixtureOptions &options, AVMediaType mediaType, const std::string &path)
+{
+    const AVCodec *encoder = nullptr;
+    if (mediaType == AVMEDIA_TYPE_VIDEO)
+    {
+        encoder = avcodec_find_encoder_by_name("libx264");
+        if (!encoder)
+            encoder = avcodec_find_encoder(AV_CODEC_ID_H264);
+    }
+    else
+    {
+        encoder = avcodec_find_encoder_by_name("aac");
+        if (!encoder)
+            encoder = avcodec_find_encoder(AV_CODEC_ID_AAC);
+    }
+    if (!encoder)
+    {
+        setError(mediaType == AVMEDIA_TYPE_VIDEO ? "No H.264 encoder available" : "No AAC encoder available");
+        return false;
+    }
+
+    AVFormatContext *formatContext = nullptr;
+    if (avformat_alloc_output_context2(&formatContext, nullptr, "mp4", path.c_str()) < 0)
+    {
+        setError("Failed to create fixture: " + path);
+        return false;
+    }
+
+    AVCodecContext *codecContext = avcodec_alloc_context3(encoder);
+    AVFrame *frame = av_frame_alloc();
+    AVPacket *packet = av_packet_alloc();
+    bool success = codecContext && frame && packet;
+
+    if (success && mediaType == AVMEDIA_TYPE_VIDEO)
+    {
+        codecContext->width = options.width;
+        codecContext->height = options.height;
+        codecContext->time_base = av_make_q(1, options.frameRate);
+        codecContext->framerate = av_make_q(options.frameRate, 1);
+        codecContext->gop_size = options.gopSize;
+        codecContext->max_b_frames = 2;
+        codecContext->pix_fmt = AV_PIX_FMT_YUV420P;
+        codecContext->bit_rate = options.videoBitRate;
+        if (encoder->name == std::string("libx264"))
+        {
+            av_opt_set(codecContext->priv_data, "preset", "ultrafast", 0);
+        }
+    }
+    else if (success)
+    {
+        codecContext->sample_rate = options.sampleRate;
+        codecContext->time_base = av_make_q(1, options.sampleRate);
+        av_channel_layout_default(&codecContext->ch_layout, options.channels);
+        codecContext->sample_fmt = AV_SAMPLE_FMT_FLTP;
+        codecContext->bit_rate = options.audioBitRate;
+    }
+
+    if (success)
+    {
+        codecContext->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+        success = avcodec_open2(codecContext, encoder, nullptr) >= 0;
+        if (!success)
+            setError(std::string("Failed to open encoder ") + encoder->name);
+    }
+
+    AVStream *stream = success ? avformat_new_stream(formatContext, nullptr) : nullptr;
+    if (success)
+    {
+        success = stream && avcodec_parameters_from_context(stream->codecpar, codecContext) >= 0;
+    }
+
+    // 与B站DASH缓存一致的分片MP4结构
+    AVDictionary *muxerOptions = nullptr;
+    av_dict_set(&muxerOptions, "movflags", "frag_keyframe+empty_moov+default_base_moof", 0);
+    if (success)
+    {
+        stream->time_base = codecContext->time_base;
+        success = avio_open(&formatContext->pb, path.c_str(), AVIO_FLAG_WRITE) >= 0 &&
+                  avformat_write_header(formatContext, &muxerOptions) >= 0;
+        if (!success)
+            setError("Failed to write fixture header: " + path);
+    }
+    av_dict_free(&muxerOptions);
+
+    if (success)
+    {
+        if (mediaType == AVMEDIA_TYPE_VIDEO)
+        {
+            frame->format = codecContext->pix_fmt;
+            frame->width = codecContext->width;
+            frame->height = codecContext->height;
+        }
+        else
+        {
+            frame->format = codecContext->sample_fmt;
+            frame->sample_rate = codecContext->sample_rate;
+            frame->nb_samples = codecContext->frame_size > 0 ? codecContext->frame_size : 1024;
+            av_channel_layout_copy(&frame->ch_layout, &codecContext->ch_layout);
+        }
+        success = av_frame_get_buffer(frame, 0) >= 0;
+    }
+
+    int64_t totalUnits = mediaType == AVMEDIA_TYPE_VIDEO
+                             ? (int64_t)(options.durationSeconds * options.frameRate)
+                             : (int64_t)(options.durationSeconds * options.sampleRate);
+    int64_t position = 0;
+
+    // 写完所有帧后再送入nullptr冲刷编码器
+    while (success)
+    {
+        bool flushing = position >= totalUnits;
+        if (!flushing)
+        {
+            success = av_frame_make_writable(frame) >= 0;
+            if (!success)
+                break;
+            frame->pts = position;
+            if (mediaType == AVMEDIA_TYPE_VIDEO)
+            {
+                fillVideoFrame(frame, position);
+                position++;
+            }
+            else
+            {
+                fillAudioFrame(frame, position);
+                position += frame->nb_samples;
+            }
+        }
+
+        if (avcodec_send_frame(codecContext, flushing ? nullptr : frame) < 0)
+        {
+            success = false;
+            break;
+        }
+
+        int ret;
+        while ((ret = avcodec_receive_packet(codecContext, packet)) >= 0)
+        {
+            packet->stream_index = stream->index;
+            av_packet_rescale_ts(packet, codecContext->time_base, stream->time_base);
+            if (av_interleaved_write_frame(formatContext, packet) < 0)
+            {
+                success = false;
+                break;
+            }
+        }
+        if (ret != AVERROR(EAGAIN) && ret != AVERROR_EOF && ret < 0)
+        {
+            success = false;
+        }
+        if (flushing || ret == AVERROR_EOF)
+        {
+            break;
+        }
+    }
+
+    if (success)
+    {
+        success = av_write_trailer(formatContext) >= 0;
+    }
+    else if (lastError.empty())
+    {
+        setError("Failed to encode fixture: " + path);
+    }
+
+    av_packet_free(&packet);
+    av_frame_free(&frame);
+    avcodec_free_context(&codecContext);
+    if (formatContext->pb)
+    {
+        avio_closep(&formatContext->pb);
+    }
+    avformat_free_context(formatContext);
+    return success;
+}
+
+void FixtureGenerator::fillVideoFrame(AVFrame *frame, int64_t index)
+{
+    // 对角移动的渐变保证帧间有运动，低位噪声使码率接近真实内容
+    for (int y = 0; y < frame->height; y++)
+    {
+        uint8_t *row = frame->data[0] + y * frame->linesize[0];
+        for (int x = 0; x < frame->width; x++)
+        {
+            noiseState ^= noiseState << 13;
+            noiseState ^= noiseState >> 17;
+            noiseState ^= noiseState << 5;
+            row[x] = (uint8_t)(((x + y + index * 3) & 0xff) ^ (noiseState & 0x0f));
+        }
+    }
+    for (int plane = 1; plane < 3; plane++)
+    {
+        for (int y = 0; y < frame->height / 2; y++)
+        {
+            uint8_t *row = frame->data[plane] + y * frame->linesize[plane];
+            for (int x = 0; x < frame->width / 2; x++)
+            {
+                row[x] = (uint8_t)(128 + ((plane == 1 ? x : y) + index) % 64 - 32);
+            }
+        }
+    }
+}
+
+void FixtureGenerator::fillAudioFrame(AVFrame *frame, int64_t firstSample)
+{
+    const double pi = 3.14159265358979323846;
+    for (int channel = 0; channel < frame->ch_layout.nb_channels; channel++)
+    {
+        float *samples = (float *)frame->data[channel];
+        double frequency = 440.0 * (channel + 1);
+        for (int i = 0; i < frame->nb_samples; i++)
+        {
+            double t = (double)(firstSample + i) / frame->sample_rate;
+            samples[i] = (float)(0.25 * std::sin(2.0 * pi * frequency * t));
+        }
+    }
+}
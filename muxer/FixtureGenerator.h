@@ -0,0 +1,76 @@
+#ifndef FIXTURE_GENERATOR_H
+#define FIXTURE_GENERATOR_H
+
+#include <string>
+extern "C"
+{
+#include <libavformat/avformat.h>
+#include <libavcodec/avcodec.h>
+}
+
+/**
+ * 合成测试素材参数
+ */
+struct FixtureOptions
+{
+    // 时长（秒）
+    double durationSeconds = 10.0;
+    // 视频分辨率和帧率（即视频包率）
+    int width = 1280;
+    int height = 720;
+    int frameRate = 30;
+    // 关键帧间隔（帧）
+    int gopSize = 60;
+    int64_t videoBitRate = 2000000;
+    // 音频采样率，AAC包率为 sampleRate / 1024
+    int sampleRate = 48000;
+    int channels = 2;
+    int64_t audioBitRate = 128000;
+};
+
+/**
+ * 用FFmpeg自带编码器生成与B站缓存相同结构的合成素材：
+ * 仅含H.264视频的fMP4和仅含AAC音频的fMP4（m4s）
+ */
+class FixtureGenerator
+{
+public:
+    /**
+     * 生成视频和音频素材
+     * @param options 素材参数
+     * @param videoPath 视频输出路径
+     * @param audioPath 音频输出路径
+     * @return 是否生成成功
+     */
+    bool generate(const FixtureOptions &options, const std::string &videoPath, const std::string &audioPath);
+
+    /**
+     * 获取错误信息
+     * @return 最后的错误信息
+     */
+    std::string getLastError() const { return lastError; }
+
+private:
+    std::string lastError;
+
+    /**
+     * 编码单一媒体类型的合成内容并写入fMP4
+     * @param options 素材参数
+     * @param mediaType 视频或音频
+     * @param path 输出路径
+     * @return 成功返回true，失败返回false
+     */
+    bool generateStream(const FixtureOptions &options, AVMediaType mediaType, const std::string &path);
+
+    /**
+     * 填充一帧合成内容（移动的渐变加噪声 / 正弦音）
+     */
+    void fillVideoFrame(AVFrame *frame, int64_t index);
+    void fillAudioFrame(AVFrame *frame, int64_t firstSample);
+
+    void setError(const std::string &error) { lastError = error; }
+
+    uint32_t noiseState = 0x9e3779b9u;
+};
+
+#endif // FIXTURE_GENERATOR_H
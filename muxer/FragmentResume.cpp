@@ -0,0 +1,295 @@
+#include "FragmentResume.h"
+#include "FileClone.h"
+#include <algorithm>
+
+static const size_t kSmallBoxLimit = 256;
+static const size_t kStsdLimit = 64 * 1024;
+static const size_t kMoofLimit = 64 * 1024 * 1024;
+
+// 在内存中的盒子内容里查找第一个指定类型的子盒子
+static bool findBox(const uint8_t *data, size_t size, uint32_t type, const uint8_t *&payload, size_t &payloadSize)
+{
+    size_t offset = 0;
+    uint32_t childType;
+    while (nextBox(data, size, offset, childType, payload, payloadSize))
+    {
+        if (childType == type)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool FragmentResume::scan(const std::string &path)
+{
+    tracks.clear();
+    fragmentDefaults.clear();
+    fragmentCount = 0;
+    lastSequence = 0;
+    dataEnd = 0;
+    lastError.clear();
+
+    bool success = parseFile(path);
+    reader.close();
+    return success;
+}
+
+bool FragmentResume::truncate(const std::string &path) const
+{
+    return truncateFile(path, dataEnd);
+}
+
+bool FragmentResume::matchesHeader(const uint8_t *data, size_t size) const
+{
+    const uint8_t *moov;
+    size_t moovSize;
+    if (!findBox(data, size, boxType("moov"), moov, moovSize))
+    {
+        return false;
+    }
+
+    size_t index = 0;
+    size_t offset = 0;
+    uint32_t type;
+    const uint8_t *trak;
+    size_t trakSize;
+    while (nextBox(moov, moovSize, offset, type, trak, trakSize))
+    {
+        if (type != boxType("trak"))
+        {
+            continue;
+        }
+        const uint8_t *mdia, *mdhd, *minf, *stbl, *stsd;
+        size_t mdiaSize, mdhdSize, minfSize, stblSize, stsdSize;
+        if (index >= tracks.size() || !findBox(trak, trakSize, boxType("mdia"), mdia, mdiaSize) ||
+            !findBox(mdia, mdiaSize, boxType("mdhd"), mdhd, mdhdSize) || mdhdSize < 24 ||
+            (mdhd[0] == 1 && mdhdSize < 36) || !findBox(mdia, mdiaSize, boxType("minf"), minf, minfSize) ||
+            !findBox(minf, minfSize, boxType("stbl"), stbl, stblSize) ||
+            !findBox(stbl, stblSize, boxType("stsd"), stsd, stsdSize))
+        {
+            return false;
+        }
+        const Track &track = tracks[index++];
+        if (readBE32(mdhd + (mdhd[0] == 1 ? 20 : 12)) != track.timescale ||
+            stsdSize != track.sampleDescription.size() ||
+            !std::equal(stsd, stsd + stsdSize, track.sampleDescription.begin()))
+        {
+            return false;
+        }
+    }
+    return index == tracks.size();
+}
+
+bool FragmentResume::parseFile(const std::string &path)
+{
+    if (!reader.open(path))
+    {
+        setError("Failed to open " + path);
+        return false;
+    }
+
+    int64_t fileSize = reader.getFileSize();
+    bool haveMoov = false;
+    std::vector<Track> pending;
+    uint32_t pendingSequence = 0;
+    int64_t pendingEnd = -1;
+    BoxHeader box;
+    // 写到一半的盒子越过文件末尾，读取盒子头失败，扫描到此为止
+    for (int64_t offset = 0; reader.readBoxHeader(offset, fileSize, box); offset = box.end())
+    {
+        if (box.type == boxType("ftyp") || box.type == boxType("styp") || box.type == boxType("free") ||
+            box.type == boxType("skip"))
+        {
+            continue;
+        }
+        if (box.type == boxType("moov"))
+        {
+            if (haveMoov)
+            {
+                setError("Multiple moov boxes in " + path);
+                return false;
+            }
+            if (!parseMoov(box))
+            {
+                return false;
+            }
+            haveMoov = true;
+            dataEnd = box.end();
+        }
+        else if (box.type == boxType("moof") && haveMoov)
+        {
+            pending = tracks;
+            if (!readFragment(box, pending, pendingSequence))
+            {
+                // moof本身是完整的，内容无效说明不是本程序写出的文件
+                return false;
+            }
+            pendingEnd = box.end();
+        }
+        else if (box.type == boxType("mdat") && pendingEnd == box.offset)
+        {
+            // 分片的数据完整，之前的moof生效
+            tracks.swap(pending);
+            lastSequence = pendingSequence;
+            fragmentCount++;
+            dataEnd = box.end();
+            pendingEnd = -1;
+        }
+        else
+        {
+            // 已写完的文件尾部（mfra）或开头的sidx：不是中断的输出
+            setError("Not an interrupted fragmented MP4: " + path);
+            return false;
+        }
+    }
+
+    if (!haveMoov)
+    {
+        setError("No moov box in " + path);
+        return false;
+    }
+    if (fragmentCount == 0)
+    {
+        setError("No complete fragment in " + path);
+        return false;
+    }
+    return true;
+}
+
+bool FragmentResume::parseMoov(const BoxHeader &moov)
+{
+    std::vector<uint8_t> payload;
+    BoxHeader mvex;
+    if (!reader.findChild(moov.payloadOffset(), moov.end(), boxType("mvex"), mvex))
+    {
+        setError("Not a fragmented MP4 (no mvex)");
+        return false;
+    }
+    BoxHeader trex;
+    for (int64_t offset = mvex.payloadOffset(); reader.readBoxHeader(offset, mvex.end(), trex); offset = trex.end())
+    {
+        if (trex.type == boxType("trex") && reader.readPayload(trex, kSmallBoxLimit, payload))
+        {
+            parseTrex(payload.data(), payload.size(), fragmentDefaults);
+        }
+    }
+
+    BoxHeader trak;
+    for (int64_t offset = moov.payloadOffset(); reader.readBoxHeader(offset, moov.end(), trak); offset = trak.end())
+    {
+        if (trak.type != boxType("trak"))
+        {
+            continue;
+        }
+        Track track;
+        BoxHeader tkhd, mdia, mdhd;
+        if (!reader.findChild(trak.payloadOffset(), trak.end(), boxType("tkhd"), tkhd) ||
+            !reader.readPayload(tkhd, kSmallBoxLimit, payload) || payload.size() < 24)
+        {
+            setError("Invalid tkhd");
+            return false;
+        }
+        track.trackId = readBE32(&payload[payload[0] == 1 ? 20 : 12]);
+        if (!reader.findChild(trak.payloadOffset(), trak.end(), boxType("mdia"), mdia) ||
+            !reader.findChild(mdia.payloadOffset(), mdia.end(), boxType("mdhd"), mdhd) ||
+            !reader.readPayload(mdhd, kSmallBoxLimit, payload) || payload.size() < 24 ||
+            (payload[0] == 1 && payload.size() < 36))
+        {
+            setError("Invalid mdhd");
+            return false;
+        }
+        track.timescale = readBE32(&payload[payload[0] == 1 ? 20 : 12]);
+        if (track.timescale == 0)
+        {
+            setError("Invalid timescale");
+            return false;
+        }
+        BoxHeader minf, stbl, stsd;
+        if (!reader.findChild(mdia.payloadOffset(), mdia.end(), boxType("minf"), minf) ||
+            !reader.findChild(minf.payloadOffset(), minf.end(), boxType("stbl"), stbl) ||
+            !reader.findChild(stbl.payloadOffset(), stbl.end(), boxType("stsd"), stsd) ||
+            !reader.readPayload(stsd, kStsdLimit, track.sampleDescription))
+        {
+            setError("Invalid stsd");
+            return false;
+        }
+        tracks.push_back(track);
+    }
+    if (tracks.empty())
+    {
+        setError("No tracks");
+        return false;
+    }
+    return true;
+}
+
+bool FragmentResume::readFragment(const BoxHeader &moof, std::vector<Track> &pending, uint32_t &sequence)
+{
+    std::vector<uint8_t> payload;
+    if (!reader.readPayload(moof, kMoofLimit, payload))
+    {
+        setError("Invalid moof");
+        return false;
+    }
+
+    // 没有显式基准偏移时，后一个traf的数据紧接前一个traf的数据
+    int64_t dataEnd = moof.offset;
+    size_t offset = 0;
+    uint32_t type;
+    const uint8_t *child;
+    size_t childSize;
+    while (nextBox(payload.data(), payload.size(), offset, type, child, childSize))
+    {
+        if (type == boxType("mfhd") && childSize >= 8)
+        {
+            sequence = readBE32(child + 4);
+        }
+        else if (type == boxType("traf") && !readTraf(child, childSize, moof.offset, dataEnd, pending))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool FragmentResume::readTraf(const uint8_t *data, size_t size, int64_t moofOffset, int64_t &dataEnd,
+                              std::vector<Track> &pending)
+{
+    std::string error;
+    if (!parseTrackFragment(data, size, moofOffset, fragmentDefaults, dataEnd, trackFragment, error))
+    {
+        setError(error);
+        return false;
+    }
+    Track *track = nullptr;
+    for (Track &candidate : pending)
+    {
+        if (candidate.trackId == trackFragment.trackId)
+        {
+            track = &candidate;
+        }
+    }
+    if (!track)
+    {
+        setError("Fragment of unknown track");
+        return false;
+    }
+    if (trackFragment.haveDecodeTime)
+    {
+        track->endDecodeTime = trackFragment.decodeTime;
+    }
+    for (const TrackRun &run : trackFragment.runs)
+    {
+        if (run.sampleCount > 0 && !track->haveSamples)
+        {
+            track->haveSamples = true;
+            track->firstDecodeTime = track->endDecodeTime;
+        }
+        for (uint32_t i = 0; i < run.sampleCount; i++)
+        {
+            track->endDecodeTime += run.getSample(i).duration;
+        }
+    }
+    return true;
+}
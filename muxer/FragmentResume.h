@@ -0,0 +1,101 @@
+#ifndef FRAGMENT_RESUME_H
+#define FRAGMENT_RESUME_H
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+#include "IsoBmff.h"
+
+/**
+ * 中断的分片MP4输出（ftyp、空moov，之后是成对的moof+mdat）的续写位置
+ * 只读取盒子头、moov中的轨道信息和各moof，不读取样本数据；
+ * 最后一个完整的moof+mdat之后的数据（写了一半的分片）由truncate截掉
+ */
+class FragmentResume
+{
+public:
+    /**
+     * 一个轨道已写出的时间范围（轨道的时间刻度）
+     */
+    struct Track
+    {
+        uint32_t trackId = 0;
+        uint32_t timescale = 0;
+        // 完整分片中是否已有该轨道的样本
+        bool haveSamples = false;
+        // 第一个样本的解码时间
+        uint64_t firstDecodeTime = 0;
+        // 最后一个样本之后的解码时间，续写从这里开始
+        uint64_t endDecodeTime = 0;
+        // stsd的内容：编码参数（含avcC等附加数据）
+        std::vector<uint8_t> sampleDescription;
+    };
+
+    /**
+     * 扫描文件
+     * @param path 文件路径
+     * @return 是分片MP4且至少有一个完整分片时返回true
+     */
+    bool scan(const std::string &path);
+
+    /**
+     * 检查为续写新生成的文件头（ftyp+moov）与已有文件的轨道是否一致：
+     * 各trak的时间刻度和stsd（编码参数）逐字节相同，输入改变时通常不同
+     * @param data 文件头数据
+     * @param size 数据长度
+     * @return 一致返回true
+     */
+    bool matchesHeader(const uint8_t *data, size_t size) const;
+
+    /**
+     * 截掉最后一个完整分片之后的数据
+     * @return 成功返回true
+     */
+    bool truncate(const std::string &path) const;
+
+    /**
+     * 各轨道，顺序与moov中的trak（即输出流）一致
+     */
+    const std::vector<Track> &getTracks() const { return tracks; }
+
+    int getFragmentCount() const { return fragmentCount; }
+
+    /**
+     * 下一个分片的序号（mfhd）
+     */
+    uint32_t getNextSequence() const { return lastSequence + 1; }
+
+    /**
+     * 最后一个完整分片的结束位置，即保留的字节数
+     */
+    int64_t getDataEnd() const { return dataEnd; }
+
+    std::string getLastError() const { return lastError; }
+
+private:
+    // trex中的默认值
+    std::map<uint32_t, TrackFragmentDefaults> fragmentDefaults;
+    // 解析traf时复用的缓冲
+    TrackFragment trackFragment;
+
+    IsoBmffReader reader;
+    std::vector<Track> tracks;
+    int fragmentCount = 0;
+    uint32_t lastSequence = 0;
+    int64_t dataEnd = 0;
+    std::string lastError;
+
+    bool parseFile(const std::string &path);
+    bool parseMoov(const BoxHeader &moov);
+
+    /**
+     * 读取一个moof中各轨道的时间范围，结果先放在pending中，对应的mdat完整后才生效
+     */
+    bool readFragment(const BoxHeader &moof, std::vector<Track> &pending, uint32_t &sequence);
+    bool readTraf(const uint8_t *data, size_t size, int64_t moofOffset, int64_t &dataEnd, std::vector<Track> &pending);
+
+    void setError(const std::string &error) { lastError = error; }
+};
+
+#endif // FRAGMENT_RESUME_H
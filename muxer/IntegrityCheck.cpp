@@ -0,0 +1,652 @@
+#include "IntegrityCheck.h"
+#include "IsoBmff.h"
+#include <algorithm>
+#include <cstring>
+extern "C"
+{
+#include <libavformat/avio.h>
+#include <libavformat/version.h>
+#include <libavutil/mem.h>
+}
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define CRC32C_X86 1
+#include <nmmintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+#define CRC32C_ARM 1
+#include <arm_acle.h>
+#endif
+
+// CRC32C的反射多项式
+static const uint32_t kCrc32cPoly = 0x82f63b78;
+// 输出AVIOContext的缓冲区大小，每次回调对应一次write系统调用
+static const int kOutputBufferSize = 256 * 1024;
+static const int kInputBufferSize = 64 * 1024;
+// 补读未覆盖部分时每次读取的大小
+static const size_t kFillBlockSize = 1024 * 1024;
+
+/**
+ * 查表法使用的8张表（slicing-by-8）
+ */
+struct Crc32cTables
+{
+    uint32_t table[8][256];
+
+    Crc32cTables()
+    {
+        for (uint32_t i = 0; i < 256; i++)
+        {
+            uint32_t crc = i;
+            for (int bit = 0; bit < 8; bit++)
+            {
+                crc = crc & 1 ? (crc >> 1) ^ kCrc32cPoly : crc >> 1;
+            }
+            table[0][i] = crc;
+        }
+        for (uint32_t i = 0; i < 256; i++)
+        {
+            for (int t = 1; t < 8; t++)
+            {
+                table[t][i] = (table[t - 1][i] >> 8) ^ table[0][table[t - 1][i] & 0xff];
+            }
+        }
+    }
+};
+
+static const Crc32cTables &crc32cTables()
+{
+    static const Crc32cTables tables;
+    return tables;
+}
+
+// 以下函数的state为未取反的CRC寄存器
+static uint32_t crc32cSoftware(uint32_t state, const uint8_t *p, size_t size)
+{
+    const Crc32cTables &tables = crc32cTables();
+    const uint32_t(*t)[256] = tables.table;
+    while (size >= 8)
+    {
+        uint32_t low = state ^ ((uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24));
+        uint32_t high = (uint32_t)p[4] | ((uint32_t)p[5] << 8) | ((uint32_t)p[6] << 16) | ((uint32_t)p[7] << 24);
+        state = t[7][low & 0xff] ^ t[6][(low >> 8) & 0xff] ^ t[5][(low >> 16) & 0xff] ^ t[4][low >> 24] ^
+                t[3][high & 0xff] ^ t[2][(high >> 8) & 0xff] ^ t[1][(high >> 16) & 0xff] ^ t[0][high >> 24];
+        p += 8;
+        size -= 8;
+    }
+    while (size--)
+    {
+        state = (state >> 8) ^ t[0][(state ^ *p++) & 0xff];
+    }
+    return state;
+}
+
+#if defined(CRC32C_X86)
+#if defined(__GNUC__)
+__attribute__((target("sse4.2")))
+#endif
+static uint32_t crc32cHardware(uint32_t state, const uint8_t *p, size_t size)
+{
+    while (size > 0 && ((uintptr_t)p & 7) != 0)
+    {
+        state = _mm_crc32_u8(state, *p++);
+        size--;
+    }
+    uint64_t state64 = state;
+    while (size >= 8)
+    {
+        uint64_t word;
+        std::memcpy(&word, p, 8);
+        state64 = _mm_crc32_u64(state64, word);
+        p += 8;
+        size -= 8;
+    }
+    state = (uint32_t)state64;
+    while (size--)
+    {
+        state = _mm_crc32_u8(state, *p++);
+    }
+    return state;
+}
+
+static bool hasHardwareCrc32c()
+{
+#ifdef _MSC_VER
+    int info[4];
+    __cpuid(info, 1);
+    return (info[2] & (1 << 20)) != 0;
+#else
+    return __builtin_cpu_supports("sse4.2");
+#endif
+}
+#elif defined(CRC32C_ARM)
+static uint32_t crc32cHardware(uint32_t state, const uint8_t *p, size_t size)
+{
+    while (size >= 8)
+    {
+        uint64_t word;
+        std::memcpy(&word, p, 8);
+        state = __crc32cd(state, word);
+        p += 8;
+        size -= 8;
+    }
+    while (size--)
+    {
+        state = __crc32cb(state, *p++);
+    }
+    return state;
+}
+
+static bool hasHardwareCrc32c()
+{
+    return true;
+}
+#endif
+
+uint32_t crc32cUpdate(uint32_t crc, const void *data, size_t size)
+{
+    const uint8_t *p = static_cast<const uint8_t *>(data);
+#if defined(CRC32C_X86) || defined(CRC32C_ARM)
+    static const bool hardware = hasHardwareCrc32c();
+    if (hardware)
+    {
+        return ~crc32cHardware(~crc, p, size);
+    }
+#endif
+    return ~crc32cSoftware(~crc, p, size);
+}
+
+// 模多项式乘法（反射表示），用于计算追加0字节后的CRC
+static uint32_t multiplyModPoly(uint32_t a, uint32_t b)
+{
+    uint32_t mask = (uint32_t)1 << 31;
+    uint32_t product = 0;
+    while (mask != 0)
+    {
+        if (a & mask)
+        {
+            product ^= b;
+        }
+        mask >>= 1;
+        b = b & 1 ? (b >> 1) ^ kCrc32cPoly : b >> 1;
+    }
+    return product;
+}
+
+/**
+ * 未取反的CRC寄存器在数据后追加zeroBytes个0字节后的值
+ */
+static uint32_t crc32cShift(uint32_t state, uint64_t zeroBytes)
+{
+    // power为x^(8*2^k)，从x^8开始逐次平方
+    uint32_t power = (uint32_t)1 << 23;
+    while (zeroBytes != 0)
+    {
+        if (zeroBytes & 1)
+        {
+            state = multiplyModPoly(power, state);
+        }
+        zeroBytes >>= 1;
+        power = multiplyModPoly(power, power);
+    }
+    return state;
+}
+
+// 不取反的CRC（初始寄存器为0），各段可按位置移位后异或组合
+static uint32_t crc32cRaw(const uint8_t *data, size_t size)
+{
+    return ~crc32cUpdate(~0u, data, size);
+}
+
+void RangeChecksum::reset(int64_t fileSize)
+{
+    this->fileSize = std::max<int64_t>(0, fileSize);
+    coveredBytes = 0;
+    state = 0;
+    covered.clear();
+}
+
+void RangeChecksum::update(int64_t offset, const uint8_t *data, size_t size)
+{
+    int64_t begin = std::max<int64_t>(offset, 0);
+    int64_t end = std::min<int64_t>(offset + (int64_t)size, fileSize);
+    while (begin < end)
+    {
+        auto next = covered.upper_bound(begin);
+        if (next != covered.begin())
+        {
+            auto previous = std::prev(next);
+            if (previous->second > begin)
+            {
+                // 已经计入的部分跳过
+                begin = previous->second;
+                continue;
+            }
+        }
+        int64_t pieceEnd = next == covered.end() ? end : std::min(end, next->first);
+        uint32_t piece = crc32cRaw(data + (begin - offset), (size_t)(pieceEnd - begin));
+        state ^= crc32cShift(piece, (uint64_t)(fileSize - pieceEnd));
+        coveredBytes += pieceEnd - begin;
+
+        // 与前后相邻的范围合并
+        auto inserted = covered.emplace(begin, pieceEnd).first;
+        if (inserted != covered.begin())
+        {
+            auto previous = std::prev(inserted);
+            if (previous->second == begin)
+            {
+                previous->second = pieceEnd;
+                covered.erase(inserted);
+                inserted = previous;
+            }
+        }
+        auto following = std::next(inserted);
+        if (following != covered.end() && following->first == inserted->second)
+        {
+            inserted->second = following->second;
+            covered.erase(following);
+        }
+        begin = pieceEnd;
+    }
+}
+
+bool RangeChecksum::finish(const ReadFunction &read, uint32_t &crc)
+{
+    std::vector<std::pair<int64_t, int64_t>> holes;
+    int64_t position = 0;
+    for (const auto &range : covered)
+    {
+        if (range.first > position)
+        {
+            holes.emplace_back(position, range.first);
+        }
+        position = range.second;
+    }
+    if (position < fileSize)
+    {
+        holes.emplace_back(position, fileSize);
+    }
+
+    std::vector<uint8_t> buffer;
+    for (const auto &hole : holes)
+    {
+        for (int64_t offset = hole.first; offset < hole.second;)
+        {
+            size_t block = (size_t)std::min<int64_t>(hole.second - offset, (int64_t)kFillBlockSize);
+            buffer.resize(block);
+            if (!read(offset, buffer.data(), block))
+            {
+                return false;
+            }
+            update(offset, buffer.data(), block);
+            offset += block;
+        }
+    }
+
+    // 标准CRC的初始寄存器为全1，其影响只取决于文件长度
+    crc = ~(state ^ crc32cShift(~0u, (uint64_t)fileSize));
+    return true;
+}
+
+ChecksumInput::~ChecksumInput()
+{
+    close();
+}
+
+int ChecksumInput::open(const std::string &path)
+{
+    close();
+    position = 0;
+    file = openFileUtf8(path, "rb");
+    if (!file)
+    {
+        return -1;
+    }
+    int64_t fileSize = 0;
+    int64_t modifiedTime = 0;
+    if (!ProbeCache::statFile(path, fileSize, modifiedTime))
+    {
+        close();
+        return -1;
+    }
+    checksum.reset(fileSize);
+
+    unsigned char *buffer = (unsigned char *)av_malloc(kInputBufferSize);
+    if (!buffer)
+    {
+        close();
+        return -1;
+    }
+    context = avio_alloc_context(buffer, kInputBufferSize, 0, this, readPacket, nullptr, seekPacket);
+    if (!context)
+    {
+        av_free(buffer);
+        close();
+        return -1;
+    }
+    return 0;
+}
+
+void ChecksumInput::close()
+{
+    if (context)
+    {
+        av_freep(&context->buffer);
+#if LIBAVFORMAT_VERSION_INT >= AV_VERSION_INT(57, 80, 100)
+        avio_context_free(&context);
+#else
+        av_freep(&context);
+#endif
+    }
+    if (file)
+    {
+        std::fclose(file);
+        file = nullptr;
+    }
+}
+
+bool ChecksumInput::finish(uint32_t &crc)
+{
+    if (!file)
+    {
+        return false;
+    }
+    return checksum.finish(
+        [this](int64_t offset, uint8_t *buffer, size_t size) {
+            size_t bytesRead = 0;
+            return readAt(offset, buffer, size, bytesRead) && bytesRead == size;
+        },
+        crc);
+}
+
+int ChecksumInput::readPacket(void *opaque, uint8_t *buffer, int bufferSize)
+{
+    ChecksumInput *input = static_cast<ChecksumInput *>(opaque);
+    size_t bytesRead = 0;
+    if (bufferSize < 0 || !input->readAt(input->position, buffer, (size_t)bufferSize, bytesRead))
+    {
+        return AVERROR(EIO);
+    }
+    if (bytesRead == 0)
+    {
+        return AVERROR_EOF;
+    }
+    input->position += (int64_t)bytesRead;
+    return (int)bytesRead;
+}
+
+int64_t ChecksumInput::seekPacket(void *opaque, int64_t offset, int whence)
+{
+    ChecksumInput *input = static_cast<ChecksumInput *>(opaque);
+    int64_t target;
+    switch (whence & ~AVSEEK_FORCE)
+    {
+    case AVSEEK_SIZE: return input->checksum.getFileSize();
+    case SEEK_SET: target = offset; break;
+    case SEEK_CUR: target = input->position + offset; break;
+    case SEEK_END: target = input->checksum.getFileSize() + offset; break;
+    default: return AVERROR(EINVAL);
+    }
+    if (target < 0)
+    {
+        return AVERROR(EINVAL);
+    }
+    input->position = target;
+    return target;
+}
+
+bool ChecksumInput::readAt(int64_t offset, uint8_t *data, size_t length, size_t &bytesRead)
+{
+    if (seekFile(file, offset) != 0)
+    {
+        return false;
+    }
+    bytesRead = std::fread(data, 1, length, file);
+    if (bytesRead < length && std::ferror(file))
+    {
+        return false;
+    }
+    checksum.update(offset, data, bytesRead);
+    return true;
+}
+
+void PacketChecker::reset(const std::vector<double> &secondsPerTick)
+{
+    streams.assign(secondsPerTick.size(), StreamIntegrity());
+    states.assign(secondsPerTick.size(), StreamState());
+    for (size_t i = 0; i < secondsPerTick.size(); i++)
+    {
+        states[i].secondsPerTick = secondsPerTick[i];
+    }
+}
+
+void PacketChecker::onPacket(int stream, const uint8_t *data, int size, bool hasDts, int64_t dts, int64_t duration)
+{
+    if (stream < 0 || stream >= (int)streams.size())
+    {
+        return;
+    }
+    StreamIntegrity &integrity = streams[stream];
+    StreamState &state = states[stream];
+    integrity.packets++;
+    if (data && size > 0)
+    {
+        integrity.bytes += size;
+        integrity.crc32c = crc32cUpdate(integrity.crc32c, data, (size_t)size);
+    }
+
+    if (!hasDts)
+    {
+        return;
+    }
+    if (state.hasLastDts)
+    {
+        if (dts <= state.lastDts)
+        {
+            integrity.nonMonotonicDts++;
+        }
+        else if (state.lastDuration > 0)
+        {
+            // 空出超过一个数据包时长才算空隙，避免时间戳取整误差
+            int64_t hole = dts - (state.lastDts + state.lastDuration);
+            if (hole > state.lastDuration)
+            {
+                integrity.gaps++;
+                integrity.gapSeconds += hole * state.secondsPerTick;
+            }
+        }
+    }
+    state.hasLastDts = true;
+    state.lastDts = dts;
+    state.lastDuration = duration;
+}
+
+void PacketChecker::onDropped(int stream)
+{
+    if (stream >= 0 && stream < (int)streams.size())
+    {
+        streams[stream].droppedPackets++;
+    }
+}
+
+ChecksumOutput::~ChecksumOutput()
+{
+    close();
+}
+
+int ChecksumOutput::open(const std::string &path)
+{
+    close();
+    position = 0;
+    filePosition = 0;
+    size = 0;
+    crc = 0;
+    failed = false;
+
+    file = openFileUtf8(path, "w+b");
+    if (!file)
+    {
+        return -1;
+    }
+    // AVIOContext已经按块缓冲，stdio不再缓冲，封装器重新打开文件读取时内容已在文件中
+    std::setvbuf(file, nullptr, _IONBF, 0);
+
+    unsigned char *buffer = (unsigned char *)av_malloc(kOutputBufferSize);
+    if (!buffer)
+    {
+        close();
+        return -1;
+    }
+#if LIBAVFORMAT_VERSION_MAJOR >= 61
+    context = avio_alloc_context(buffer, kOutputBufferSize, 1, this, nullptr, writePacket, seekPacket);
+#else
+    context = avio_alloc_context(buffer, kOutputBufferSize, 1, this, nullptr, writePacketMutable, seekPacket);
+#endif
+    if (!context)
+    {
+        av_free(buffer);
+        close();
+        return -1;
+    }
+    return 0;
+}
+
+int ChecksumOutput::close()
+{
+    if (context)
+    {
+        avio_flush(context);
+        if (context->error < 0)
+        {
+            failed = true;
+        }
+        av_freep(&context->buffer);
+#if LIBAVFORMAT_VERSION_INT >= AV_VERSION_INT(57, 80, 100)
+        avio_context_free(&context);
+#else
+        av_freep(&context);
+#endif
+    }
+    if (file)
+    {
+        if (std::fclose(file) != 0)
+        {
+            failed = true;
+        }
+        file = nullptr;
+    }
+    return failed ? -1 : 0;
+}
+
+int ChecksumOutput::writePacket(void *opaque, const uint8_t *buffer, int bufferSize)
+{
+    return static_cast<ChecksumOutput *>(opaque)->write(buffer, bufferSize);
+}
+
+int ChecksumOutput::writePacketMutable(void *opaque, uint8_t *buffer, int bufferSize)
+{
+    return static_cast<ChecksumOutput *>(opaque)->write(buffer, bufferSize);
+}
+
+int64_t ChecksumOutput::seekPacket(void *opaque, int64_t offset, int whence)
+{
+    ChecksumOutput *output = static_cast<ChecksumOutput *>(opaque);
+    int64_t target;
+    switch (whence & ~AVSEEK_FORCE)
+    {
+    case AVSEEK_SIZE: return output->size;
+    case SEEK_SET: target = offset; break;
+    case SEEK_CUR: target = output->position + offset; break;
+    case SEEK_END: target = output->size + offset; break;
+    default: return AVERROR(EINVAL);
+    }
+    if (target < 0)
+    {
+        return AVERROR(EINVAL);
+    }
+    output->position = target;
+    return target;
+}
+
+int ChecksumOutput::write(const uint8_t *data, int length)
+{
+    if (failed || length < 0)
+    {
+        return AVERROR(EIO);
+    }
+    int64_t offset = position;
+    size_t remaining = (size_t)length;
+
+    // 越过文件末尾写入时中间由0填充
+    static const uint8_t zeros[4096] = {};
+    while (size < offset)
+    {
+        size_t fill = (size_t)std::min<int64_t>(offset - size, (int64_t)sizeof(zeros));
+        crc = crc32cUpdate(crc, zeros, fill);
+        size += fill;
+    }
+
+    // 改写已写出的部分：新旧内容之差的CRC后移到文件末尾，与原CRC异或即得新CRC
+    if (offset < size && remaining > 0)
+    {
+        size_t overlap = (size_t)std::min<int64_t>(size - offset, (int64_t)remaining);
+        std::vector<uint8_t> difference(overlap);
+        if (!readAt(offset, difference.data(), overlap))
+        {
+            failed = true;
+            return AVERROR(EIO);
+        }
+        for (size_t i = 0; i < overlap; i++)
+        {
+            difference[i] ^= data[i];
+        }
+        uint32_t state = ~crc32cUpdate(~0u, difference.data(), overlap);
+        crc ^= crc32cShift(state, (uint64_t)(size - offset - (int64_t)overlap));
+        if (!writeAt(offset, data, overlap))
+        {
+            failed = true;
+            return AVERROR(EIO);
+        }
+        data += overlap;
+        offset += overlap;
+        remaining -= overlap;
+    }
+
+    if (remaining > 0)
+    {
+        crc = crc32cUpdate(crc, data, remaining);
+        if (!writeAt(offset, data, remaining))
+        {
+            failed = true;
+            return AVERROR(EIO);
+        }
+        offset += remaining;
+        size = offset;
+    }
+    position = offset;
+    return length;
+}
+
+bool ChecksumOutput::writeAt(int64_t offset, const uint8_t *data, size_t length)
+{
+    if (filePosition != offset && seekFile(file, offset) != 0)
+    {
+        return false;
+    }
+    if (std::fwrite(data, 1, length, file) != length)
+    {
+        return false;
+    }
+    filePosition = offset + (int64_t)length;
+    return true;
+}
+
+bool ChecksumOutput::readAt(int64_t offset, uint8_t *data, size_t length)
+{
+    bool success = seekFile(file, offset) == 0 && std::fread(data, 1, length, file) == length;
+    // 读写切换之间必须定位，下一次写入总是先seek
+    filePosition = -1;
+    return success;
+}
@@ -0,0 +1,232 @@
+#ifndef INTEGRITY_CHECK_H
+#define INTEGRITY_CHECK_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+
+struct AVIOContext;
+
+/**
+ * 计算CRC32C（Castagnoli），可分段调用
+ * x86-64支持SSE4.2时使用crc32指令，ARMv8编译时启用CRC扩展则使用__crc32c指令，否则查表
+ * @param crc 之前数据的CRC（首次为0）
+ * @param data 数据
+ * @param size 字节数
+ * @return 追加数据后的CRC
+ */
+uint32_t crc32cUpdate(uint32_t crc, const void *data, size_t size);
+
+/**
+ * 单个输出流的数据包校验和统计
+ */
+struct StreamIntegrity
+{
+    int64_t packets = 0;
+    int64_t bytes = 0;
+    // 按写出顺序串联所有数据包内容的CRC32C（类似framemd5，但每个流只有一个值）
+    uint32_t crc32c = 0;
+    // DTS不大于前一个数据包的数据包数
+    int64_t nonMonotonicDts = 0;
+    // 被丢弃的数据包数（不含按时间范围裁剪掉的，如解码器拒绝的损坏数据包）
+    int64_t droppedPackets = 0;
+    // 与前一个数据包之间空出超过一个数据包时长的次数及空隙总长（秒）
+    int64_t gaps = 0;
+    double gapSeconds = 0.0;
+};
+
+/**
+ * 在写出数据包时累计各流的校验和，并检查DTS单调性和空隙
+ */
+class PacketChecker
+{
+public:
+    /**
+     * 开始新的检查
+     * @param secondsPerTick 各流时间基（秒），决定流的数量
+     */
+    void reset(const std::vector<double> &secondsPerTick);
+
+    /**
+     * 记录一个写出的数据包
+     * @param stream 输出流序号
+     * @param data 数据包内容
+     * @param size 字节数
+     * @param hasDts 是否带有DTS
+     * @param dts DTS（流时间基）
+     * @param duration 时长（流时间基），未知时为0
+     */
+    void onPacket(int stream, const uint8_t *data, int size, bool hasDts, int64_t dts, int64_t duration);
+
+    void onDropped(int stream);
+
+    const std::vector<StreamIntegrity> &getStreams() const { return streams; }
+
+private:
+    struct StreamState
+    {
+        double secondsPerTick = 0.0;
+        bool hasLastDts = false;
+        int64_t lastDts = 0;
+        int64_t lastDuration = 0;
+    };
+
+    std::vector<StreamIntegrity> streams;
+    std::vector<StreamState> states;
+};
+
+/**
+ * 按任意顺序读取文件时累计整个文件的CRC32C
+ * 每段新读到的数据按到文件末尾的距离移位后异或进结果，重复读取的部分只计一次；
+ * 结束时只补读从未读到的部分（如被跳过的盒子、裁剪时跳过的范围），不需要为校验单独读一遍文件
+ */
+class RangeChecksum
+{
+public:
+    /**
+     * 读取数据的回调，读满size字节返回true
+     */
+    typedef std::function<bool(int64_t offset, uint8_t *buffer, size_t size)> ReadFunction;
+
+    /**
+     * 开始新的文件
+     * @param fileSize 文件大小，超出的部分被忽略
+     */
+    void reset(int64_t fileSize);
+
+    /**
+     * 记录一段读到的数据
+     * @param offset 数据在文件中的位置
+     */
+    void update(int64_t offset, const uint8_t *data, size_t size);
+
+    /**
+     * 补读未覆盖的部分，得到整个文件的CRC32C
+     * @param read 读取回调
+     * @param crc 输出的CRC32C
+     * @return 补读失败返回false
+     */
+    bool finish(const ReadFunction &read, uint32_t &crc);
+
+    int64_t getFileSize() const { return fileSize; }
+    int64_t getCoveredBytes() const { return coveredBytes; }
+
+private:
+    int64_t fileSize = 0;
+    int64_t coveredBytes = 0;
+    // 已覆盖部分的未取反CRC（各段移位到文件末尾后异或）
+    uint32_t state = 0;
+    // 已覆盖的范围（起点、终点），互不相交也不相邻
+    std::map<int64_t, int64_t> covered;
+};
+
+/**
+ * 读取输入时顺带计算整个文件CRC32C的AVIOContext
+ */
+class ChecksumInput
+{
+public:
+    ChecksumInput() = default;
+    ~ChecksumInput();
+
+    ChecksumInput(const ChecksumInput &) = delete;
+    ChecksumInput &operator=(const ChecksumInput &) = delete;
+
+    /**
+     * 打开输入文件
+     * @param path 文件路径（UTF-8）
+     * @return 成功返回0，失败返回负数
+     */
+    int open(const std::string &path);
+    void close();
+
+    bool isOpen() const { return context != nullptr; }
+
+    /**
+     * 交给AVFormatContext::pb使用的上下文（需设置AVFMT_FLAG_CUSTOM_IO），所有权仍属于本对象
+     */
+    AVIOContext *getContext() const { return context; }
+
+    /**
+     * 补读未读到的部分，得到整个文件的CRC32C（在close()之前调用）
+     * @return 成功返回true
+     */
+    bool finish(uint32_t &crc);
+
+private:
+    std::FILE *file = nullptr;
+    AVIOContext *context = nullptr;
+    int64_t position = 0;
+    RangeChecksum checksum;
+
+    static int readPacket(void *opaque, uint8_t *buffer, int bufferSize);
+    static int64_t seekPacket(void *opaque, int64_t offset, int whence);
+
+    bool readAt(int64_t offset, uint8_t *data, size_t length, size_t &bytesRead);
+};
+
+/**
+ * 边写边计算整个输出文件CRC32C的AVIOContext
+ * 封装器回头改写已写出的部分（如mdat长度、预留空间中的moov）时，
+ * 利用CRC的线性从文件读回旧内容修正校验和，写完后不需要再读一遍整个文件
+ */
+class ChecksumOutput
+{
+public:
+    ChecksumOutput() = default;
+    ~ChecksumOutput();
+
+    ChecksumOutput(const ChecksumOutput &) = delete;
+    ChecksumOutput &operator=(const ChecksumOutput &) = delete;
+
+    /**
+     * 创建输出文件
+     * @param path 文件路径（UTF-8）
+     * @return 成功返回0，失败返回负数
+     */
+    int open(const std::string &path);
+
+    /**
+     * 关闭文件并释放AVIOContext
+     * @return 成功返回0；写入失败或校验和无法维护时返回负数
+     */
+    int close();
+
+    bool isOpen() const { return context != nullptr; }
+
+    /**
+     * 交给AVFormatContext::pb使用的上下文，所有权仍属于本对象
+     */
+    AVIOContext *getContext() const { return context; }
+
+    /**
+     * 文件内容的CRC32C和大小（close()成功后有效）
+     */
+    uint32_t getChecksum() const { return crc; }
+    int64_t getSize() const { return size; }
+
+private:
+    std::FILE *file = nullptr;
+    AVIOContext *context = nullptr;
+    // 下一次写入的位置和文件中的实际位置
+    int64_t position = 0;
+    int64_t filePosition = 0;
+    // 已计入校验和的长度（即文件大小）
+    int64_t size = 0;
+    uint32_t crc = 0;
+    bool failed = false;
+
+    static int writePacket(void *opaque, const uint8_t *buffer, int bufferSize);
+    static int writePacketMutable(void *opaque, uint8_t *buffer, int bufferSize);
+    static int64_t seekPacket(void *opaque, int64_t offset, int whence);
+
+    int write(const uint8_t *data, int length);
+    bool writeAt(int64_t offset, const uint8_t *data, size_t length);
+    bool readAt(int64_t offset, uint8_t *data, size_t length);
+};
+
+#endif // INTEGRITY_CHECK_H
@@ -0,0 +1,822 @@
+#include "IsoBmff.h"
+#include "IntegrityCheck.h"
+#include <algorithm>
+extern "C"
+{
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+}
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+// 各盒子内容的读取上限
+static const size_t kSmallBoxLimit = 256;
+static const size_t kStsdLimit = 64 * 1024;
+static const size_t kSidxLimit = 1024 * 1024;
+// 顶层盒子最多检查的数量，避免在异常文件上长时间扫描
+static const int kMaxTopLevelBoxes = 64;
+
+// tfhd的flags
+static const uint32_t kTfhdBaseDataOffset = 0x000001;
+static const uint32_t kTfhdDescriptionIndex = 0x000002;
+static const uint32_t kTfhdDefaultDuration = 0x000008;
+static const uint32_t kTfhdDefaultSize = 0x000010;
+static const uint32_t kTfhdDefaultFlags = 0x000020;
+static const uint32_t kTfhdDefaultBaseIsMoof = 0x020000;
+
+// trun的flags
+static const uint32_t kTrunDataOffset = 0x000001;
+static const uint32_t kTrunFirstSampleFlags = 0x000004;
+static const uint32_t kTrunDuration = 0x000100;
+static const uint32_t kTrunSize = 0x000200;
+static const uint32_t kTrunFlags = 0x000400;
+static const uint32_t kTrunCompositionOffset = 0x000800;
+
+// 盒子类型为大端序，av_codec_get_id使用MKTAG（首字符在低位）
+static unsigned int toCodecTag(uint32_t type)
+{
+    return ((type >> 24) & 0xff) | ((type >> 8) & 0xff00) | ((type << 8) & 0xff0000) | ((type & 0xff) << 24);
+}
+
+std::FILE *openFileUtf8(const std::string &path, const char *mode)
+{
+#ifdef _WIN32
+    // 路径为UTF-8，与FFmpeg在Windows上的约定一致
+    int length = MultiByteToWideChar(CP_UTF8, 0, path.c_str(), -1, nullptr, 0);
+    if (length <= 0)
+    {
+        return nullptr;
+    }
+    std::wstring widePath(length, L'\0');
+    MultiByteToWideChar(CP_UTF8, 0, path.c_str(), -1, &widePath[0], length);
+    std::wstring wideMode(mode, mode + std::char_traits<char>::length(mode));
+    return _wfopen(widePath.c_str(), wideMode.c_str());
+#else
+    return std::fopen(path.c_str(), mode);
+#endif
+}
+
+int seekFile(std::FILE *file, int64_t offset)
+{
+#ifdef _WIN32
+    return _fseeki64(file, offset, SEEK_SET);
+#else
+    return fseeko(file, (off_t)offset, SEEK_SET);
+#endif
+}
+
+bool nextBox(const uint8_t *data, size_t size, size_t &offset, uint32_t &type, const uint8_t *&payload,
+             size_t &payloadSize)
+{
+    if (size < 8 || offset > size - 8)
+    {
+        return false;
+    }
+    uint64_t boxSize = readBE32(data + offset);
+    size_t headerSize = 8;
+    type = readBE32(data + offset + 4);
+    if (boxSize == 1)
+    {
+        if (offset > size - 16)
+        {
+            return false;
+        }
+        boxSize = readBE64(data + offset + 8);
+        headerSize = 16;
+    }
+    else if (boxSize == 0)
+    {
+        boxSize = size - offset;
+    }
+    if (boxSize < headerSize || boxSize > size - offset)
+    {
+        return false;
+    }
+    payload = data + offset + headerSize;
+    payloadSize = (size_t)boxSize - headerSize;
+    offset += (size_t)boxSize;
+    return true;
+}
+
+bool parseTrex(const uint8_t *data, size_t size, std::map<uint32_t, TrackFragmentDefaults> &defaults)
+{
+    if (size < 24)
+    {
+        return false;
+    }
+    TrackFragmentDefaults &track = defaults[readBE32(data + 4)];
+    track.descriptionIndex = readBE32(data + 8);
+    track.duration = readBE32(data + 12);
+    track.size = readBE32(data + 16);
+    track.flags = readBE32(data + 20);
+    return true;
+}
+
+TrackRunSample TrackRun::getSample(uint32_t index) const
+{
+    TrackRunSample sample;
+    sample.duration = defaults.duration;
+    sample.size = defaults.size;
+    sample.flags = index == 0 && haveFirstSampleFlags ? firstSampleFlags : defaults.flags;
+    const uint8_t *entry = entries + (size_t)index * entrySize;
+    if (flags & kTrunDuration)
+    {
+        sample.duration = readBE32(entry);
+        entry += 4;
+    }
+    if (flags & kTrunSize)
+    {
+        sample.size = readBE32(entry);
+        entry += 4;
+    }
+    if (flags & kTrunFlags)
+    {
+        sample.flags = readBE32(entry);
+        entry += 4;
+    }
+    if (flags & kTrunCompositionOffset)
+    {
+        sample.compositionOffset = (int32_t)readBE32(entry);
+    }
+    return sample;
+}
+
+/**
+ * 解析tfhd，base为数据偏移的基准
+ */
+static bool parseTfhd(const uint8_t *box, size_t boxSize, int64_t moofOffset,
+                      const std::map<uint32_t, TrackFragmentDefaults> &trexDefaults, int64_t dataEnd,
+                      TrackFragment &fragment, int64_t &base)
+{
+    if (boxSize < 8)
+    {
+        return false;
+    }
+    uint32_t flags = readBE32(box) & 0xffffff;
+    fragment.trackId = readBE32(box + 4);
+    auto found = trexDefaults.find(fragment.trackId);
+    fragment.defaults = found != trexDefaults.end() ? found->second : TrackFragmentDefaults();
+    base = (flags & kTfhdDefaultBaseIsMoof) ? moofOffset : dataEnd;
+
+    size_t position = 8;
+    size_t required = position + ((flags & kTfhdBaseDataOffset) ? 8 : 0) + ((flags & kTfhdDescriptionIndex) ? 4 : 0) +
+                      ((flags & kTfhdDefaultDuration) ? 4 : 0) + ((flags & kTfhdDefaultSize) ? 4 : 0) +
+                      ((flags & kTfhdDefaultFlags) ? 4 : 0);
+    if (boxSize < required)
+    {
+        return false;
+    }
+    if (flags & kTfhdBaseDataOffset)
+    {
+        base = (int64_t)readBE64(box + position);
+        position += 8;
+    }
+    if (flags & kTfhdDescriptionIndex)
+    {
+        fragment.defaults.descriptionIndex = readBE32(box + position);
+        position += 4;
+    }
+    if (flags & kTfhdDefaultDuration)
+    {
+        fragment.defaults.duration = readBE32(box + position);
+        position += 4;
+    }
+    if (flags & kTfhdDefaultSize)
+    {
+        fragment.defaults.size = readBE32(box + position);
+        position += 4;
+    }
+    if (flags & kTfhdDefaultFlags)
+    {
+        fragment.defaults.flags = readBE32(box + position);
+    }
+    return true;
+}
+
+/**
+ * 解析trun，dataEnd为没有数据偏移时的起点，解析后更新为样本数据的结束位置
+ */
+static bool parseTrun(const uint8_t *box, size_t boxSize, const TrackFragment &fragment, int64_t base,
+                      int64_t &dataEnd, TrackRun &run)
+{
+    if (boxSize < 8)
+    {
+        return false;
+    }
+    run.version = box[0];
+    run.flags = readBE32(box) & 0xffffff;
+    run.sampleCount = readBE32(box + 4);
+    run.defaults = fragment.defaults;
+    run.haveFirstSampleFlags = (run.flags & kTrunFirstSampleFlags) != 0;
+    size_t position = 8;
+    size_t required = position + ((run.flags & kTrunDataOffset) ? 4 : 0) + (run.haveFirstSampleFlags ? 4 : 0);
+    run.entrySize = ((run.flags & kTrunDuration) ? 4 : 0) + ((run.flags & kTrunSize) ? 4 : 0) +
+                    ((run.flags & kTrunFlags) ? 4 : 0) + ((run.flags & kTrunCompositionOffset) ? 4 : 0);
+    // 各字段都取默认值时trun中没有逐样本的数据
+    if (boxSize < required || (run.entrySize > 0 && (boxSize - required) / run.entrySize < run.sampleCount))
+    {
+        return false;
+    }
+
+    run.dataOffset = dataEnd;
+    if (run.flags & kTrunDataOffset)
+    {
+        run.dataOffset = base + (int32_t)readBE32(box + position);
+        position += 4;
+    }
+    if (run.haveFirstSampleFlags)
+    {
+        run.firstSampleFlags = readBE32(box + position);
+        position += 4;
+    }
+    run.entries = box + position;
+
+    run.dataSize = 0;
+    if (run.flags & kTrunSize)
+    {
+        for (uint32_t i = 0; i < run.sampleCount; i++)
+        {
+            run.dataSize += run.getSample(i).size;
+        }
+    }
+    else
+    {
+        run.dataSize = (int64_t)run.defaults.size * run.sampleCount;
+    }
+    dataEnd = run.dataOffset + run.dataSize;
+    return true;
+}
+
+bool parseTrackFragment(const uint8_t *data, size_t size, int64_t moofOffset,
+                        const std::map<uint32_t, TrackFragmentDefaults> &trexDefaults, int64_t &dataEnd,
+                        TrackFragment &fragment, std::string &error)
+{
+    fragment.trackId = 0;
+    fragment.defaults = TrackFragmentDefaults();
+    fragment.haveDecodeTime = false;
+    fragment.decodeTime = 0;
+    fragment.runs.clear();
+
+    bool haveHeader = false;
+    int64_t base = dataEnd;
+    size_t offset = 0;
+    uint32_t type;
+    const uint8_t *box;
+    size_t boxSize;
+    while (nextBox(data, size, offset, type, box, boxSize))
+    {
+        if (type == boxType("tfhd"))
+        {
+            if (!parseTfhd(box, boxSize, moofOffset, trexDefaults, dataEnd, fragment, base))
+            {
+                error = "Invalid tfhd";
+                return false;
+            }
+            haveHeader = true;
+            dataEnd = base;
+        }
+        else if (type == boxType("tfdt"))
+        {
+            if (boxSize < 8 || (box[0] == 1 && boxSize < 12))
+            {
+                error = "Invalid tfdt";
+                return false;
+            }
+            fragment.haveDecodeTime = true;
+            fragment.decodeTime = box[0] == 1 ? readBE64(box + 4) : readBE32(box + 4);
+        }
+        else if (type == boxType("trun"))
+        {
+            TrackRun run;
+            if (!haveHeader || !parseTrun(box, boxSize, fragment, base, dataEnd, run))
+            {
+                error = "Invalid trun";
+                return false;
+            }
+            fragment.runs.push_back(run);
+        }
+    }
+    if (!haveHeader)
+    {
+        error = "Invalid traf";
+        return false;
+    }
+    return true;
+}
+
+IsoBmffReader::~IsoBmffReader()
+{
+    close();
+}
+
+bool IsoBmffReader::open(const std::string &path)
+{
+    close();
+    file = openFileUtf8(path, "rb");
+    if (!file)
+    {
+        return false;
+    }
+
+#ifdef _WIN32
+    _fseeki64(file, 0, SEEK_END);
+    fileSize = _ftelli64(file);
+#else
+    fseeko(file, 0, SEEK_END);
+    fileSize = (int64_t)ftello(file);
+#endif
+    return fileSize >= 0;
+}
+
+void IsoBmffReader::close()
+{
+    if (file)
+    {
+        std::fclose(file);
+        file = nullptr;
+    }
+    fileSize = 0;
+}
+
+bool IsoBmffReader::readAt(int64_t offset, void *buffer, size_t size)
+{
+    if (!file || offset < 0 || seekFile(file, offset) != 0)
+    {
+        return false;
+    }
+    if (std::fread(buffer, 1, size, file) != size)
+    {
+        return false;
+    }
+    if (checksum)
+    {
+        checksum->update(offset, static_cast<const uint8_t *>(buffer), size);
+    }
+    return true;
+}
+
+bool IsoBmffReader::readBoxHeader(int64_t offset, int64_t limit, BoxHeader &header)
+{
+    uint8_t buffer[16];
+    if (offset + 8 > limit || !readAt(offset, buffer, 8))
+    {
+        return false;
+    }
+
+    header.offset = offset;
+    header.type = readBE32(buffer + 4);
+    header.headerSize = 8;
+    uint32_t size32 = readBE32(buffer);
+    if (size32 == 1)
+    {
+        if (offset + 16 > limit || !readAt(offset + 8, buffer + 8, 8))
+        {
+            return false;
+        }
+        header.size = (int64_t)readBE64(buffer + 8);
+        header.headerSize = 16;
+    }
+    else if (size32 == 0)
+    {
+        // 延伸到父盒子（或文件）末尾
+        header.size = limit - offset;
+    }
+    else
+    {
+        header.size = size32;
+    }
+
+    if (header.type == boxType("uuid"))
+    {
+        header.headerSize += 16;
+    }
+    return header.size >= header.headerSize && header.size <= limit - offset;
+}
+
+bool IsoBmffReader::findChild(int64_t begin, int64_t end, uint32_t type, BoxHeader &child)
+{
+    int64_t offset = begin;
+    while (readBoxHeader(offset, end, child))
+    {
+        if (child.type == type)
+        {
+            return true;
+        }
+        offset = child.end();
+    }
+    return false;
+}
+
+bool IsoBmffReader::readPayload(const BoxHeader &header, size_t maxBytes, std::vector<uint8_t> &payload)
+{
+    if (header.payloadSize() < 0 || (uint64_t)header.payloadSize() > maxBytes)
+    {
+        return false;
+    }
+    payload.resize((size_t)header.payloadSize());
+    return payload.empty() || readAt(header.payloadOffset(), payload.data(), payload.size());
+}
+
+bool IsoBmffProbe::probe(const std::string &path, MediaInfo &info)
+{
+    lastError.clear();
+    if (!reader.open(path))
+    {
+        setError("Failed to open " + path);
+        return false;
+    }
+
+    int64_t fileSize = reader.getFileSize();
+    BoxHeader box;
+    if (!reader.readBoxHeader(0, fileSize, box) || (box.type != boxType("ftyp") && box.type != boxType("moov")))
+    {
+        reader.close();
+        setError("Not an ISO-BMFF file");
+        return false;
+    }
+
+    uint32_t movieTimescale = 0;
+    uint64_t movieDuration = 0;
+    std::vector<Track> tracks;
+    std::vector<BoxHeader> sidxBoxes;
+    bool haveMoov = false;
+    bool success = true;
+
+    int64_t offset = 0;
+    for (int count = 0; count < kMaxTopLevelBoxes && reader.readBoxHeader(offset, fileSize, box); count++)
+    {
+        if (box.type == boxType("moov"))
+        {
+            if (!parseMoov(box, movieTimescale, movieDuration, tracks))
+            {
+                success = false;
+                break;
+            }
+            haveMoov = true;
+        }
+        else if (box.type == boxType("sidx"))
+        {
+            sidxBoxes.push_back(box);
+        }
+        else if (box.type == boxType("moof") || (box.type == boxType("mdat") && haveMoov))
+        {
+            // 分片之前的部分已包含所需信息
+            break;
+        }
+        offset = box.end();
+    }
+
+    if (success && !haveMoov)
+    {
+        setError("No moov box before the media data");
+        success = false;
+    }
+    if (success)
+    {
+        for (const auto &sidx : sidxBoxes)
+        {
+            parseSidx(sidx, tracks);
+        }
+    }
+    reader.close();
+    if (!success)
+    {
+        return false;
+    }
+
+    info.formatName = "mov,mp4,m4a,3gp,3g2,mj2";
+    info.fileSize = fileSize;
+    info.durationSeconds = 0.0;
+    info.streams.clear();
+
+    for (size_t i = 0; i < tracks.size(); i++)
+    {
+        Track &track = tracks[i];
+        double seconds = 0.0;
+        if (track.duration > 0 && track.timescale > 0)
+        {
+            seconds = track.duration / (double)track.timescale;
+        }
+        else if (track.sidxSeconds > 0)
+        {
+            seconds = track.sidxSeconds;
+        }
+        else if (movieDuration > 0 && movieTimescale > 0)
+        {
+            seconds = movieDuration / (double)movieTimescale;
+        }
+        if (seconds <= 0)
+        {
+            setError("Unknown duration");
+            return false;
+        }
+
+        track.stream.index = (int)i;
+        track.stream.durationSeconds = seconds;
+        info.durationSeconds = std::max(info.durationSeconds, seconds);
+        info.streams.push_back(track.stream);
+    }
+
+    if (info.streams.empty())
+    {
+        setError("No tracks");
+        return false;
+    }
+    info.bitRate = info.durationSeconds > 0 ? (int64_t)(fileSize * 8 / info.durationSeconds) : 0;
+    return true;
+}
+
+bool IsoBmffProbe::parseMoov(const BoxHeader &moov, uint32_t &movieTimescale, uint64_t &movieDuration,
+                             std::vector<Track> &tracks)
+{
+    std::vector<uint8_t> payload;
+    BoxHeader box;
+    int64_t offset = moov.payloadOffset();
+    while (reader.readBoxHeader(offset, moov.end(), box))
+    {
+        if (box.type == boxType("mvhd"))
+        {
+            if (!reader.readPayload(box, kSmallBoxLimit, payload) || payload.size() < 20)
+            {
+                setError("Invalid mvhd");
+                return false;
+            }
+            if (payload[0] == 1 && payload.size() >= 32)
+            {
+                movieTimescale = readBE32(&payload[20]);
+                movieDuration = readBE64(&payload[24]);
+            }
+            else
+            {
+                movieTimescale = readBE32(&payload[12]);
+                movieDuration = readBE32(&payload[16]);
+            }
+            if (movieDuration == 0xffffffffu || movieDuration == UINT64_MAX)
+            {
+                movieDuration = 0;
+            }
+        }
+        else if (box.type == boxType("mvex"))
+        {
+            // 分片文件的总时长（mehd，以电影时间刻度计）
+            BoxHeader mehd;
+            if (reader.findChild(box.payloadOffset(), box.end(), boxType("mehd"), mehd) &&
+                reader.readPayload(mehd, kSmallBoxLimit, payload) && payload.size() >= 8)
+            {
+                uint64_t fragmentDuration =
+                    payload[0] == 1 && payload.size() >= 12 ? readBE64(&payload[4]) : readBE32(&payload[4]);
+                if (fragmentDuration > 0)
+                {
+                    movieDuration = fragmentDuration;
+                }
+            }
+        }
+        else if (box.type == boxType("trak"))
+        {
+            Track track;
+            if (!parseTrak(box, track))
+            {
+                return false;
+            }
+            tracks.push_back(track);
+        }
+        offset = box.end();
+    }
+    return true;
+}
+
+bool IsoBmffProbe::parseTrak(const BoxHeader &trak, Track &track)
+{
+    std::vector<uint8_t> payload;
+    BoxHeader tkhd, mdia, mdhd, hdlr, minf, stbl, stsd;
+
+    if (reader.findChild(trak.payloadOffset(), trak.end(), boxType("tkhd"), tkhd) &&
+        reader.readPayload(tkhd, kSmallBoxLimit, payload) && payload.size() >= 16)
+    {
+        track.trackId = readBE32(&payload[payload[0] == 1 ? 20 : 12]);
+    }
+
+    if (!reader.findChild(trak.payloadOffset(), trak.end(), boxType("mdia"), mdia) ||
+        !reader.findChild(mdia.payloadOffset(), mdia.end(), boxType("mdhd"), mdhd) ||
+        !reader.findChild(mdia.payloadOffset(), mdia.end(), boxType("hdlr"), hdlr) ||
+        !reader.findChild(mdia.payloadOffset(), mdia.end(), boxType("minf"), minf) ||
+        !reader.findChild(minf.payloadOffset(), minf.end(), boxType("stbl"), stbl) ||
+        !reader.findChild(stbl.payloadOffset(), stbl.end(), boxType("stsd"), stsd))
+    {
+        setError("Incomplete trak");
+        return false;
+    }
+
+    if (!reader.readPayload(mdhd, kSmallBoxLimit, payload) || payload.size() < 20)
+    {
+        setError("Invalid mdhd");
+        return false;
+    }
+    if (payload[0] == 1 && payload.size() >= 32)
+    {
+        track.timescale = readBE32(&payload[20]);
+        track.duration = readBE64(&payload[24]);
+    }
+    else
+    {
+        track.timescale = readBE32(&payload[12]);
+        track.duration = readBE32(&payload[16]);
+    }
+    if (track.duration == 0xffffffffu || track.duration == UINT64_MAX)
+    {
+        track.duration = 0;
+    }
+
+    if (!reader.readPayload(hdlr, kSmallBoxLimit, payload) || payload.size() < 12)
+    {
+        setError("Invalid hdlr");
+        return false;
+    }
+    track.handler = readBE32(&payload[8]);
+
+    return parseStsd(stsd, track);
+}
+
+// 读取MPEG-4描述符的变长长度
+static bool readDescriptorLength(const std::vector<uint8_t> &data, size_t &pos, uint32_t &length)
+{
+    length = 0;
+    for (int i = 0; i < 4; i++)
+    {
+        if (pos >= data.size())
+        {
+            return false;
+        }
+        uint8_t byte = data[pos++];
+        length = (length << 7) | (byte & 0x7f);
+        if (!(byte & 0x80))
+        {
+            return true;
+        }
+    }
+    return true;
+}
+
+// 从esds中取出objectTypeIndication和平均码率
+static bool parseEsds(const std::vector<uint8_t> &esds, uint8_t &objectType, uint32_t &averageBitRate)
+{
+    size_t pos = 4;
+    uint32_t length;
+    if (pos >= esds.size() || esds[pos++] != 0x03 || !readDescriptorLength(esds, pos, length) ||
+        pos + 3 > esds.size())
+    {
+        return false;
+    }
+    pos += 2;
+    uint8_t flags = esds[pos++];
+    if (flags & 0x80)
+        pos += 2;
+    if ((flags & 0x40) && pos < esds.size())
+        pos += 1 + esds[pos];
+    if (flags & 0x20)
+        pos += 2;
+
+    if (pos >= esds.size() || esds[pos++] != 0x04 || !readDescriptorLength(esds, pos, length) ||
+        pos + 13 > esds.size())
+    {
+        return false;
+    }
+    objectType = esds[pos];
+    averageBitRate = readBE32(&esds[pos + 9]);
+    return true;
+}
+
+bool IsoBmffProbe::parseStsd(const BoxHeader &stsd, Track &track)
+{
+    std::vector<uint8_t> payload;
+    if (!reader.readPayload(stsd, kStsdLimit, payload) || payload.size() < 16 || readBE32(&payload[4]) < 1)
+    {
+        setError("Invalid stsd");
+        return false;
+    }
+
+    // 只看第一个样本描述
+    const uint8_t *entry = &payload[8];
+    size_t entrySize = std::min<size_t>(readBE32(entry), payload.size() - 8);
+    uint32_t format = readBE32(entry + 4);
+    StreamInfo &stream = track.stream;
+
+    if (track.handler == boxType("vide"))
+    {
+        if (entrySize < 86)
+        {
+            setError("Invalid visual sample entry");
+            return false;
+        }
+        stream.mediaType = "video";
+        const AVCodecTag *const tags[] = {avformat_get_mov_video_tags(), nullptr};
+        stream.codecId = av_codec_get_id(tags, toCodecTag(format));
+        stream.width = readBE16(entry + 32);
+        stream.height = readBE16(entry + 34);
+    }
+    else if (track.handler == boxType("soun"))
+    {
+        if (entrySize < 36)
+        {
+            setError("Invalid audio sample entry");
+            return false;
+        }
+        stream.mediaType = "audio";
+        uint16_t version = readBE16(entry + 16);
+        if (version > 1)
+        {
+            // QuickTime v2音频描述的采样率为浮点数，交给libavformat处理
+            setError("Unsupported audio sample entry version");
+            return false;
+        }
+        stream.channels = readBE16(entry + 24);
+        stream.sampleRate = (int)(readBE32(entry + 32) >> 16);
+
+        if (format == boxType("mp4a"))
+        {
+            // mp4a可以承载AAC或MP3，由esds中的objectTypeIndication区分
+            size_t childOffset = version == 1 ? 52 : 36;
+            uint8_t objectType = 0;
+            uint32_t averageBitRate = 0;
+            bool found = false;
+            while (childOffset + 8 <= entrySize)
+            {
+                uint32_t childSize = readBE32(entry + childOffset);
+                if (childSize < 8 || childOffset + childSize > entrySize)
+                    break;
+                if (readBE32(entry + childOffset + 4) == boxType("esds"))
+                {
+                    std::vector<uint8_t> esds(entry + childOffset + 8, entry + childOffset + childSize);
+                    found = parseEsds(esds, objectType, averageBitRate);
+                    break;
+                }
+                childOffset += childSize;
+            }
+            if (!found)
+            {
+                setError("Missing esds");
+                return false;
+            }
+            if (objectType == 0x40 || objectType == 0x66 || objectType == 0x67 || objectType == 0x68)
+                stream.codecId = AV_CODEC_ID_AAC;
+            else if (objectType == 0x69 || objectType == 0x6B)
+                stream.codecId = AV_CODEC_ID_MP3;
+            else
+                stream.codecId = AV_CODEC_ID_NONE;
+            stream.bitRate = averageBitRate;
+        }
+        else
+        {
+            const AVCodecTag *const tags[] = {avformat_get_mov_audio_tags(), nullptr};
+            stream.codecId = av_codec_get_id(tags, toCodecTag(format));
+        }
+    }
+    else
+    {
+        setError("Unsupported track handler");
+        return false;
+    }
+
+    // 加密或未知的样本描述交给libavformat处理
+    if (stream.codecId == AV_CODEC_ID_NONE)
+    {
+        setError("Unknown sample entry");
+        return false;
+    }
+    stream.codecName = avcodec_get_name((AVCodecID)stream.codecId);
+    return true;
+}
+
+void IsoBmffProbe::parseSidx(const BoxHeader &sidx, std::vector<Track> &tracks)
+{
+    std::vector<uint8_t> payload;
+    if (!reader.readPayload(sidx, kSidxLimit, payload) || payload.size() < 24)
+    {
+        return;
+    }
+
+    uint32_t referenceId = readBE32(&payload[4]);
+    uint32_t timescale = readBE32(&payload[8]);
+    size_t pos = payload[0] == 1 ? 28 : 20;
+    if (timescale == 0 || pos + 4 > payload.size())
+    {
+        return;
+    }
+    uint16_t referenceCount = readBE16(&payload[pos + 2]);
+    pos += 4;
+
+    uint64_t duration = 0;
+    for (uint16_t i = 0; i < referenceCount && pos + 12 <= payload.size(); i++, pos += 12)
+    {
+        duration += readBE32(&payload[pos + 4]);
+    }
+
+    for (auto &track : tracks)
+    {
+        if (track.trackId == referenceId || tracks.size() == 1)
+        {
+            track.sidxSeconds += duration / (double)timescale;
+        }
+    }
+}
@@ -0,0 +1,261 @@
+#ifndef ISO_BMFF_H
+#define ISO_BMFF_H
+
+#include <cstdint>
+#include <cstdio>
+#include <map>
+#include <string>
+#include <vector>
+#include "MediaProbe.h"
+
+class RangeChecksum;
+
+/**
+ * 由四个字符组成的盒子类型（大端），如 boxType("moov")
+ */
+inline uint32_t boxType(const char *name)
+{
+    return ((uint32_t)(uint8_t)name[0] << 24) | ((uint32_t)(uint8_t)name[1] << 16) |
+           ((uint32_t)(uint8_t)name[2] << 8) | (uint32_t)(uint8_t)name[3];
+}
+
+inline uint16_t readBE16(const uint8_t *p) { return (uint16_t)((p[0] << 8) | p[1]); }
+inline uint32_t readBE32(const uint8_t *p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | (uint32_t)p[3];
+}
+inline uint64_t readBE64(const uint8_t *p) { return ((uint64_t)readBE32(p) << 32) | readBE32(p + 4); }
+
+/**
+ * 打开文件，路径为UTF-8（Windows上转换为宽字符路径）
+ * @param path 文件路径
+ * @param mode fopen的打开模式
+ * @return 失败返回nullptr
+ */
+std::FILE *openFileUtf8(const std::string &path, const char *mode);
+
+/**
+ * 支持64位偏移的fseek(SEEK_SET)
+ * @return 成功返回0
+ */
+int seekFile(std::FILE *file, int64_t offset);
+
+/**
+ * 在内存中的盒子内容里依次取出子盒子
+ * @param offset 当前位置，成功时移到下一个子盒子
+ * @return 取到完整的子盒子返回true
+ */
+bool nextBox(const uint8_t *data, size_t size, size_t &offset, uint32_t &type, const uint8_t *&payload,
+             size_t &payloadSize);
+
+/**
+ * 分片中样本的默认值（trex，可被tfhd覆盖）
+ */
+struct TrackFragmentDefaults
+{
+    uint32_t descriptionIndex = 1;
+    uint32_t duration = 0;
+    uint32_t size = 0;
+    uint32_t flags = 0;
+};
+
+/**
+ * 解析trex的内容
+ * @param defaults 按track_ID保存默认值
+ * @return 长度不足时返回false
+ */
+bool parseTrex(const uint8_t *data, size_t size, std::map<uint32_t, TrackFragmentDefaults> &defaults);
+
+/**
+ * trun中一个样本的各字段，trun中没有的字段取默认值
+ */
+struct TrackRunSample
+{
+    uint32_t duration = 0;
+    uint32_t size = 0;
+    uint32_t flags = 0;
+    int32_t compositionOffset = 0;
+};
+
+/**
+ * 一个trun：连续存放的一组样本
+ * 逐样本的字段直接从盒子内容中读取，只在所解析的moof内容有效期间使用
+ */
+struct TrackRun
+{
+    uint8_t version = 0;
+    uint32_t flags = 0;
+    uint32_t sampleCount = 0;
+    // 第一个样本数据在文件中的位置和所有样本的总字节数
+    int64_t dataOffset = 0;
+    int64_t dataSize = 0;
+    TrackFragmentDefaults defaults;
+    bool haveFirstSampleFlags = false;
+    uint32_t firstSampleFlags = 0;
+    const uint8_t *entries = nullptr;
+    size_t entrySize = 0;
+
+    TrackRunSample getSample(uint32_t index) const;
+};
+
+/**
+ * 一个traf：tfhd中的轨道和默认值、tfdt中的解码时间以及各trun
+ */
+struct TrackFragment
+{
+    uint32_t trackId = 0;
+    TrackFragmentDefaults defaults;
+    bool haveDecodeTime = false;
+    uint64_t decodeTime = 0;
+    std::vector<TrackRun> runs;
+};
+
+/**
+ * 解析moof中的一个traf，并按tfhd和trun的数据偏移推算各trun样本数据在文件中的位置
+ * @param data traf的内容（不含头部），trun的逐样本字段指向其中
+ * @param size 内容长度
+ * @param moofOffset 所在moof在文件中的位置
+ * @param trexDefaults 各轨道trex中的默认值
+ * @param dataEnd 没有显式基准偏移时的数据位置（moof中第一个traf为moofOffset，之后为前一个traf数据的结束位置），
+ *                解析后更新为本traf数据的结束位置
+ * @param fragment 输出的traf
+ * @param error 失败时的原因
+ * @return 盒子无效时返回false
+ */
+bool parseTrackFragment(const uint8_t *data, size_t size, int64_t moofOffset,
+                        const std::map<uint32_t, TrackFragmentDefaults> &trexDefaults, int64_t &dataEnd,
+                        TrackFragment &fragment, std::string &error);
+
+/**
+ * 盒子头
+ */
+struct BoxHeader
+{
+    uint32_t type = 0;
+    // 盒子在文件中的起始位置
+    int64_t offset = 0;
+    // 含头部的总长度
+    int64_t size = 0;
+    // 头部长度（8，64位长度时16，uuid盒子再加16）
+    int headerSize = 0;
+
+    int64_t payloadOffset() const { return offset + headerSize; }
+    int64_t payloadSize() const { return size - headerSize; }
+    int64_t end() const { return offset + size; }
+};
+
+/**
+ * ISO-BMFF（MP4/fMP4）盒子读取器
+ * 只按需读取盒子头和指定盒子的内容，每次读取都有长度上限
+ */
+class IsoBmffReader
+{
+public:
+    IsoBmffReader() = default;
+    ~IsoBmffReader();
+
+    IsoBmffReader(const IsoBmffReader &) = delete;
+    IsoBmffReader &operator=(const IsoBmffReader &) = delete;
+
+    /**
+     * 打开文件
+     * @param path 文件路径
+     * @return 成功返回true
+     */
+    bool open(const std::string &path);
+    void close();
+
+    int64_t getFileSize() const { return fileSize; }
+
+    /**
+     * 设置后每次readAt()读到的数据都计入该校验和（用于顺带计算整个文件的CRC32C）
+     */
+    void setChecksum(RangeChecksum *checksum) { this->checksum = checksum; }
+
+    /**
+     * 读取位于offset的盒子头
+     * @param offset 盒子起始位置
+     * @param limit 父盒子（或文件）的结束位置，盒子不能越过该位置
+     * @param header 输出的盒子头
+     * @return 成功返回true，到达limit或盒子头无效返回false
+     */
+    bool readBoxHeader(int64_t offset, int64_t limit, BoxHeader &header);
+
+    /**
+     * 在[begin, end)中查找第一个指定类型的子盒子
+     * @return 找到返回true
+     */
+    bool findChild(int64_t begin, int64_t end, uint32_t type, BoxHeader &child);
+
+    /**
+     * 读取盒子内容（不含头部）
+     * @param header 盒子头
+     * @param maxBytes 内容长度上限，超过时返回false
+     * @param payload 输出的内容
+     * @return 成功返回true
+     */
+    bool readPayload(const BoxHeader &header, size_t maxBytes, std::vector<uint8_t> &payload);
+
+    /**
+     * 从指定位置读取数据
+     * @return 读满size字节返回true
+     */
+    bool readAt(int64_t offset, void *buffer, size_t size);
+
+private:
+    std::FILE *file = nullptr;
+    int64_t fileSize = 0;
+    RangeChecksum *checksum = nullptr;
+};
+
+/**
+ * 直接解析ftyp/moov/trak/stsd（及sidx）的快速探测
+ * 不创建libavformat解封装器，用于大量缓存分片的探测和任务分流；
+ * 遇到无法确定编码或时长的文件返回false，由调用者退回libavformat
+ */
+class IsoBmffProbe
+{
+public:
+    /**
+     * 探测文件
+     * @param path 文件路径
+     * @param info 输出的元数据（流复制兼容性由调用者填写）
+     * @return 成功返回true，不是ISO-BMFF或信息不完整时返回false
+     */
+    bool probe(const std::string &path, MediaInfo &info);
+
+    /**
+     * 获取错误信息
+     * @return 最后一次探测失败的原因
+     */
+    std::string getLastError() const { return lastError; }
+
+private:
+    struct Track
+    {
+        uint32_t trackId = 0;
+        uint32_t handler = 0;
+        uint32_t timescale = 0;
+        uint64_t duration = 0;
+        // sidx中各分段时长之和（秒），fMP4的mdhd时长通常为0
+        double sidxSeconds = 0.0;
+        StreamInfo stream;
+    };
+
+    IsoBmffReader reader;
+    std::string lastError;
+
+    bool parseMoov(const BoxHeader &moov, uint32_t &movieTimescale, uint64_t &movieDuration,
+                   std::vector<Track> &tracks);
+    bool parseTrak(const BoxHeader &trak, Track &track);
+    bool parseStsd(const BoxHeader &stsd, Track &track);
+
+    /**
+     * 解析sidx，把各分段时长累加到对应轨道
+     */
+    void parseSidx(const BoxHeader &sidx, std::vector<Track> &tracks);
+
+    void setError(const std::string &error) { lastError = error; }
+};
+
+#endif // ISO_BMFF_H
@@ -0,0 +1,558 @@
+#include "LoudnessMeter.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+// 门限块和短期响度的长度（以100ms为一步）
+static const size_t kBlockSteps = 4;
+static const size_t kShortTermSteps = 30;
+// 绝对门限（LUFS）和相对门限（LU）
+static const double kAbsoluteGate = -70.0;
+static const double kIntegratedRelativeGate = -10.0;
+static const double kRangeRelativeGate = -20.0;
+// 真峰值过采样滤波器每相的抽头数
+static const int kTapsPerPhase = 12;
+// 测量线程队列中的数据包字节数上限，超过时合并线程等待
+static const int64_t kMaxQueuedBytes = 16 * 1024 * 1024;
+
+static double energyToLoudness(double energy)
+{
+    return energy > 0.0 ? -0.691 + 10.0 * std::log10(energy) : -std::numeric_limits<double>::infinity();
+}
+
+static double loudnessToEnergy(double loudness)
+{
+    return std::pow(10.0, (loudness + 0.691) / 10.0);
+}
+
+static double amplitudeToDecibels(double amplitude)
+{
+    return amplitude > 0.0 ? 20.0 * std::log10(amplitude) : -std::numeric_limits<double>::infinity();
+}
+
+// 绝对门限和相对门限（相对于通过绝对门限部分的平均能量）之上的能量
+static std::vector<double> gateEnergies(const std::vector<double> &energies, double relativeGate)
+{
+    double absoluteThreshold = loudnessToEnergy(kAbsoluteGate);
+    double sum = 0.0;
+    size_t count = 0;
+    for (double energy : energies)
+    {
+        if (energy > absoluteThreshold)
+        {
+            sum += energy;
+            count++;
+        }
+    }
+    std::vector<double> gated;
+    if (count == 0)
+    {
+        return gated;
+    }
+    double relativeThreshold = sum / count * std::pow(10.0, relativeGate / 10.0);
+    for (double energy : energies)
+    {
+        if (energy > absoluteThreshold && energy > relativeThreshold)
+        {
+            gated.push_back(energy);
+        }
+    }
+    return gated;
+}
+
+LoudnessMeter::LoudnessMeter(int sampleRate, const std::vector<double> &channelWeights)
+    : sampleRate(sampleRate), channels(channelWeights.size()), stepSamples(std::max(1, sampleRate / 10))
+{
+    for (size_t i = 0; i < channels.size(); i++)
+    {
+        channels[i].weight = channelWeights[i];
+    }
+
+    // K加权的两级滤波器（BS.1770模拟原型经双线性变换，适用于任意采样率）：
+    // 高架滤波器模拟头部的声学效应，RLB高通滤除低频
+    double k = std::tan(M_PI * 1681.974450955533 / sampleRate);
+    double q = 0.7071752369554196;
+    double vh = std::pow(10.0, 3.999843853973347 / 20.0);
+    double vb = std::pow(vh, 0.4996667741545416);
+    double a0 = 1.0 + k / q + k * k;
+    shelf.b0 = (vh + vb * k / q + k * k) / a0;
+    shelf.b1 = 2.0 * (k * k - vh) / a0;
+    shelf.b2 = (vh - vb * k / q + k * k) / a0;
+    shelf.a1 = 2.0 * (k * k - 1.0) / a0;
+    shelf.a2 = (1.0 - k / q + k * k) / a0;
+
+    k = std::tan(M_PI * 38.13547087602444 / sampleRate);
+    q = 0.5003270373238773;
+    a0 = 1.0 + k / q + k * k;
+    highpass.b0 = 1.0;
+    highpass.b1 = -2.0;
+    highpass.b2 = 1.0;
+    highpass.a1 = 2.0 * (k * k - 1.0) / a0;
+    highpass.a2 = (1.0 - k / q + k * k) / a0;
+
+    // 真峰值：96kHz以下4倍过采样，192kHz以下2倍
+    oversample = sampleRate < 96000 ? 4 : (sampleRate < 192000 ? 2 : 1);
+    if (oversample > 1)
+    {
+        // Hann窗sinc低通，截止于原采样率的奈奎斯特频率；拆成oversample相，每相归一化为单位直流增益。
+        // 每相的系数倒序存放，与按时间顺序排列的历史采样做点积
+        tapsPerPhase = kTapsPerPhase;
+        int taps = tapsPerPhase * oversample;
+        std::vector<double> prototype(taps);
+        for (int i = 0; i < taps; i++)
+        {
+            double x = (i - (taps - 1) / 2.0) / oversample;
+            double sinc = x == 0.0 ? 1.0 : std::sin(M_PI * x) / (M_PI * x);
+            double window = 0.5 - 0.5 * std::cos(2.0 * M_PI * (i + 0.5) / taps);
+            prototype[i] = sinc * window;
+        }
+        polyphase.resize(taps);
+        for (int phase = 0; phase < oversample; phase++)
+        {
+            double sum = 0.0;
+            for (int tap = 0; tap < tapsPerPhase; tap++)
+            {
+                sum += prototype[phase + oversample * tap];
+            }
+            for (int tap = 0; tap < tapsPerPhase; tap++)
+            {
+                polyphase[phase * tapsPerPhase + (tapsPerPhase - 1 - tap)] =
+                    (float)(prototype[phase + oversample * tap] / sum);
+            }
+        }
+        for (Channel &channel : channels)
+        {
+            channel.history.assign(tapsPerPhase - 1, 0.0f);
+        }
+    }
+}
+
+void LoudnessMeter::addSamples(const float *const *planes, int count)
+{
+    // 按100ms的步长分段，每段内逐声道连续滤波并累加平方
+    for (int offset = 0; offset < count;)
+    {
+        int length = std::min(count - offset, stepSamples - stepFill);
+        for (size_t c = 0; c < channels.size(); c++)
+        {
+            Channel &channel = channels[c];
+            if (channel.weight == 0.0)
+            {
+                continue;
+            }
+            const float *input = planes[c] + offset;
+            const Biquad s = shelf;
+            const Biquad h = highpass;
+            double z0 = channel.z[0], z1 = channel.z[1], z2 = channel.z[2], z3 = channel.z[3];
+            double sum = 0.0;
+            for (int i = 0; i < length; i++)
+            {
+                double x = input[i];
+                double y = s.b0 * x + z0;
+                z0 = s.b1 * x - s.a1 * y + z1;
+                z1 = s.b2 * x - s.a2 * y;
+                double k = h.b0 * y + z2;
+                z2 = h.b1 * y - h.a1 * k + z3;
+                z3 = h.b2 * y - h.a2 * k;
+                sum += k * k;
+            }
+            // 静音时状态衰减为非规格化数会使运算变慢，直接清零
+            double *state = channel.z;
+            state[0] = std::fabs(z0) < 1e-30 ? 0.0 : z0;
+            state[1] = std::fabs(z1) < 1e-30 ? 0.0 : z1;
+            state[2] = std::fabs(z2) < 1e-30 ? 0.0 : z2;
+            state[3] = std::fabs(z3) < 1e-30 ? 0.0 : z3;
+            stepSum += channel.weight * sum;
+        }
+        stepFill += length;
+        offset += length;
+        if (stepFill == stepSamples)
+        {
+            finishStep();
+        }
+    }
+
+    for (size_t c = 0; c < channels.size(); c++)
+    {
+        measurePeaks(channels[c], planes[c], count);
+    }
+    samples += count;
+}
+
+void LoudnessMeter::finishStep()
+{
+    recentSteps.push_back(stepSum / stepSamples);
+    if (recentSteps.size() > kShortTermSteps)
+    {
+        recentSteps.pop_front();
+    }
+    stepSum = 0.0;
+    stepFill = 0;
+
+    if (recentSteps.size() >= kBlockSteps)
+    {
+        double sum = 0.0;
+        for (size_t i = recentSteps.size() - kBlockSteps; i < recentSteps.size(); i++)
+        {
+            sum += recentSteps[i];
+        }
+        blockEnergies.push_back(sum / kBlockSteps);
+    }
+    if (recentSteps.size() == kShortTermSteps)
+    {
+        double sum = 0.0;
+        for (double energy : recentSteps)
+        {
+            sum += energy;
+        }
+        shortTermEnergies.push_back(sum / kShortTermSteps);
+    }
+}
+
+void LoudnessMeter::measurePeaks(Channel &channel, const float *input, int count)
+{
+    float peak = 0.0f;
+    for (int i = 0; i < count; i++)
+    {
+        peak = std::max(peak, std::fabs(input[i]));
+    }
+    samplePeak = std::max(samplePeak, (double)peak);
+    if (oversample == 1)
+    {
+        return;
+    }
+
+    // 历史采样接上本段采样，每个输入采样对应oversample个插值点
+    size_t historySize = channel.history.size();
+    peakBuffer.resize(historySize + count);
+    std::copy(channel.history.begin(), channel.history.end(), peakBuffer.begin());
+    std::copy(input, input + count, peakBuffer.begin() + historySize);
+
+    // 每相对本段所有位置同时累加：最内层循环沿采样方向，各位置的累加互不依赖，
+    // 不开启fast-math也能向量化（逐位置按抽头求点积是浮点归约，不能重排，不会向量化）；
+    // 每个位置仍按抽头顺序累加，结果与逐位置计算相同
+    phaseValues.resize(count);
+    peakValues.assign(count, 0.0f);
+    float *values = phaseValues.data();
+    float *peaks = peakValues.data();
+    for (int phase = 0; phase < oversample; phase++)
+    {
+        const float *phaseCoefficients = polyphase.data() + phase * tapsPerPhase;
+        std::fill(phaseValues.begin(), phaseValues.end(), 0.0f);
+        for (int tap = 0; tap < tapsPerPhase; tap++)
+        {
+            float coefficient = phaseCoefficients[tap];
+            const float *window = peakBuffer.data() + tap;
+            for (int i = 0; i < count; i++)
+            {
+                values[i] += coefficient * window[i];
+            }
+        }
+        for (int i = 0; i < count; i++)
+        {
+            peaks[i] = std::max(peaks[i], std::fabs(values[i]));
+        }
+    }
+    float interpolatedPeak = 0.0f;
+    for (int i = 0; i < count; i++)
+    {
+        interpolatedPeak = std::max(interpolatedPeak, peaks[i]);
+    }
+    truePeak = std::max(truePeak, (double)interpolatedPeak);
+    std::copy(peakBuffer.end() - historySize, peakBuffer.end(), channel.history.begin());
+}
+
+LoudnessStats LoudnessMeter::getStats() const
+{
+    LoudnessStats stats;
+    stats.samples = samples;
+    stats.valid = !blockEnergies.empty();
+
+    std::vector<double> gated = gateEnergies(blockEnergies, kIntegratedRelativeGate);
+    double sum = 0.0;
+    for (double energy : gated)
+    {
+        sum += energy;
+    }
+    stats.integrated = gated.empty() ? -std::numeric_limits<double>::infinity() : energyToLoudness(sum / gated.size());
+
+    // 响度范围：门限后短期响度分布的10%到95%分位
+    std::vector<double> shortTerm = gateEnergies(shortTermEnergies, kRangeRelativeGate);
+    if (!shortTerm.empty())
+    {
+        std::sort(shortTerm.begin(), shortTerm.end());
+        size_t last = shortTerm.size() - 1;
+        double low = energyToLoudness(shortTerm[(size_t)std::lround(last * 0.10)]);
+        double high = energyToLoudness(shortTerm[(size_t)std::lround(last * 0.95)]);
+        stats.range = high - low;
+    }
+
+    // 插值点不一定经过原始采样，真峰值至少为采样峰值
+    stats.truePeak = amplitudeToDecibels(std::max(truePeak, samplePeak));
+    stats.samplePeak = amplitudeToDecibels(samplePeak);
+    return stats;
+}
+
+LoudnessAnalyzer::~LoudnessAnalyzer()
+{
+    stop();
+    avcodec_free_context(&decoder);
+    av_frame_free(&frame);
+}
+
+int LoudnessAnalyzer::open(const AVStream *stream)
+{
+    const AVCodec *codec = avcodec_find_decoder(stream->codecpar->codec_id);
+    if (!codec)
+    {
+        lastError = std::string("No decoder for ") + avcodec_get_name(stream->codecpar->codec_id);
+        return -1;
+    }
+    decoder = avcodec_alloc_context3(codec);
+    if (!decoder || avcodec_parameters_to_context(decoder, stream->codecpar) < 0)
+    {
+        lastError = "Failed to create loudness decoder";
+        return -1;
+    }
+    decoder->pkt_timebase = stream->time_base;
+    if (avcodec_open2(decoder, codec, nullptr) < 0)
+    {
+        lastError = "Failed to open loudness decoder";
+        return -1;
+    }
+    frame = av_frame_alloc();
+    if (!frame)
+    {
+        lastError = "Out of memory";
+        return -1;
+    }
+    streamIndex = stream->index;
+    worker = std::thread(&LoudnessAnalyzer::run, this);
+    return 0;
+}
+
+void LoudnessAnalyzer::onPacket(const AVPacket *packet)
+{
+    if (packet->stream_index != streamIndex || !worker.joinable())
+    {
+        return;
+    }
+    // 只增加引用，解码在测量线程中进行
+    AVPacket *reference = av_packet_alloc();
+    if (!reference || av_packet_ref(reference, packet) < 0)
+    {
+        av_packet_free(&reference);
+        decodeErrors++;
+        return;
+    }
+    std::unique_lock<std::mutex> lock(mutex);
+    queueChanged.wait(lock, [this]() { return queuedBytes < kMaxQueuedBytes || stopping; });
+    queue.push_back(reference);
+    queuedBytes += reference->size;
+    queueChanged.notify_all();
+}
+
+LoudnessStats LoudnessAnalyzer::finish()
+{
+    if (worker.joinable())
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            queue.push_back(nullptr);
+            queueChanged.notify_all();
+        }
+        worker.join();
+    }
+    LoudnessStats stats;
+    if (meter)
+    {
+        stats = meter->getStats();
+    }
+    stats.decodeErrors = decodeErrors;
+    return stats;
+}
+
+void LoudnessAnalyzer::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+        queueChanged.notify_all();
+    }
+    if (worker.joinable())
+    {
+        worker.join();
+    }
+    for (AVPacket *packet : queue)
+    {
+        av_packet_free(&packet);
+    }
+    queue.clear();
+    queuedBytes = 0;
+}
+
+void LoudnessAnalyzer::run()
+{
+    for (;;)
+    {
+        AVPacket *packet = nullptr;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            queueChanged.wait(lock, [this]() { return !queue.empty() || stopping; });
+            if (stopping)
+            {
+                return;
+            }
+            packet = queue.front();
+            queue.pop_front();
+            if (packet)
+            {
+                queuedBytes -= packet->size;
+            }
+            queueChanged.notify_all();
+        }
+
+        // 空指针冲刷解码器
+        if (avcodec_send_packet(decoder, packet) < 0 && packet)
+        {
+            decodeErrors++;
+        }
+        receiveFrames();
+        if (!packet)
+        {
+            return;
+        }
+        av_packet_free(&packet);
+    }
+}
+
+void LoudnessAnalyzer::receiveFrames()
+{
+    while (avcodec_receive_frame(decoder, frame) >= 0)
+    {
+        measureFrame();
+        av_frame_unref(frame);
+    }
+}
+
+// BS.1770的声道权重：LFE不计入，侧面和后方（环绕）声道为1.41，其他声道为1.0
+static std::vector<double> channelWeights(const AVChannelLayout &layout)
+{
+    // 未指定声道顺序时按该声道数的默认布局（6声道即5.1）
+    AVChannelLayout known = {};
+    if (layout.order == AV_CHANNEL_ORDER_UNSPEC)
+    {
+        av_channel_layout_default(&known, layout.nb_channels);
+    }
+    else
+    {
+        av_channel_layout_copy(&known, &layout);
+    }
+    std::vector<double> weights(layout.nb_channels, 1.0);
+    for (int c = 0; c < layout.nb_channels; c++)
+    {
+        switch (av_channel_layout_channel_from_index(&known, c))
+        {
+        case AV_CHAN_LOW_FREQUENCY:
+        case AV_CHAN_LOW_FREQUENCY_2:
+            weights[c] = 0.0;
+            break;
+        case AV_CHAN_SIDE_LEFT:
+        case AV_CHAN_SIDE_RIGHT:
+        case AV_CHAN_BACK_LEFT:
+        case AV_CHAN_BACK_RIGHT:
+        case AV_CHAN_BACK_CENTER:
+        case AV_CHAN_TOP_BACK_LEFT:
+        case AV_CHAN_TOP_BACK_CENTER:
+        case AV_CHAN_TOP_BACK_RIGHT:
+        case AV_CHAN_SURROUND_DIRECT_LEFT:
+        case AV_CHAN_SURROUND_DIRECT_RIGHT:
+            weights[c] = 1.41;
+            break;
+        default:
+            break;
+        }
+    }
+    av_channel_layout_uninit(&known);
+    return weights;
+}
+
+// 交错或平面的样本转换为平面float
+template <typename T>
+static void convertSamples(const AVFrame *frame, bool planar, double bias, double scale,
+                           std::vector<std::vector<float>> &planes)
+{
+    int channels = (int)planes.size();
+    for (int c = 0; c < channels; c++)
+    {
+        const T *source = reinterpret_cast<const T *>(planar ? frame->extended_data[c] : frame->extended_data[0]);
+        int start = planar ? 0 : c;
+        int stride = planar ? 1 : channels;
+        float *destination = planes[c].data();
+        for (int i = 0; i < frame->nb_samples; i++)
+        {
+            destination[i] = (float)((source[start + i * stride] - bias) * scale);
+        }
+    }
+}
+
+void LoudnessAnalyzer::measureFrame()
+{
+    int channels = frame->ch_layout.nb_channels;
+    if (channels <= 0 || frame->sample_rate <= 0 || frame->nb_samples <= 0)
+    {
+        return;
+    }
+    if (!meter)
+    {
+        // 按声道布局中各声道的位置确定权重，与声道的排列顺序无关
+        meter.reset(new LoudnessMeter(frame->sample_rate, channelWeights(frame->ch_layout)));
+    }
+    // 采样率或声道数中途变化的帧不计入
+    if (meter->getSampleRate() != frame->sample_rate || meter->getChannels() != channels)
+    {
+        decodeErrors++;
+        return;
+    }
+
+    AVSampleFormat format = (AVSampleFormat)frame->format;
+    if (format == AV_SAMPLE_FMT_FLTP)
+    {
+        // AAC等解码器的输出格式，不需要转换
+        meter->addSamples(reinterpret_cast<const float *const *>(frame->extended_data), frame->nb_samples);
+        return;
+    }
+
+    planes.resize(channels);
+    for (auto &plane : planes)
+    {
+        plane.resize(frame->nb_samples);
+    }
+    bool planar = av_sample_fmt_is_planar(format) != 0;
+    switch (format)
+    {
+    case AV_SAMPLE_FMT_FLT: convertSamples<float>(frame, planar, 0.0, 1.0, planes); break;
+    case AV_SAMPLE_FMT_DBL:
+    case AV_SAMPLE_FMT_DBLP: convertSamples<double>(frame, planar, 0.0, 1.0, planes); break;
+    case AV_SAMPLE_FMT_S16:
+    case AV_SAMPLE_FMT_S16P: convertSamples<int16_t>(frame, planar, 0.0, 1.0 / 32768.0, planes); break;
+    case AV_SAMPLE_FMT_S32:
+    case AV_SAMPLE_FMT_S32P: convertSamples<int32_t>(frame, planar, 0.0, 1.0 / 2147483648.0, planes); break;
+    case AV_SAMPLE_FMT_U8:
+    case AV_SAMPLE_FMT_U8P: convertSamples<uint8_t>(frame, planar, 128.0, 1.0 / 128.0, planes); break;
+    default:
+        decodeErrors++;
+        return;
+    }
+
+    std::vector<const float *> pointers(channels);
+    for (int c = 0; c < channels; c++)
+    {
+        pointers[c] = planes[c].data();
+    }
+    meter->addSamples(pointers.data(), frame->nb_samples);
+}
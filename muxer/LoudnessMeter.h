@@ -0,0 +1,170 @@
+#ifndef LOUDNESS_METER_H
+#define LOUDNESS_METER_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+extern "C"
+{
+#include <libavformat/avformat.h>
+#include <libavcodec/avcodec.h>
+}
+
+/**
+ * EBU R128 响度测量结果
+ */
+struct LoudnessStats
+{
+    // 是否有有效结果（开启测量且至少解码了一个门限块）
+    bool valid = false;
+    // 综合响度（LUFS），全程静音时为-inf
+    double integrated = 0.0;
+    // 响度范围（LU）
+    double range = 0.0;
+    // 真峰值（dBTP，4倍过采样）和采样峰值（dBFS）
+    double truePeak = 0.0;
+    double samplePeak = 0.0;
+    // 测量的采样数（每声道）和解码失败的数据包数
+    int64_t samples = 0;
+    int decodeErrors = 0;
+};
+
+/**
+ * ITU-R BS.1770 / EBU R128 响度计：K加权滤波、400ms门限块（75%重叠）计算综合响度，
+ * 3s短期响度计算响度范围，多相FIR过采样计算真峰值
+ * 输入为平面float采样，按声道整段处理（滤波器状态逐声道保存），不依赖FFmpeg
+ */
+class LoudnessMeter
+{
+public:
+    /**
+     * @param sampleRate 采样率
+     * @param channelWeights 各声道的权重（BS.1770：左右中1.0，环绕1.41，LFE为0），个数即声道数
+     */
+    LoudnessMeter(int sampleRate, const std::vector<double> &channelWeights);
+
+    int getSampleRate() const { return sampleRate; }
+    int getChannels() const { return (int)channels.size(); }
+
+    /**
+     * 送入一段采样
+     * @param planes 各声道的采样（-1.0~1.0），个数等于声道数
+     * @param count 每声道的采样数
+     */
+    void addSamples(const float *const *planes, int count);
+
+    /**
+     * 计算当前为止的结果
+     */
+    LoudnessStats getStats() const;
+
+private:
+    // 二阶IIR（直接II型转置）
+    struct Biquad
+    {
+        double b0, b1, b2, a1, a2;
+    };
+
+    struct Channel
+    {
+        double weight = 1.0;
+        // 两级K加权滤波器的状态
+        double z[4] = {0.0, 0.0, 0.0, 0.0};
+        // 真峰值过采样滤波器的历史采样（最近的在最后）
+        std::vector<float> history;
+    };
+
+    int sampleRate;
+    Biquad shelf;
+    Biquad highpass;
+    std::vector<Channel> channels;
+
+    // 真峰值过采样倍数和多相滤波器系数（phase * tapsPerPhase + tap）
+    int oversample = 1;
+    int tapsPerPhase = 0;
+    std::vector<float> polyphase;
+    std::vector<float> peakBuffer;
+    // 当前相各位置的插值结果和各位置所有相的最大绝对值
+    std::vector<float> phaseValues;
+    std::vector<float> peakValues;
+    double truePeak = 0.0;
+    double samplePeak = 0.0;
+
+    // 100ms一步；门限块为最近4步，短期响度为最近30步
+    int stepSamples;
+    int stepFill = 0;
+    double stepSum = 0.0;
+    std::deque<double> recentSteps;
+    std::vector<double> blockEnergies;
+    std::vector<double> shortTermEnergies;
+    int64_t samples = 0;
+
+    void finishStep();
+    void measurePeaks(Channel &channel, const float *samples, int count);
+};
+
+/**
+ * 在独立线程中解码一个音频流并用LoudnessMeter测量
+ * 合并线程只增加数据包的引用并放入队列，解码和测量不占用流复制的时间；
+ * 队列超过上限时合并线程等待，避免解码跟不上时无限占用内存
+ */
+class LoudnessAnalyzer
+{
+public:
+    LoudnessAnalyzer() = default;
+    ~LoudnessAnalyzer();
+
+    LoudnessAnalyzer(const LoudnessAnalyzer &) = delete;
+    LoudnessAnalyzer &operator=(const LoudnessAnalyzer &) = delete;
+
+    /**
+     * 创建解码器并启动测量线程
+     * @param stream 音频输入流
+     * @return 成功返回0，失败返回负数
+     */
+    int open(const AVStream *stream);
+
+    /**
+     * 把音频流的数据包交给测量线程（其他流的数据包被忽略）
+     */
+    void onPacket(const AVPacket *packet);
+
+    /**
+     * 冲刷解码器，等待测量线程处理完所有数据包
+     * @return 测量结果
+     */
+    LoudnessStats finish();
+
+    std::string getLastError() const { return lastError; }
+
+private:
+    int streamIndex = -1;
+    AVCodecContext *decoder = nullptr;
+    AVFrame *frame = nullptr;
+    std::unique_ptr<LoudnessMeter> meter;
+    // 样本格式转换为平面float的缓冲区
+    std::vector<std::vector<float>> planes;
+    std::atomic<int> decodeErrors{0};
+    std::string lastError;
+
+    std::thread worker;
+    std::mutex mutex;
+    std::condition_variable queueChanged;
+    // 空指针表示输入结束
+    std::deque<AVPacket *> queue;
+    int64_t queuedBytes = 0;
+    bool stopping = false;
+
+    void run();
+    void receiveFrames();
+    void measureFrame();
+    void stop();
+};
+
+#endif // LOUDNESS_METER_H
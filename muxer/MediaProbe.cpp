@@ -0,0 +1,124 @@
+#include "MediaProbe.h"
+#include <sys/stat.h>
+#include <sys/types.h>
+
+ProbeCache &ProbeCache::shared()
+{
+    static ProbeCache cache;
+    return cache;
+}
+
+bool ProbeCache::lookup(const std::string &path, int64_t size, int64_t modifiedTime, MediaInfo &info)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    auto found = index.find(path);
+    if (found == index.end() || found->second->size != size || found->second->modifiedTime != modifiedTime)
+    {
+        misses++;
+        return false;
+    }
+
+    entries.splice(entries.begin(), entries, found->second);
+    info = found->second->info;
+    hits++;
+    return true;
+}
+
+void ProbeCache::insert(const std::string &path, int64_t size, int64_t modifiedTime, const MediaInfo &info)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (capacity == 0)
+    {
+        return;
+    }
+
+    auto found = index.find(path);
+    if (found != index.end())
+    {
+        entries.erase(found->second);
+        index.erase(found);
+    }
+
+    Entry entry;
+    entry.path = path;
+    entry.size = size;
+    entry.modifiedTime = modifiedTime;
+    entry.info = info;
+    entries.push_front(std::move(entry));
+    index[path] = entries.begin();
+    evict();
+}
+
+void ProbeCache::clear()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    entries.clear();
+    index.clear();
+    hits = 0;
+    misses = 0;
+}
+
+void ProbeCache::setCapacity(size_t capacity)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    this->capacity = capacity;
+    evict();
+}
+
+size_t ProbeCache::getCapacity() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return capacity;
+}
+
+size_t ProbeCache::getSize() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return entries.size();
+}
+
+int64_t ProbeCache::getHits() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return hits;
+}
+
+int64_t ProbeCache::getMisses() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return misses;
+}
+
+void ProbeCache::evict()
+{
+    while (entries.size() > capacity)
+    {
+        index.erase(entries.back().path);
+        entries.pop_back();
+    }
+}
+
+bool ProbeCache::statFile(const std::string &path, int64_t &size, int64_t &modifiedTime)
+{
+#ifdef _WIN32
+    struct _stat64 st;
+    if (_stat64(path.c_str(), &st) != 0)
+    {
+        return false;
+    }
+    modifiedTime = (int64_t)st.st_mtime * 1000000000LL;
+#else
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0)
+    {
+        return false;
+    }
+#if defined(__APPLE__)
+    modifiedTime = (int64_t)st.st_mtimespec.tv_sec * 1000000000LL + st.st_mtimespec.tv_nsec;
+#else
+    modifiedTime = (int64_t)st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+#endif
+#endif
+    size = (int64_t)st.st_size;
+    return true;
+}
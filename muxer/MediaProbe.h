@@ -0,0 +1,120 @@
+#ifndef MEDIA_PROBE_H
+#define MEDIA_PROBE_H
+
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * 单个流的元数据
+ */
+struct StreamInfo
+{
+    int index = 0;
+    // video / audio / subtitle / data / other
+    std::string mediaType;
+    // AVCodecID
+    int codecId = 0;
+    std::string codecName;
+    // 视频
+    int width = 0;
+    int height = 0;
+    std::string pixelFormat;
+    double frameRate = 0.0;
+    // 音频
+    int sampleRate = 0;
+    int channels = 0;
+    std::string sampleFormat;
+    int64_t bitRate = 0;
+    // 时长（秒），未知时为0
+    double durationSeconds = 0.0;
+    // 能否直接流复制到目标封装格式（随目标格式变化，不进入缓存）
+    bool copyCompatible = false;
+};
+
+/**
+ * 输入文件的元数据
+ */
+struct MediaInfo
+{
+    std::string path;
+    std::string formatName;
+    int64_t fileSize = 0;
+    double durationSeconds = 0.0;
+    // 开始时间（秒）；快速探测不解析编辑列表，此时startTimeKnown为false
+    double startSeconds = 0.0;
+    bool startTimeKnown = false;
+    int64_t bitRate = 0;
+    std::vector<StreamInfo> streams;
+    // 针对目标格式需要转码的流数量
+    int transcodeStreams = 0;
+};
+
+/**
+ * 探测结果缓存
+ * 以文件路径为键并记录文件大小和修改时间，二者任一变化即视为未命中；
+ * 按最近使用顺序淘汰，可在多个线程间共享
+ */
+class ProbeCache
+{
+public:
+    explicit ProbeCache(size_t capacity = 4096) : capacity(capacity) {}
+
+    /**
+     * 进程内共享的缓存实例
+     */
+    static ProbeCache &shared();
+
+    /**
+     * 查找缓存
+     * @param path 文件路径
+     * @param size 当前文件大小
+     * @param modifiedTime 当前修改时间（纳秒）
+     * @param info 命中时写入缓存的元数据
+     * @return 是否命中
+     */
+    bool lookup(const std::string &path, int64_t size, int64_t modifiedTime, MediaInfo &info);
+
+    /**
+     * 写入缓存，超出容量时淘汰最久未使用的条目
+     */
+    void insert(const std::string &path, int64_t size, int64_t modifiedTime, const MediaInfo &info);
+
+    void clear();
+    void setCapacity(size_t capacity);
+
+    size_t getCapacity() const;
+    size_t getSize() const;
+    int64_t getHits() const;
+    int64_t getMisses() const;
+
+    /**
+     * 读取文件大小和修改时间（纳秒）
+     * @return 文件存在返回true
+     */
+    static bool statFile(const std::string &path, int64_t &size, int64_t &modifiedTime);
+
+private:
+    struct Entry
+    {
+        std::string path;
+        int64_t size;
+        int64_t modifiedTime;
+        MediaInfo info;
+    };
+
+    size_t capacity;
+    // 头部为最近使用
+    std::list<Entry> entries;
+    std::unordered_map<std::string, std::list<Entry>::iterator> index;
+    int64_t hits = 0;
+    int64_t misses = 0;
+    mutable std::mutex mutex;
+
+    void evict();
+};
+
+#endif // MEDIA_PROBE_H
@@ -0,0 +1,511 @@
+#include "MergeCache.h"
+#include "IntegrityCheck.h"
+#include "IsoBmff.h"
+#include "MediaProbe.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <sstream>
+#ifndef _WIN32
+#include <sys/stat.h>
+#endif
+
+// 默认的缓存总大小上限
+static const int64_t kDefaultMaxBytes = 10LL * 1024 * 1024 * 1024;
+// 指纹采样：开头和结尾各读取的字节数，以及中间均匀分布的采样块数量和大小
+static const size_t kEdgeSampleBytes = 64 * 1024;
+static const int kMiddleSamples = 16;
+static const size_t kMiddleSampleBytes = 4 * 1024;
+// 核对输入时每次读取的大小
+static const size_t kVerifyBlockSize = 1024 * 1024;
+static const char *const kIndexFileName = "index.tsv";
+static const char *const kIndexLockFileName = "index.tsv.lock";
+// 命中只改变使用顺序，至多每隔这么久写一次索引
+static const std::chrono::seconds kTouchSaveInterval(5);
+
+static std::string toHex(uint64_t value, int digits)
+{
+    char text[17];
+    std::snprintf(text, sizeof(text), "%0*llx", digits, (unsigned long long)value);
+    return text;
+}
+
+/**
+ * 文件大小和采样块CRC32C组成的指纹
+ */
+static bool fingerprintFile(const std::string &path, std::string &fingerprint)
+{
+    int64_t size = 0;
+    int64_t modifiedTime = 0;
+    if (!ProbeCache::statFile(path, size, modifiedTime))
+    {
+        return false;
+    }
+    std::FILE *file = openFileUtf8(path, "rb");
+    if (!file)
+    {
+        return false;
+    }
+
+    // 采样范围（起点、长度），小文件时相互重叠也无妨
+    std::vector<std::pair<int64_t, size_t>> samples;
+    samples.emplace_back(0, (size_t)std::min<int64_t>(size, (int64_t)kEdgeSampleBytes));
+    for (int i = 1; i <= kMiddleSamples; i++)
+    {
+        int64_t offset = size / (kMiddleSamples + 1) * i;
+        samples.emplace_back(offset, (size_t)std::min<int64_t>(size - offset, (int64_t)kMiddleSampleBytes));
+    }
+    int64_t tail = std::max<int64_t>(0, size - (int64_t)kEdgeSampleBytes);
+    samples.emplace_back(tail, (size_t)(size - tail));
+
+    std::vector<uint8_t> buffer(kEdgeSampleBytes);
+    uint32_t crc = 0;
+    bool success = true;
+    for (const auto &sample : samples)
+    {
+        if (sample.second == 0)
+        {
+            continue;
+        }
+        if (seekFile(file, sample.first) != 0 || std::fread(buffer.data(), 1, sample.second, file) != sample.second)
+        {
+            success = false;
+            break;
+        }
+        crc = crc32cUpdate(crc, buffer.data(), sample.second);
+    }
+    std::fclose(file);
+
+    fingerprint = toHex((uint64_t)size, 16) + toHex(crc, 8);
+    return success;
+}
+
+/**
+ * 读取整个文件计算CRC32C
+ */
+static bool checksumFile(const std::string &path, uint32_t &crc)
+{
+    std::FILE *file = openFileUtf8(path, "rb");
+    if (!file)
+    {
+        return false;
+    }
+    std::vector<uint8_t> buffer(kVerifyBlockSize);
+    crc = 0;
+    size_t bytesRead;
+    while ((bytesRead = std::fread(buffer.data(), 1, buffer.size(), file)) > 0)
+    {
+        crc = crc32cUpdate(crc, buffer.data(), bytesRead);
+    }
+    bool success = !std::ferror(file);
+    std::fclose(file);
+    return success;
+}
+
+// 缓存的文件设为只读，避免与之硬链接的输出被其他程序原地改写时破坏缓存
+static void setReadOnly(const std::string &path)
+{
+#ifndef _WIN32
+    ::chmod(path.c_str(), 0444);
+#else
+    (void)path;
+#endif
+}
+
+MergeCache::MergeCache(const std::string &directory)
+    : directory(directory), maxBytes(kDefaultMaxBytes), lastSave(std::chrono::steady_clock::now())
+{
+    createDirectory(directory);
+    std::lock_guard<std::mutex> lock(mutex);
+    FileLock indexLock;
+    lockIndex(indexLock);
+    load();
+    size_t count = entries.size();
+    evict();
+    if (entries.size() != count)
+    {
+        save();
+    }
+}
+
+MergeCache::~MergeCache()
+{
+    // 保存尚未写入的命中顺序
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!touchedKeys.empty())
+    {
+        FileLock indexLock;
+        lockIndex(indexLock);
+        reload();
+        save();
+    }
+}
+
+MergeCache &MergeCache::forDirectory(const std::string &directory)
+{
+    static std::mutex registryMutex;
+    static std::map<std::string, std::unique_ptr<MergeCache>> registry;
+
+    std::lock_guard<std::mutex> lock(registryMutex);
+    std::unique_ptr<MergeCache> &cache = registry[directory];
+    if (!cache)
+    {
+        cache.reset(new MergeCache(directory));
+    }
+    return *cache;
+}
+
+bool MergeCache::makeKey(const std::vector<std::string> &inputPaths, const std::string &optionsKey, std::string &key)
+{
+    key.clear();
+    for (const auto &path : inputPaths)
+    {
+        std::string fingerprint;
+        if (!fingerprintFile(path, fingerprint))
+        {
+            return false;
+        }
+        key += fingerprint + "-";
+    }
+    key += toHex(crc32cUpdate(0, optionsKey.data(), optionsKey.size()), 8);
+    return true;
+}
+
+bool MergeCache::fetch(const std::string &key, const std::vector<std::string> &inputPaths,
+                       const std::string &outputPath, bool verifyInputs, CloneMethod &method)
+{
+    method = CloneMethod::Failed;
+    Entry entry;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        // 其他进程可能加入了条目
+        refresh();
+        auto found = index.find(key);
+        if (found == index.end())
+        {
+            misses++;
+            return false;
+        }
+        entry = *found->second;
+    }
+
+    // 输入核对和文件复制不持有锁
+    bool valid = true;
+    if (verifyInputs && entry.inputChecksums.size() == inputPaths.size())
+    {
+        for (size_t i = 0; i < inputPaths.size() && valid; i++)
+        {
+            uint32_t crc = 0;
+            valid = checksumFile(inputPaths[i], crc) && crc == entry.inputChecksums[i];
+        }
+    }
+    if (valid)
+    {
+        method = cloneFile(filePath(entry.fileName), outputPath, true);
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (method == CloneMethod::Failed)
+    {
+        // 输入与记录不符或缓存文件已丢失；期间其他进程可能已替换该条目，替换后的不删除
+        FileLock indexLock;
+        lockIndex(indexLock);
+        reload();
+        auto found = index.find(key);
+        if (found != index.end() && found->second->fileName == entry.fileName &&
+            found->second->size == entry.size && found->second->inputChecksums == entry.inputChecksums)
+        {
+            erase(found->second);
+            save();
+        }
+        misses++;
+        return false;
+    }
+    auto found = index.find(key);
+    if (found != index.end())
+    {
+        entries.splice(entries.begin(), entries, found->second);
+    }
+    touchedKeys.push_back(key);
+    if (std::chrono::steady_clock::now() - lastSave >= kTouchSaveInterval)
+    {
+        FileLock indexLock;
+        lockIndex(indexLock);
+        reload();
+        save();
+    }
+    hits++;
+    return true;
+}
+
+bool MergeCache::store(const std::string &key, const std::string &outputPath,
+                       const std::vector<uint32_t> &inputChecksums)
+{
+    // 保留输出的扩展名，便于直接查看缓存目录
+    std::string extension;
+    size_t dot = outputPath.find_last_of('.');
+    size_t separator = outputPath.find_last_of("/\\");
+    if (dot != std::string::npos && (separator == std::string::npos || dot > separator))
+    {
+        extension = outputPath.substr(dot);
+    }
+    std::string fileName = key + extension;
+    // 临时文件名带进程号，多个进程同时加入同一条目时互不干扰
+    std::string temporary = filePath(fileName + "." + uniqueFileSuffix() + ".tmp");
+
+    // 缓存是长期保存的一份，不与输出硬链接
+    if (cloneFile(outputPath, temporary, false) == CloneMethod::Failed)
+    {
+        return false;
+    }
+    int64_t size = 0;
+    int64_t modifiedTime = 0;
+    if (!ProbeCache::statFile(temporary, size, modifiedTime))
+    {
+        removeFile(temporary);
+        return false;
+    }
+    setReadOnly(temporary);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    FileLock indexLock;
+    lockIndex(indexLock);
+    reload();
+    if (!renameFile(temporary, filePath(fileName)))
+    {
+        removeFile(temporary);
+        return false;
+    }
+    auto found = index.find(key);
+    if (found != index.end())
+    {
+        // 文件已被替换，只移除旧条目
+        totalBytes -= found->second->size;
+        entries.erase(found->second);
+        index.erase(found);
+    }
+
+    Entry entry;
+    entry.key = key;
+    entry.fileName = fileName;
+    entry.size = size;
+    entry.inputChecksums = inputChecksums;
+    entries.push_front(std::move(entry));
+    index[key] = entries.begin();
+    totalBytes += size;
+    evict();
+    save();
+    return true;
+}
+
+void MergeCache::clear()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    FileLock indexLock;
+    lockIndex(indexLock);
+    reload();
+    while (!entries.empty())
+    {
+        erase(std::prev(entries.end()));
+    }
+    hits = 0;
+    misses = 0;
+    save();
+}
+
+void MergeCache::setMaxBytes(int64_t maxBytes)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (this->maxBytes == maxBytes)
+    {
+        return;
+    }
+    this->maxBytes = maxBytes;
+    FileLock indexLock;
+    lockIndex(indexLock);
+    reload();
+    size_t count = entries.size();
+    evict();
+    if (entries.size() != count)
+    {
+        save();
+    }
+}
+
+int64_t MergeCache::getMaxBytes() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return maxBytes;
+}
+
+int64_t MergeCache::getTotalBytes() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return totalBytes;
+}
+
+size_t MergeCache::getSize() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return entries.size();
+}
+
+int64_t MergeCache::getHits() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return hits;
+}
+
+int64_t MergeCache::getMisses() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return misses;
+}
+
+std::string MergeCache::filePath(const std::string &fileName) const
+{
+    if (directory.empty() || directory.back() == '/' || directory.back() == '\\')
+    {
+        return directory + fileName;
+    }
+    return directory + "/" + fileName;
+}
+
+void MergeCache::lockIndex(FileLock &indexLock) const
+{
+    // 无法加锁（如目录只读）时照常读写，保存同样会失败
+    indexLock.lock(filePath(kIndexLockFileName), true);
+}
+
+void MergeCache::load()
+{
+    // 先记录再读取：读取期间被其他进程改写时下次refresh会重新读取
+    std::string path = filePath(kIndexFileName);
+    if (!ProbeCache::statFile(path, indexSize, indexModifiedTime))
+    {
+        indexSize = -1;
+        indexModifiedTime = -1;
+    }
+    // 每行：键、文件名、字节数、各输入的CRC32C（逗号分隔，未知时为-），按最近使用顺序排列
+    std::ifstream file(path);
+    std::string line;
+    while (std::getline(file, line))
+    {
+        std::istringstream fields(line);
+        Entry entry;
+        std::string checksums;
+        if (!std::getline(fields, entry.key, '\t') || !std::getline(fields, entry.fileName, '\t') ||
+            !(fields >> entry.size) || index.count(entry.key))
+        {
+            continue;
+        }
+        fields >> checksums;
+        if (checksums != "-")
+        {
+            std::istringstream values(checksums);
+            std::string value;
+            while (std::getline(values, value, ','))
+            {
+                entry.inputChecksums.push_back((uint32_t)std::strtoul(value.c_str(), nullptr, 16));
+            }
+        }
+
+        // 跳过已被删除或改动的文件
+        int64_t size = 0;
+        int64_t modifiedTime = 0;
+        if (!ProbeCache::statFile(filePath(entry.fileName), size, modifiedTime) || size != entry.size)
+        {
+            continue;
+        }
+        totalBytes += entry.size;
+        entries.push_back(std::move(entry));
+        index[entries.back().key] = std::prev(entries.end());
+    }
+}
+
+void MergeCache::reload()
+{
+    entries.clear();
+    index.clear();
+    totalBytes = 0;
+    load();
+    for (const auto &key : touchedKeys)
+    {
+        auto found = index.find(key);
+        if (found != index.end())
+        {
+            entries.splice(entries.begin(), entries, found->second);
+        }
+    }
+}
+
+void MergeCache::refresh()
+{
+    int64_t size = -1;
+    int64_t modifiedTime = -1;
+    if (!ProbeCache::statFile(filePath(kIndexFileName), size, modifiedTime))
+    {
+        size = -1;
+        modifiedTime = -1;
+    }
+    if (size != indexSize || modifiedTime != indexModifiedTime)
+    {
+        reload();
+    }
+}
+
+void MergeCache::save()
+{
+    lastSave = std::chrono::steady_clock::now();
+    std::string path = filePath(kIndexFileName);
+    std::string temporary = path + ".tmp";
+    {
+        std::ofstream file(temporary, std::ios::trunc);
+        for (const auto &entry : entries)
+        {
+            file << entry.key << '\t' << entry.fileName << '\t' << entry.size << '\t';
+            if (entry.inputChecksums.empty())
+            {
+                file << '-';
+            }
+            for (size_t i = 0; i < entry.inputChecksums.size(); i++)
+            {
+                file << (i > 0 ? "," : "") << toHex(entry.inputChecksums[i], 8);
+            }
+            file << '\n';
+        }
+        if (!file)
+        {
+            return;
+        }
+    }
+    if (!renameFile(temporary, path))
+    {
+        return;
+    }
+    touchedKeys.clear();
+    if (!ProbeCache::statFile(path, indexSize, indexModifiedTime))
+    {
+        indexSize = -1;
+        indexModifiedTime = -1;
+    }
+}
+
+void MergeCache::erase(std::list<Entry>::iterator entry)
+{
+    removeFile(filePath(entry->fileName));
+    totalBytes -= entry->size;
+    index.erase(entry->key);
+    entries.erase(entry);
+}
+
+void MergeCache::evict()
+{
+    while (!entries.empty() && totalBytes > maxBytes)
+    {
+        erase(std::prev(entries.end()));
+    }
+}
@@ -0,0 +1,118 @@
+#ifndef MERGE_CACHE_H
+#define MERGE_CACHE_H
+
+#include <chrono>
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "FileClone.h"
+
+/**
+ * 合并结果的磁盘缓存
+ * 以各输入的快速指纹（大小和若干采样块的CRC32C）加上影响输出的合并选项为键，
+ * 命中时把缓存的输出以写时复制（不支持时硬链接或复制）放到输出路径，不再合并。
+ * 条目记录合并时顺带计算的输入完整CRC32C，核对模式下命中前先只读核对输入。
+ * 按总大小以最近使用顺序淘汰；索引保存在缓存目录的index.tsv中，同一目录在进程内共享一个实例。
+ * 多个进程可共用一个缓存目录：修改索引时持有锁文件index.tsv.lock，先重新读取索引再修改和保存；
+ * 命中只改变使用顺序，合并到下一次保存，至多每隔几秒写一次索引
+ */
+class MergeCache
+{
+public:
+    explicit MergeCache(const std::string &directory);
+
+    ~MergeCache();
+
+    MergeCache(const MergeCache &) = delete;
+    MergeCache &operator=(const MergeCache &) = delete;
+
+    /**
+     * 取得目录对应的缓存实例，首次使用时创建目录并读取索引
+     */
+    static MergeCache &forDirectory(const std::string &directory);
+
+    /**
+     * 由输入的快速指纹和合并选项计算缓存键
+     * 指纹只读取每个输入开头、结尾和均匀分布的若干小块，与文件大小无关
+     * @param inputPaths 输入文件路径
+     * @param optionsKey 影响输出内容的合并选项
+     * @param key 输出的缓存键（可用作文件名）
+     * @return 输入无法读取时返回false
+     */
+    static bool makeKey(const std::vector<std::string> &inputPaths, const std::string &optionsKey, std::string &key);
+
+    /**
+     * 查找缓存并把缓存的输出放到outputPath
+     * @param key 缓存键
+     * @param inputPaths 输入文件路径（核对时使用）
+     * @param outputPath 输出文件路径
+     * @param verifyInputs 条目记录了输入的完整CRC32C时先读取输入核对，不一致时删除条目
+     * @param method 命中时输出所用的复制方式
+     * @return 是否命中
+     */
+    bool fetch(const std::string &key, const std::vector<std::string> &inputPaths, const std::string &outputPath,
+               bool verifyInputs, CloneMethod &method);
+
+    /**
+     * 把合并输出加入缓存，超出总大小时淘汰最久未使用的条目
+     * @param key 缓存键
+     * @param outputPath 合并输出
+     * @param inputChecksums 合并时顺带计算的各输入完整CRC32C，未知时为空
+     * @return 成功返回true
+     */
+    bool store(const std::string &key, const std::string &outputPath, const std::vector<uint32_t> &inputChecksums);
+
+    /**
+     * 删除所有缓存的输出
+     */
+    void clear();
+
+    void setMaxBytes(int64_t maxBytes);
+
+    int64_t getMaxBytes() const;
+    int64_t getTotalBytes() const;
+    size_t getSize() const;
+    int64_t getHits() const;
+    int64_t getMisses() const;
+
+private:
+    struct Entry
+    {
+        std::string key;
+        // 缓存目录中的文件名
+        std::string fileName;
+        int64_t size = 0;
+        std::vector<uint32_t> inputChecksums;
+    };
+
+    std::string directory;
+    int64_t maxBytes;
+    int64_t totalBytes = 0;
+    // 头部为最近使用
+    std::list<Entry> entries;
+    std::unordered_map<std::string, std::list<Entry>::iterator> index;
+    int64_t hits = 0;
+    int64_t misses = 0;
+    // 上次读取或保存后索引文件的大小和修改时间，不同时说明其他进程修改过
+    int64_t indexSize = -1;
+    int64_t indexModifiedTime = -1;
+    // 上次保存后命中的条目（按命中顺序），重新读取索引后移到头部
+    std::vector<std::string> touchedKeys;
+    std::chrono::steady_clock::time_point lastSave;
+    mutable std::mutex mutex;
+
+    std::string filePath(const std::string &fileName) const;
+    // 以下函数调用时需持有mutex；修改索引前还需持有锁文件并调用reload
+    void lockIndex(FileLock &indexLock) const;
+    void load();
+    void reload();
+    void refresh();
+    void save();
+    void erase(std::list<Entry>::iterator entry);
+    void evict();
+};
+
+#endif // MERGE_CACHE_H
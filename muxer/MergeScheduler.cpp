@@ -0,0 +1,365 @@
+#include "MergeScheduler.h"
+#include <algorithm>
+
+// 开销模型：流复制受I/O限制，转码受编码速度限制（按像素数和时长估计）
+static const double copyBytesPerSecond = 400.0 * 1024 * 1024;
+static const double transcodePixelsPerSecond = 60.0 * 1920 * 1080;
+
+// 内存模型：流复制只有交织缓冲，转码还需要解码/编码的帧队列
+static const int64_t copyMemoryBytes = 32LL * 1024 * 1024;
+static const int64_t transcodeFramesInFlight = 48;
+
+MergeScheduler::MergeScheduler(const SchedulerLimits &limits)
+    : limits(limits)
+{
+    int threads = limits.workerThreads > 0 ? limits.workerThreads
+                                           : (int)std::max(1u, std::thread::hardware_concurrency());
+    for (int i = 0; i < threads; i++)
+    {
+        workers.emplace_back(&MergeScheduler::workerLoop, this);
+    }
+}
+
+MergeScheduler::~MergeScheduler()
+{
+    std::vector<QueuedJob> cancelled;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+        cancelled.swap(pending);
+        for (const auto &queued : cancelled)
+        {
+            finishResult(queued.id, false, "Scheduler shut down before the job started");
+            failedJobs++;
+        }
+    }
+    jobAvailable.notify_all();
+    jobFinished.notify_all();
+
+    for (auto &worker : workers)
+    {
+        worker.join();
+    }
+
+    for (const auto &queued : cancelled)
+    {
+        if (queued.job.onComplete)
+        {
+            queued.job.onComplete(queued.id, false, "Scheduler shut down before the job started", MergeStats());
+        }
+    }
+}
+
+int64_t MergeScheduler::submit(const MergeJob &job)
+{
+    QueuedJob queued;
+    queued.job = job;
+    queued.submitTime = Clock::now();
+    queued.hasDeadline = job.deadlineSeconds > 0;
+    queued.deadline = queued.submitTime + std::chrono::duration_cast<Clock::duration>(
+                                              std::chrono::duration<double>(std::max(0.0, job.deadlineSeconds)));
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        queued.id = nextJobId++;
+        results[queued.id] = JobResult();
+        if (stopping)
+        {
+            finishResult(queued.id, false, "Scheduler is shutting down");
+            failedJobs++;
+            return queued.id;
+        }
+        pending.push_back(queued);
+    }
+    jobAvailable.notify_one();
+    return queued.id;
+}
+
+void MergeScheduler::applyEstimate(QueuedJob &queued, const MergeEstimate &estimate)
+{
+    const MergeJob &job = queued.job;
+    queued.transcode = estimate.transcodeStreams > 0;
+    double pixels = (double)std::max(1, estimate.maxWidth) * std::max(1, estimate.maxHeight);
+    queued.estimatedCost = queued.transcode
+                               ? estimate.durationSeconds * pixels * 30.0 / transcodePixelsPerSecond
+                               : estimate.inputBytes / copyBytesPerSecond;
+
+    if (queued.job.memoryBytes <= 0)
+    {
+        queued.job.memoryBytes = copyMemoryBytes;
+        if (queued.transcode)
+        {
+            queued.job.memoryBytes += (int64_t)(pixels * 1.5) * transcodeFramesInFlight;
+        }
+    }
+
+    // 两个输入加一个输出；分段模式下每段各自打开
+    int segments = std::max(1, job.options.parallelSegments);
+    queued.openFiles = 3 * segments;
+    if (segments > 1)
+    {
+        queued.job.memoryBytes *= segments;
+    }
+}
+
+bool MergeScheduler::wait(int64_t jobId, std::string *error)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    auto it = results.find(jobId);
+    if (it == results.end())
+    {
+        if (error)
+            *error = "Unknown job id";
+        return false;
+    }
+
+    // map的迭代器在增删其他元素时保持有效，有等待者的记录不会被删除
+    JobResult &result = it->second;
+    result.waiters++;
+    jobFinished.wait(lock, [&]() { return result.finished; });
+    result.waiters--;
+
+    bool success = result.success;
+    if (error)
+        *error = result.error;
+    // 结果交给所有同时等待的调用者后才释放
+    if (result.waiters == 0)
+        results.erase(it);
+    return success;
+}
+
+bool MergeScheduler::cancel(int64_t jobId)
+{
+    QueuedJob cancelled;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto running = runningMergers.find(jobId);
+        if (running != runningMergers.end())
+        {
+            running->second->cancel();
+            return true;
+        }
+
+        auto it = std::find_if(pending.begin(), pending.end(),
+                               [jobId](const QueuedJob &queued) { return queued.id == jobId; });
+        if (it == pending.end())
+        {
+            return false;
+        }
+        cancelled = std::move(*it);
+        pending.erase(it);
+
+        finishResult(jobId, false, "Merge cancelled");
+        failedJobs++;
+    }
+    jobFinished.notify_all();
+
+    if (cancelled.job.onComplete)
+    {
+        cancelled.job.onComplete(jobId, false, "Merge cancelled", MergeStats());
+    }
+    return true;
+}
+
+void MergeScheduler::waitAll()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    // 不固定结果：之后仍可逐个等待，但只保留最近结束的limits.retainedResults个
+    jobFinished.wait(lock, [&]() { return pending.empty() && runningJobs == 0; });
+}
+
+void MergeScheduler::finishResult(int64_t jobId, bool success, const std::string &error)
+{
+    JobResult &result = results[jobId];
+    result.finished = true;
+    result.success = success;
+    result.error = error;
+    if (limits.retainedResults == 0)
+        return;
+
+    // 只用onComplete或waitAll()的调用者从不wait()，不限制时结果会一直累积
+    finishedOrder.push_back(jobId);
+    while (finishedOrder.size() > limits.retainedResults)
+    {
+        auto it = results.find(finishedOrder.front());
+        finishedOrder.pop_front();
+        if (it != results.end() && it->second.waiters == 0)
+            results.erase(it);
+    }
+}
+
+SchedulerMetrics MergeScheduler::getMetrics() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    SchedulerMetrics metrics;
+    metrics.queueDepth = pending.size();
+    metrics.runningJobs = runningJobs;
+    metrics.runningTranscodes = runningTranscodes;
+    metrics.completedJobs = completedJobs;
+    metrics.failedJobs = failedJobs;
+    metrics.deadlineMisses = deadlineMisses;
+    metrics.memoryInUse = memoryInUse;
+    metrics.openFilesInUse = openFilesInUse;
+    metrics.averageWaitSeconds = startedJobs > 0 ? totalWaitSeconds / startedJobs : 0.0;
+    metrics.maxWaitSeconds = maxWaitSeconds;
+    return metrics;
+}
+
+bool MergeScheduler::runsBefore(const QueuedJob &a, const QueuedJob &b)
+{
+    if (a.job.priority != b.job.priority)
+        return a.job.priority > b.job.priority;
+    if (a.hasDeadline != b.hasDeadline)
+        return a.hasDeadline;
+    if (a.hasDeadline && a.deadline != b.deadline)
+        return a.deadline < b.deadline;
+    if (a.estimatedCost != b.estimatedCost)
+        return a.estimatedCost < b.estimatedCost;
+    return a.id < b.id;
+}
+
+bool MergeScheduler::fitsLimits(const QueuedJob &job) const
+{
+    // 没有运行中的任务时总是放行，避免超出上限的单个任务永远无法执行
+    if (runningJobs == 0)
+        return true;
+
+    if (job.transcode && limits.maxConcurrentTranscodes > 0 &&
+        (int)runningTranscodes >= limits.maxConcurrentTranscodes)
+        return false;
+    if (limits.maxMemoryBytes > 0 && memoryInUse + job.job.memoryBytes > limits.maxMemoryBytes)
+        return false;
+    if (limits.maxOpenFiles > 0 && openFilesInUse + job.openFiles > limits.maxOpenFiles)
+        return false;
+    return true;
+}
+
+int MergeScheduler::selectNextJob() const
+{
+    int selected = -1;
+    for (size_t i = 0; i < pending.size(); i++)
+    {
+        // 未探测的任务先交给工作线程探测，正在探测的任务暂不参与调度
+        if (!pending[i].probed)
+        {
+            if (!pending[i].probing)
+                return (int)i;
+            continue;
+        }
+        // 探测失败的任务不占资源，立即交给工作线程报告失败
+        if (!pending[i].probeError.empty())
+            return (int)i;
+        if (!fitsLimits(pending[i]))
+            continue;
+        if (selected < 0 || runsBefore(pending[i], pending[selected]))
+            selected = (int)i;
+    }
+    return selected;
+}
+
+void MergeScheduler::workerLoop()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true)
+    {
+        int index = -1;
+        jobAvailable.wait(lock, [&]() {
+            if (stopping)
+                return true;
+            index = selectNextJob();
+            return index >= 0;
+        });
+        if (stopping)
+            return;
+
+        if (!pending[index].probed)
+        {
+            // 只读取文件头，判断是流复制还是转码；不持有锁，其他工作线程可同时探测或调度
+            pending[index].probing = true;
+            int64_t id = pending[index].id;
+            MergeJob job = pending[index].job;
+            lock.unlock();
+
+            MergeEstimate estimate;
+            AudioVideoMerger prober;
+            std::string probeError;
+            if (!prober.estimate(job.videoPath, job.audioPath, job.outputPath, job.options, estimate))
+                probeError = prober.getLastError();
+
+            lock.lock();
+            // 探测期间任务可能已被取消
+            auto it = std::find_if(pending.begin(), pending.end(),
+                                   [id](const QueuedJob &queued) { return queued.id == id; });
+            if (it != pending.end())
+            {
+                applyEstimate(*it, estimate);
+                it->probeError = probeError;
+                it->probed = true;
+                it->probing = false;
+            }
+            jobAvailable.notify_all();
+            continue;
+        }
+
+        QueuedJob queued = std::move(pending[index]);
+        pending.erase(pending.begin() + index);
+
+        bool reserve = queued.probeError.empty();
+        runningJobs++;
+        if (reserve)
+        {
+            if (queued.transcode)
+                runningTranscodes++;
+            memoryInUse += queued.job.memoryBytes;
+            openFilesInUse += queued.openFiles;
+        }
+
+        Clock::time_point startTime = Clock::now();
+        double waitSeconds = std::chrono::duration<double>(startTime - queued.submitTime).count();
+        totalWaitSeconds += waitSeconds;
+        maxWaitSeconds = std::max(maxWaitSeconds, waitSeconds);
+        startedJobs++;
+
+        AudioVideoMerger merger;
+        runningMergers[queued.id] = &merger;
+        lock.unlock();
+
+        bool success = false;
+        std::string error = queued.probeError;
+        if (reserve)
+        {
+            success = merger.merge(queued.job.videoPath, queued.job.audioPath, queued.job.outputPath,
+                                   queued.job.options);
+            if (!success)
+                error = merger.getLastError();
+        }
+
+        if (queued.job.onComplete)
+        {
+            queued.job.onComplete(queued.id, success, error, merger.getLastStats());
+        }
+
+        lock.lock();
+        runningMergers.erase(queued.id);
+        runningJobs--;
+        if (reserve)
+        {
+            if (queued.transcode)
+                runningTranscodes--;
+            memoryInUse -= queued.job.memoryBytes;
+            openFilesInUse -= queued.openFiles;
+        }
+        if (success)
+            completedJobs++;
+        else
+            failedJobs++;
+        if (queued.hasDeadline && Clock::now() > queued.deadline)
+            deadlineMisses++;
+
+        finishResult(queued.id, success, error);
+
+        // 释放的资源可能让其他等待中的任务满足上限
+        jobAvailable.notify_all();
+        jobFinished.notify_all();
+    }
+}
@@ -0,0 +1,199 @@
+#ifndef MERGE_SCHEDULER_H
+#define MERGE_SCHEDULER_H
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "AudioVideoMerger.h"
+
+/**
+ * 合并任务描述
+ */
+struct MergeJob
+{
+    std::string videoPath;
+    std::string audioPath;
+    std::string outputPath;
+    MergeOptions options;
+    // 优先级，数值越大越先执行
+    int priority = 0;
+    // 截止时间（秒，相对于提交时刻），小于等于0表示没有截止时间
+    double deadlineSeconds = 0.0;
+    // 预计内存占用（字节），为0时根据探测结果估算
+    int64_t memoryBytes = 0;
+    // 任务结束后在工作线程中调用，stats为该任务的合并统计（未执行的任务为空统计）
+    std::function<void(int64_t jobId, bool success, const std::string &error, const MergeStats &stats)> onComplete;
+};
+
+/**
+ * 调度器全局资源上限，0表示不限制
+ */
+struct SchedulerLimits
+{
+    // 工作线程数，0表示使用CPU核数
+    int workerThreads = 0;
+    // 同时进行的转码任务数
+    int maxConcurrentTranscodes = 1;
+    // 所有运行中任务的预计内存总和（字节）
+    int64_t maxMemoryBytes = 0;
+    // 所有运行中任务打开的文件句柄总数
+    int maxOpenFiles = 0;
+    // 保留的已结束且未被wait()取走的任务结果数，超出时丢弃最早结束的
+    size_t retainedResults = 1024;
+};
+
+/**
+ * 调度器运行指标
+ */
+struct SchedulerMetrics
+{
+    size_t queueDepth = 0;
+    size_t runningJobs = 0;
+    size_t runningTranscodes = 0;
+    size_t completedJobs = 0;
+    size_t failedJobs = 0;
+    size_t deadlineMisses = 0;
+    int64_t memoryInUse = 0;
+    int openFilesInUse = 0;
+    // 从提交到开始执行的等待时间（秒）
+    double averageWaitSeconds = 0.0;
+    double maxWaitSeconds = 0.0;
+};
+
+/**
+ * 合并任务调度器
+ * 按优先级、截止时间和预计开销（流复制远低于转码）选择下一个任务，
+ * 同时限制并发转码数、内存和文件句柄，使短的交互任务不必排在长转码之后
+ */
+class MergeScheduler
+{
+public:
+    explicit MergeScheduler(const SchedulerLimits &limits = SchedulerLimits());
+
+    /**
+     * 停止接收任务，取消尚未开始的任务并等待运行中的任务结束
+     */
+    ~MergeScheduler();
+
+    /**
+     * 提交任务，立即返回；工作线程先探测输入以估计开销，探测完成后任务才参与调度
+     * @param job 任务描述
+     * @return 任务ID，探测失败的任务同样会返回ID并以失败结束
+     */
+    int64_t submit(const MergeJob &job);
+
+    /**
+     * 等待任务结束；结果交给（所有同时等待的）调用者后释放，之后再等待同一任务返回false。
+     * 没人取走的结果只保留最近结束的limits.retainedResults个，更早的同样返回false
+     * @param jobId 任务ID
+     * @param error 失败时的错误信息，可为nullptr
+     * @return 任务是否成功
+     */
+    bool wait(int64_t jobId, std::string *error = nullptr);
+
+    /**
+     * 取消任务：排队中的任务直接移除，运行中的任务中断其读写
+     * @param jobId 任务ID
+     * @return 任务存在且尚未结束返回true
+     */
+    bool cancel(int64_t jobId);
+
+    /**
+     * 等待所有已提交的任务结束，任务的结果按limits.retainedResults保留
+     */
+    void waitAll();
+
+    /**
+     * 获取调度器运行指标
+     */
+    SchedulerMetrics getMetrics() const;
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    struct QueuedJob
+    {
+        int64_t id;
+        MergeJob job;
+        bool transcode;
+        // 预计开销（秒级的相对值），用于同优先级内短任务优先
+        double estimatedCost;
+        int openFiles;
+        Clock::time_point submitTime;
+        Clock::time_point deadline;
+        bool hasDeadline;
+        // 是否已探测输入（开销、资源估计有效），以及是否有工作线程正在探测
+        bool probed = false;
+        bool probing = false;
+        std::string probeError;
+    };
+
+    struct JobResult
+    {
+        bool finished = false;
+        bool success = false;
+        std::string error;
+        // 正在wait()中等待该任务的调用者数量
+        int waiters = 0;
+    };
+
+    SchedulerLimits limits;
+    std::vector<std::thread> workers;
+    std::vector<QueuedJob> pending;
+    std::map<int64_t, JobResult> results;
+    // 按结束顺序排列的任务ID，用于限制保留的结果数
+    std::deque<int64_t> finishedOrder;
+    // 运行中任务的合并器，用于取消
+    std::map<int64_t, AudioVideoMerger *> runningMergers;
+
+    mutable std::mutex mutex;
+    std::condition_variable jobAvailable;
+    std::condition_variable jobFinished;
+
+    int64_t nextJobId = 1;
+    bool stopping = false;
+
+    size_t runningJobs = 0;
+    size_t runningTranscodes = 0;
+    int64_t memoryInUse = 0;
+    int openFilesInUse = 0;
+    size_t completedJobs = 0;
+    size_t failedJobs = 0;
+    size_t deadlineMisses = 0;
+    size_t startedJobs = 0;
+    double totalWaitSeconds = 0.0;
+    double maxWaitSeconds = 0.0;
+
+    void workerLoop();
+
+    /**
+     * 由探测结果估计任务的开销、内存和文件句柄
+     */
+    static void applyEstimate(QueuedJob &queued, const MergeEstimate &estimate);
+
+    /**
+     * 在持有锁时选出下一个满足资源上限的任务
+     * @return pending中的下标，没有可运行任务时返回-1
+     */
+    int selectNextJob() const;
+
+    /**
+     * 判断a是否应排在b之前
+     */
+    static bool runsBefore(const QueuedJob &a, const QueuedJob &b);
+
+    bool fitsLimits(const QueuedJob &job) const;
+
+    /**
+     * 在持有锁时记录任务结果，并丢弃超出保留数量的最早结果（有等待者的由wait()释放）
+     */
+    void finishResult(int64_t jobId, bool success, const std::string &error);
+};
+
+#endif // MERGE_SCHEDULER_H
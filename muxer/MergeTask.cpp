@@ -0,0 +1,79 @@
+#include "MergeTask.h"
+#include <chrono>
+
+std::shared_ptr<MergeTask> MergeTask::start(const std::string &videoPath, const std::string &audioPath,
+                                            const std::string &outputPath, const MergeOptions &options,
+                                            AudioVideoMerger::ProgressCallback progressCallback,
+                                            double progressIntervalSeconds,
+                                            CompletionCallback completionCallback,
+                                            std::shared_ptr<PacketTap> packetTap)
+{
+    std::shared_ptr<MergeTask> task(new MergeTask());
+    MergeTask *self = task.get();
+
+    self->merger.setProgressCallback(
+        [self, progressCallback](double value) {
+            self->progress = value;
+            if (progressCallback)
+            {
+                progressCallback(value);
+            }
+        },
+        progressIntervalSeconds);
+    self->merger.setPacketTap(std::move(packetTap));
+
+    std::promise<bool> promise;
+    self->result = promise.get_future().share();
+
+    // 线程只访问任务自身，句柄析构时会先join，因此无需延长生命周期
+    self->worker = std::thread(
+        [self, videoPath, audioPath, outputPath, options, completionCallback](std::promise<bool> promise) {
+            bool success = self->merger.merge(videoPath, audioPath, outputPath, options);
+            std::string error = self->merger.getLastError();
+            promise.set_value(success);
+            if (completionCallback)
+            {
+                completionCallback(success, error);
+            }
+        },
+        std::move(promise));
+
+    return task;
+}
+
+MergeTask::~MergeTask()
+{
+    if (worker.joinable())
+    {
+        if (!isDone())
+        {
+            merger.cancel();
+        }
+        worker.join();
+    }
+}
+
+bool MergeTask::isDone() const
+{
+    return result.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+}
+
+bool MergeTask::wait()
+{
+    return result.get();
+}
+
+bool MergeTask::waitFor(double timeoutSeconds)
+{
+    return result.wait_for(std::chrono::duration<double>(timeoutSeconds)) == std::future_status::ready;
+}
+
+std::string MergeTask::getLastError() const
+{
+    // 结束前错误信息仍可能被合并线程修改
+    if (!isDone())
+    {
+        return std::string();
+    }
+    return merger.getLastError();
+}
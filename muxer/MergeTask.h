@@ -0,0 +1,93 @@
+#ifndef MERGE_TASK_H
+#define MERGE_TASK_H
+
+#include <atomic>
+#include <functional>
+#include <future>
+#include <memory>
+#include <string>
+#include <thread>
+#include "AudioVideoMerger.h"
+
+/**
+ * 异步合并任务句柄
+ * 在独立线程中执行合并，可查询进度、等待结果或取消；
+ * 句柄析构时会取消尚未完成的合并并等待线程退出
+ */
+class MergeTask
+{
+public:
+    /**
+     * 合并结束回调（在合并线程中调用），参数为是否成功和错误信息
+     */
+    typedef std::function<void(bool success, const std::string &error)> CompletionCallback;
+
+    /**
+     * 启动异步合并
+     * @param videoPath 视频文件路径
+     * @param audioPath 音频文件路径
+     * @param outputPath 输出文件路径
+     * @param options 合并选项
+     * @param progressCallback 进度回调，可为空
+     * @param progressIntervalSeconds 进度回调的最小间隔（秒）
+     * @param completionCallback 结束回调，可为空
+     * @param packetTap 写出数据包的分接（见AudioVideoMerger::setPacketTap），可为空
+     * @return 任务句柄
+     */
+    static std::shared_ptr<MergeTask> start(const std::string &videoPath, const std::string &audioPath,
+                                            const std::string &outputPath, const MergeOptions &options = MergeOptions(),
+                                            AudioVideoMerger::ProgressCallback progressCallback = nullptr,
+                                            double progressIntervalSeconds = 0.5,
+                                            CompletionCallback completionCallback = nullptr,
+                                            std::shared_ptr<PacketTap> packetTap = nullptr);
+
+    ~MergeTask();
+
+    /**
+     * 请求取消，阻塞中的读写会被中断
+     */
+    void cancel() { merger.cancel(); }
+
+    /**
+     * 是否已结束（成功、失败或已取消）
+     */
+    bool isDone() const;
+
+    /**
+     * 等待合并结束
+     * @return 是否合并成功
+     */
+    bool wait();
+
+    /**
+     * 最多等待指定时间
+     * @param timeoutSeconds 超时时间（秒）
+     * @return 在超时前结束返回true
+     */
+    bool waitFor(double timeoutSeconds);
+
+    /**
+     * 合并结果的future，可与其他异步代码组合
+     */
+    std::shared_future<bool> getFuture() const { return result; }
+
+    /**
+     * 最近一次报告的进度（0~1）
+     */
+    double getProgress() const { return progress; }
+
+    /**
+     * 获取错误信息，仅在结束后有效
+     */
+    std::string getLastError() const;
+
+private:
+    MergeTask() = default;
+
+    AudioVideoMerger merger;
+    std::thread worker;
+    std::shared_future<bool> result;
+    std::atomic<double> progress{0.0};
+};
+
+#endif // MERGE_TASK_H
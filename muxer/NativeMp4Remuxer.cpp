@@ -0,0 +1,1121 @@
+#include "NativeMp4Remuxer.h"
+#include <algorithm>
+#include <climits>
+
+// 各盒子内容的读取上限
+static const size_t kSmallBoxLimit = 256;
+static const size_t kStsdLimit = 64 * 1024;
+static const size_t kElstLimit = 64 * 1024;
+static const size_t kMoofLimit = 64 * 1024 * 1024;
+// 复制样本数据时单次读写的最大字节数
+static const size_t kCopyBlockSize = 4 * 1024 * 1024;
+// 输出的电影时间刻度（毫秒）
+static const uint32_t kMovieTimescale = 1000;
+
+// 样本标志：非同步样本或依赖其他样本时不是关键帧（与libavformat的判断一致）
+static const uint32_t kSampleNotKeyframe = 0x00010000 | 0x01000000;
+
+static const uint8_t kIdentityMatrix[36] = {0x00, 0x01, 0x00, 0x00, 0, 0, 0, 0, 0, 0, 0, 0,
+                                            0, 0, 0, 0, 0x00, 0x01, 0x00, 0x00, 0, 0, 0, 0,
+                                            0, 0, 0, 0, 0, 0, 0, 0, 0x40, 0x00, 0x00, 0x00};
+
+static void put16(std::vector<uint8_t> &out, uint32_t value)
+{
+    out.push_back((uint8_t)(value >> 8));
+    out.push_back((uint8_t)value);
+}
+
+static void put32(std::vector<uint8_t> &out, uint32_t value)
+{
+    out.push_back((uint8_t)(value >> 24));
+    out.push_back((uint8_t)(value >> 16));
+    out.push_back((uint8_t)(value >> 8));
+    out.push_back((uint8_t)value);
+}
+
+static void put64(std::vector<uint8_t> &out, uint64_t value)
+{
+    put32(out, (uint32_t)(value >> 32));
+    put32(out, (uint32_t)value);
+}
+
+static void putZeros(std::vector<uint8_t> &out, size_t count)
+{
+    out.insert(out.end(), count, 0);
+}
+
+/**
+ * 开始写一个盒子，返回盒子起始位置，由endBox回填长度
+ */
+static size_t beginBox(std::vector<uint8_t> &out, const char *type)
+{
+    size_t start = out.size();
+    put32(out, 0);
+    put32(out, boxType(type));
+    return start;
+}
+
+static size_t beginFullBox(std::vector<uint8_t> &out, const char *type, uint8_t version, uint32_t flags)
+{
+    size_t start = beginBox(out, type);
+    put32(out, ((uint32_t)version << 24) | (flags & 0xffffff));
+    return start;
+}
+
+static void patch32(std::vector<uint8_t> &out, size_t position, uint32_t value)
+{
+    out[position] = (uint8_t)(value >> 24);
+    out[position + 1] = (uint8_t)(value >> 16);
+    out[position + 2] = (uint8_t)(value >> 8);
+    out[position + 3] = (uint8_t)value;
+}
+
+static void endBox(std::vector<uint8_t> &out, size_t start)
+{
+    patch32(out, start, (uint32_t)(out.size() - start));
+}
+
+/**
+ * 读取整个盒子（含头部），用于原样复制到输出
+ */
+static bool readWholeBox(IsoBmffReader &reader, const BoxHeader &header, size_t maxBytes, std::vector<uint8_t> &box)
+{
+    if (header.size <= 0 || (uint64_t)header.size > maxBytes)
+    {
+        return false;
+    }
+    box.resize((size_t)header.size);
+    return reader.readAt(header.offset, box.data(), box.size());
+}
+
+/**
+ * 在不同时间刻度间换算（四舍五入）
+ */
+static uint64_t rescaleTime(uint64_t value, uint32_t from, uint32_t to)
+{
+    if (from == 0)
+    {
+        return 0;
+    }
+    return value / from * to + ((value % from) * to + from / 2) / from;
+}
+
+static bool isSupportedSampleEntry(uint32_t handler, uint32_t entry)
+{
+    if (handler == boxType("vide"))
+    {
+        return entry == boxType("avc1") || entry == boxType("avc3") || entry == boxType("hvc1") ||
+               entry == boxType("hev1");
+    }
+    if (handler == boxType("soun"))
+    {
+        return entry == boxType("mp4a");
+    }
+    return false;
+}
+
+int64_t NativeMp4Remuxer::getSampleCount(int track) const
+{
+    if (track < 0 || track >= (int)tracks.size())
+    {
+        return 0;
+    }
+    return (int64_t)tracks[track].samples.getSampleCount();
+}
+
+int64_t NativeMp4Remuxer::getSampleBytes(int track) const
+{
+    if (track < 0 || track >= (int)tracks.size())
+    {
+        return 0;
+    }
+    return tracks[track].sampleBytes;
+}
+
+int64_t NativeMp4Remuxer::getTotalSamples() const
+{
+    int64_t total = 0;
+    for (const auto &track : tracks)
+    {
+        total += (int64_t)track.samples.getSampleCount();
+    }
+    return total;
+}
+
+size_t NativeMp4Remuxer::getIndexBytes() const
+{
+    size_t total = 0;
+    for (const auto &track : tracks)
+    {
+        total += track.samples.getMemoryBytes() + track.chunks.capacity() * sizeof(Chunk);
+    }
+    return total;
+}
+
+bool NativeMp4Remuxer::getInputChecksum(int input, uint32_t &crc)
+{
+    if (input < 0 || input >= (int)inputs.size() || !inputs[input].checksum)
+    {
+        return false;
+    }
+    IsoBmffReader &reader = *inputs[input].reader;
+    return inputs[input].checksum->finish(
+        [&reader](int64_t offset, uint8_t *buffer, size_t size) { return reader.readAt(offset, buffer, size); }, crc);
+}
+
+std::vector<StreamIntegrity> NativeMp4Remuxer::getStreamIntegrity() const
+{
+    std::vector<StreamIntegrity> streams(tracks.size());
+    for (size_t i = 0; i < tracks.size(); i++)
+    {
+        // 样本表按构造保证解码时间单调递增，重叠的分片在open()时已被拒绝
+        streams[i].packets = tracks[i].samples.getSampleCount();
+        streams[i].bytes = tracks[i].sampleBytes;
+        streams[i].crc32c = tracks[i].sampleChecksum;
+        streams[i].gaps = tracks[i].gaps;
+        streams[i].gapSeconds = tracks[i].gapSeconds;
+    }
+    return streams;
+}
+
+bool NativeMp4Remuxer::open(const std::vector<std::string> &inputPaths)
+{
+    lastError.clear();
+    inputs.clear();
+    tracks.clear();
+    totalSampleBytes = 0;
+    outputBytes = 0;
+
+    for (size_t i = 0; i < inputPaths.size(); i++)
+    {
+        Input input;
+        input.path = inputPaths[i];
+        input.reader.reset(new IsoBmffReader());
+        if (!input.reader->open(input.path))
+        {
+            setError("Failed to open " + input.path);
+            return false;
+        }
+        if (computeInputChecksums)
+        {
+            input.checksum.reset(new RangeChecksum());
+            input.checksum->reset(input.reader->getFileSize());
+            input.reader->setChecksum(input.checksum.get());
+        }
+        inputs.push_back(std::move(input));
+
+        Input &current = inputs.back();
+        IsoBmffReader &reader = *current.reader;
+        int64_t fileSize = reader.getFileSize();
+        bool haveMoov = false;
+        int fragments = 0;
+        BoxHeader box;
+        int64_t offset = 0;
+        while (offset < fileSize)
+        {
+            if (!reader.readBoxHeader(offset, fileSize, box))
+            {
+                setError("Invalid or truncated box in " + current.path);
+                return false;
+            }
+            if (box.type == boxType("moov"))
+            {
+                if (haveMoov || !parseInit(current, (int)i, box))
+                {
+                    if (lastError.empty())
+                    {
+                        setError("Multiple moov boxes in " + current.path);
+                    }
+                    return false;
+                }
+                haveMoov = true;
+            }
+            else if (box.type == boxType("moof"))
+            {
+                if (!haveMoov)
+                {
+                    setError("moof before moov in " + current.path);
+                    return false;
+                }
+                if (!parseMoof(current, box))
+                {
+                    return false;
+                }
+                fragments++;
+            }
+            offset = box.end();
+        }
+
+        if (!haveMoov || fragments == 0)
+        {
+            setError("Not a fragmented MP4 file: " + current.path);
+            return false;
+        }
+    }
+
+    if (tracks.empty())
+    {
+        setError("No tracks");
+        return false;
+    }
+
+    // 各轨道在输入时间轴上的起点
+    std::vector<double> inputStarts(inputs.size(), 0.0);
+    double earliest = 0.0;
+    for (size_t i = 0; i < tracks.size(); i++)
+    {
+        Track &track = tracks[i];
+        if (track.samples.isEmpty())
+        {
+            setError("Track without samples in " + inputs[track.input].path);
+            return false;
+        }
+        track.startDelay = track.emptyEditSeconds + track.firstDecodeTime / (double)track.timescale;
+        bool firstOfInput = i == inputs[track.input].firstTrack;
+        inputStarts[track.input] =
+            firstOfInput ? track.startDelay : std::min(inputStarts[track.input], track.startDelay);
+        earliest = i == 0 ? track.startDelay : std::min(earliest, track.startDelay);
+    }
+
+    // 对齐起点时每个输入以自己最早的轨道为0，否则所有输入以最早的轨道为0；再加上各输入的偏移，
+    // 出现负的起点时整体后移
+    double lowest = 0.0;
+    for (size_t i = 0; i < inputs.size(); i++)
+    {
+        inputs[i].timeShift = -(alignStartTimes ? inputStarts[i] : earliest);
+        if (i < inputOffsets.size())
+        {
+            inputs[i].timeShift += inputOffsets[i];
+        }
+        lowest = std::min(lowest, inputStarts[i] + inputs[i].timeShift);
+    }
+    for (auto &input : inputs)
+    {
+        input.timeShift -= lowest;
+    }
+    for (auto &track : tracks)
+    {
+        track.startDelay += inputs[track.input].timeShift;
+        track.samples.shrinkToFit();
+        track.chunks.shrink_to_fit();
+    }
+    return true;
+}
+
+double NativeMp4Remuxer::getTimeShift(int input) const
+{
+    if (input < 0 || input >= (int)inputs.size())
+    {
+        return 0.0;
+    }
+    return inputs[input].timeShift;
+}
+
+bool NativeMp4Remuxer::parseInit(Input &input, int inputIndex, const BoxHeader &moov)
+{
+    IsoBmffReader &reader = *input.reader;
+    std::vector<uint8_t> payload;
+    uint32_t movieTimescale = 0;
+    bool fragmented = false;
+    std::vector<Track> initTracks;
+    std::vector<BoxHeader> trakBoxes;
+
+    BoxHeader box;
+    int64_t offset = moov.payloadOffset();
+    while (reader.readBoxHeader(offset, moov.end(), box))
+    {
+        if (box.type == boxType("mvhd"))
+        {
+            if (!reader.readPayload(box, kSmallBoxLimit, payload) || payload.size() < 24)
+            {
+                setError("Invalid mvhd in " + input.path);
+                return false;
+            }
+            movieTimescale = readBE32(&payload[payload[0] == 1 ? 20 : 12]);
+        }
+        else if (box.type == boxType("trak"))
+        {
+            Track track;
+            track.input = inputIndex;
+            if (!parseTrak(reader, box, track))
+            {
+                return false;
+            }
+            initTracks.push_back(track);
+            trakBoxes.push_back(box);
+        }
+        else if (box.type == boxType("mvex"))
+        {
+            fragmented = true;
+        }
+        offset = box.end();
+    }
+
+    if (!fragmented)
+    {
+        setError("No mvex box in " + input.path);
+        return false;
+    }
+
+    for (size_t i = 0; i < initTracks.size(); i++)
+    {
+        parseEditList(reader, trakBoxes[i], movieTimescale, initTracks[i]);
+    }
+
+    // trex中的默认样本值
+    BoxHeader mvex, trex;
+    if (reader.findChild(moov.payloadOffset(), moov.end(), boxType("mvex"), mvex))
+    {
+        offset = mvex.payloadOffset();
+        while (reader.readBoxHeader(offset, mvex.end(), trex))
+        {
+            if (trex.type == boxType("trex") && reader.readPayload(trex, kSmallBoxLimit, payload))
+            {
+                parseTrex(payload.data(), payload.size(), input.fragmentDefaults);
+            }
+            offset = trex.end();
+        }
+    }
+
+    input.firstTrack = tracks.size();
+    input.trackCount = initTracks.size();
+    tracks.insert(tracks.end(), initTracks.begin(), initTracks.end());
+    return true;
+}
+
+bool NativeMp4Remuxer::parseTrak(IsoBmffReader &reader, const BoxHeader &trak, Track &track)
+{
+    std::vector<uint8_t> payload;
+    BoxHeader tkhd, mdia, mdhd, hdlr, minf, stbl, stsd, mediaHeader;
+
+    if (!reader.findChild(trak.payloadOffset(), trak.end(), boxType("tkhd"), tkhd) ||
+        !reader.readPayload(tkhd, kSmallBoxLimit, payload) || payload.size() < 84)
+    {
+        setError("Invalid tkhd");
+        return false;
+    }
+    size_t shift = payload[0] == 1 ? 12 : 0;
+    if (payload.size() < 84 + shift)
+    {
+        setError("Invalid tkhd");
+        return false;
+    }
+    track.trackId = readBE32(&payload[12 + (payload[0] == 1 ? 8 : 0)]);
+    std::copy(&payload[40 + shift], &payload[76 + shift], track.matrix);
+    track.width = readBE32(&payload[76 + shift]);
+    track.height = readBE32(&payload[80 + shift]);
+
+    if (!reader.findChild(trak.payloadOffset(), trak.end(), boxType("mdia"), mdia) ||
+        !reader.findChild(mdia.payloadOffset(), mdia.end(), boxType("mdhd"), mdhd) ||
+        !reader.readPayload(mdhd, kSmallBoxLimit, payload) || payload.size() < 24)
+    {
+        setError("Invalid mdhd");
+        return false;
+    }
+    if (payload[0] == 1)
+    {
+        if (payload.size() < 36)
+        {
+            setError("Invalid mdhd");
+            return false;
+        }
+        track.timescale = readBE32(&payload[20]);
+        track.language = readBE16(&payload[32]);
+    }
+    else
+    {
+        track.timescale = readBE32(&payload[12]);
+        track.language = readBE16(&payload[20]);
+    }
+    if (track.timescale == 0)
+    {
+        setError("Invalid timescale");
+        return false;
+    }
+
+    if (!reader.findChild(mdia.payloadOffset(), mdia.end(), boxType("hdlr"), hdlr) ||
+        !readWholeBox(reader, hdlr, kSmallBoxLimit, track.hdlr) || track.hdlr.size() < 20)
+    {
+        setError("Invalid hdlr");
+        return false;
+    }
+    track.handler = readBE32(&track.hdlr[16]);
+
+    if (!reader.findChild(mdia.payloadOffset(), mdia.end(), boxType("minf"), minf) ||
+        !reader.findChild(minf.payloadOffset(), minf.end(), boxType("stbl"), stbl) ||
+        !reader.findChild(stbl.payloadOffset(), stbl.end(), boxType("stsd"), stsd) ||
+        !readWholeBox(reader, stsd, kStsdLimit, track.stsd) || track.stsd.size() < 24)
+    {
+        setError("Invalid stsd");
+        return false;
+    }
+
+    const char *headerType = track.handler == boxType("vide") ? "vmhd" : "smhd";
+    if (!reader.findChild(minf.payloadOffset(), minf.end(), boxType(headerType), mediaHeader) ||
+        !readWholeBox(reader, mediaHeader, kSmallBoxLimit, track.mediaHeader))
+    {
+        setError(std::string("Missing ") + headerType);
+        return false;
+    }
+
+    // 所有样本描述都必须是受支持的编码
+    uint32_t entryCount = readBE32(&track.stsd[12]);
+    size_t offset = 16;
+    for (uint32_t i = 0; i < entryCount; i++)
+    {
+        if (offset + 8 > track.stsd.size() || !isSupportedSampleEntry(track.handler, readBE32(&track.stsd[offset + 4])))
+        {
+            setError("Unsupported sample description");
+            return false;
+        }
+        offset += readBE32(&track.stsd[offset]);
+    }
+    if (entryCount == 0)
+    {
+        setError("Empty stsd");
+        return false;
+    }
+    return true;
+}
+
+void NativeMp4Remuxer::parseEditList(IsoBmffReader &reader, const BoxHeader &trak, uint32_t movieTimescale,
+                                     Track &track)
+{
+    std::vector<uint8_t> payload;
+    BoxHeader edts, elst;
+    if (!reader.findChild(trak.payloadOffset(), trak.end(), boxType("edts"), edts) ||
+        !reader.findChild(edts.payloadOffset(), edts.end(), boxType("elst"), elst) ||
+        !reader.readPayload(elst, kElstLimit, payload) || payload.size() < 8)
+    {
+        return;
+    }
+
+    bool version1 = payload[0] == 1;
+    size_t entrySize = version1 ? 20 : 12;
+    uint32_t entryCount = readBE32(&payload[4]);
+    for (uint32_t i = 0; i < entryCount && 8 + (i + 1) * entrySize <= payload.size(); i++)
+    {
+        const uint8_t *entry = &payload[8 + i * entrySize];
+        uint64_t segmentDuration = version1 ? readBE64(entry) : readBE32(entry);
+        int64_t mediaTime = version1 ? (int64_t)readBE64(entry + 8) : (int32_t)readBE32(entry + 4);
+        if (mediaTime == -1)
+        {
+            if (movieTimescale > 0)
+            {
+                track.emptyEditSeconds += segmentDuration / (double)movieTimescale;
+            }
+            continue;
+        }
+        track.mediaTime = std::max<int64_t>(0, mediaTime);
+        break;
+    }
+}
+
+bool NativeMp4Remuxer::parseMoof(Input &input, const BoxHeader &moof)
+{
+    std::vector<uint8_t> payload;
+    if (!input.reader->readPayload(moof, kMoofLimit, payload))
+    {
+        setError("Invalid moof in " + input.path);
+        return false;
+    }
+
+    // 没有显式基准偏移时，后一个traf的数据紧接前一个traf的数据
+    int64_t dataEnd = moof.offset;
+    size_t offset = 0;
+    uint32_t type;
+    const uint8_t *child;
+    size_t childSize;
+    while (nextBox(payload.data(), payload.size(), offset, type, child, childSize))
+    {
+        if (type == boxType("traf") && !parseTraf(input, moof, child, childSize, dataEnd))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool NativeMp4Remuxer::parseTraf(Input &input, const BoxHeader &moof, const uint8_t *data, size_t size,
+                                 int64_t &dataEnd)
+{
+    std::string error;
+    if (!parseTrackFragment(data, size, moof.offset, input.fragmentDefaults, dataEnd, trackFragment, error))
+    {
+        setError(error + " in " + input.path);
+        return false;
+    }
+    Track *track = nullptr;
+    for (size_t i = input.firstTrack; i < input.firstTrack + input.trackCount; i++)
+    {
+        if (tracks[i].trackId == trackFragment.trackId)
+        {
+            track = &tracks[i];
+        }
+    }
+    if (!track)
+    {
+        setError("Fragment for unknown track in " + input.path);
+        return false;
+    }
+
+    if (trackFragment.haveDecodeTime)
+    {
+        uint64_t decodeTime = trackFragment.decodeTime;
+        if (!track->haveDecodeTime)
+        {
+            track->firstDecodeTime = decodeTime;
+            track->nextDecodeTime = decodeTime;
+            track->haveDecodeTime = true;
+        }
+        else if (decodeTime > track->nextDecodeTime)
+        {
+            // 分片之间有空隙时延长前一个样本，保持后续样本的时间不变
+            uint64_t gap = decodeTime - track->nextDecodeTime;
+            if (gap > track->samples.getDurations().getLastValue())
+            {
+                track->gaps++;
+                track->gapSeconds += gap / (double)track->timescale;
+            }
+            if (!track->samples.extendLastDuration(gap))
+            {
+                setError("Unsupported gap between fragments in " + input.path);
+                return false;
+            }
+            track->mediaDuration += gap;
+            track->nextDecodeTime = decodeTime;
+        }
+        else if (decodeTime < track->nextDecodeTime)
+        {
+            setError("Overlapping fragments in " + input.path);
+            return false;
+        }
+    }
+
+    track->haveDecodeTime = true;
+    for (const TrackRun &run : trackFragment.runs)
+    {
+        if (!parseTrun(input, *track, run))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool NativeMp4Remuxer::parseTrun(Input &input, Track &track, const TrackRun &run)
+{
+    if (run.sampleCount == 0)
+    {
+        return true;
+    }
+
+    SampleIndex &samples = track.samples;
+    if ((uint64_t)samples.getSampleCount() + run.sampleCount > UINT32_MAX)
+    {
+        setError("Too many samples in " + input.path);
+        return false;
+    }
+    if (run.dataOffset < 0 || run.dataOffset + run.dataSize > input.reader->getFileSize())
+    {
+        setError("Sample data outside the file in " + input.path);
+        return false;
+    }
+
+    Chunk chunk;
+    chunk.sourceOffset = run.dataOffset;
+    chunk.size = run.dataSize;
+    chunk.decodeTime = track.nextDecodeTime;
+    chunk.sampleCount = run.sampleCount;
+    chunk.descriptionIndex = run.defaults.descriptionIndex;
+
+    for (uint32_t i = 0; i < run.sampleCount; i++)
+    {
+        TrackRunSample sample = run.getSample(i);
+        if (run.version == 0 && sample.compositionOffset < 0)
+        {
+            // 版本0的合成时间偏移是无符号数
+            setError("Unsupported composition offset in " + input.path);
+            return false;
+        }
+        samples.append(sample.size, sample.duration, sample.compositionOffset,
+                       !(sample.flags & kSampleNotKeyframe));
+        track.nextDecodeTime += sample.duration;
+        track.mediaDuration += sample.duration;
+    }
+
+    track.sampleBytes += chunk.size;
+    totalSampleBytes += chunk.size;
+    track.chunks.push_back(chunk);
+    return true;
+}
+
+std::vector<std::pair<size_t, size_t>> NativeMp4Remuxer::layoutChunks(int64_t mdatPayloadOffset)
+{
+    struct Entry
+    {
+        double time;
+        size_t track;
+        size_t chunk;
+    };
+    std::vector<Entry> entries;
+    for (size_t t = 0; t < tracks.size(); t++)
+    {
+        const Track &track = tracks[t];
+        for (size_t c = 0; c < track.chunks.size(); c++)
+        {
+            double time = track.startDelay + (track.chunks[c].decodeTime - track.firstDecodeTime) / (double)track.timescale;
+            entries.push_back({time, t, c});
+        }
+    }
+    std::stable_sort(entries.begin(), entries.end(),
+                     [](const Entry &a, const Entry &b) { return a.time < b.time; });
+
+    std::vector<std::pair<size_t, size_t>> order;
+    order.reserve(entries.size());
+    int64_t position = mdatPayloadOffset;
+    for (const auto &entry : entries)
+    {
+        Chunk &chunk = tracks[entry.track].chunks[entry.chunk];
+        chunk.outputOffset = position;
+        position += chunk.size;
+        order.push_back(std::make_pair(entry.track, entry.chunk));
+    }
+    return order;
+}
+
+bool NativeMp4Remuxer::copyChunks(std::FILE *output, const std::vector<std::pair<size_t, size_t>> &order)
+{
+    std::vector<uint8_t> buffer(kCopyBlockSize);
+    int64_t copied = 0;
+    // 一次连续复制中依次包含的各块（轨道序号、字节数），用于分别计算各轨道的校验和
+    std::vector<std::pair<size_t, int64_t>> spans;
+
+    size_t i = 0;
+    while (i < order.size())
+    {
+        // 同一输入中源位置相连的块合并成一次连续复制
+        const Track &first = tracks[order[i].first];
+        int input = first.input;
+        int64_t sourceOffset = first.chunks[order[i].second].sourceOffset;
+        int64_t size = first.chunks[order[i].second].size;
+        spans.assign(1, std::make_pair(order[i].first, size));
+        for (i++; i < order.size(); i++)
+        {
+            const Track &next = tracks[order[i].first];
+            const Chunk &chunk = next.chunks[order[i].second];
+            if (next.input != input || chunk.sourceOffset != sourceOffset + size)
+            {
+                break;
+            }
+            size += chunk.size;
+            spans.emplace_back(order[i].first, chunk.size);
+        }
+        size_t span = 0;
+        int64_t spanRemaining = spans[0].second;
+
+        IsoBmffReader &reader = *inputs[input].reader;
+        while (size > 0)
+        {
+            if (cancelFlag && *cancelFlag)
+            {
+                setError("Merge cancelled");
+                return false;
+            }
+            size_t block = (size_t)std::min<int64_t>(size, (int64_t)buffer.size());
+            if (!reader.readAt(sourceOffset, buffer.data(), block))
+            {
+                setError("Failed to read " + inputs[input].path);
+                return false;
+            }
+            if (!writeOutput(output, buffer.data(), block))
+            {
+                setError("Failed to write output file");
+                return false;
+            }
+            for (size_t done = 0; computeChecksums && done < block;)
+            {
+                while (spanRemaining == 0)
+                {
+                    spanRemaining = spans[++span].second;
+                }
+                size_t piece = (size_t)std::min<int64_t>(spanRemaining, (int64_t)(block - done));
+                Track &track = tracks[spans[span].first];
+                track.sampleChecksum = crc32cUpdate(track.sampleChecksum, buffer.data() + done, piece);
+                done += piece;
+                spanRemaining -= piece;
+            }
+            sourceOffset += block;
+            size -= block;
+            copied += block;
+            if (progressCallback)
+            {
+                progressCallback(copied, totalSampleBytes);
+            }
+        }
+    }
+    return true;
+}
+
+bool NativeMp4Remuxer::writeOutput(std::FILE *output, const void *data, size_t size)
+{
+    if (computeChecksums)
+    {
+        outputChecksum = crc32cUpdate(outputChecksum, data, size);
+    }
+    return std::fwrite(data, 1, size, output) == size;
+}
+
+bool NativeMp4Remuxer::write(const std::string &outputPath, bool faststart)
+{
+    lastError.clear();
+    outputBytes = 0;
+    outputChecksum = 0;
+    for (auto &track : tracks)
+    {
+        track.sampleChecksum = 0;
+    }
+    if (tracks.empty())
+    {
+        setError("No tracks");
+        return false;
+    }
+
+    bool hasAvc = false;
+    for (const auto &track : tracks)
+    {
+        uint32_t entry = readBE32(&track.stsd[20]);
+        hasAvc |= entry == boxType("avc1") || entry == boxType("avc3");
+    }
+
+    // 与libavformat的mp4封装器相同的品牌
+    std::vector<uint8_t> ftyp;
+    size_t start = beginBox(ftyp, "ftyp");
+    put32(ftyp, boxType("isom"));
+    put32(ftyp, 0x200);
+    put32(ftyp, boxType("isom"));
+    put32(ftyp, boxType("iso2"));
+    if (hasAvc)
+    {
+        put32(ftyp, boxType("avc1"));
+    }
+    put32(ftyp, boxType("mp41"));
+    endBox(ftyp, start);
+
+    // 样本总量已知，直接选择32位或64位的mdat头
+    std::vector<uint8_t> mdatHeader;
+    if (totalSampleBytes + 8 > (int64_t)UINT32_MAX)
+    {
+        put32(mdatHeader, 1);
+        put32(mdatHeader, boxType("mdat"));
+        put64(mdatHeader, (uint64_t)totalSampleBytes + 16);
+    }
+    else
+    {
+        put32(mdatHeader, (uint32_t)(totalSampleBytes + 8));
+        put32(mdatHeader, boxType("mdat"));
+    }
+    // 快速启动时moov在mdat之前：moov的大小只取决于样本表和stco/co64的选择，
+    // 按上一次的moov大小重新布局直到大小不再变化，然后一次写完
+    std::vector<uint8_t> moov;
+    std::vector<std::pair<size_t, size_t>> order;
+    if (faststart)
+    {
+        size_t moovSize = 0;
+        for (size_t pass = 0;; pass++)
+        {
+            order = layoutChunks((int64_t)(ftyp.size() + moovSize + mdatHeader.size()));
+            moov.clear();
+            buildMoov(moov);
+            if (moov.size() == moovSize)
+            {
+                break;
+            }
+            if (pass > tracks.size() + 1)
+            {
+                setError("Failed to lay out the moov box");
+                return false;
+            }
+            moovSize = moov.size();
+        }
+    }
+    else
+    {
+        order = layoutChunks((int64_t)(ftyp.size() + mdatHeader.size()));
+    }
+
+    std::FILE *output = openFileUtf8(outputPath, "wb");
+    if (!output)
+    {
+        setError("Failed to create output file: " + outputPath);
+        return false;
+    }
+
+    bool success = writeOutput(output, ftyp.data(), ftyp.size()) && writeOutput(output, moov.data(), moov.size()) &&
+                   writeOutput(output, mdatHeader.data(), mdatHeader.size());
+    if (!success)
+    {
+        setError("Failed to write output file");
+    }
+    success = success && copyChunks(output, order);
+
+    if (success && !faststart)
+    {
+        buildMoov(moov);
+        if (!writeOutput(output, moov.data(), moov.size()))
+        {
+            setError("Failed to write output file");
+            success = false;
+        }
+    }
+    outputBytes = (int64_t)(ftyp.size() + mdatHeader.size() + moov.size()) + totalSampleBytes;
+
+    if (std::fclose(output) != 0 && success)
+    {
+        setError("Failed to write output file");
+        success = false;
+    }
+    return success;
+}
+
+void NativeMp4Remuxer::buildMoov(std::vector<uint8_t> &out) const
+{
+    // 各轨道在电影时间刻度下的时长（含起始延迟）
+    uint64_t movieDuration = 0;
+    for (const auto &track : tracks)
+    {
+        uint64_t presentation = track.mediaDuration > (uint64_t)track.mediaTime ? track.mediaDuration - track.mediaTime : 0;
+        uint64_t duration = (uint64_t)(track.startDelay * kMovieTimescale + 0.5) +
+                            rescaleTime(presentation, track.timescale, kMovieTimescale);
+        movieDuration = std::max(movieDuration, duration);
+    }
+    bool longMovie = movieDuration > UINT32_MAX;
+
+    size_t moov = beginBox(out, "moov");
+    size_t mvhd = beginFullBox(out, "mvhd", longMovie ? 1 : 0, 0);
+    if (longMovie)
+    {
+        putZeros(out, 16);
+        put32(out, kMovieTimescale);
+        put64(out, movieDuration);
+    }
+    else
+    {
+        putZeros(out, 8);
+        put32(out, kMovieTimescale);
+        put32(out, (uint32_t)movieDuration);
+    }
+    put32(out, 0x00010000);
+    put16(out, 0x0100);
+    putZeros(out, 10);
+    out.insert(out.end(), kIdentityMatrix, kIdentityMatrix + sizeof(kIdentityMatrix));
+    putZeros(out, 24);
+    put32(out, (uint32_t)tracks.size() + 1);
+    endBox(out, mvhd);
+
+    for (size_t i = 0; i < tracks.size(); i++)
+    {
+        buildTrak(out, tracks[i], (uint32_t)i + 1, kMovieTimescale);
+    }
+    endBox(out, moov);
+}
+
+void NativeMp4Remuxer::buildTrak(std::vector<uint8_t> &out, const Track &track, uint32_t trackId,
+                                 uint32_t movieTimescale) const
+{
+    uint64_t presentation = track.mediaDuration > (uint64_t)track.mediaTime ? track.mediaDuration - track.mediaTime : 0;
+    uint64_t delay = (uint64_t)(track.startDelay * movieTimescale + 0.5);
+    uint64_t editDuration = rescaleTime(presentation, track.timescale, movieTimescale);
+    uint64_t trackDuration = delay + editDuration;
+    bool audio = track.handler == boxType("soun");
+
+    size_t trak = beginBox(out, "trak");
+
+    bool longTrack = trackDuration > UINT32_MAX;
+    size_t tkhd = beginFullBox(out, "tkhd", longTrack ? 1 : 0, 0x3);
+    if (longTrack)
+    {
+        putZeros(out, 16);
+        put32(out, trackId);
+        put32(out, 0);
+        put64(out, trackDuration);
+    }
+    else
+    {
+        putZeros(out, 8);
+        put32(out, trackId);
+        put32(out, 0);
+        put32(out, (uint32_t)trackDuration);
+    }
+    putZeros(out, 8);
+    put16(out, 0);
+    put16(out, 0);
+    put16(out, audio ? 0x0100 : 0);
+    put16(out, 0);
+    out.insert(out.end(), track.matrix, track.matrix + sizeof(track.matrix));
+    put32(out, audio ? 0 : track.width);
+    put32(out, audio ? 0 : track.height);
+    endBox(out, tkhd);
+
+    // 起始延迟用空编辑表示，B帧的合成时间偏移用媒体起点表示
+    if (delay > 0 || track.mediaTime != 0)
+    {
+        bool longEdit = trackDuration > UINT32_MAX || track.mediaTime > INT32_MAX;
+        size_t edts = beginBox(out, "edts");
+        size_t elst = beginFullBox(out, "elst", longEdit ? 1 : 0, 0);
+        put32(out, delay > 0 ? 2 : 1);
+        if (delay > 0)
+        {
+            if (longEdit)
+            {
+                put64(out, delay);
+                put64(out, (uint64_t)-1);
+            }
+            else
+            {
+                put32(out, (uint32_t)delay);
+                put32(out, 0xffffffffu);
+            }
+            put32(out, 0x00010000);
+        }
+        if (longEdit)
+        {
+            put64(out, editDuration);
+            put64(out, (uint64_t)track.mediaTime);
+        }
+        else
+        {
+            put32(out, (uint32_t)editDuration);
+            put32(out, (uint32_t)track.mediaTime);
+        }
+        put32(out, 0x00010000);
+        endBox(out, elst);
+        endBox(out, edts);
+    }
+
+    size_t mdia = beginBox(out, "mdia");
+    bool longMedia = track.mediaDuration > UINT32_MAX;
+    size_t mdhd = beginFullBox(out, "mdhd", longMedia ? 1 : 0, 0);
+    if (longMedia)
+    {
+        putZeros(out, 16);
+        put32(out, track.timescale);
+        put64(out, track.mediaDuration);
+    }
+    else
+    {
+        putZeros(out, 8);
+        put32(out, track.timescale);
+        put32(out, (uint32_t)track.mediaDuration);
+    }
+    put16(out, track.language);
+    put16(out, 0);
+    endBox(out, mdhd);
+
+    out.insert(out.end(), track.hdlr.begin(), track.hdlr.end());
+
+    size_t minf = beginBox(out, "minf");
+    out.insert(out.end(), track.mediaHeader.begin(), track.mediaHeader.end());
+    size_t dinf = beginBox(out, "dinf");
+    size_t dref = beginFullBox(out, "dref", 0, 0);
+    put32(out, 1);
+    size_t url = beginFullBox(out, "url ", 0, 0x1);
+    endBox(out, url);
+    endBox(out, dref);
+    endBox(out, dinf);
+    buildStbl(out, track);
+    endBox(out, minf);
+    endBox(out, mdia);
+    endBox(out, trak);
+}
+
+void NativeMp4Remuxer::buildStbl(std::vector<uint8_t> &out, const Track &track) const
+{
+    const SampleIndex &samples = track.samples;
+
+    size_t stbl = beginBox(out, "stbl");
+    out.insert(out.end(), track.stsd.begin(), track.stsd.end());
+
+    // 样本表中的每一段就是一个stts/ctts条目
+    size_t stts = beginFullBox(out, "stts", 0, 0);
+    put32(out, samples.getDurations().getRunCount());
+    samples.getDurations().forEachRun([&](uint32_t count, uint32_t duration) {
+        put32(out, count);
+        put32(out, duration);
+    });
+    endBox(out, stts);
+
+    if (samples.hasCompositionOffsets())
+    {
+        size_t ctts = beginFullBox(out, "ctts", samples.hasNegativeCompositionOffsets() ? 1 : 0, 0);
+        put32(out, samples.getCompositionOffsets().getRunCount());
+        samples.getCompositionOffsets().forEachRun([&](uint32_t count, uint32_t offset) {
+            put32(out, count);
+            put32(out, offset);
+        });
+        endBox(out, ctts);
+    }
+
+    // 全部是关键帧时省略stss
+    if (!samples.isAllSync())
+    {
+        size_t stss = beginFullBox(out, "stss", 0, 0);
+        put32(out, samples.getSyncSampleCount());
+        samples.forEachSyncSample([&](uint32_t sample) { put32(out, sample); });
+        endBox(out, stss);
+    }
+
+    size_t stsc = beginFullBox(out, "stsc", 0, 0);
+    size_t countPosition = out.size();
+    put32(out, 0);
+    uint32_t entries = 0;
+    for (size_t i = 0; i < track.chunks.size(); i++)
+    {
+        const Chunk &chunk = track.chunks[i];
+        if (i == 0 || chunk.sampleCount != track.chunks[i - 1].sampleCount ||
+            chunk.descriptionIndex != track.chunks[i - 1].descriptionIndex)
+        {
+            put32(out, (uint32_t)i + 1);
+            put32(out, chunk.sampleCount);
+            put32(out, chunk.descriptionIndex);
+            entries++;
+        }
+    }
+    patch32(out, countPosition, entries);
+    endBox(out, stsc);
+
+    size_t stsz = beginFullBox(out, "stsz", 0, 0);
+    put32(out, samples.isConstantSize() ? samples.getFirstSize() : 0);
+    put32(out, samples.getSampleCount());
+    if (!samples.isConstantSize())
+    {
+        samples.getSizes().forEachRun([&](uint32_t count, uint32_t size) {
+            for (uint32_t i = 0; i < count; i++)
+            {
+                put32(out, size);
+            }
+        });
+    }
+    endBox(out, stsz);
+
+    bool largeOffsets = false;
+    for (const auto &chunk : track.chunks)
+    {
+        largeOffsets |= chunk.outputOffset > (int64_t)UINT32_MAX;
+    }
+    size_t stco = beginFullBox(out, largeOffsets ? "co64" : "stco", 0, 0);
+    put32(out, (uint32_t)track.chunks.size());
+    for (const auto &chunk : track.chunks)
+    {
+        if (largeOffsets)
+        {
+            put64(out, (uint64_t)chunk.outputOffset);
+        }
+        else
+        {
+            put32(out, (uint32_t)chunk.outputOffset);
+        }
+    }
+    endBox(out, stco);
+    endBox(out, stbl);
+}
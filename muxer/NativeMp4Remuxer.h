@@ -0,0 +1,235 @@
+#ifndef NATIVE_MP4_REMUXER_H
+#define NATIVE_MP4_REMUXER_H
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include "IntegrityCheck.h"
+#include "IsoBmff.h"
+#include "SampleIndex.h"
+
+/**
+ * 分片MP4（fMP4/m4s）到普通MP4的专用流复制封装器
+ * 直接解析输入的moov和各分片的moof/traf/trun得到样本表，
+ * 按分片成块复制mdat数据，再根据样本表生成输出的moov，不经过libavformat的通用封装流程。
+ * 只处理H.264/HEVC视频和AAC音频；open()返回false时由调用者退回libavformat
+ */
+class NativeMp4Remuxer
+{
+public:
+    /**
+     * 复制进度回调，参数为已复制和总共需要复制的样本字节数
+     */
+    typedef std::function<void(int64_t copiedBytes, int64_t totalBytes)> ProgressCallback;
+
+    NativeMp4Remuxer() = default;
+    ~NativeMp4Remuxer() = default;
+
+    NativeMp4Remuxer(const NativeMp4Remuxer &) = delete;
+    NativeMp4Remuxer &operator=(const NativeMp4Remuxer &) = delete;
+
+    /**
+     * 打开输入并建立所有轨道的样本表
+     * 输入中的全部轨道按输入顺序依次成为输出的轨道
+     * @param inputPaths 输入文件路径（如视频m4s和音频m4s）
+     * @return 成功返回true；不是fMP4、编码不受支持或分片无法解析时返回false
+     */
+    bool open(const std::vector<std::string> &inputPaths);
+
+    /**
+     * 写出MP4文件（ftyp、mdat、moov）
+     * @param outputPath 输出文件路径
+     * @param faststart 是否把moov放在mdat之前（按样本表预先计算布局，只写一遍）
+     * @return 是否写出成功
+     */
+    bool write(const std::string &outputPath, bool faststart = false);
+
+    /**
+     * 设置起点对齐方式和各输入的时间偏移（在open()之前调用）
+     * @param alignStartTimes 为true时每个输入的起点对齐到0，否则保留输入之间原有的起点差
+     * @param offsets 各输入额外的偏移（秒），可为负
+     */
+    void setStartAlignment(bool alignStartTimes, const std::vector<double> &offsets)
+    {
+        this->alignStartTimes = alignStartTimes;
+        inputOffsets = offsets;
+    }
+
+    void setProgressCallback(ProgressCallback callback) { progressCallback = callback; }
+
+    /**
+     * 写出时计算输出文件和各轨道样本数据的CRC32C（在write()之前调用）
+     */
+    void setComputeChecksums(bool enable) { computeChecksums = enable; }
+
+    /**
+     * 读取输入时顺带计算各输入文件的CRC32C（在open()之前调用）
+     */
+    void setComputeInputChecksums(bool enable) { computeInputChecksums = enable; }
+
+    /**
+     * 补读未读到的部分，得到输入文件的CRC32C（开启输入校验且write()成功后调用）
+     * @param input 输入序号
+     * @param crc 输出的CRC32C
+     * @return 成功返回true
+     */
+    bool getInputChecksum(int input, uint32_t &crc);
+
+    /**
+     * 设置取消标志，复制数据时检查，置位后write()以失败返回
+     */
+    void setCancelFlag(const std::atomic<bool> *flag) { cancelFlag = flag; }
+
+    /**
+     * 获取错误信息
+     * @return 最后的错误信息
+     */
+    std::string getLastError() const { return lastError; }
+
+    int getTrackCount() const { return (int)tracks.size(); }
+
+    /**
+     * 输出轨道的样本数量和样本字节数（与输出文件中的流顺序一致）
+     */
+    int64_t getSampleCount(int track) const;
+    int64_t getSampleBytes(int track) const;
+
+    /**
+     * 输入时间轴到输出时间轴的平移量（秒，open()成功后有效）
+     */
+    double getTimeShift(int input) const;
+
+    int64_t getTotalSamples() const;
+    int64_t getTotalSampleBytes() const { return totalSampleBytes; }
+
+    /**
+     * 所有轨道样本表占用的内存（字节）
+     */
+    size_t getIndexBytes() const;
+
+    /**
+     * 输出文件的字节数（write()成功后有效）
+     */
+    int64_t getOutputBytes() const { return outputBytes; }
+
+    /**
+     * 输出文件的CRC32C（开启校验且write()成功后有效）
+     */
+    uint32_t getOutputChecksum() const { return outputChecksum; }
+
+    /**
+     * 各输出轨道的样本校验和及分片间空隙（开启校验且write()成功后有效）
+     */
+    std::vector<StreamIntegrity> getStreamIntegrity() const;
+
+private:
+    /**
+     * 一个trun对应的连续样本数据，输出时作为一个块整体复制
+     */
+    struct Chunk
+    {
+        int64_t sourceOffset = 0;
+        int64_t size = 0;
+        uint64_t decodeTime = 0;
+        uint32_t sampleCount = 0;
+        uint32_t descriptionIndex = 1;
+        int64_t outputOffset = 0;
+    };
+
+    struct Track
+    {
+        int input = 0;
+        uint32_t trackId = 0;
+        uint32_t handler = 0;
+        uint32_t timescale = 0;
+        uint16_t language = 0x55c4;
+        // tkhd中的变换矩阵和宽高（16.16定点）
+        uint8_t matrix[36] = {};
+        uint32_t width = 0;
+        uint32_t height = 0;
+        // 原样复制的盒子（含头部）
+        std::vector<uint8_t> stsd;
+        std::vector<uint8_t> hdlr;
+        std::vector<uint8_t> mediaHeader;
+        // 输入编辑列表：开头的空编辑（秒）和媒体起点（媒体时间刻度）
+        double emptyEditSeconds = 0.0;
+        int64_t mediaTime = 0;
+        // 第一个分片的解码时间和下一个样本的预期解码时间
+        uint64_t firstDecodeTime = 0;
+        uint64_t nextDecodeTime = 0;
+        bool haveDecodeTime = false;
+        // 在输出时间轴上的起始延迟（秒）
+        double startDelay = 0.0;
+
+        SampleIndex samples;
+        std::vector<Chunk> chunks;
+        int64_t sampleBytes = 0;
+        uint64_t mediaDuration = 0;
+        // 分片之间超过一个样本时长的空隙
+        int64_t gaps = 0;
+        double gapSeconds = 0.0;
+        // 按解码顺序串联所有样本的CRC32C
+        uint32_t sampleChecksum = 0;
+    };
+
+    struct Input
+    {
+        std::string path;
+        std::unique_ptr<IsoBmffReader> reader;
+        size_t firstTrack = 0;
+        size_t trackCount = 0;
+        // 各轨道trex中的默认值
+        std::map<uint32_t, TrackFragmentDefaults> fragmentDefaults;
+        std::unique_ptr<RangeChecksum> checksum;
+        // 输入时间轴到输出时间轴的平移量（秒）
+        double timeShift = 0.0;
+    };
+
+    std::vector<Input> inputs;
+    std::vector<Track> tracks;
+    bool alignStartTimes = true;
+    std::vector<double> inputOffsets;
+    int64_t totalSampleBytes = 0;
+    int64_t outputBytes = 0;
+    bool computeChecksums = false;
+    bool computeInputChecksums = false;
+    uint32_t outputChecksum = 0;
+    std::string lastError;
+    ProgressCallback progressCallback;
+    const std::atomic<bool> *cancelFlag = nullptr;
+    // 解析traf时复用的缓冲
+    TrackFragment trackFragment;
+
+    bool parseInit(Input &input, int inputIndex, const BoxHeader &moov);
+    bool parseTrak(IsoBmffReader &reader, const BoxHeader &trak, Track &track);
+    void parseEditList(IsoBmffReader &reader, const BoxHeader &trak, uint32_t movieTimescale, Track &track);
+    bool parseMoof(Input &input, const BoxHeader &moof);
+    bool parseTraf(Input &input, const BoxHeader &moof, const uint8_t *data, size_t size, int64_t &dataEnd);
+    bool parseTrun(Input &input, Track &track, const TrackRun &run);
+
+    /**
+     * 按解码时间交错排列各轨道的块并分配输出位置
+     * @param mdatPayloadOffset mdat内容在输出文件中的起始位置
+     * @return 块的输出顺序（轨道序号、块序号）
+     */
+    std::vector<std::pair<size_t, size_t>> layoutChunks(int64_t mdatPayloadOffset);
+
+    bool copyChunks(std::FILE *output, const std::vector<std::pair<size_t, size_t>> &order);
+
+    /**
+     * 写出数据，开启校验时同时累计输出文件的校验和
+     */
+    bool writeOutput(std::FILE *output, const void *data, size_t size);
+
+    void buildMoov(std::vector<uint8_t> &moov) const;
+    void buildTrak(std::vector<uint8_t> &out, const Track &track, uint32_t trackId, uint32_t movieTimescale) const;
+    void buildStbl(std::vector<uint8_t> &out, const Track &track) const;
+
+    void setError(const std::string &error) { lastError = error; }
+};
+
+#endif // NATIVE_MP4_REMUXER_H
@@ -0,0 +1,243 @@
+#include "PacketTap.h"
+#include <algorithm>
+#include <chrono>
+
+// 等待队列空间时检查取消标志的间隔
+static const std::chrono::milliseconds kCancelPollInterval(50);
+
+PacketBatch::~PacketBatch()
+{
+    for (AVPacket *packet : packets)
+    {
+        av_packet_free(&packet);
+    }
+}
+
+bool PacketBatch::append(const AVPacket *packet)
+{
+    AVPacket *reference = av_packet_alloc();
+    if (!reference)
+    {
+        return false;
+    }
+    // 有引用计数的数据包只增加引用，不复制负载
+    if (av_packet_ref(reference, packet) < 0)
+    {
+        av_packet_free(&reference);
+        return false;
+    }
+    packets.push_back(reference);
+    streamIndexes.push_back(packet->stream_index);
+    pts.push_back(packet->pts);
+    dts.push_back(packet->dts);
+    durations.push_back(packet->duration);
+    flags.push_back(packet->flags);
+    bytes += packet->size;
+    return true;
+}
+
+PacketTap::PacketTap(size_t batchPackets, size_t maxQueuedBatches)
+    : batchPackets(std::max<size_t>(1, batchPackets)), maxQueuedBatches(std::max<size_t>(1, maxQueuedBatches))
+{
+}
+
+void PacketTap::setStreams(const std::vector<TapStream> &streams)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    this->streams = streams;
+    haveStreams = true;
+    queueChanged.notify_all();
+}
+
+void PacketTap::setStreams(const AVFormatContext *formatContext)
+{
+    std::vector<TapStream> streams;
+    for (unsigned int i = 0; i < formatContext->nb_streams; i++)
+    {
+        const AVStream *stream = formatContext->streams[i];
+        TapStream tapStream;
+        tapStream.index = (int)i;
+        switch (stream->codecpar->codec_type)
+        {
+        case AVMEDIA_TYPE_VIDEO: tapStream.mediaType = "video"; break;
+        case AVMEDIA_TYPE_AUDIO: tapStream.mediaType = "audio"; break;
+        case AVMEDIA_TYPE_SUBTITLE: tapStream.mediaType = "subtitle"; break;
+        case AVMEDIA_TYPE_DATA: tapStream.mediaType = "data"; break;
+        default: tapStream.mediaType = "other"; break;
+        }
+        tapStream.codecName = avcodec_get_name(stream->codecpar->codec_id);
+        tapStream.timeBaseNum = stream->time_base.num;
+        tapStream.timeBaseDen = stream->time_base.den;
+        streams.push_back(tapStream);
+    }
+    setStreams(streams);
+}
+
+bool PacketTap::push(const AVPacket *packet)
+{
+    if (!current)
+    {
+        current.reset(new PacketBatch());
+    }
+    if (!current->append(packet))
+    {
+        return false;
+    }
+    if (current->size() < batchPackets)
+    {
+        return true;
+    }
+    return flush();
+}
+
+bool PacketTap::flush()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    while (!closed && queue.size() >= maxQueuedBatches)
+    {
+        if (isCancelled())
+        {
+            current.reset();
+            return false;
+        }
+        queueChanged.wait_for(lock, kCancelPollInterval);
+    }
+    if (closed)
+    {
+        current.reset();
+        return false;
+    }
+    if (current && current->size() > 0)
+    {
+        queue.push_back(std::move(current));
+        queueChanged.notify_all();
+    }
+    current.reset();
+    return true;
+}
+
+void PacketTap::finish(const std::string &error)
+{
+    flush();
+    std::lock_guard<std::mutex> lock(mutex);
+    this->error = error;
+    finished = true;
+    queueChanged.notify_all();
+}
+
+bool PacketTap::waitStreams(std::vector<TapStream> &streams)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    queueChanged.wait(lock, [this]() { return haveStreams || finished || closed; });
+    streams = this->streams;
+    return haveStreams;
+}
+
+std::unique_ptr<PacketBatch> PacketTap::next()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    queueChanged.wait(lock, [this]() { return !queue.empty() || finished || closed; });
+    if (queue.empty())
+    {
+        return nullptr;
+    }
+    std::unique_ptr<PacketBatch> batch = std::move(queue.front());
+    queue.pop_front();
+    queueChanged.notify_all();
+    return batch;
+}
+
+void PacketTap::close()
+{
+    std::deque<std::unique_ptr<PacketBatch>> dropped;
+    std::lock_guard<std::mutex> lock(mutex);
+    closed = true;
+    dropped.swap(queue);
+    queueChanged.notify_all();
+}
+
+bool PacketTap::isFinished() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return finished;
+}
+
+std::string PacketTap::getError() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return error;
+}
+
+PacketDemuxer::PacketDemuxer(const std::string &path, std::shared_ptr<PacketTap> tap)
+    : tap(std::move(tap))
+{
+    this->tap->setCancelFlag(&cancelRequested);
+    worker = std::thread(&PacketDemuxer::run, this, path);
+}
+
+PacketDemuxer::~PacketDemuxer()
+{
+    cancelRequested = true;
+    tap->close();
+    if (worker.joinable())
+    {
+        worker.join();
+    }
+}
+
+int PacketDemuxer::interruptCallback(void *opaque)
+{
+    return static_cast<PacketDemuxer *>(opaque)->cancelRequested ? 1 : 0;
+}
+
+void PacketDemuxer::run(const std::string &path)
+{
+    AVFormatContext *formatContext = avformat_alloc_context();
+    if (!formatContext)
+    {
+        tap->finish("Out of memory");
+        return;
+    }
+    formatContext->interrupt_callback.callback = interruptCallback;
+    formatContext->interrupt_callback.opaque = this;
+    if (avformat_open_input(&formatContext, path.c_str(), nullptr, nullptr) < 0)
+    {
+        tap->finish("Failed to open input file: " + path);
+        return;
+    }
+    if (avformat_find_stream_info(formatContext, nullptr) < 0)
+    {
+        avformat_close_input(&formatContext);
+        tap->finish("Failed to read stream information: " + path);
+        return;
+    }
+    tap->setStreams(formatContext);
+
+    std::string error;
+    AVPacket *packet = av_packet_alloc();
+    if (!packet)
+    {
+        error = "Out of memory";
+    }
+    while (packet)
+    {
+        int result = av_read_frame(formatContext, packet);
+        if (result < 0)
+        {
+            if (result != AVERROR_EOF)
+            {
+                error = cancelRequested ? "Demux cancelled" : "Failed to read packet: " + path;
+            }
+            break;
+        }
+        bool accepted = tap->push(packet);
+        av_packet_unref(packet);
+        if (!accepted)
+        {
+            break;
+        }
+    }
+    av_packet_free(&packet);
+    avformat_close_input(&formatContext);
+    tap->finish(error);
+}
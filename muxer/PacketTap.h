@@ -0,0 +1,198 @@
+#ifndef PACKET_TAP_H
+#define PACKET_TAP_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+extern "C"
+{
+#include <libavformat/avformat.h>
+}
+
+/**
+ * 分接的流信息（时间戳的时间基为timeBaseNum/timeBaseDen）
+ */
+struct TapStream
+{
+    int index = 0;
+    // video / audio / subtitle / data / other
+    std::string mediaType;
+    std::string codecName;
+    int timeBaseNum = 0;
+    int timeBaseDen = 1;
+};
+
+/**
+ * 一批数据包
+ * 时间戳等字段按列存放在连续数组中；负载不复制，持有数据包的引用直到批次释放
+ */
+class PacketBatch
+{
+public:
+    PacketBatch() = default;
+    ~PacketBatch();
+
+    PacketBatch(const PacketBatch &) = delete;
+    PacketBatch &operator=(const PacketBatch &) = delete;
+
+    size_t size() const { return packets.size(); }
+    int64_t getBytes() const { return bytes; }
+
+    const std::vector<int32_t> &getStreamIndexes() const { return streamIndexes; }
+    const std::vector<int64_t> &getPts() const { return pts; }
+    const std::vector<int64_t> &getDts() const { return dts; }
+    const std::vector<int64_t> &getDurations() const { return durations; }
+    const std::vector<int32_t> &getFlags() const { return flags; }
+
+    /**
+     * 第i个数据包的负载
+     */
+    const uint8_t *getData(size_t i) const { return packets[i]->data; }
+    int getSize(size_t i) const { return packets[i]->size; }
+
+private:
+    friend class PacketTap;
+
+    std::vector<AVPacket *> packets;
+    std::vector<int32_t> streamIndexes;
+    std::vector<int64_t> pts;
+    std::vector<int64_t> dts;
+    std::vector<int64_t> durations;
+    std::vector<int32_t> flags;
+    int64_t bytes = 0;
+
+    /**
+     * 引用数据包并追加到批次
+     * @return 引用失败（内存不足）返回false
+     */
+    bool append(const AVPacket *packet);
+};
+
+/**
+ * 数据包分接：合并（或解封装）线程写出数据包的同时，把数据包的引用成批交给另一个线程
+ * 队列有上限，消费者跟不上时生产者等待；消费者调用close()后生产者不再等待并丢弃数据包。
+ * 每个实例只用于一次合并或解封装
+ */
+class PacketTap
+{
+public:
+    /**
+     * @param batchPackets 每批的数据包数量
+     * @param maxQueuedBatches 队列中最多等待的批次数
+     */
+    explicit PacketTap(size_t batchPackets = 64, size_t maxQueuedBatches = 16);
+
+    PacketTap(const PacketTap &) = delete;
+    PacketTap &operator=(const PacketTap &) = delete;
+
+    // 以下由生产者调用
+
+    /**
+     * 设置流信息（在第一个数据包之前调用）
+     */
+    void setStreams(const std::vector<TapStream> &streams);
+
+    /**
+     * 按AVFormatContext的流设置流信息
+     */
+    void setStreams(const AVFormatContext *formatContext);
+
+    /**
+     * 等待队列空间时检查的取消标志，置位后push不再等待
+     */
+    void setCancelFlag(const std::atomic<bool> *cancelFlag) { this->cancelFlag = cancelFlag; }
+
+    /**
+     * 引用数据包（不复制负载）加入当前批次，批次满时放入队列，队列满时等待
+     * @return 消费者已关闭或已取消时返回false（数据包被丢弃）
+     */
+    bool push(const AVPacket *packet);
+
+    /**
+     * 放入未满的批次并结束，消费者取完剩余批次后得到空指针
+     * @param error 生产者失败时的错误信息，成功时为空
+     */
+    void finish(const std::string &error = std::string());
+
+    // 以下由消费者调用
+
+    /**
+     * 等待流信息
+     * @return 在结束前得到流信息返回true
+     */
+    bool waitStreams(std::vector<TapStream> &streams);
+
+    /**
+     * 取出下一批，队列为空时等待
+     * @return 结束后返回空指针
+     */
+    std::unique_ptr<PacketBatch> next();
+
+    /**
+     * 消费者不再读取，丢弃队列中的批次
+     */
+    void close();
+
+    bool isFinished() const;
+
+    /**
+     * 生产者的错误信息，finish之后有效
+     */
+    std::string getError() const;
+
+private:
+    size_t batchPackets;
+    size_t maxQueuedBatches;
+    const std::atomic<bool> *cancelFlag = nullptr;
+
+    // 只由生产者访问
+    std::unique_ptr<PacketBatch> current;
+
+    mutable std::mutex mutex;
+    std::condition_variable queueChanged;
+    std::deque<std::unique_ptr<PacketBatch>> queue;
+    std::vector<TapStream> streams;
+    bool haveStreams = false;
+    bool finished = false;
+    bool closed = false;
+    std::string error;
+
+    bool isCancelled() const { return cancelFlag && *cancelFlag; }
+
+    /**
+     * 把当前批次放入队列
+     * @return 消费者已关闭或已取消时返回false
+     */
+    bool flush();
+};
+
+/**
+ * 在后台线程中用libavformat解封装文件，把所有数据包（输入流索引和时间基）送入PacketTap
+ * 析构时关闭分接并等待线程退出
+ */
+class PacketDemuxer
+{
+public:
+    PacketDemuxer(const std::string &path, std::shared_ptr<PacketTap> tap);
+    ~PacketDemuxer();
+
+    PacketDemuxer(const PacketDemuxer &) = delete;
+    PacketDemuxer &operator=(const PacketDemuxer &) = delete;
+
+private:
+    std::shared_ptr<PacketTap> tap;
+    std::atomic<bool> cancelRequested{false};
+    std::thread worker;
+
+    static int interruptCallback(void *opaque);
+
+    void run(const std::string &path);
+};
+
+#endif // PACKET_TAP_H
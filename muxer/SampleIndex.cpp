@@ -0,0 +1,146 @@
+#include "SampleIndex.h"
+#include <climits>
+
+void RunLengthStream::append(uint32_t value)
+{
+    if (runCount > 0 && value == runValue && runCount < UINT32_MAX)
+    {
+        runCount++;
+        return;
+    }
+    flush();
+    runValue = value;
+    runCount = 1;
+}
+
+bool RunLengthStream::replaceLast(uint32_t value)
+{
+    if (runCount == 0)
+    {
+        return false;
+    }
+    if (runCount == 1)
+    {
+        runValue = value;
+        return true;
+    }
+    runCount--;
+    append(value);
+    return true;
+}
+
+void RunLengthStream::flush()
+{
+    if (runCount == 0)
+    {
+        return;
+    }
+    int64_t delta = (int64_t)runValue - (int64_t)encodedValue;
+    uint64_t zigzag = ((uint64_t)delta << 1) ^ (uint64_t)(delta >> 63);
+    // 最低位标记是否带有长度
+    writeVarint((zigzag << 1) | (runCount > 1 ? 1 : 0));
+    if (runCount > 1)
+    {
+        writeVarint(runCount - 1);
+    }
+    encodedValue = runValue;
+    runs++;
+    runCount = 0;
+}
+
+void RunLengthStream::writeVarint(uint64_t value)
+{
+    while (value >= 0x80)
+    {
+        bytes.push_back((uint8_t)(value | 0x80));
+        value >>= 7;
+    }
+    bytes.push_back((uint8_t)value);
+}
+
+uint64_t RunLengthStream::readVarint(size_t &position) const
+{
+    uint64_t value = 0;
+    int shift = 0;
+    while (position < bytes.size())
+    {
+        uint8_t byte = bytes[position++];
+        value |= (uint64_t)(byte & 0x7f) << shift;
+        if (!(byte & 0x80))
+        {
+            break;
+        }
+        shift += 7;
+    }
+    return value;
+}
+
+bool SampleIndex::append(uint32_t size, uint32_t duration, int32_t compositionOffset, bool sync)
+{
+    if (sampleCount == UINT32_MAX)
+    {
+        return false;
+    }
+    if (sampleCount == 0)
+    {
+        firstSize = size;
+    }
+    sampleCount++;
+
+    sizes.append(size);
+    durations.append(duration);
+    compositionOffsets.append((uint32_t)compositionOffset);
+    nonZeroCompositionOffsets |= compositionOffset != 0;
+    negativeCompositionOffsets |= compositionOffset < 0;
+
+    if (allSync && !sync)
+    {
+        // 第一次出现非关键帧时才补上之前的关键帧序号
+        allSync = false;
+        for (uint32_t i = 1; i < sampleCount; i++)
+        {
+            appendSyncSample(i);
+        }
+    }
+    else if (!allSync && sync)
+    {
+        appendSyncSample(sampleCount);
+    }
+    return true;
+}
+
+bool SampleIndex::extendLastDuration(uint64_t extra)
+{
+    if (sampleCount == 0 || durations.getLastValue() + extra > UINT32_MAX)
+    {
+        return false;
+    }
+    return durations.replaceLast((uint32_t)(durations.getLastValue() + extra));
+}
+
+void SampleIndex::appendSyncSample(uint32_t sample)
+{
+    uint32_t delta = sample - lastSyncSample;
+    while (delta >= 0x80)
+    {
+        syncDeltas.push_back((uint8_t)(delta | 0x80));
+        delta >>= 7;
+    }
+    syncDeltas.push_back((uint8_t)delta);
+    lastSyncSample = sample;
+    syncSampleCount++;
+}
+
+size_t SampleIndex::getMemoryBytes() const
+{
+    return sizeof(*this) + sizes.getMemoryBytes() + durations.getMemoryBytes() + compositionOffsets.getMemoryBytes() +
+           syncDeltas.capacity();
+}
+
+void SampleIndex::shrinkToFit()
+{
+    sizes.shrinkToFit();
+    durations.shrinkToFit();
+    compositionOffsets.shrinkToFit();
+    syncDeltas.shrink_to_fit();
+}
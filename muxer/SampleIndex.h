@@ -0,0 +1,177 @@
+#ifndef SAMPLE_INDEX_H
+#define SAMPLE_INDEX_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/**
+ * 行程编码的数值序列
+ * 相同取值的连续项合并为一段，每段只保存与前一段取值之差（zigzag变长整数）和长度；
+ * 长度为1的段不保存长度。最后一段在追加到不同取值之前不编码，便于修改最后一项
+ */
+class RunLengthStream
+{
+public:
+    void append(uint32_t value);
+
+    /**
+     * 修改最后一项的取值
+     * @return 序列为空时返回false
+     */
+    bool replaceLast(uint32_t value);
+
+    uint32_t getLastValue() const { return runValue; }
+
+    /**
+     * 段数（即stts/ctts的条目数）
+     */
+    uint32_t getRunCount() const { return runs + (runCount > 0 ? 1 : 0); }
+
+    size_t getMemoryBytes() const { return bytes.capacity(); }
+    void shrinkToFit() { bytes.shrink_to_fit(); }
+
+    /**
+     * 依次访问每一段
+     * @param visit 参数为段长度和取值
+     */
+    template <typename Visitor>
+    void forEachRun(Visitor visit) const
+    {
+        size_t position = 0;
+        uint32_t value = 0;
+        while (position < bytes.size())
+        {
+            uint64_t head = readVarint(position);
+            uint32_t count = 1;
+            if (head & 1)
+            {
+                count = (uint32_t)readVarint(position) + 1;
+            }
+            uint64_t zigzag = head >> 1;
+            int64_t delta = (int64_t)(zigzag >> 1) ^ -(int64_t)(zigzag & 1);
+            value = (uint32_t)((int64_t)value + delta);
+            visit(count, value);
+        }
+        if (runCount > 0)
+        {
+            visit(runCount, runValue);
+        }
+    }
+
+private:
+    std::vector<uint8_t> bytes;
+    // 已编码的最后一段的取值，作为下一段差值的基准
+    uint32_t encodedValue = 0;
+    uint32_t runs = 0;
+    // 尚未编码的最后一段
+    uint32_t runValue = 0;
+    uint32_t runCount = 0;
+
+    void flush();
+    void writeVarint(uint64_t value);
+    uint64_t readVarint(size_t &position) const;
+};
+
+/**
+ * 原生封装路径的紧凑样本表
+ * 样本大小、时长、合成时间偏移各用一个RunLengthStream，关键帧序号用差值变长整数保存；
+ * 在所有样本都是关键帧之前（如音频）不保存关键帧序号。
+ * 时长和合成时间偏移的各段与stts/ctts条目一一对应，写moov时直接输出
+ */
+class SampleIndex
+{
+public:
+    /**
+     * 追加一个样本
+     * @param size 样本字节数
+     * @param duration 样本时长（媒体时间刻度）
+     * @param compositionOffset 合成时间偏移
+     * @param sync 是否为关键帧
+     * @return 样本数达到上限时返回false
+     */
+    bool append(uint32_t size, uint32_t duration, int32_t compositionOffset, bool sync);
+
+    /**
+     * 延长最后一个样本的时长（分片之间有空隙时）
+     * @return 没有样本或时长溢出时返回false
+     */
+    bool extendLastDuration(uint64_t extra);
+
+    uint32_t getSampleCount() const { return sampleCount; }
+    bool isEmpty() const { return sampleCount == 0; }
+    bool hasCompositionOffsets() const { return nonZeroCompositionOffsets; }
+    bool hasNegativeCompositionOffsets() const { return negativeCompositionOffsets; }
+    bool isAllSync() const { return allSync; }
+    uint32_t getSyncSampleCount() const { return allSync ? sampleCount : syncSampleCount; }
+
+    /**
+     * 所有样本大小相同时可只写stsz的sample_size
+     */
+    bool isConstantSize() const { return sizes.getRunCount() <= 1; }
+    uint32_t getFirstSize() const { return firstSize; }
+
+    const RunLengthStream &getSizes() const { return sizes; }
+    const RunLengthStream &getDurations() const { return durations; }
+    const RunLengthStream &getCompositionOffsets() const { return compositionOffsets; }
+
+    /**
+     * 依次访问关键帧序号（从1开始）
+     */
+    template <typename Visitor>
+    void forEachSyncSample(Visitor visit) const
+    {
+        if (allSync)
+        {
+            for (uint32_t i = 1; i <= sampleCount; i++)
+            {
+                visit(i);
+            }
+            return;
+        }
+        size_t position = 0;
+        uint32_t sample = 0;
+        while (position < syncDeltas.size())
+        {
+            uint32_t delta = 0;
+            int shift = 0;
+            uint8_t byte;
+            do
+            {
+                byte = syncDeltas[position++];
+                delta |= (uint32_t)(byte & 0x7f) << shift;
+                shift += 7;
+            } while (byte & 0x80);
+            sample += delta;
+            visit(sample);
+        }
+    }
+
+    /**
+     * 样本表占用的内存（字节）
+     */
+    size_t getMemoryBytes() const;
+
+    /**
+     * 所有样本追加完成后释放多余的预留空间
+     */
+    void shrinkToFit();
+
+private:
+    RunLengthStream sizes;
+    RunLengthStream durations;
+    RunLengthStream compositionOffsets;
+    // 相邻关键帧序号之差
+    std::vector<uint8_t> syncDeltas;
+    uint32_t lastSyncSample = 0;
+    uint32_t syncSampleCount = 0;
+    uint32_t sampleCount = 0;
+    uint32_t firstSize = 0;
+    bool allSync = true;
+    bool nonZeroCompositionOffsets = false;
+    bool negativeCompositionOffsets = false;
+
+    void appendSyncSample(uint32_t sample);
+};
+
+#endif // SAMPLE_INDEX_H
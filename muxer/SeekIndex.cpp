@@ -0,0 +1,496 @@
+#include "SeekIndex.h"
+#include "FileClone.h"
+#include "IntegrityCheck.h"
+#include <algorithm>
+#include <cstring>
+
+const char *const kSidxMovflags = "+frag_keyframe+empty_moov+default_base_moof+global_sidx";
+
+static const char kMagic[8] = {'A', 'V', 'M', 'I', 'D', 'X', '1', '\0'};
+static const size_t kHeaderSize = 24;
+static const size_t kPointSize = 16;
+static const size_t kSmallBoxLimit = 256;
+static const size_t kElstLimit = 64 * 1024;
+// 单个样本表和moof的长度上限
+static const size_t kTableLimit = 256 * 1024 * 1024;
+static const size_t kMoofLimit = 64 * 1024 * 1024;
+
+// sample_is_non_sync_sample或sample_depends_on为1
+static const uint32_t kSampleNotKeyframe = 0x00010000 | 0x01000000;
+
+static void putLE32(std::vector<uint8_t> &out, uint32_t value)
+{
+    for (int i = 0; i < 4; i++)
+    {
+        out.push_back((uint8_t)(value >> (8 * i)));
+    }
+}
+
+static void putLE64(std::vector<uint8_t> &out, uint64_t value)
+{
+    putLE32(out, (uint32_t)value);
+    putLE32(out, (uint32_t)(value >> 32));
+}
+
+static uint32_t readLE32(const uint8_t *p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint64_t readLE64(const uint8_t *p)
+{
+    return (uint64_t)readLE32(p) | ((uint64_t)readLE32(p + 4) << 32);
+}
+
+bool SeekIndex::build(const std::string &path)
+{
+    points.clear();
+    fragmentDefaults.clear();
+    timescale = 0;
+    trackIndex = -1;
+    lastError.clear();
+
+    bool success = parseFile(path);
+    reader.close();
+    if (!success)
+    {
+        points.clear();
+    }
+    return success;
+}
+
+bool SeekIndex::parseFile(const std::string &path)
+{
+    if (!reader.open(path))
+    {
+        setError("Failed to open " + path);
+        return false;
+    }
+
+    int64_t fileSize = reader.getFileSize();
+    Track track;
+    bool haveMoov = false;
+    BoxHeader box;
+    for (int64_t offset = 0; offset < fileSize; offset = box.end())
+    {
+        if (!reader.readBoxHeader(offset, fileSize, box))
+        {
+            setError(offset == 0 ? "Not an MP4/MOV file: " + path : "Invalid or truncated box in " + path);
+            return false;
+        }
+        if (box.type == boxType("moov"))
+        {
+            if (haveMoov)
+            {
+                setError("Multiple moov boxes in " + path);
+                return false;
+            }
+            if (!parseMoov(box, track))
+            {
+                return false;
+            }
+            haveMoov = true;
+        }
+        else if (box.type == boxType("moof"))
+        {
+            if (!haveMoov)
+            {
+                setError("moof before moov in " + path);
+                return false;
+            }
+            if (!readFragment(box, track))
+            {
+                return false;
+            }
+        }
+    }
+    if (!haveMoov)
+    {
+        setError("No moov box in " + path);
+        return false;
+    }
+    timescale = track.timescale;
+    return true;
+}
+
+bool SeekIndex::parseMoov(const BoxHeader &moov, Track &track)
+{
+    std::vector<uint8_t> payload;
+    uint32_t movieTimescale = 0;
+    BoxHeader mvhd;
+    if (reader.findChild(moov.payloadOffset(), moov.end(), boxType("mvhd"), mvhd) &&
+        reader.readPayload(mvhd, kSmallBoxLimit, payload) && payload.size() >= 24)
+    {
+        movieTimescale = readBE32(&payload[payload[0] == 1 ? 20 : 12]);
+    }
+
+    // 分片默认值（moov中可能没有mvex）
+    BoxHeader mvex;
+    if (reader.findChild(moov.payloadOffset(), moov.end(), boxType("mvex"), mvex))
+    {
+        BoxHeader trex;
+        for (int64_t offset = mvex.payloadOffset(); reader.readBoxHeader(offset, mvex.end(), trex);
+             offset = trex.end())
+        {
+            if (trex.type == boxType("trex") && reader.readPayload(trex, kSmallBoxLimit, payload))
+            {
+                parseTrex(payload.data(), payload.size(), fragmentDefaults);
+            }
+        }
+    }
+
+    // 轨道与流的顺序一致，取第一个视频轨道
+    int index = 0;
+    BoxHeader trak;
+    for (int64_t offset = moov.payloadOffset(); reader.readBoxHeader(offset, moov.end(), trak); offset = trak.end())
+    {
+        if (trak.type != boxType("trak"))
+        {
+            continue;
+        }
+        bool isVideo = false;
+        if (!parseTrak(trak, movieTimescale, track, isVideo))
+        {
+            return false;
+        }
+        if (isVideo)
+        {
+            trackIndex = index;
+            return true;
+        }
+        index++;
+    }
+    setError("No video track");
+    return false;
+}
+
+bool SeekIndex::parseTrak(const BoxHeader &trak, uint32_t movieTimescale, Track &track, bool &isVideo)
+{
+    std::vector<uint8_t> payload;
+    BoxHeader tkhd, mdia, mdhd, hdlr, minf, stbl;
+
+    if (!reader.findChild(trak.payloadOffset(), trak.end(), boxType("mdia"), mdia) ||
+        !reader.findChild(mdia.payloadOffset(), mdia.end(), boxType("hdlr"), hdlr) ||
+        !reader.readPayload(hdlr, kSmallBoxLimit, payload) || payload.size() < 12)
+    {
+        setError("Invalid hdlr");
+        return false;
+    }
+    isVideo = readBE32(&payload[8]) == boxType("vide");
+    if (!isVideo)
+    {
+        return true;
+    }
+
+    if (!reader.findChild(trak.payloadOffset(), trak.end(), boxType("tkhd"), tkhd) ||
+        !reader.readPayload(tkhd, kSmallBoxLimit, payload) || payload.size() < 24)
+    {
+        setError("Invalid tkhd");
+        return false;
+    }
+    track.trackId = readBE32(&payload[payload[0] == 1 ? 20 : 12]);
+
+    if (!reader.findChild(mdia.payloadOffset(), mdia.end(), boxType("mdhd"), mdhd) ||
+        !reader.readPayload(mdhd, kSmallBoxLimit, payload) || payload.size() < 24 ||
+        (payload[0] == 1 && payload.size() < 36))
+    {
+        setError("Invalid mdhd");
+        return false;
+    }
+    track.timescale = readBE32(&payload[payload[0] == 1 ? 20 : 12]);
+    if (track.timescale == 0)
+    {
+        setError("Invalid timescale");
+        return false;
+    }
+
+    // 编辑列表：开头的空编辑推迟显示，媒体起点之前的部分不显示
+    BoxHeader edts, elst;
+    if (reader.findChild(trak.payloadOffset(), trak.end(), boxType("edts"), edts) &&
+        reader.findChild(edts.payloadOffset(), edts.end(), boxType("elst"), elst) &&
+        reader.readPayload(elst, kElstLimit, payload) && payload.size() >= 8)
+    {
+        bool version1 = payload[0] == 1;
+        size_t entrySize = version1 ? 20 : 12;
+        uint32_t entryCount = readBE32(&payload[4]);
+        for (uint32_t i = 0; i < entryCount && 8 + (i + 1) * entrySize <= payload.size(); i++)
+        {
+            const uint8_t *entry = &payload[8 + i * entrySize];
+            uint64_t segmentDuration = version1 ? readBE64(entry) : readBE32(entry);
+            int64_t mediaTime = version1 ? (int64_t)readBE64(entry + 8) : (int32_t)readBE32(entry + 4);
+            if (mediaTime == -1)
+            {
+                if (movieTimescale > 0)
+                {
+                    track.ptsShift += (int64_t)(segmentDuration * track.timescale / movieTimescale);
+                }
+                continue;
+            }
+            track.ptsShift -= mediaTime;
+            break;
+        }
+    }
+
+    if (!reader.findChild(mdia.payloadOffset(), mdia.end(), boxType("minf"), minf) ||
+        !reader.findChild(minf.payloadOffset(), minf.end(), boxType("stbl"), stbl))
+    {
+        setError("Missing stbl");
+        return false;
+    }
+    return readSampleTables(stbl, track);
+}
+
+bool SeekIndex::readSampleTables(const BoxHeader &stbl, Track &track)
+{
+    auto readTable = [this, &stbl](const char *type, std::vector<uint8_t> &table) {
+        BoxHeader box;
+        return reader.findChild(stbl.payloadOffset(), stbl.end(), boxType(type), box) &&
+               reader.readPayload(box, kTableLimit, table) && table.size() >= 8;
+    };
+
+    std::vector<uint8_t> stsz, stsc, stco, stts, ctts, stss;
+    bool chunkOffsets64 = false;
+    if (!readTable("stco", stco))
+    {
+        chunkOffsets64 = readTable("co64", stco);
+    }
+    if (!readTable("stsz", stsz) || stsz.size() < 12 || !readTable("stsc", stsc) || !readTable("stts", stts) ||
+        stco.size() < 8)
+    {
+        setError("Missing sample tables");
+        return false;
+    }
+    bool haveCtts = readTable("ctts", ctts);
+    // 没有stss时所有样本都是关键帧
+    bool haveStss = readTable("stss", stss);
+
+    uint32_t sampleSize = readBE32(&stsz[4]);
+    uint32_t sampleCount = readBE32(&stsz[8]);
+    uint32_t chunkCount = readBE32(&stco[4]);
+    uint32_t stscCount = readBE32(&stsc[4]);
+    uint32_t sttsCount = readBE32(&stts[4]);
+    uint32_t cttsCount = haveCtts ? readBE32(&ctts[4]) : 0;
+    uint32_t stssCount = haveStss ? readBE32(&stss[4]) : 0;
+    if ((sampleSize == 0 && stsz.size() < 12 + 4 * (uint64_t)sampleCount) ||
+        stco.size() < 8 + (chunkOffsets64 ? 8 : 4) * (uint64_t)chunkCount ||
+        stsc.size() < 8 + 12 * (uint64_t)stscCount || stts.size() < 8 + 8 * (uint64_t)sttsCount ||
+        ctts.size() < (haveCtts ? 8 + 8 * (uint64_t)cttsCount : 0) ||
+        stss.size() < (haveStss ? 8 + 4 * (uint64_t)stssCount : 0) || (sampleCount > 0 && stscCount == 0))
+    {
+        setError("Truncated sample tables");
+        return false;
+    }
+
+    // 按块依次走过所有样本，记录关键帧的时间和位置
+    uint32_t stscIndex = 0;
+    uint32_t sttsIndex = 0, sttsLeft = 0, delta = 0;
+    uint32_t cttsIndex = 0, cttsLeft = 0;
+    int32_t compositionOffset = 0;
+    uint32_t stssIndex = 0;
+    uint64_t decodeTime = 0;
+    uint32_t sample = 0;
+    for (uint32_t chunk = 1; chunk <= chunkCount && sample < sampleCount; chunk++)
+    {
+        while (stscIndex + 1 < stscCount && readBE32(&stsc[8 + 12 * (stscIndex + 1)]) <= chunk)
+        {
+            stscIndex++;
+        }
+        uint32_t samplesPerChunk = readBE32(&stsc[8 + 12 * stscIndex + 4]);
+        int64_t offset = chunkOffsets64 ? (int64_t)readBE64(&stco[8 + 8 * (chunk - 1)])
+                                        : (int64_t)readBE32(&stco[8 + 4 * (chunk - 1)]);
+        for (uint32_t i = 0; i < samplesPerChunk && sample < sampleCount; i++, sample++)
+        {
+            while (sttsLeft == 0 && sttsIndex < sttsCount)
+            {
+                sttsLeft = readBE32(&stts[8 + 8 * sttsIndex]);
+                delta = readBE32(&stts[12 + 8 * sttsIndex]);
+                sttsIndex++;
+            }
+            while (cttsLeft == 0 && cttsIndex < cttsCount)
+            {
+                cttsLeft = readBE32(&ctts[8 + 8 * cttsIndex]);
+                compositionOffset = (int32_t)readBE32(&ctts[12 + 8 * cttsIndex]);
+                cttsIndex++;
+            }
+
+            bool sync = true;
+            if (haveStss)
+            {
+                while (stssIndex < stssCount && readBE32(&stss[8 + 4 * stssIndex]) < sample + 1)
+                {
+                    stssIndex++;
+                }
+                sync = stssIndex < stssCount && readBE32(&stss[8 + 4 * stssIndex]) == sample + 1;
+            }
+            if (sync)
+            {
+                SeekPoint point;
+                point.pts = (int64_t)decodeTime + compositionOffset + track.ptsShift;
+                point.offset = offset;
+                points.push_back(point);
+            }
+
+            offset += sampleSize != 0 ? sampleSize : readBE32(&stsz[12 + 4 * sample]);
+            decodeTime += delta;
+            sttsLeft = sttsLeft > 0 ? sttsLeft - 1 : 0;
+            cttsLeft = cttsLeft > 0 ? cttsLeft - 1 : 0;
+        }
+    }
+    track.nextDecodeTime = decodeTime;
+    return true;
+}
+
+bool SeekIndex::readFragment(const BoxHeader &moof, Track &track)
+{
+    std::vector<uint8_t> payload;
+    if (!reader.readPayload(moof, kMoofLimit, payload))
+    {
+        setError("Invalid moof");
+        return false;
+    }
+
+    // 没有显式基准偏移时，后一个traf的数据紧接前一个traf的数据
+    int64_t dataEnd = moof.offset;
+    size_t offset = 0;
+    uint32_t type;
+    const uint8_t *child;
+    size_t childSize;
+    while (nextBox(payload.data(), payload.size(), offset, type, child, childSize))
+    {
+        if (type == boxType("traf") && !readTraf(child, childSize, moof.offset, track, dataEnd))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool SeekIndex::readTraf(const uint8_t *data, size_t size, int64_t moofOffset, Track &track, int64_t &dataEnd)
+{
+    std::string error;
+    if (!parseTrackFragment(data, size, moofOffset, fragmentDefaults, dataEnd, trackFragment, error))
+    {
+        setError(error);
+        return false;
+    }
+    // 其他轨道的traf只用于推算数据位置
+    if (trackFragment.trackId != track.trackId)
+    {
+        return true;
+    }
+    if (trackFragment.haveDecodeTime)
+    {
+        track.nextDecodeTime = trackFragment.decodeTime;
+    }
+    for (const TrackRun &run : trackFragment.runs)
+    {
+        int64_t sampleOffset = run.dataOffset;
+        for (uint32_t i = 0; i < run.sampleCount; i++)
+        {
+            TrackRunSample sample = run.getSample(i);
+            if (!(sample.flags & kSampleNotKeyframe))
+            {
+                SeekPoint point;
+                point.pts = (int64_t)track.nextDecodeTime + sample.compositionOffset + track.ptsShift;
+                point.offset = sampleOffset;
+                points.push_back(point);
+            }
+            track.nextDecodeTime += sample.duration;
+            sampleOffset += sample.size;
+        }
+    }
+    return true;
+}
+
+bool SeekIndex::save(const std::string &path)
+{
+    std::vector<uint8_t> data(kMagic, kMagic + sizeof(kMagic));
+    data.reserve(kHeaderSize + points.size() * kPointSize + 4);
+    putLE32(data, timescale);
+    putLE32(data, (uint32_t)trackIndex);
+    putLE64(data, points.size());
+    for (const SeekPoint &point : points)
+    {
+        putLE64(data, (uint64_t)point.pts);
+        putLE64(data, (uint64_t)point.offset);
+    }
+    putLE32(data, crc32cUpdate(0, data.data(), data.size()));
+
+    // 写完整后再改名，读取方不会看到写了一半的索引
+    std::string temporaryPath = path + ".tmp";
+    std::FILE *file = openFileUtf8(temporaryPath, "wb");
+    if (!file)
+    {
+        setError("Failed to create " + temporaryPath);
+        return false;
+    }
+    bool success = std::fwrite(data.data(), 1, data.size(), file) == data.size();
+    if (std::fclose(file) != 0)
+    {
+        success = false;
+    }
+    if (!success || !renameFile(temporaryPath, path))
+    {
+        removeFile(temporaryPath);
+        setError("Failed to write " + path);
+        return false;
+    }
+    return true;
+}
+
+bool SeekIndex::load(const std::string &path)
+{
+    points.clear();
+    timescale = 0;
+    trackIndex = -1;
+    lastError.clear();
+
+    std::FILE *file = openFileUtf8(path, "rb");
+    if (!file)
+    {
+        setError("Failed to open " + path);
+        return false;
+    }
+    std::vector<uint8_t> data;
+    uint8_t buffer[64 * 1024];
+    size_t bytesRead;
+    while ((bytesRead = std::fread(buffer, 1, sizeof(buffer), file)) > 0)
+    {
+        data.insert(data.end(), buffer, buffer + bytesRead);
+    }
+    bool readError = std::ferror(file) != 0;
+    std::fclose(file);
+    if (readError)
+    {
+        setError("Failed to read " + path);
+        return false;
+    }
+
+    if (data.size() < kHeaderSize + 4 || std::memcmp(data.data(), kMagic, sizeof(kMagic)) != 0)
+    {
+        setError("Not a seek index: " + path);
+        return false;
+    }
+    uint64_t count = readLE64(&data[16]);
+    if (count > (data.size() - kHeaderSize - 4) / kPointSize || data.size() != kHeaderSize + count * kPointSize + 4)
+    {
+        setError("Truncated seek index: " + path);
+        return false;
+    }
+    if (crc32cUpdate(0, data.data(), data.size() - 4) != readLE32(&data[data.size() - 4]))
+    {
+        setError("Seek index checksum mismatch: " + path);
+        return false;
+    }
+
+    timescale = readLE32(&data[8]);
+    trackIndex = (int)readLE32(&data[12]);
+    points.resize((size_t)count);
+    for (size_t i = 0; i < points.size(); i++)
+    {
+        const uint8_t *entry = &data[kHeaderSize + i * kPointSize];
+        points[i].pts = (int64_t)readLE64(entry);
+        points[i].offset = (int64_t)readLE64(entry + 8);
+    }
+    return true;
+}
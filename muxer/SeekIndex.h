@@ -0,0 +1,95 @@
+#ifndef SEEK_INDEX_H
+#define SEEK_INDEX_H
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+#include "IsoBmff.h"
+
+/**
+ * 按关键帧分片并在文件开头写入全局sidx的movflags（libavformat的mov/mp4封装器）
+ */
+extern const char *const kSidxMovflags;
+
+/**
+ * 一个关键帧
+ */
+struct SeekPoint
+{
+    // 显示时间戳（轨道的时间刻度）
+    int64_t pts = 0;
+    // 关键帧数据在文件中的字节位置
+    int64_t offset = 0;
+};
+
+/**
+ * MP4/MOV文件视频轨道的关键帧索引，以及紧凑的二进制旁路文件
+ *
+ * 旁路文件格式（小端）：
+ *   0   8  "AVMIDX1\0"
+ *   8   4  时间刻度（pts的单位为1/时间刻度秒）
+ *   12  4  轨道序号（与输出流序号一致）
+ *   16  8  关键帧数量n
+ *   24  16*n  每个关键帧：int64 pts、int64 字节位置，按解码顺序
+ *   末尾 4  之前所有字节的CRC32C
+ */
+class SeekIndex
+{
+public:
+    /**
+     * 从文件的样本表读取第一个视频轨道的关键帧
+     * 普通文件只读取moov中的样本表，分片文件只读取各moof，都不读取样本数据
+     * @param path MP4/MOV文件路径
+     * @return 成功返回true，不是ISO-BMFF文件或没有视频轨道时返回false
+     */
+    bool build(const std::string &path);
+
+    /**
+     * 写出旁路文件（先写临时文件再改名）
+     */
+    bool save(const std::string &path);
+
+    /**
+     * 读取并校验旁路文件
+     */
+    bool load(const std::string &path);
+
+    const std::vector<SeekPoint> &getPoints() const { return points; }
+    uint32_t getTimescale() const { return timescale; }
+    int getTrackIndex() const { return trackIndex; }
+
+    std::string getLastError() const { return lastError; }
+
+private:
+    struct Track
+    {
+        uint32_t trackId = 0;
+        uint32_t timescale = 0;
+        // 编辑列表造成的显示时间平移（轨道时间刻度）
+        int64_t ptsShift = 0;
+        // 下一个样本的解码时间
+        uint64_t nextDecodeTime = 0;
+    };
+
+    IsoBmffReader reader;
+    std::vector<SeekPoint> points;
+    uint32_t timescale = 0;
+    int trackIndex = -1;
+    // 各轨道（track_ID）的分片默认值，没有显式基准偏移时计算其他轨道数据的位置也需要
+    std::map<uint32_t, TrackFragmentDefaults> fragmentDefaults;
+    // 解析traf时复用的缓冲
+    TrackFragment trackFragment;
+    std::string lastError;
+
+    bool parseFile(const std::string &path);
+    bool parseMoov(const BoxHeader &moov, Track &track);
+    bool parseTrak(const BoxHeader &trak, uint32_t movieTimescale, Track &track, bool &isVideo);
+    bool readSampleTables(const BoxHeader &stbl, Track &track);
+    bool readFragment(const BoxHeader &moof, Track &track);
+    bool readTraf(const uint8_t *data, size_t size, int64_t moofOffset, Track &track, int64_t &dataEnd);
+
+    void setError(const std::string &error) { lastError = error; }
+};
+
+#endif // SEEK_INDEX_H
@@ -0,0 +1,249 @@
+#include "SegmentWriter.h"
+#include "IsoBmff.h"
+#include <algorithm>
+
+static const int kBufferSize = 256 * 1024;
+// 排队等待写盘的数据上限，磁盘跟不上时封装器等待，避免无限占用内存
+static const int64_t kQueueLimit = 64LL * 1024 * 1024;
+
+SegmentWriter::~SegmentWriter()
+{
+    finish();
+}
+
+void SegmentWriter::install(AVFormatContext *formatContext)
+{
+    interruptCallback = formatContext->interrupt_callback;
+    formatContext->opaque = this;
+    formatContext->io_open = ioOpen;
+#if LIBAVFORMAT_VERSION_INT >= AV_VERSION_INT(59, 17, 100)
+    formatContext->io_close2 = ioClose2;
+#else
+    formatContext->io_close = ioClose;
+#endif
+
+    stopping = false;
+    worker = std::thread(&SegmentWriter::run, this);
+}
+
+int SegmentWriter::finish()
+{
+    // 封装器出错退出时可能留下未关闭的文件，关闭时还需要写线程写出剩余数据
+    while (!files.empty())
+    {
+        close(files.begin()->first);
+    }
+    stop();
+    return lastError.empty() ? 0 : -1;
+}
+
+int SegmentWriter::ioOpen(AVFormatContext *formatContext, AVIOContext **pb, const char *url, int flags,
+                          AVDictionary **options)
+{
+    SegmentWriter *writer = static_cast<SegmentWriter *>(formatContext->opaque);
+    // 封装器读取已有文件（如追加播放列表）时仍使用普通IO
+    if ((flags & AVIO_FLAG_READ) || !writer->worker.joinable())
+    {
+        return avio_open2(pb, url, flags, &writer->interruptCallback, options);
+    }
+    return writer->open(pb, url);
+}
+
+#if LIBAVFORMAT_VERSION_INT >= AV_VERSION_INT(59, 17, 100)
+int SegmentWriter::ioClose2(AVFormatContext *formatContext, AVIOContext *pb)
+{
+    return static_cast<SegmentWriter *>(formatContext->opaque)->close(pb);
+}
+#else
+void SegmentWriter::ioClose(AVFormatContext *formatContext, AVIOContext *pb)
+{
+    static_cast<SegmentWriter *>(formatContext->opaque)->close(pb);
+}
+#endif
+
+int SegmentWriter::open(AVIOContext **pb, const char *url)
+{
+    std::string path = url;
+    if (path.compare(0, 5, "file:") == 0)
+    {
+        path = path.substr(5);
+    }
+
+    std::unique_ptr<File> file(new File());
+    file->path = path;
+    file->writer = this;
+    file->file = openFileUtf8(path, "wb");
+    if (!file->file)
+    {
+        lastError = "Failed to create " + path;
+        return AVERROR(EIO);
+    }
+
+    unsigned char *buffer = (unsigned char *)av_malloc(kBufferSize);
+    if (buffer)
+    {
+#if LIBAVFORMAT_VERSION_MAJOR >= 61
+        file->context = avio_alloc_context(buffer, kBufferSize, 1, file.get(), nullptr, writePacket, seekPacket);
+#else
+        file->context = avio_alloc_context(buffer, kBufferSize, 1, file.get(), nullptr, writePacketMutable,
+                                           seekPacket);
+#endif
+    }
+    if (!file->context)
+    {
+        av_free(buffer);
+        std::fclose(file->file);
+        return AVERROR(ENOMEM);
+    }
+
+    *pb = file->context;
+    files[file->context] = std::move(file);
+    return 0;
+}
+
+int SegmentWriter::close(AVIOContext *pb)
+{
+    auto it = files.find(pb);
+    if (it == files.end())
+    {
+        // avio_open2打开的文件
+        return avio_close(pb);
+    }
+    File &file = *it->second;
+
+    // 剩余的缓冲数据入队后等待本文件写完，封装器关闭后可能立即改名
+    avio_flush(file.context);
+    bool failed = file.context->error < 0;
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        queueChanged.wait(lock, [&]() { return file.pending == 0; });
+        failed = failed || file.failed;
+    }
+    if (std::fclose(file.file) != 0)
+    {
+        failed = true;
+    }
+    av_freep(&file.context->buffer);
+#if LIBAVFORMAT_VERSION_INT >= AV_VERSION_INT(57, 80, 100)
+    avio_context_free(&file.context);
+#else
+    av_freep(&file.context);
+#endif
+
+    filesWritten++;
+    bytesWritten += file.size;
+    if (failed && lastError.empty())
+    {
+        lastError = "Failed to write " + file.path;
+    }
+    files.erase(it);
+    return failed ? AVERROR(EIO) : 0;
+}
+
+int SegmentWriter::writePacket(void *opaque, const uint8_t *buffer, int bufferSize)
+{
+    File *file = static_cast<File *>(opaque);
+    return file->writer->write(*file, buffer, bufferSize);
+}
+
+int SegmentWriter::writePacketMutable(void *opaque, uint8_t *buffer, int bufferSize)
+{
+    File *file = static_cast<File *>(opaque);
+    return file->writer->write(*file, buffer, bufferSize);
+}
+
+int64_t SegmentWriter::seekPacket(void *opaque, int64_t offset, int whence)
+{
+    File *file = static_cast<File *>(opaque);
+    int64_t target;
+    switch (whence & ~AVSEEK_FORCE)
+    {
+    case AVSEEK_SIZE: return file->size;
+    case SEEK_SET: target = offset; break;
+    case SEEK_CUR: target = file->position + offset; break;
+    case SEEK_END: target = file->size + offset; break;
+    default: return AVERROR(EINVAL);
+    }
+    if (target < 0)
+    {
+        return AVERROR(EINVAL);
+    }
+    // 写入带着位置入队，写线程按位置写盘
+    file->position = target;
+    return target;
+}
+
+int SegmentWriter::write(File &file, const uint8_t *data, int length)
+{
+    Chunk chunk;
+    chunk.file = &file;
+    chunk.offset = file.position;
+    chunk.data.assign(data, data + length);
+
+    std::unique_lock<std::mutex> lock(mutex);
+    queueChanged.wait(lock, [&]() { return queuedBytes < kQueueLimit || file.failed; });
+    if (file.failed)
+    {
+        return AVERROR(EIO);
+    }
+    queue.push_back(std::move(chunk));
+    queuedBytes += length;
+    file.pending += length;
+    lock.unlock();
+    queueChanged.notify_all();
+
+    file.position += length;
+    file.size = std::max(file.size, file.position);
+    return length;
+}
+
+void SegmentWriter::run()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true)
+    {
+        queueChanged.wait(lock, [&]() { return stopping || !queue.empty(); });
+        if (queue.empty())
+        {
+            break;
+        }
+        Chunk chunk = std::move(queue.front());
+        queue.pop_front();
+        File &file = *chunk.file;
+        bool failed = file.failed;
+        lock.unlock();
+
+        if (!failed)
+        {
+            if (file.filePosition != chunk.offset && seekFile(file.file, chunk.offset) != 0)
+            {
+                failed = true;
+            }
+            else if (std::fwrite(chunk.data.data(), 1, chunk.data.size(), file.file) != chunk.data.size())
+            {
+                failed = true;
+            }
+            file.filePosition = chunk.offset + (int64_t)chunk.data.size();
+        }
+
+        lock.lock();
+        file.failed = failed;
+        file.pending -= (int64_t)chunk.data.size();
+        queuedBytes -= (int64_t)chunk.data.size();
+        queueChanged.notify_all();
+    }
+}
+
+void SegmentWriter::stop()
+{
+    if (!worker.joinable())
+    {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    queueChanged.notify_all();
+    worker.join();
+}
@@ -0,0 +1,106 @@
+#ifndef SEGMENT_WRITER_H
+#define SEGMENT_WRITER_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+extern "C"
+{
+#include <libavformat/avformat.h>
+}
+
+/**
+ * 接管HLS/DASH封装器打开的分片和清单文件（AVFormatContext::io_open/io_close2），
+ * 在独立线程中写盘：封装器只把缓冲区交给队列，解封装和封装不等待磁盘写入
+ * 关闭文件时等待该文件的数据写完（封装器随后可能改名或覆盖它），其他文件的写入不受影响
+ */
+class SegmentWriter
+{
+public:
+    SegmentWriter() = default;
+    ~SegmentWriter();
+
+    SegmentWriter(const SegmentWriter &) = delete;
+    SegmentWriter &operator=(const SegmentWriter &) = delete;
+
+    /**
+     * 设置输出上下文的文件回调并启动写线程，封装器创建的子上下文会继承这些回调
+     * @param formatContext 输出上下文，其opaque由本对象使用；不是写入的文件仍交给avio_open2打开
+     */
+    void install(AVFormatContext *formatContext);
+
+    /**
+     * 等待所有数据写完并停止写线程（在av_write_trailer之后调用）
+     * @return 所有文件都写入成功返回0，否则返回负数
+     */
+    int finish();
+
+    // 写出的文件数和字节数
+    int getFilesWritten() const { return filesWritten; }
+    int64_t getBytesWritten() const { return bytesWritten; }
+
+    std::string getLastError() const { return lastError; }
+
+private:
+    struct File
+    {
+        std::string path;
+        std::FILE *file = nullptr;
+        AVIOContext *context = nullptr;
+        SegmentWriter *writer = nullptr;
+        // 下一次写入的逻辑位置和已写到的最大位置
+        int64_t position = 0;
+        int64_t size = 0;
+        // 文件中实际写到的位置（只由写线程使用），连续写入时不需要seek
+        int64_t filePosition = 0;
+        // 已排队但尚未写盘的字节数（受mutex保护）
+        int64_t pending = 0;
+        bool failed = false;
+    };
+
+    struct Chunk
+    {
+        File *file;
+        int64_t offset;
+        std::vector<uint8_t> data;
+    };
+
+    AVIOInterruptCB interruptCallback = {nullptr, nullptr};
+    std::map<AVIOContext *, std::unique_ptr<File>> files;
+    int filesWritten = 0;
+    int64_t bytesWritten = 0;
+    std::string lastError;
+
+    std::thread worker;
+    std::mutex mutex;
+    std::condition_variable queueChanged;
+    std::deque<Chunk> queue;
+    int64_t queuedBytes = 0;
+    bool stopping = false;
+
+    static int ioOpen(AVFormatContext *formatContext, AVIOContext **pb, const char *url, int flags,
+                      AVDictionary **options);
+#if LIBAVFORMAT_VERSION_INT >= AV_VERSION_INT(59, 17, 100)
+    static int ioClose2(AVFormatContext *formatContext, AVIOContext *pb);
+#else
+    static void ioClose(AVFormatContext *formatContext, AVIOContext *pb);
+#endif
+    static int writePacket(void *opaque, const uint8_t *buffer, int bufferSize);
+    static int writePacketMutable(void *opaque, uint8_t *buffer, int bufferSize);
+    static int64_t seekPacket(void *opaque, int64_t offset, int whence);
+
+    int open(AVIOContext **pb, const char *url);
+    int close(AVIOContext *pb);
+    int write(File &file, const uint8_t *data, int length);
+    void run();
+    void stop();
+};
+
+#endif // SEGMENT_WRITER_H
@@ -0,0 +1,521 @@
+#include "SegmentedMerger.h"
+#include "SeekIndex.h"
+#include <algorithm>
+#include <cstdio>
+#include <iostream>
+#include <memory>
+#include <thread>
+
+// 并行分段时各段合并在总进度中所占的比例，其余为拼接
+static const double kSegmentMergeShare = 0.9;
+
+SegmentedMerger::SegmentedMerger(int segmentCount)
+    : segmentCount(segmentCount)
+{
+    if (this->segmentCount < 1)
+    {
+        this->segmentCount = std::max(1u, std::thread::hardware_concurrency());
+    }
+}
+
+void SegmentedMerger::setProgressCallback(AudioVideoMerger::ProgressCallback callback, double minIntervalSeconds)
+{
+    std::lock_guard<std::mutex> lock(mergerMutex);
+    progressCallback = callback;
+    progressInterval = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+        std::chrono::duration<double>(std::max(0.0, minIntervalSeconds)));
+}
+
+void SegmentedMerger::cancel()
+{
+    std::lock_guard<std::mutex> lock(mergerMutex);
+    cancelRequested = true;
+    for (AudioVideoMerger *merger : activeMergers)
+    {
+        merger->cancel();
+    }
+}
+
+void SegmentedMerger::attachMerger(AudioVideoMerger &merger, size_t segment)
+{
+    std::lock_guard<std::mutex> lock(mergerMutex);
+    if (progressCallback)
+    {
+        merger.setProgressCallback([this, segment](double progress) { updateProgress(segment, progress); },
+                                   std::chrono::duration<double>(progressInterval).count());
+    }
+    if (cancelRequested)
+    {
+        merger.cancel();
+    }
+    activeMergers.push_back(&merger);
+}
+
+void SegmentedMerger::detachMerger(AudioVideoMerger &merger)
+{
+    std::lock_guard<std::mutex> lock(mergerMutex);
+    activeMergers.erase(std::remove(activeMergers.begin(), activeMergers.end(), &merger), activeMergers.end());
+}
+
+void SegmentedMerger::updateProgress(size_t segment, double progress)
+{
+    std::lock_guard<std::mutex> lock(mergerMutex);
+    if (segment >= segmentProgress.size())
+    {
+        return;
+    }
+    segmentProgress[segment] = progress;
+    double total = 0.0;
+    for (double value : segmentProgress)
+    {
+        total += value;
+    }
+    reportProgress(total / segmentProgress.size() * mergeShare, false);
+}
+
+void SegmentedMerger::reportProgress(double progress, bool force)
+{
+    if (!progressCallback)
+    {
+        return;
+    }
+    auto now = std::chrono::steady_clock::now();
+    if (!force && now - lastProgressTime < progressInterval)
+    {
+        return;
+    }
+    lastProgressTime = now;
+    progressCallback(std::min(1.0, std::max(0.0, progress)));
+}
+
+bool SegmentedMerger::merge(const std::string &videoPath, const std::string &audioPath, const std::string &outputPath,
+                            const MergeOptions &options)
+{
+    lastError.clear();
+    checksumValid = false;
+    outputChecksum = 0;
+    streamIntegrity.clear();
+    packetsRead = 0;
+    packetsWritten = 0;
+    bytesRead = 0;
+
+    MergeOptions segmentOptions = options;
+    segmentOptions.parallelSegments = 0;
+    // 缓存由外层的AudioVideoMerger::merge查找和保存
+    segmentOptions.cacheDirectory.clear();
+    // 关键帧索引也由外层在最终输出上生成
+    segmentOptions.seekIndexPath.clear();
+    // 中间文件不需要改名发布，最终输出已由外层写到临时文件；分段合并不续写
+    segmentOptions.atomicOutput = false;
+    segmentOptions.resume = false;
+
+    // 音频逐段转码时每段开头都有编码器的预延迟，拼接处产生间隙，音频转码只能单线程进行
+    bool audioTranscoded = true;
+    if (segmentCount >= 2)
+    {
+        AudioVideoMerger prober;
+        MergeEstimate estimate;
+        audioTranscoded = !prober.estimate(videoPath, audioPath, outputPath, options, estimate) ||
+                          estimate.transcodeAudioStreams > 0;
+    }
+
+    std::vector<SplitPoint> splitPoints;
+    if (segmentCount < 2 || audioTranscoded || findSplitPoints(videoPath, options, splitPoints) < 0 ||
+        splitPoints.empty())
+    {
+        // 无法切分（无视频流、时长未知、太短或需要转码音频）时退回单线程合并
+        if (options.verbose)
+            std::cout << "Parallel segmentation not possible, falling back to a single pass" << std::endl;
+        AudioVideoMerger merger;
+        {
+            std::lock_guard<std::mutex> lock(mergerMutex);
+            segmentProgress.assign(1, 0.0);
+            mergeShare = 1.0;
+        }
+        attachMerger(merger, 0);
+        bool merged = merger.merge(videoPath, audioPath, outputPath, segmentOptions);
+        detachMerger(merger);
+        if (!merged)
+        {
+            setError(merger.getLastError());
+            return false;
+        }
+        checksumValid = merger.getLastStats().checksumValid;
+        outputChecksum = merger.getLastStats().outputCrc32c;
+        streamIntegrity = merger.getLastStats().streams;
+        packetsRead = merger.getLastStats().packetsRead;
+        packetsWritten = merger.getLastStats().packetsWritten;
+        bytesRead = merger.getLastStats().bytesRead;
+        return true;
+    }
+
+    // 中间文件使用保留原始时间基的封装格式
+    const char *fragmentFormat = av_guess_format("nut", nullptr, nullptr) ? "nut" : "matroska";
+    const char *fragmentExtension = av_guess_format("nut", nullptr, nullptr) ? ".nut" : ".mkv";
+
+    size_t fragmentCount = splitPoints.size() + 1;
+    std::vector<std::string> fragmentPaths(fragmentCount);
+    std::vector<std::string> fragmentErrors(fragmentCount);
+    std::vector<char> fragmentResults(fragmentCount, 0);
+    std::vector<std::unique_ptr<AudioVideoMerger>> mergers(fragmentCount);
+    std::vector<std::thread> workers;
+    {
+        std::lock_guard<std::mutex> lock(mergerMutex);
+        segmentProgress.assign(fragmentCount, 0.0);
+        mergeShare = kSegmentMergeShare;
+    }
+
+    if (options.verbose)
+        std::cout << "Merging in " << fragmentCount << " parallel segments" << std::endl;
+
+    for (size_t i = 0; i < fragmentCount; i++)
+    {
+        fragmentPaths[i] = outputPath + ".part" + std::to_string(i) + fragmentExtension;
+
+        MergeOptions fragmentOptions = segmentOptions;
+        fragmentOptions.outputFormat = fragmentFormat;
+        // 中间文件保留原始时间戳，拼接时统一重设
+        fragmentOptions.rebaseTimestamps = false;
+        fragmentOptions.faststart = false;
+        fragmentOptions.sidx = false;
+        // 只校验最终输出
+        fragmentOptions.checksum = false;
+        if (i > 0)
+        {
+            fragmentOptions.startTime = splitPoints[i - 1].startTimestamp / (double)AV_TIME_BASE;
+        }
+        if (i < splitPoints.size())
+        {
+            fragmentOptions.endTime = splitPoints[i].endTimestamp / (double)AV_TIME_BASE;
+        }
+
+        mergers[i].reset(new AudioVideoMerger());
+        workers.emplace_back([&, i, fragmentOptions]() {
+            AudioVideoMerger &merger = *mergers[i];
+            attachMerger(merger, i);
+            fragmentResults[i] = merger.merge(videoPath, audioPath, fragmentPaths[i], fragmentOptions);
+            detachMerger(merger);
+            if (!fragmentResults[i])
+            {
+                fragmentErrors[i] = merger.getLastError();
+            }
+        });
+    }
+
+    for (auto &worker : workers)
+    {
+        worker.join();
+    }
+
+    bool success = true;
+    for (size_t i = 0; i < fragmentCount; i++)
+    {
+        if (!fragmentResults[i])
+        {
+            setError("Segment " + std::to_string(i) + " failed: " + fragmentErrors[i]);
+            success = false;
+            break;
+        }
+    }
+
+    if (success)
+    {
+        success = stitchFragments(fragmentPaths, outputPath, options);
+    }
+
+    for (const auto &fragmentPath : fragmentPaths)
+    {
+        std::remove(fragmentPath.c_str());
+    }
+    return success;
+}
+
+int SegmentedMerger::findSplitPoints(const std::string &videoPath, const MergeOptions &options,
+                                     std::vector<SplitPoint> &splitPoints)
+{
+    AVFormatContext *formatContext = nullptr;
+    if (avformat_open_input(&formatContext, videoPath.c_str(), nullptr, nullptr) < 0)
+    {
+        return -1;
+    }
+    if (avformat_find_stream_info(formatContext, nullptr) < 0)
+    {
+        avformat_close_input(&formatContext);
+        return -1;
+    }
+
+    int videoStreamIndex = av_find_best_stream(formatContext, AVMEDIA_TYPE_VIDEO, -1, -1, nullptr, 0);
+    if (videoStreamIndex < 0 || formatContext->duration == AV_NOPTS_VALUE || formatContext->duration <= 0)
+    {
+        avformat_close_input(&formatContext);
+        return -1;
+    }
+
+    AVStream *videoStream = formatContext->streams[videoStreamIndex];
+    int64_t fileStart = formatContext->start_time != AV_NOPTS_VALUE ? formatContext->start_time : 0;
+    // 各段的startTime/endTime在合并后的时间轴上：对齐起点时视频的时间戳
+    // 先减去自身的起点再加上videoOffset，与AudioVideoMerger定位输入时的换算一致
+    int64_t timelineOffset = options.alignStartTimes ? AudioVideoMerger::secondsToTimestamp(options.videoOffset) : 0;
+
+    int64_t rangeStart = options.startTime > 0 ? AudioVideoMerger::secondsToTimestamp(options.startTime) : 0;
+    int64_t rangeEnd = formatContext->duration + timelineOffset;
+    if (options.endTime >= 0)
+    {
+        rangeEnd = std::min(rangeEnd, AudioVideoMerger::secondsToTimestamp(options.endTime));
+    }
+    rangeStart = std::max(rangeStart, timelineOffset);
+    if (rangeEnd <= rangeStart)
+    {
+        avformat_close_input(&formatContext);
+        return -1;
+    }
+
+    int segments = (int)std::min<int64_t>(segmentCount, (rangeEnd - rangeStart) / ((int64_t)minSegmentSeconds * AV_TIME_BASE));
+
+    AVPacket packet;
+    int64_t lastStart = rangeStart;
+    for (int k = 1; k < segments; k++)
+    {
+        int64_t target = fileStart - timelineOffset + rangeStart + (rangeEnd - rangeStart) * k / segments;
+        if (avformat_seek_file(formatContext, -1, INT64_MIN, target, target, 0) < 0)
+        {
+            continue;
+        }
+
+        // 定位后读取到的第一个视频关键帧即为分段边界
+        int64_t keyframePts = AV_NOPTS_VALUE;
+        while (av_read_frame(formatContext, &packet) >= 0)
+        {
+            bool found = packet.stream_index == videoStreamIndex && (packet.flags & AV_PKT_FLAG_KEY) &&
+                         packet.pts != AV_NOPTS_VALUE;
+            if (found)
+            {
+                keyframePts = packet.pts;
+            }
+            av_packet_unref(&packet);
+            if (found)
+            {
+                break;
+            }
+        }
+        if (keyframePts == AV_NOPTS_VALUE)
+        {
+            continue;
+        }
+
+        SplitPoint point;
+        int64_t keyframeOffset = timelineOffset - fileStart;
+        point.startTimestamp =
+            av_rescale_q_rnd(keyframePts, videoStream->time_base, AV_TIME_BASE_Q, AV_ROUND_UP) + keyframeOffset;
+        point.endTimestamp =
+            av_rescale_q_rnd(keyframePts, videoStream->time_base, AV_TIME_BASE_Q, AV_ROUND_DOWN) + keyframeOffset;
+
+        // 关键帧间隔大于段长时相邻目标会落在同一关键帧上
+        if (point.endTimestamp <= lastStart || point.startTimestamp >= rangeEnd)
+        {
+            continue;
+        }
+        splitPoints.push_back(point);
+        lastStart = point.startTimestamp;
+    }
+
+    avformat_close_input(&formatContext);
+    return 0;
+}
+
+bool SegmentedMerger::stitchFragments(const std::vector<std::string> &fragmentPaths, const std::string &outputPath,
+                                      const MergeOptions &options)
+{
+    AVFormatContext *outputFormatContext = nullptr;
+    const char *formatName = options.outputFormat.empty() ? nullptr : options.outputFormat.c_str();
+    if (avformat_alloc_output_context2(&outputFormatContext, nullptr, formatName, outputPath.c_str()) < 0)
+    {
+        setError("Failed to create output file: " + outputPath);
+        return false;
+    }
+    ChecksumOutput checksumOutput;
+    bool outputOpened = true;
+    if (!(outputFormatContext->oformat->flags & AVFMT_NOFILE))
+    {
+        if (options.checksum)
+        {
+            outputOpened = checksumOutput.open(outputPath) >= 0;
+            outputFormatContext->pb = checksumOutput.getContext();
+        }
+        else
+        {
+            outputOpened = avio_open(&outputFormatContext->pb, outputPath.c_str(), AVIO_FLAG_WRITE) >= 0;
+        }
+    }
+    if (!outputOpened)
+    {
+        avformat_free_context(outputFormatContext);
+        setError("Failed to create output file: " + outputPath);
+        return false;
+    }
+    PacketChecker packetChecker;
+
+    bool rebase = options.startTime > 0 && options.rebaseTimestamps;
+    int64_t timestampOffset = AV_NOPTS_VALUE;
+    std::vector<int64_t> lastDts;
+    bool success = true;
+
+    for (size_t i = 0; i < fragmentPaths.size() && success; i++)
+    {
+        AVFormatContext *fragmentContext = nullptr;
+        if (avformat_open_input(&fragmentContext, fragmentPaths[i].c_str(), nullptr, nullptr) < 0 ||
+            avformat_find_stream_info(fragmentContext, nullptr) < 0)
+        {
+            avformat_close_input(&fragmentContext);
+            setError("Failed to open segment: " + fragmentPaths[i]);
+            success = false;
+            break;
+        }
+
+        if (i == 0)
+        {
+            // 以第一段的流参数建立输出流
+            for (unsigned int s = 0; s < fragmentContext->nb_streams && success; s++)
+            {
+                AVStream *inStream = fragmentContext->streams[s];
+                AVStream *outStream = avformat_new_stream(outputFormatContext, nullptr);
+                if (!outStream || avcodec_parameters_copy(outStream->codecpar, inStream->codecpar) < 0)
+                {
+                    success = false;
+                    break;
+                }
+                outStream->codecpar->codec_tag = 0;
+                outStream->time_base = inStream->time_base;
+            }
+            // 拼接前不知道各段的样本数，快速启动时由封装器在结尾把moov移到开头
+            AVDictionary *muxerOptions = nullptr;
+            if (options.sidx)
+            {
+                av_dict_set(&muxerOptions, "movflags", kSidxMovflags, 0);
+            }
+            else if (options.faststart)
+            {
+                av_dict_set(&muxerOptions, "movflags", "+faststart", 0);
+            }
+            success = success && avformat_write_header(outputFormatContext, &muxerOptions) >= 0;
+            av_dict_free(&muxerOptions);
+            if (!success)
+            {
+                avformat_close_input(&fragmentContext);
+                setError("Failed to write file header");
+                success = false;
+                break;
+            }
+            lastDts.assign(outputFormatContext->nb_streams, AV_NOPTS_VALUE);
+            if (options.checksum)
+            {
+                std::vector<double> secondsPerTick;
+                for (unsigned int s = 0; s < outputFormatContext->nb_streams; s++)
+                {
+                    secondsPerTick.push_back(av_q2d(outputFormatContext->streams[s]->time_base));
+                }
+                packetChecker.reset(secondsPerTick);
+            }
+        }
+        else if (fragmentContext->nb_streams != outputFormatContext->nb_streams)
+        {
+            avformat_close_input(&fragmentContext);
+            setError("Segment stream layout mismatch: " + fragmentPaths[i]);
+            success = false;
+            break;
+        }
+
+        AVPacket packet;
+        while (av_read_frame(fragmentContext, &packet) >= 0)
+        {
+            packetsRead++;
+            bytesRead += packet.size;
+            AVStream *inStream = fragmentContext->streams[packet.stream_index];
+            AVStream *outStream = outputFormatContext->streams[packet.stream_index];
+
+            if (rebase)
+            {
+                if (timestampOffset == AV_NOPTS_VALUE && packet.dts != AV_NOPTS_VALUE)
+                {
+                    timestampOffset = av_rescale_q(packet.dts, inStream->time_base, AV_TIME_BASE_Q);
+                }
+                if (timestampOffset != AV_NOPTS_VALUE)
+                {
+                    int64_t offset = av_rescale_q(timestampOffset, AV_TIME_BASE_Q, inStream->time_base);
+                    if (packet.pts != AV_NOPTS_VALUE)
+                        packet.pts -= offset;
+                    if (packet.dts != AV_NOPTS_VALUE)
+                        packet.dts -= offset;
+                }
+            }
+
+            av_packet_rescale_ts(&packet, inStream->time_base, outStream->time_base);
+            packet.pos = -1;
+
+            // 段边界处（如关键帧之前的音频）可能重复，按DTS单调递增去重
+            int64_t &streamLastDts = lastDts[packet.stream_index];
+            if (packet.dts != AV_NOPTS_VALUE)
+            {
+                if (streamLastDts != AV_NOPTS_VALUE && packet.dts <= streamLastDts)
+                {
+                    av_packet_unref(&packet);
+                    continue;
+                }
+                streamLastDts = packet.dts;
+            }
+
+            if (options.checksum)
+            {
+                packetChecker.onPacket(packet.stream_index, packet.data, packet.size, packet.dts != AV_NOPTS_VALUE,
+                                       packet.dts, packet.duration);
+            }
+
+            if (av_interleaved_write_frame(outputFormatContext, &packet) < 0)
+            {
+                av_packet_unref(&packet);
+                setError("Failed to write packet while stitching segments");
+                success = false;
+                break;
+            }
+            packetsWritten++;
+            av_packet_unref(&packet);
+        }
+
+        avformat_close_input(&fragmentContext);
+
+        std::lock_guard<std::mutex> lock(mergerMutex);
+        if (cancelRequested)
+        {
+            setError("Merge cancelled");
+            success = false;
+        }
+        bool last = i + 1 == fragmentPaths.size();
+        reportProgress(mergeShare + (1.0 - mergeShare) * (i + 1) / fragmentPaths.size(), last);
+    }
+
+    // 写文件尾失败（如moov写入出错）时输出不完整，不能发布
+    if (success && av_write_trailer(outputFormatContext) < 0)
+    {
+        setError("Failed to write file trailer");
+        success = false;
+    }
+
+    if (checksumOutput.isOpen())
+    {
+        outputFormatContext->pb = nullptr;
+        if (checksumOutput.close() < 0 && success)
+        {
+            setError("Failed to write output file");
+            success = false;
+        }
+        checksumValid = success;
+        outputChecksum = checksumOutput.getChecksum();
+    }
+    else if (!(outputFormatContext->oformat->flags & AVFMT_NOFILE))
+    {
+        avio_closep(&outputFormatContext->pb);
+    }
+    avformat_free_context(outputFormatContext);
+    streamIntegrity = packetChecker.getStreams();
+    return success;
+}
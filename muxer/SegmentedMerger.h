@@ -0,0 +1,140 @@
+#ifndef SEGMENTED_MERGER_H
+#define SEGMENTED_MERGER_H
+
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "AudioVideoMerger.h"
+
+/**
+ * 并行分段合并
+ * 在视频关键帧处把时间轴切成多段，每段由独立线程中的AudioVideoMerger
+ * 处理（复制或转码）为中间文件，最后按顺序拼接成最终输出
+ */
+class SegmentedMerger
+{
+public:
+    /**
+     * @param segmentCount 分段数（即并行线程数）
+     */
+    explicit SegmentedMerger(int segmentCount);
+
+    /**
+     * 分段并行合并音频和视频文件，需要转码音频时退回单线程合并
+     * @param videoPath 视频文件路径
+     * @param audioPath 音频文件路径
+     * @param outputPath 输出文件路径
+     * @param options 合并选项，parallelSegments 字段被忽略
+     * @return 是否合并成功
+     */
+    bool merge(const std::string &videoPath, const std::string &audioPath, const std::string &outputPath,
+               const MergeOptions &options);
+
+    /**
+     * 获取错误信息
+     * @return 最后的错误信息
+     */
+    std::string getLastError() const { return lastError; }
+
+    /**
+     * 设置进度回调：各段进度的平均值占前90%，拼接占其余部分；回调在分段线程或合并线程中调用，不会并发
+     * @param callback 进度回调，为空时取消
+     * @param minIntervalSeconds 两次回调的最小间隔（秒）
+     */
+    void setProgressCallback(AudioVideoMerger::ProgressCallback callback, double minIntervalSeconds = 0.5);
+
+    /**
+     * 请求取消合并，可从任意线程调用；正在运行的各段随之取消，之后启动的段立即失败
+     */
+    void cancel();
+
+    /**
+     * 开启校验（MergeOptions::checksum）时最终输出的校验结果，合并成功后有效
+     */
+    bool hasChecksum() const { return checksumValid; }
+    uint32_t getOutputChecksum() const { return outputChecksum; }
+    const std::vector<StreamIntegrity> &getStreamIntegrity() const { return streamIntegrity; }
+
+    /**
+     * 拼接时从各段读取和写入输出的数据包数，以及读取的数据量（字节）
+     */
+    int64_t getPacketsRead() const { return packetsRead; }
+    int64_t getPacketsWritten() const { return packetsWritten; }
+    int64_t getBytesRead() const { return bytesRead; }
+
+private:
+    /**
+     * 分段边界（AV_TIME_BASE单位，合并后的时间轴上，即各段的startTime/endTime）
+     * 关键帧时间戳换算时向上取整作为下一段起点、向下取整作为上一段终点，
+     * 保证关键帧恰好属于下一段
+     */
+    struct SplitPoint
+    {
+        int64_t startTimestamp;
+        int64_t endTimestamp;
+    };
+
+    int segmentCount;
+    std::string lastError;
+
+    // 取消状态和正在运行的各段，由mergerMutex保护
+    std::mutex mergerMutex;
+    bool cancelRequested = false;
+    std::vector<AudioVideoMerger *> activeMergers;
+
+    // 进度报告状态，由mergerMutex保护
+    AudioVideoMerger::ProgressCallback progressCallback;
+    std::chrono::steady_clock::duration progressInterval = std::chrono::milliseconds(500);
+    std::chrono::steady_clock::time_point lastProgressTime;
+    std::vector<double> segmentProgress;
+    // 各段合并在总进度中所占的比例
+    double mergeShare = 1.0;
+    bool checksumValid = false;
+    uint32_t outputChecksum = 0;
+    std::vector<StreamIntegrity> streamIntegrity;
+    int64_t packetsRead = 0;
+    int64_t packetsWritten = 0;
+    int64_t bytesRead = 0;
+
+    // 每段的最短时长（秒），避免短文件被切得过碎
+    static const int minSegmentSeconds = 5;
+
+    /**
+     * 在视频输入中查找分段边界（均匀划分后取之前最近的关键帧）
+     * @param videoPath 视频文件路径
+     * @param options 合并选项（时间范围）
+     * @param splitPoints 输出的内部边界，不含首尾
+     * @return 成功返回0，失败返回负数
+     */
+    int findSplitPoints(const std::string &videoPath, const MergeOptions &options,
+                        std::vector<SplitPoint> &splitPoints);
+
+    /**
+     * 按顺序拼接中间文件，去除段边界处重复的数据包
+     * @param fragmentPaths 中间文件路径
+     * @param outputPath 输出文件路径
+     * @param options 合并选项
+     * @return 成功返回true，失败返回false
+     */
+    bool stitchFragments(const std::vector<std::string> &fragmentPaths, const std::string &outputPath,
+                         const MergeOptions &options);
+
+    /**
+     * 开始合并前登记一段：转发取消和进度
+     * @param merger 该段的合并器
+     * @param segment 段序号，对应segmentProgress
+     */
+    void attachMerger(AudioVideoMerger &merger, size_t segment);
+    void detachMerger(AudioVideoMerger &merger);
+
+    /**
+     * 更新一段的进度并在间隔到达时汇报总进度
+     */
+    void updateProgress(size_t segment, double progress);
+    void reportProgress(double progress, bool force);
+
+    void setError(const std::string &error) { lastError = error; }
+};
+
+#endif // SEGMENTED_MERGER_H
@@ -0,0 +1,312 @@
+#include "ThumbnailExtractor.h"
+#include "IsoBmff.h"
+#include "TranscodeLibraries.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+extern "C"
+{
+#include <libavutil/opt.h>
+}
+
+// 把模板中的%d或%0Nd替换为序号（不把模板当作printf格式串），没有时在扩展名前追加序号
+static std::string formatPath(const std::string &pattern, int index)
+{
+    for (size_t i = 0; i + 1 < pattern.size(); i++)
+    {
+        if (pattern[i] != '%')
+        {
+            continue;
+        }
+        size_t end = i + 1;
+        int digits = 0;
+        if (pattern[end] == '0')
+        {
+            end++;
+            while (end < pattern.size() && pattern[end] >= '0' && pattern[end] <= '9')
+            {
+                digits = digits * 10 + (pattern[end] - '0');
+                end++;
+            }
+        }
+        if (end < pattern.size() && pattern[end] == 'd' && digits < 20)
+        {
+            char number[32];
+            std::snprintf(number, sizeof(number), "%0*d", digits, index);
+            return pattern.substr(0, i) + number + pattern.substr(end + 1);
+        }
+    }
+
+    size_t dot = pattern.find_last_of('.');
+    size_t separator = pattern.find_last_of("/\\");
+    if (dot == std::string::npos || (separator != std::string::npos && dot < separator))
+    {
+        dot = pattern.size();
+    }
+    return pattern.substr(0, dot) + "_" + std::to_string(index) + pattern.substr(dot);
+}
+
+ThumbnailExtractor::~ThumbnailExtractor()
+{
+    avcodec_free_context(&decoder);
+    avcodec_free_context(&encoder);
+    if (scaler)
+    {
+        transcodeLibs->swsFreeContext(scaler);
+    }
+    av_frame_free(&frame);
+    av_frame_free(&scaledFrame);
+    av_packet_free(&encodedPacket);
+}
+
+int ThumbnailExtractor::open(const AVStream *stream, double intervalSeconds, int width, const std::string &format,
+                             int quality, const std::string &pathPattern)
+{
+    if (format != "jpeg" && format != "webp")
+    {
+        setError("Unsupported thumbnail format: " + format);
+        return -1;
+    }
+
+    std::string loadError;
+    transcodeLibs = TranscodeLibraries::load(&loadError);
+    if (!transcodeLibs)
+    {
+        setError(loadError);
+        return -1;
+    }
+
+    const AVCodec *codec = avcodec_find_decoder(stream->codecpar->codec_id);
+    if (!codec)
+    {
+        setError(std::string("No decoder for ") + avcodec_get_name(stream->codecpar->codec_id));
+        return -1;
+    }
+    decoder = avcodec_alloc_context3(codec);
+    if (!decoder || avcodec_parameters_to_context(decoder, stream->codecpar) < 0)
+    {
+        setError("Failed to create thumbnail decoder");
+        return -1;
+    }
+    decoder->pkt_timebase = stream->time_base;
+    // 只送入关键帧，非关键帧（如HEVC CRA之后的前置图像）不需要解码
+    decoder->skip_frame = AVDISCARD_NONKEY;
+    if (avcodec_open2(decoder, codec, nullptr) < 0)
+    {
+        setError("Failed to open thumbnail decoder");
+        return -1;
+    }
+
+    frame = av_frame_alloc();
+    encodedPacket = av_packet_alloc();
+    if (!frame || !encodedPacket)
+    {
+        setError("Out of memory");
+        return -1;
+    }
+
+    streamIndex = stream->index;
+    timeBase = stream->time_base;
+    this->intervalSeconds = intervalSeconds;
+    nextSeconds = 0.0;
+    this->width = width;
+    this->format = format;
+    this->quality = std::max(0, std::min(100, quality));
+    this->pathPattern = pathPattern;
+    return 0;
+}
+
+void ThumbnailExtractor::onPacket(const AVPacket *packet)
+{
+    if (!decoder || packet->stream_index != streamIndex || !(packet->flags & AV_PKT_FLAG_KEY))
+    {
+        return;
+    }
+    int64_t timestamp = packet->pts != AV_NOPTS_VALUE ? packet->pts : packet->dts;
+    if (timestamp == AV_NOPTS_VALUE)
+    {
+        return;
+    }
+    double seconds = timestamp * av_q2d(timeBase);
+    if (seconds < nextSeconds)
+    {
+        return;
+    }
+    // 关键帧间隔大于缩略图间隔时跳过落空的间隔
+    nextSeconds = (std::floor(seconds / intervalSeconds) + 1) * intervalSeconds;
+
+    if (decodeKeyframe(packet) < 0 || encodeThumbnail(std::max(0.0, seconds)) < 0)
+    {
+        failures++;
+    }
+    av_frame_unref(frame);
+}
+
+std::vector<Thumbnail> ThumbnailExtractor::takeThumbnails()
+{
+    std::vector<Thumbnail> result;
+    result.swap(thumbnails);
+    return result;
+}
+
+int ThumbnailExtractor::decodeKeyframe(const AVPacket *packet)
+{
+    // 送入关键帧后立即排空，有B帧重排延迟的解码器也能马上输出这一帧
+    if (avcodec_send_packet(decoder, packet) < 0 || avcodec_send_packet(decoder, nullptr) < 0)
+    {
+        avcodec_flush_buffers(decoder);
+        setError("Failed to decode keyframe");
+        return -1;
+    }
+    int ret = avcodec_receive_frame(decoder, frame);
+    // 重置排空状态，准备下一个关键帧
+    avcodec_flush_buffers(decoder);
+    if (ret < 0)
+    {
+        setError("Keyframe produced no picture");
+        return -1;
+    }
+    return 0;
+}
+
+int ThumbnailExtractor::setupEncoder()
+{
+    const AVCodec *codec = nullptr;
+    if (format == "webp")
+    {
+        codec = avcodec_find_encoder_by_name("libwebp");
+        if (!codec)
+        {
+            codec = avcodec_find_encoder(AV_CODEC_ID_WEBP);
+        }
+    }
+    else
+    {
+        codec = avcodec_find_encoder(AV_CODEC_ID_MJPEG);
+    }
+    if (!codec)
+    {
+        setError("No " + format + " encoder available");
+        return -1;
+    }
+
+    encoder = avcodec_alloc_context3(codec);
+    if (!encoder)
+    {
+        setError("Out of memory");
+        return -1;
+    }
+
+    // 只缩小不放大，尺寸取偶数以满足4:2:0采样
+    int outputWidth = frame->width;
+    int outputHeight = frame->height;
+    if (width > 0 && width < frame->width)
+    {
+        outputWidth = width;
+        outputHeight = (int)std::lround((double)frame->height * width / frame->width);
+    }
+    encoder->width = std::max(2, outputWidth & ~1);
+    encoder->height = std::max(2, outputHeight & ~1);
+    encoder->time_base = av_make_q(1, 25);
+
+    if (format == "webp")
+    {
+        encoder->pix_fmt = AV_PIX_FMT_YUV420P;
+        av_opt_set(encoder, "quality", std::to_string(quality).c_str(), AV_OPT_SEARCH_CHILDREN);
+    }
+    else
+    {
+        // 质量0~100映射到mjpeg的qscale 31~2
+        encoder->pix_fmt = AV_PIX_FMT_YUVJ420P;
+        encoder->flags |= AV_CODEC_FLAG_QSCALE;
+        encoder->global_quality = FF_QP2LAMBDA * (2 + (100 - quality) * 29 / 100);
+    }
+
+    if (avcodec_open2(encoder, codec, nullptr) < 0)
+    {
+        setError("Failed to open " + format + " encoder");
+        avcodec_free_context(&encoder);
+        return -1;
+    }
+
+    scaledFrame = av_frame_alloc();
+    if (!scaledFrame)
+    {
+        setError("Out of memory");
+        return -1;
+    }
+    scaledFrame->format = encoder->pix_fmt;
+    scaledFrame->width = encoder->width;
+    scaledFrame->height = encoder->height;
+    if (av_frame_get_buffer(scaledFrame, 0) < 0)
+    {
+        setError("Out of memory");
+        av_frame_free(&scaledFrame);
+        return -1;
+    }
+    return 0;
+}
+
+int ThumbnailExtractor::encodeThumbnail(double seconds)
+{
+    if (!encoder && setupEncoder() < 0)
+    {
+        return -1;
+    }
+
+    // 每次都按当前帧创建缩放上下文，分辨率中途变化时也能缩放到同一尺寸
+    if (scaler)
+    {
+        transcodeLibs->swsFreeContext(scaler);
+    }
+    scaler = transcodeLibs->swsGetContext(frame->width, frame->height, (AVPixelFormat)frame->format,
+                                          encoder->width, encoder->height, encoder->pix_fmt, SWS_BICUBIC, nullptr,
+                                          nullptr, nullptr);
+    if (!scaler || av_frame_make_writable(scaledFrame) < 0)
+    {
+        setError("Failed to create thumbnail scaler");
+        return -1;
+    }
+    transcodeLibs->swsScale(scaler, frame->data, frame->linesize, 0, frame->height, scaledFrame->data,
+                            scaledFrame->linesize);
+    scaledFrame->pts = (int64_t)thumbnails.size();
+    scaledFrame->quality = encoder->global_quality;
+
+    // 图像编码器每帧立即输出，不需要冲刷
+    if (avcodec_send_frame(encoder, scaledFrame) < 0 || avcodec_receive_packet(encoder, encodedPacket) < 0)
+    {
+        setError("Failed to encode thumbnail");
+        return -1;
+    }
+
+    Thumbnail thumbnail;
+    thumbnail.seconds = seconds;
+    thumbnail.width = encoder->width;
+    thumbnail.height = encoder->height;
+    bool success = true;
+    if (pathPattern.empty())
+    {
+        thumbnail.data.assign(encodedPacket->data, encodedPacket->data + encodedPacket->size);
+    }
+    else
+    {
+        thumbnail.path = formatPath(pathPattern, (int)thumbnails.size() + failures);
+        std::FILE *file = openFileUtf8(thumbnail.path, "wb");
+        success = file && std::fwrite(encodedPacket->data, 1, encodedPacket->size, file) == (size_t)encodedPacket->size;
+        if (file && std::fclose(file) != 0)
+        {
+            success = false;
+        }
+        if (!success)
+        {
+            setError("Failed to write thumbnail: " + thumbnail.path);
+        }
+    }
+    av_packet_unref(encodedPacket);
+    if (!success)
+    {
+        return -1;
+    }
+    thumbnails.push_back(std::move(thumbnail));
+    return 0;
+}
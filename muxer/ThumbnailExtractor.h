@@ -0,0 +1,117 @@
+#ifndef THUMBNAIL_EXTRACTOR_H
+#define THUMBNAIL_EXTRACTOR_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+extern "C"
+{
+#include <libavformat/avformat.h>
+#include <libavcodec/avcodec.h>
+}
+
+struct SwsContext;
+struct TranscodeLibraries;
+
+/**
+ * 合并时提取的一张缩略图
+ */
+struct Thumbnail
+{
+    // 在输出时间轴上的时间（秒）
+    double seconds = 0.0;
+    int width = 0;
+    int height = 0;
+    // 写入的文件路径（指定了文件名模板时）
+    std::string path;
+    // 编码后的图像（未指定文件名模板时）
+    std::vector<uint8_t> data;
+};
+
+/**
+ * 按固定间隔从视频流中提取关键帧缩略图
+ * 直接使用合并时已读取的数据包，每个间隔只解码其后的第一个关键帧（单独解码并排空解码器），
+ * 用swscale缩放后编码为JPEG或WebP
+ */
+class ThumbnailExtractor
+{
+public:
+    ThumbnailExtractor() = default;
+    ~ThumbnailExtractor();
+
+    ThumbnailExtractor(const ThumbnailExtractor &) = delete;
+    ThumbnailExtractor &operator=(const ThumbnailExtractor &) = delete;
+
+    /**
+     * 创建解码器
+     * @param stream 视频输入流
+     * @param intervalSeconds 缩略图间隔（秒）
+     * @param width 缩略图宽度（高度按比例），0或大于原始宽度时不缩放
+     * @param format "jpeg" 或 "webp"
+     * @param quality 图像质量（0~100）
+     * @param pathPattern 文件名模板（如 "thumb_%04d.jpg"，%d为序号），为空时保存在内存中
+     * @return 成功返回0，失败返回负数
+     */
+    int open(const AVStream *stream, double intervalSeconds, int width, const std::string &format, int quality,
+             const std::string &pathPattern);
+
+    /**
+     * 处理视频输入的数据包，到达下一个间隔后的关键帧时解码并生成缩略图
+     * 缩略图失败不影响合并，只计入失败次数
+     * @param packet 数据包（时间戳为stream的时间基，已平移到输出时间轴）
+     */
+    void onPacket(const AVPacket *packet);
+
+    /**
+     * 取出已生成的缩略图
+     */
+    std::vector<Thumbnail> takeThumbnails();
+
+    int getFailures() const { return failures; }
+    std::string getLastError() const { return lastError; }
+
+private:
+    int streamIndex = -1;
+    AVRational timeBase{0, 1};
+    double intervalSeconds = 0.0;
+    double nextSeconds = 0.0;
+    int width = 0;
+    std::string format;
+    int quality = 0;
+    std::string pathPattern;
+
+    const TranscodeLibraries *transcodeLibs = nullptr;
+    AVCodecContext *decoder = nullptr;
+    // 编码器和缩放上下文在第一帧解码后按帧尺寸创建
+    AVCodecContext *encoder = nullptr;
+    SwsContext *scaler = nullptr;
+    AVFrame *frame = nullptr;
+    AVFrame *scaledFrame = nullptr;
+    AVPacket *encodedPacket = nullptr;
+
+    std::vector<Thumbnail> thumbnails;
+    int failures = 0;
+    std::string lastError;
+
+    /**
+     * 解码单个关键帧
+     * @return 成功返回0，失败返回负数
+     */
+    int decodeKeyframe(const AVPacket *packet);
+
+    /**
+     * 按解码帧的尺寸和格式创建编码器和缩放上下文
+     * @return 成功返回0，失败返回负数
+     */
+    int setupEncoder();
+
+    /**
+     * 缩放并编码frame，生成缩略图
+     * @return 成功返回0，失败返回负数
+     */
+    int encodeThumbnail(double seconds);
+
+    void setError(const std::string &error) { lastError = error; }
+};
+
+#endif // THUMBNAIL_EXTRACTOR_H
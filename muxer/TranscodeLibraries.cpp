@@ -0,0 +1,133 @@
+#include "TranscodeLibraries.h"
+#include <mutex>
+
+#ifdef AVMERGER_LAZY_TRANSCODE_LIBS
+extern "C"
+{
+#include <libswresample/version.h>
+#include <libswscale/version.h>
+}
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <dlfcn.h>
+#endif
+
+// 按平台命名规则打开带主版本号的库，找不到时再尝试不带版本号的名字
+static void *openLibrary(const std::string &name, int major)
+{
+#ifdef _WIN32
+    std::string fileName = name + "-" + std::to_string(major) + ".dll";
+    // DLL与本模块（如Python扩展）放在同一目录，优先从该目录加载
+    HMODULE self = nullptr;
+    char modulePath[MAX_PATH];
+    if (GetModuleHandleExA(GET_MODULE_HANDLE_EX_FLAG_FROM_ADDRESS | GET_MODULE_HANDLE_EX_FLAG_UNCHANGED_REFCOUNT,
+                           (LPCSTR)&openLibrary, &self) &&
+        GetModuleFileNameA(self, modulePath, MAX_PATH) > 0)
+    {
+        std::string directory(modulePath);
+        size_t separator = directory.find_last_of("\\/");
+        if (separator != std::string::npos)
+        {
+            HMODULE handle = LoadLibraryA((directory.substr(0, separator + 1) + fileName).c_str());
+            if (handle)
+            {
+                return (void *)handle;
+            }
+        }
+    }
+    return (void *)LoadLibraryA(fileName.c_str());
+#else
+#ifdef __APPLE__
+    std::string versioned = "lib" + name + "." + std::to_string(major) + ".dylib";
+    std::string unversioned = "lib" + name + ".dylib";
+#else
+    std::string versioned = "lib" + name + ".so." + std::to_string(major);
+    std::string unversioned = "lib" + name + ".so";
+#endif
+    void *handle = dlopen(versioned.c_str(), RTLD_NOW | RTLD_LOCAL);
+    if (!handle)
+    {
+        handle = dlopen(unversioned.c_str(), RTLD_NOW | RTLD_LOCAL);
+    }
+    return handle;
+#endif
+}
+
+static void *findSymbol(void *handle, const char *name)
+{
+#ifdef _WIN32
+    return (void *)GetProcAddress((HMODULE)handle, name);
+#else
+    return dlsym(handle, name);
+#endif
+}
+
+#define LOAD_SYMBOL(handle, field, symbol)                                            \
+    libraries.field = (decltype(libraries.field))findSymbol(handle, #symbol);         \
+    if (!libraries.field)                                                             \
+    {                                                                                 \
+        error = "Missing symbol " #symbol;                                            \
+        return false;                                                                 \
+    }
+
+static bool loadLibraries(TranscodeLibraries &libraries, std::string &error)
+{
+    // 句柄在进程结束前不释放
+    void *swscale = openLibrary("swscale", LIBSWSCALE_VERSION_MAJOR);
+    if (!swscale)
+    {
+        error = "Failed to load libswscale, required for transcoding";
+        return false;
+    }
+    void *swresample = openLibrary("swresample", LIBSWRESAMPLE_VERSION_MAJOR);
+    if (!swresample)
+    {
+        error = "Failed to load libswresample, required for transcoding";
+        return false;
+    }
+
+    LOAD_SYMBOL(swscale, swsGetContext, sws_getContext)
+    LOAD_SYMBOL(swscale, swsScale, sws_scale)
+    LOAD_SYMBOL(swscale, swsFreeContext, sws_freeContext)
+    LOAD_SYMBOL(swresample, swrAllocSetOpts2, swr_alloc_set_opts2)
+    LOAD_SYMBOL(swresample, swrInit, swr_init)
+    LOAD_SYMBOL(swresample, swrGetOutSamples, swr_get_out_samples)
+    LOAD_SYMBOL(swresample, swrConvert, swr_convert)
+    LOAD_SYMBOL(swresample, swrFree, swr_free)
+    return true;
+}
+
+#undef LOAD_SYMBOL
+
+#else
+
+static bool loadLibraries(TranscodeLibraries &libraries, std::string &)
+{
+    libraries.swsGetContext = &sws_getContext;
+    libraries.swsScale = &sws_scale;
+    libraries.swsFreeContext = &sws_freeContext;
+    libraries.swrAllocSetOpts2 = &swr_alloc_set_opts2;
+    libraries.swrInit = &swr_init;
+    libraries.swrGetOutSamples = &swr_get_out_samples;
+    libraries.swrConvert = &swr_convert;
+    libraries.swrFree = &swr_free;
+    return true;
+}
+
+#endif
+
+const TranscodeLibraries *TranscodeLibraries::load(std::string *error)
+{
+    static std::once_flag once;
+    static TranscodeLibraries libraries;
+    static bool loaded = false;
+    static std::string loadError;
+
+    std::call_once(once, []() { loaded = loadLibraries(libraries, loadError); });
+    if (!loaded && error)
+    {
+        *error = loadError;
+    }
+    return loaded ? &libraries : nullptr;
+}
@@ -0,0 +1,35 @@
+#ifndef TRANSCODE_LIBRARIES_H
+#define TRANSCODE_LIBRARIES_H
+
+#include <string>
+extern "C"
+{
+#include <libswresample/swresample.h>
+#include <libswscale/swscale.h>
+}
+
+/**
+ * 只有转码才用到的swscale/swresample函数表
+ * 定义AVMERGER_LAZY_TRANSCODE_LIBS时，第一次转码才动态加载这两个库，
+ * 只做流复制的进程启动时不必加载它们；否则直接指向链接进来的函数
+ */
+struct TranscodeLibraries
+{
+    decltype(&sws_getContext) swsGetContext;
+    decltype(&sws_scale) swsScale;
+    decltype(&sws_freeContext) swsFreeContext;
+    decltype(&swr_alloc_set_opts2) swrAllocSetOpts2;
+    decltype(&swr_init) swrInit;
+    decltype(&swr_get_out_samples) swrGetOutSamples;
+    decltype(&swr_convert) swrConvert;
+    decltype(&swr_free) swrFree;
+
+    /**
+     * 获取函数表，只在第一次调用时加载，线程安全
+     * @param error 加载失败时的错误信息，可为nullptr
+     * @return 函数表，加载失败返回nullptr
+     */
+    static const TranscodeLibraries *load(std::string *error = nullptr);
+};
+
+#endif // TRANSCODE_LIBRARIES_H
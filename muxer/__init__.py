@@ -3,12 +3,90 @@
 Audio Video Merger package
 """
 
+import asyncio
+
 try:
-    from .avmerger import AudioVideoMerger
+    from .avmerger import (
+        AudioVideoMerger,
+        MergeOptions,
+        MergeStats,
+        MergeJob,
+        MergeScheduler,
+        MergeTask,
+        SchedulerLimits,
+        SchedulerMetrics,
+        start_merge,
+        probe,
+        probe_cache_info,
+        clear_probe_cache,
+        set_probe_cache_capacity,
+    )
 except ImportError as e:
     raise ImportError(f"Failed to import avmerger extension: {e}")
 
+
+
+async def merge_async(video_path, audio_path, output_path, options=None,
+                      progress=None, progress_interval=0.5):
+    """
+    Awaitable merge. Progress callbacks run on the event loop; cancelling the
+    awaiting coroutine cancels the merge. Raises RuntimeError on failure.
+    """
+    loop = asyncio.get_running_loop()
+    future = loop.create_future()
+
+    def call_in_loop(callback, *args):
+        try:
+            loop.call_soon_threadsafe(callback, *args)
+        except RuntimeError:
+            # 事件循环已关闭
+            pass
+
+    def resolve(success, error):
+        if not future.done():
+            future.set_result((success, error))
+
+    def on_complete(success, error):
+        call_in_loop(resolve, success, error)
+
+    def on_progress(value):
+        call_in_loop(progress, value)
+
+    task = start_merge(
+        video_path,
+        audio_path,
+        output_path,
+        options if options is not None else MergeOptions(),
+        on_progress if progress is not None else None,
+        progress_interval,
+        on_complete,
+    )
+    try:
+        success, error = await future
+    except asyncio.CancelledError:
+        task.cancel()
+        raise
+    if not success:
+        raise RuntimeError(error)
+    return True
+
+
 __version__ = "0.1.0"
 __author__ = "Your Name"
 
-__all__ = ['AudioVideoMerger']
+__all__ = [
+    'AudioVideoMerger',
+    'MergeOptions',
+    'MergeStats',
+    'MergeJob',
+    'MergeScheduler',
+    'MergeTask',
+    'SchedulerLimits',
+    'SchedulerMetrics',
+    'start_merge',
+    'merge_async',
+    'probe',
+    'probe_cache_info',
+    'clear_probe_cache',
+    'set_probe_cache_capacity',
+]
@@ -0,0 +1,385 @@
+// avmerger_bench：合成素材上的合并性能基准
+// 生成指定时长/码率/包率的H.264+AAC fMP4素材，分别测量流复制和转码的
+// 吞吐量（MB/s、包/s）、峰值内存和各阶段耗时，结果写为JSON便于版本间对比。
+// 峰值内存是进程级的历史最大值，每个场景因此在单独的子进程（本程序加--run-scenario）中运行，
+// 不包含素材生成和其他场景的内存
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "AudioVideoMerger.h"
+#include "FixtureGenerator.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+struct BenchOptions
+{
+    FixtureOptions fixture;
+    int iterations = 3;
+    bool transcode = true;
+    std::string workDir = ".";
+    std::string jsonPath = "avmerger_bench.json";
+    // 非空时为子进程：只运行该场景，把场景结果写到jsonPath
+    std::string runScenario;
+};
+
+struct IterationResult
+{
+    MergeStats stats;
+    bool success = false;
+};
+
+// 进程峰值常驻内存（KB）
+static long peakRssKilobytes()
+{
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters;
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+    {
+        return (long)(counters.PeakWorkingSetSize / 1024);
+    }
+    return 0;
+#else
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+    return usage.ru_maxrss / 1024;
+#else
+    return usage.ru_maxrss;
+#endif
+#endif
+}
+
+// 合并期间丢弃AudioVideoMerger打印到标准输出的流信息
+class StdoutSilencer
+{
+public:
+    StdoutSilencer() : saved(std::cout.rdbuf(sink.rdbuf())) {}
+    ~StdoutSilencer() { std::cout.rdbuf(saved); }
+
+private:
+    std::ostringstream sink;
+    std::streambuf *saved;
+};
+
+static void printUsage(const char *program)
+{
+    std::cerr << "Usage: " << program << " [options]\n"
+              << "  --duration SECONDS     fixture duration (default 10)\n"
+              << "  --width W --height H   video resolution (default 1280x720)\n"
+              << "  --fps N                video packet rate (default 30)\n"
+              << "  --gop N                keyframe interval in frames (default 60)\n"
+              << "  --video-bitrate BPS    video bitrate (default 2000000)\n"
+              << "  --sample-rate HZ       audio sample rate, packet rate is HZ/1024 (default 48000)\n"
+              << "  --audio-bitrate BPS    audio bitrate (default 128000)\n"
+              << "  --iterations N         merges per scenario (default 3)\n"
+              << "  --no-transcode         only benchmark stream copy\n"
+              << "  --work-dir DIR         where fixtures and outputs are written (default .)\n"
+              << "  --json PATH            result file (default avmerger_bench.json)\n";
+}
+
+static bool parseArguments(int argc, char *argv[], BenchOptions &options)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (arg == "--no-transcode")
+        {
+            options.transcode = false;
+            continue;
+        }
+        if (arg == "--help" || arg == "-h" || i + 1 >= argc)
+        {
+            return false;
+        }
+
+        std::string value = argv[++i];
+        if (arg == "--duration")
+            options.fixture.durationSeconds = std::atof(value.c_str());
+        else if (arg == "--width")
+            options.fixture.width = std::atoi(value.c_str());
+        else if (arg == "--height")
+            options.fixture.height = std::atoi(value.c_str());
+        else if (arg == "--fps")
+            options.fixture.frameRate = std::atoi(value.c_str());
+        else if (arg == "--gop")
+            options.fixture.gopSize = std::atoi(value.c_str());
+        else if (arg == "--video-bitrate")
+            options.fixture.videoBitRate = std::atoll(value.c_str());
+        else if (arg == "--sample-rate")
+            options.fixture.sampleRate = std::atoi(value.c_str());
+        else if (arg == "--audio-bitrate")
+            options.fixture.audioBitRate = std::atoll(value.c_str());
+        else if (arg == "--iterations")
+            options.iterations = std::max(1, std::atoi(value.c_str()));
+        else if (arg == "--work-dir")
+            options.workDir = value;
+        else if (arg == "--json")
+            options.jsonPath = value;
+        else if (arg == "--run-scenario" && (value == "stream_copy" || value == "transcode"))
+            options.runScenario = value;
+        else
+            return false;
+    }
+    return options.fixture.durationSeconds > 0 && options.fixture.width > 0 && options.fixture.height > 0 &&
+           options.fixture.frameRate > 0 && options.fixture.sampleRate > 0;
+}
+
+static std::vector<IterationResult> runScenario(const BenchOptions &options, const std::string &videoPath,
+                                                const std::string &audioPath, const std::string &outputPath,
+                                                bool transcode, std::string &error)
+{
+    std::vector<IterationResult> results;
+    for (int i = 0; i < options.iterations; i++)
+    {
+        MergeOptions mergeOptions;
+        mergeOptions.forceTranscode = transcode;
+
+        AudioVideoMerger merger;
+        IterationResult result;
+        {
+            StdoutSilencer silencer;
+            result.success = merger.merge(videoPath, audioPath, outputPath, mergeOptions);
+        }
+        result.stats = merger.getLastStats();
+        if (!result.success)
+        {
+            error = merger.getLastError();
+        }
+        results.push_back(result);
+        std::remove(outputPath.c_str());
+        if (!result.success)
+        {
+            break;
+        }
+    }
+    return results;
+}
+
+// 输出 {"mean":..,"min":..,"max":..}
+static std::string summarize(const std::vector<double> &values)
+{
+    double sum = 0.0;
+    double minValue = values.empty() ? 0.0 : values[0];
+    double maxValue = minValue;
+    for (double value : values)
+    {
+        sum += value;
+        minValue = std::min(minValue, value);
+        maxValue = std::max(maxValue, value);
+    }
+    std::ostringstream json;
+    json << "{\"mean\": " << (values.empty() ? 0.0 : sum / values.size()) << ", \"min\": " << minValue
+         << ", \"max\": " << maxValue << "}";
+    return json.str();
+}
+
+static std::string scenarioJson(const std::string &name, const std::vector<IterationResult> &results,
+                                long peakRss, const std::string &error)
+{
+    std::vector<double> megabytesPerSecond, packetsPerSecond, open, header, packets, trailer, total;
+    for (const auto &result : results)
+    {
+        if (!result.success)
+            continue;
+        const MergeStats &stats = result.stats;
+        double seconds = std::max(stats.totalSeconds, 1e-9);
+        megabytesPerSecond.push_back(stats.bytesRead / (1024.0 * 1024.0) / seconds);
+        packetsPerSecond.push_back(stats.packetsRead / seconds);
+        open.push_back(stats.openSeconds);
+        header.push_back(stats.headerSeconds);
+        packets.push_back(stats.packetSeconds);
+        trailer.push_back(stats.trailerSeconds);
+        total.push_back(stats.totalSeconds);
+    }
+
+    const MergeStats last = results.empty() ? MergeStats() : results.back().stats;
+    std::ostringstream json;
+    json << "    {\n"
+         << "      \"scenario\": \"" << name << "\",\n"
+         << "      \"success\": " << (error.empty() ? "true" : "false") << ",\n"
+         << "      \"iterations\": " << total.size() << ",\n"
+         << "      \"packets\": " << last.packetsRead << ",\n"
+         << "      \"input_bytes\": " << last.bytesRead << ",\n"
+         << "      \"output_bytes\": " << last.bytesWritten << ",\n"
+         << "      \"throughput_mb_per_s\": " << summarize(megabytesPerSecond) << ",\n"
+         << "      \"packets_per_s\": " << summarize(packetsPerSecond) << ",\n"
+         << "      \"peak_rss_kb\": " << peakRss << ",\n"
+         << "      \"phase_seconds\": {\n"
+         << "        \"open\": " << summarize(open) << ",\n"
+         << "        \"header\": " << summarize(header) << ",\n"
+         << "        \"packets\": " << summarize(packets) << ",\n"
+         << "        \"trailer\": " << summarize(trailer) << ",\n"
+         << "        \"total\": " << summarize(total) << "\n"
+         << "      }";
+    if (!error.empty())
+    {
+        std::string escaped;
+        for (char c : error)
+        {
+            if (c == '"' || c == '\\')
+                escaped += '\\';
+            escaped += c;
+        }
+        json << ",\n      \"error\": \"" << escaped << "\"";
+    }
+    json << "\n    }";
+    return json.str();
+}
+
+// 命令行参数加引号（路径可能含空格）
+static std::string quoteArgument(const std::string &argument)
+{
+    std::string quoted = "\"";
+    for (char c : argument)
+    {
+        if (c == '"')
+            quoted += '\\';
+        quoted += c;
+    }
+    return quoted + "\"";
+}
+
+/**
+ * 在子进程中运行一个场景，子进程的峰值内存只包含该场景
+ * @return 场景结果的JSON，子进程未写出结果时返回失败的场景结果
+ */
+static std::string runScenarioProcess(const char *program, const BenchOptions &options, const std::string &name,
+                                      bool &success)
+{
+    std::string resultPath = options.workDir + "/bench_" + name + ".json";
+    std::string command = quoteArgument(program) + " --run-scenario " + name + " --iterations " +
+                          std::to_string(options.iterations) + " --work-dir " + quoteArgument(options.workDir) +
+                          " --json " + quoteArgument(resultPath);
+#ifdef _WIN32
+    // cmd /c 会去掉整条命令最外层的一对引号
+    command = "\"" + command + "\"";
+#endif
+    std::remove(resultPath.c_str());
+    int status = std::system(command.c_str());
+
+    std::ifstream file(resultPath);
+    std::ostringstream result;
+    result << file.rdbuf();
+    file.close();
+    std::remove(resultPath.c_str());
+    success = status == 0;
+    if (result.str().empty())
+    {
+        success = false;
+        return scenarioJson(name, std::vector<IterationResult>(), 0,
+                            "Scenario process failed with status " + std::to_string(status));
+    }
+    return result.str();
+}
+
+int main(int argc, char *argv[])
+{
+    BenchOptions options;
+    if (!parseArguments(argc, argv, options))
+    {
+        printUsage(argv[0]);
+        return 2;
+    }
+
+    av_log_set_level(AV_LOG_ERROR);
+
+    std::string videoPath = options.workDir + "/bench_v.m4s";
+    std::string audioPath = options.workDir + "/bench_a.m4s";
+    std::string outputPath = options.workDir + "/bench_out.mp4";
+
+    if (!options.runScenario.empty())
+    {
+        // 子进程：素材已由父进程生成
+        std::string error;
+        auto results =
+            runScenario(options, videoPath, audioPath, outputPath, options.runScenario == "transcode", error);
+        std::ofstream file(options.jsonPath);
+        file << scenarioJson(options.runScenario, results, peakRssKilobytes(), error);
+        if (!error.empty())
+        {
+            std::cerr << options.runScenario << " failed: " << error << std::endl;
+        }
+        return error.empty() && file ? 0 : 1;
+    }
+
+    std::cerr << "Generating " << options.fixture.durationSeconds << "s fixture ("
+              << options.fixture.width << "x" << options.fixture.height << "@" << options.fixture.frameRate
+              << ", " << options.fixture.videoBitRate << " bps)..." << std::endl;
+
+    auto generateStart = std::chrono::steady_clock::now();
+    FixtureGenerator generator;
+    if (!generator.generate(options.fixture, videoPath, audioPath))
+    {
+        std::cerr << "Fixture generation failed: " << generator.getLastError() << std::endl;
+        return 1;
+    }
+    double generateSeconds =
+        std::chrono::duration<double>(std::chrono::steady_clock::now() - generateStart).count();
+
+    std::vector<std::string> scenarios;
+    bool allSucceeded = true;
+
+    std::vector<std::string> toRun = {"stream_copy"};
+    if (options.transcode)
+    {
+        toRun.push_back("transcode");
+    }
+
+    for (const auto &scenario : toRun)
+    {
+        std::cerr << "Running " << scenario << " x" << options.iterations << "..." << std::endl;
+        bool success = false;
+        scenarios.push_back(runScenarioProcess(argv[0], options, scenario, success));
+        allSucceeded = allSucceeded && success;
+    }
+
+    std::remove(videoPath.c_str());
+    std::remove(audioPath.c_str());
+
+    std::ostringstream json;
+    json << "{\n"
+         << "  \"benchmark\": \"avmerger\",\n"
+         << "  \"timestamp\": " << (long long)std::time(nullptr) << ",\n"
+         << "  \"libavformat_version\": \"" << (avformat_version() >> 16) << "." << ((avformat_version() >> 8) & 0xff)
+         << "." << (avformat_version() & 0xff) << "\",\n"
+         << "  \"fixture\": {\n"
+         << "    \"duration_seconds\": " << options.fixture.durationSeconds << ",\n"
+         << "    \"width\": " << options.fixture.width << ",\n"
+         << "    \"height\": " << options.fixture.height << ",\n"
+         << "    \"frame_rate\": " << options.fixture.frameRate << ",\n"
+         << "    \"gop_size\": " << options.fixture.gopSize << ",\n"
+         << "    \"video_bitrate\": " << options.fixture.videoBitRate << ",\n"
+         << "    \"sample_rate\": " << options.fixture.sampleRate << ",\n"
+         << "    \"audio_bitrate\": " << options.fixture.audioBitRate << ",\n"
+         << "    \"generation_seconds\": " << generateSeconds << "\n"
+         << "  },\n"
+         << "  \"results\": [\n";
+    for (size_t i = 0; i < scenarios.size(); i++)
+    {
+        json << scenarios[i] << (i + 1 < scenarios.size() ? ",\n" : "\n");
+    }
+    json << "  ]\n}\n";
+
+    std::ofstream file(options.jsonPath);
+    file << json.str();
+    std::cout << json.str();
+    if (!file)
+    {
+        std::cerr << "Failed to write " << options.jsonPath << std::endl;
+        return 1;
+    }
+    return allSucceeded ? 0 : 1;
+}
@@ -0,0 +1,51 @@
+#!/bin/sh
+# 构建只包含avmerger所需组件的静态FFmpeg，配合 -DAVMERGER_STATIC_FFMPEG=ON 使用
+#
+#   ./build_minimal_ffmpeg.sh /path/to/ffmpeg-source /opt/ffmpeg-minimal
+#   PKG_CONFIG_PATH=/opt/ffmpeg-minimal/lib/pkgconfig cmake -S . -B build -DAVMERGER_STATIC_FFMPEG=ON
+#
+# 包含：file协议，mov/mp4、matroska、nut（分段合并的中间文件）、mpegts、flv的解封装，
+# ContainerRules中各输出格式（mp4/mov/ipod、matroska/webm、mpegts、flv）和HLS/DASH打包的封装器，
+# 复制时按容器需要的比特流过滤器（h264/hevc转Annex B、ADTS转AAC），h264/aac的解析器和解码器，
+# aac编码器，缩略图的mjpeg编码器，swscale/swresample。
+# 设置 AVMERGER_WITH_X264=1 时启用libx264（GPL），供转码和基准素材生成使用；
+# 设置 AVMERGER_WITH_WEBP=1 时启用libwebp（需已安装），供WebP缩略图使用。
+# 未包含的组件在运行时报告明确的错误（如 Output format not available in the linked FFmpeg）。
+set -e
+
+if [ $# -lt 2 ]; then
+    echo "Usage: $0 <ffmpeg-source-dir> <install-prefix>" >&2
+    exit 2
+fi
+
+SOURCE_DIR=$1
+PREFIX=$2
+JOBS=${JOBS:-$(nproc 2>/dev/null || echo 4)}
+
+EXTRA_FLAGS=""
+if [ "${AVMERGER_WITH_X264:-0}" = "1" ]; then
+    EXTRA_FLAGS="--enable-gpl --enable-libx264 --enable-encoder=libx264"
+fi
+if [ "${AVMERGER_WITH_WEBP:-0}" = "1" ]; then
+    EXTRA_FLAGS="$EXTRA_FLAGS --enable-libwebp --enable-encoder=libwebp"
+fi
+
+cd "$SOURCE_DIR"
+./configure \
+    --prefix="$PREFIX" \
+    --enable-static --disable-shared --enable-pic \
+    --disable-programs --disable-doc --disable-network --disable-autodetect \
+    --disable-avdevice --disable-avfilter --disable-postproc \
+    --disable-everything \
+    --enable-protocol=file \
+    --enable-demuxer=mov,matroska,nut,mpegts,flv \
+    --enable-muxer=mp4,mov,ipod,matroska,webm,nut,mpegts,flv,hls,dash \
+    --enable-parser=h264,hevc,aac \
+    --enable-decoder=h264,aac \
+    --enable-encoder=aac,mjpeg \
+    --enable-bsf=h264_mp4toannexb,hevc_mp4toannexb,aac_adtstoasc \
+    --enable-swscale --enable-swresample \
+    $EXTRA_FLAGS
+
+make -j"$JOBS"
+make install
@@ -0,0 +1,102 @@
+# measure_startup.py
+"""
+测量 import avmerger 的耗时和新进程中第一次合并的延迟
+
+每次测量都启动新的Python进程，模拟短生命周期的工作进程。
+Linux上同时统计导入后和合并后映射进进程的FFmpeg共享库，
+用于对比普通构建、AVMERGER_LAZY_TRANSCODE_LIBS和AVMERGER_STATIC_FFMPEG。
+
+    python measure_startup.py --runs 20
+    python measure_startup.py --runs 20 --video v.m4s --audio a.m4s --json startup.json
+    python measure_startup.py --runs 5 --video v.m4s --audio a.m4s --transcode
+"""
+
+import argparse
+import json
+import os
+import subprocess
+import sys
+import tempfile
+
+CHILD = r"""
+import json, os, sys, time
+
+def ffmpeg_libraries():
+    try:
+        with open("/proc/self/maps") as maps:
+            names = {os.path.basename(line.split()[-1]) for line in maps if "/" in line}
+    except OSError:
+        return None
+    prefixes = ("libavformat", "libavcodec", "libavutil", "libswscale", "libswresample",
+                "libavdevice", "libavfilter", "libpostproc")
+    return sorted(name for name in names if name.startswith(prefixes))
+
+start = time.perf_counter()
+import avmerger
+result = {"import_seconds": time.perf_counter() - start, "libraries_after_import": ffmpeg_libraries()}
+
+video, audio, output, transcode = sys.argv[1:5]
+if video:
+    options = avmerger.MergeOptions()
+    options.verbose = False
+    options.force_transcode = transcode == "1"
+    merger = avmerger.AudioVideoMerger()
+    start = time.perf_counter()
+    ok = merger.merge(video, audio, output, options)
+    result["first_merge_seconds"] = time.perf_counter() - start
+    result["first_merge_ok"] = ok
+    result["libraries_after_merge"] = ffmpeg_libraries()
+    if os.path.exists(output):
+        os.remove(output)
+
+print(json.dumps(result))
+"""
+
+
+def summarize(values):
+    if not values:
+        return None
+    return {"mean": sum(values) / len(values), "min": min(values), "max": max(values)}
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--runs", type=int, default=10, help="fresh interpreters to start (default 10)")
+    parser.add_argument("--video", default="", help="video input for the first-merge measurement")
+    parser.add_argument("--audio", default="", help="audio input for the first-merge measurement")
+    parser.add_argument("--transcode", action="store_true", help="force transcoding in the first merge")
+    parser.add_argument("--json", default="", help="write the results to this file")
+    args = parser.parse_args()
+
+    if bool(args.video) != bool(args.audio):
+        parser.error("--video and --audio must be given together")
+
+    output = os.path.join(tempfile.gettempdir(), "avmerger_startup_%d.mp4" % os.getpid())
+    runs = []
+    for _ in range(args.runs):
+        completed = subprocess.run(
+            [sys.executable, "-c", CHILD, args.video, args.audio, output, "1" if args.transcode else "0"],
+            stdout=subprocess.PIPE,
+            check=True,
+        )
+        runs.append(json.loads(completed.stdout.decode().strip().splitlines()[-1]))
+
+    result = {
+        "runs": len(runs),
+        "import_seconds": summarize([run["import_seconds"] for run in runs]),
+        "libraries_after_import": runs[-1]["libraries_after_import"],
+    }
+    if args.video:
+        result["first_merge_seconds"] = summarize([run["first_merge_seconds"] for run in runs])
+        result["first_merge_ok"] = all(run["first_merge_ok"] for run in runs)
+        result["libraries_after_merge"] = runs[-1]["libraries_after_merge"]
+
+    text = json.dumps(result, indent=2)
+    print(text)
+    if args.json:
+        with open(args.json, "w", encoding="utf-8") as file:
+            file.write(text + "\n")
+
+
+if __name__ == "__main__":
+    main()
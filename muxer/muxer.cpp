@@ -1,29 +1,650 @@
+// avmerge：命令行批量合并工具
+// 支持单个任务（位置参数）和JSONL清单（每行一个任务），--jobs N 并行执行，
+// 每个任务结束时打印耗时，全部结束后打印吞吐量汇总
+
 #include "muxer.h"
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <vector>
 #include "AudioVideoMerger.h"
+#include "MergeScheduler.h"
+
+struct CliOptions
+{
+    int jobs = 1;
+    std::string manifestPath;
+    // 作用于所有任务的默认参数，清单中的字段可覆盖
+    MergeOptions mergeOptions;
+    // 为每个输出写关键帧索引旁路文件 <output>.avmidx
+    bool seekIndex = false;
+    std::vector<std::string> positional;
+};
+
+struct CliSummary
+{
+    size_t succeeded = 0;
+    size_t failed = 0;
+    int64_t bytesRead = 0;
+    int64_t bytesWritten = 0;
+    int64_t packetsRead = 0;
+    size_t cacheHits = 0;
+    size_t clonedInputs = 0;
+};
+
+static void printUsage(const char *program)
+{
+    std::cerr << "Usage: " << program << " [options] <video> <audio> <output>\n"
+              << "       " << program << " [options] --manifest jobs.jsonl\n"
+              << "  --jobs N           run up to N merges in parallel (default 1)\n"
+              << "  --manifest PATH    JSONL file, one job per line:\n"
+              << "                     {\"video\": ..., \"audio\": ..., \"output\": ...,\n"
+              << "                      \"start\": s, \"end\": s, \"priority\": n, \"format\": name,\n"
+              << "                      \"video_offset\": s, \"audio_offset\": s}\n"
+              << "  --start SECONDS    trim start (seeks to the preceding keyframe)\n"
+              << "  --end SECONDS      trim end\n"
+              << "  --video-offset S   delay the video by S seconds (negative to advance)\n"
+              << "  --audio-offset S   delay the audio by S seconds (negative to advance)\n"
+              << "  --no-align         keep the inputs' original start times instead of aligning them to zero\n"
+              << "  --shortest         stop at the end of the shorter input\n"
+              << "  --format NAME      output muxer (mp4, mov, mkv, webm, ts, flv, ...), default from the extension\n"
+              << "  --segments N       split each job into N parallel segments\n"
+              << "  --transcode        re-encode every stream\n"
+              << "  --native           remux fMP4 inputs to MP4 without libavformat's muxer when possible\n"
+              << "  --validate         with --native, re-read the output and compare packet counts\n"
+              << "  --faststart        put the moov box at the front of MP4/MOV output\n"
+              << "  --sidx             fragment MP4/MOV output at keyframes and write a global sidx box\n"
+              << "  --seek-index       write a keyframe index <output>.avmidx next to every output\n"
+              << "  --resume           with --sidx, continue an interrupted merge from its last complete fragment\n"
+              << "  --no-atomic        write directly to the output instead of <name>.partial.*.<ext> and renaming\n"
+              << "  --package hls|dash write segments and a playlist/manifest; output is the .m3u8/.mpd\n"
+              << "  --segment-duration S     target segment duration for --package (default 6)\n"
+              << "  --segment-type TYPE      HLS segments: fmp4 or mpegts (default fmp4)\n"
+              << "  --checksum         print the CRC32C of every output, computed while writing\n"
+              << "  --no-clone         always merge, even when the output would be identical to an input\n"
+              << "  --cache DIR        reuse outputs of earlier merges of the same inputs and options\n"
+              << "  --cache-size GB    evict least recently used cached outputs above this size (default 10)\n"
+              << "  --cache-verify     re-read the inputs and compare full checksums before using a cached output\n"
+              << "  --loudness         measure EBU R128 loudness of the audio while merging\n"
+              << "  --thumbnails S     extract a keyframe thumbnail every S seconds of video while merging\n"
+              << "  --thumbnail-width PX     thumbnail width, height keeps the aspect ratio (default 320)\n"
+              << "  --thumbnail-format FMT   jpeg or webp (default jpeg)\n"
+              << "  --thumbnail-pattern PAT  thumbnail file names, %04d is the index\n"
+              << "                           (default <output>.thumb%04d.<format>)\n"
+              << "  --verbose          print stream information for every job\n";
+}
+
+static bool parseArguments(int argc, char *argv[], CliOptions &options)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (arg == "--transcode")
+        {
+            options.mergeOptions.forceTranscode = true;
+            continue;
+        }
+        if (arg == "--native")
+        {
+            options.mergeOptions.nativeRemux = true;
+            continue;
+        }
+        if (arg == "--validate")
+        {
+            options.mergeOptions.validateNativeRemux = true;
+            continue;
+        }
+        if (arg == "--faststart")
+        {
+            options.mergeOptions.faststart = true;
+            continue;
+        }
+        if (arg == "--sidx")
+        {
+            options.mergeOptions.sidx = true;
+            continue;
+        }
+        if (arg == "--seek-index")
+        {
+            options.seekIndex = true;
+            continue;
+        }
+        if (arg == "--resume")
+        {
+            options.mergeOptions.resume = true;
+            continue;
+        }
+        if (arg == "--no-atomic")
+        {
+            options.mergeOptions.atomicOutput = false;
+            continue;
+        }
+        if (arg == "--no-align")
+        {
+            options.mergeOptions.alignStartTimes = false;
+            continue;
+        }
+        if (arg == "--shortest")
+        {
+            options.mergeOptions.trimToShortest = true;
+            continue;
+        }
+        if (arg == "--checksum")
+        {
+            options.mergeOptions.checksum = true;
+            continue;
+        }
+        if (arg == "--no-clone")
+        {
+            options.mergeOptions.cloneUnchangedInput = false;
+            continue;
+        }
+        if (arg == "--cache-verify")
+        {
+            options.mergeOptions.cacheVerifyInputs = true;
+            continue;
+        }
+        if (arg == "--loudness")
+        {
+            options.mergeOptions.loudness = true;
+            continue;
+        }
+        if (arg == "--verbose")
+        {
+            options.mergeOptions.verbose = true;
+            continue;
+        }
+        if (arg == "--help" || arg == "-h")
+        {
+            return false;
+        }
+        if (arg.size() < 2 || arg.compare(0, 2, "--") != 0)
+        {
+            options.positional.push_back(arg);
+            continue;
+        }
+        if (i + 1 >= argc)
+        {
+            return false;
+        }
+
+        std::string value = argv[++i];
+        if (arg == "--jobs")
+            options.jobs = std::max(1, std::atoi(value.c_str()));
+        else if (arg == "--manifest")
+            options.manifestPath = value;
+        else if (arg == "--start")
+            options.mergeOptions.startTime = std::atof(value.c_str());
+        else if (arg == "--end")
+            options.mergeOptions.endTime = std::atof(value.c_str());
+        else if (arg == "--video-offset")
+            options.mergeOptions.videoOffset = std::atof(value.c_str());
+        else if (arg == "--audio-offset")
+            options.mergeOptions.audioOffset = std::atof(value.c_str());
+        else if (arg == "--format")
+            options.mergeOptions.outputFormat = value;
+        else if (arg == "--segments")
+            options.mergeOptions.parallelSegments = std::atoi(value.c_str());
+        else if (arg == "--cache")
+            options.mergeOptions.cacheDirectory = value;
+        else if (arg == "--cache-size")
+            options.mergeOptions.cacheMaxBytes = (int64_t)(std::atof(value.c_str()) * 1024 * 1024 * 1024);
+        else if (arg == "--package")
+            options.mergeOptions.packaging = value;
+        else if (arg == "--segment-duration")
+            options.mergeOptions.segmentDuration = std::atof(value.c_str());
+        else if (arg == "--segment-type")
+            options.mergeOptions.segmentType = value;
+        else if (arg == "--thumbnails")
+            options.mergeOptions.thumbnailInterval = std::atof(value.c_str());
+        else if (arg == "--thumbnail-width")
+            options.mergeOptions.thumbnailWidth = std::atoi(value.c_str());
+        else if (arg == "--thumbnail-format")
+            options.mergeOptions.thumbnailFormat = value;
+        else if (arg == "--thumbnail-pattern")
+            options.mergeOptions.thumbnailPattern = value;
+        else
+            return false;
+    }
+
+    if (options.manifestPath.empty())
+    {
+        return options.positional.size() == 3;
+    }
+    return options.positional.empty();
+}
+
+// 把码点按UTF-8追加到字符串
+static void appendUtf8(std::string &out, unsigned int codePoint)
+{
+    if (codePoint < 0x80)
+    {
+        out += (char)codePoint;
+    }
+    else if (codePoint < 0x800)
+    {
+        out += (char)(0xc0 | (codePoint >> 6));
+        out += (char)(0x80 | (codePoint & 0x3f));
+    }
+    else if (codePoint < 0x10000)
+    {
+        out += (char)(0xe0 | (codePoint >> 12));
+        out += (char)(0x80 | ((codePoint >> 6) & 0x3f));
+        out += (char)(0x80 | (codePoint & 0x3f));
+    }
+    else
+    {
+        out += (char)(0xf0 | (codePoint >> 18));
+        out += (char)(0x80 | ((codePoint >> 12) & 0x3f));
+        out += (char)(0x80 | ((codePoint >> 6) & 0x3f));
+        out += (char)(0x80 | (codePoint & 0x3f));
+    }
+}
+
+// 读取\u之后的4位十六进制数，pos指向第一位
+static bool parseHex4(const std::string &line, size_t pos, unsigned int &value)
+{
+    if (pos + 4 > line.size())
+    {
+        return false;
+    }
+    for (size_t i = pos; i < pos + 4; i++)
+    {
+        if (!std::isxdigit((unsigned char)line[i]))
+        {
+            return false;
+        }
+    }
+    value = (unsigned int)std::strtoul(line.substr(pos, 4).c_str(), nullptr, 16);
+    return true;
+}
+
+static void skipSpaces(const std::string &line, size_t &pos)
+{
+    while (pos < line.size() && (line[pos] == ' ' || line[pos] == '\t' || line[pos] == '\r' || line[pos] == '\n'))
+    {
+        pos++;
+    }
+}
+
+static bool parseJsonString(const std::string &line, size_t &pos, std::string &value)
+{
+    if (pos >= line.size() || line[pos] != '"')
+    {
+        return false;
+    }
+    value.clear();
+    for (pos++; pos < line.size(); pos++)
+    {
+        char c = line[pos];
+        if (c == '"')
+        {
+            pos++;
+            return true;
+        }
+        if (c != '\\')
+        {
+            value += c;
+            continue;
+        }
+        if (++pos >= line.size())
+        {
+            return false;
+        }
+        switch (line[pos])
+        {
+        case 'n': value += '\n'; break;
+        case 't': value += '\t'; break;
+        case 'r': value += '\r'; break;
+        case 'b': value += '\b'; break;
+        case 'f': value += '\f'; break;
+        case 'u':
+        {
+            unsigned int codePoint;
+            if (!parseHex4(line, pos + 1, codePoint))
+            {
+                return false;
+            }
+            pos += 4;
+            // BMP之外的字符（如表情符号）写作UTF-16代理对：\uD83D\uDE00
+            unsigned int low;
+            if (codePoint >= 0xd800 && codePoint < 0xdc00 && pos + 2 < line.size() && line[pos + 1] == '\\' &&
+                line[pos + 2] == 'u' && parseHex4(line, pos + 3, low) && low >= 0xdc00 && low < 0xe000)
+            {
+                codePoint = 0x10000 + ((codePoint - 0xd800) << 10) + (low - 0xdc00);
+                pos += 6;
+            }
+            else if (codePoint >= 0xd800 && codePoint < 0xe000)
+            {
+                // 不成对的代理不是有效字符
+                codePoint = 0xfffd;
+            }
+            appendUtf8(value, codePoint);
+            break;
+        }
+        default: value += line[pos]; break;
+        }
+    }
+    return false;
+}
+
+/**
+ * 解析清单中的一行：只支持一层的JSON对象，值为字符串或数字
+ * @param line 清单行
+ * @param defaults 命令行给出的默认参数
+ * @param job 解析结果
+ * @param error 失败原因
+ * @return 解析成功返回true
+ */
+static bool parseManifestLine(const std::string &line, const MergeOptions &defaults, MergeJob &job,
+                              std::string &error)
+{
+    job = MergeJob();
+    job.options = defaults;
+
+    size_t pos = 0;
+    skipSpaces(line, pos);
+    if (pos >= line.size() || line[pos] != '{')
+    {
+        error = "expected a JSON object";
+        return false;
+    }
+    pos++;
+
+    while (true)
+    {
+        skipSpaces(line, pos);
+        if (pos < line.size() && line[pos] == '}')
+        {
+            break;
+        }
+
+        std::string key;
+        skipSpaces(line, pos);
+        if (!parseJsonString(line, pos, key))
+        {
+            error = "expected a key";
+            return false;
+        }
+        skipSpaces(line, pos);
+        if (pos >= line.size() || line[pos] != ':')
+        {
+            error = "expected ':' after \"" + key + "\"";
+            return false;
+        }
+        pos++;
+        skipSpaces(line, pos);
+
+        std::string text;
+        double number = 0.0;
+        bool isString = pos < line.size() && line[pos] == '"';
+        if (isString)
+        {
+            if (!parseJsonString(line, pos, text))
+            {
+                error = "unterminated string for \"" + key + "\"";
+                return false;
+            }
+        }
+        else
+        {
+            const char *begin = line.c_str() + pos;
+            char *end = nullptr;
+            number = std::strtod(begin, &end);
+            if (end == begin)
+            {
+                error = "unsupported value for \"" + key + "\"";
+                return false;
+            }
+            pos += end - begin;
+        }
+
+        if (key == "video" && isString)
+            job.videoPath = text;
+        else if (key == "audio" && isString)
+            job.audioPath = text;
+        else if (key == "output" && isString)
+            job.outputPath = text;
+        else if (key == "format" && isString)
+            job.options.outputFormat = text;
+        else if (key == "start" && !isString)
+            job.options.startTime = number;
+        else if (key == "end" && !isString)
+            job.options.endTime = number;
+        else if (key == "video_offset" && !isString)
+            job.options.videoOffset = number;
+        else if (key == "audio_offset" && !isString)
+            job.options.audioOffset = number;
+        else if (key == "priority" && !isString)
+            job.priority = (int)number;
+        else if (key == "video" || key == "audio" || key == "output" || key == "format" || key == "start" ||
+                 key == "end" || key == "video_offset" || key == "audio_offset" || key == "priority")
+        {
+            error = "wrong value type for \"" + key + "\"";
+            return false;
+        }
+        // 其余字段忽略，便于清单携带业务信息
+
+        skipSpaces(line, pos);
+        if (pos < line.size() && line[pos] == ',')
+        {
+            pos++;
+            continue;
+        }
+        if (pos < line.size() && line[pos] == '}')
+        {
+            break;
+        }
+        error = "expected ',' or '}'";
+        return false;
+    }
+
+    if (job.videoPath.empty() || job.audioPath.empty() || job.outputPath.empty())
+    {
+        error = "\"video\", \"audio\" and \"output\" are required";
+        return false;
+    }
+    return true;
+}
+
+static bool loadManifest(const CliOptions &options, std::vector<MergeJob> &jobs)
+{
+    std::ifstream manifest(options.manifestPath);
+    if (!manifest)
+    {
+        std::cerr << "Failed to open manifest: " << options.manifestPath << std::endl;
+        return false;
+    }
+
+    std::string line;
+    size_t lineNumber = 0;
+    bool success = true;
+    while (std::getline(manifest, line))
+    {
+        lineNumber++;
+        size_t pos = 0;
+        skipSpaces(line, pos);
+        if (pos >= line.size() || line[pos] == '#')
+        {
+            continue;
+        }
 
-int main(int argc, char* argv[]) {
-    //if (argc != 4) {
-    //    std::cerr << "用法: " << argv[0] << " <视频文件> <音频文件> <输出文件>" << std::endl;
-    //    return -1;
-    //}
+        MergeJob job;
+        std::string error;
+        if (!parseManifestLine(line, options.mergeOptions, job, error))
+        {
+            std::cerr << options.manifestPath << ":" << lineNumber << ": " << error << std::endl;
+            success = false;
+            continue;
+        }
+        jobs.push_back(job);
+    }
+    return success;
+}
+
+int main(int argc, char *argv[])
+{
+#ifdef _WIN32
     SetConsoleOutputCP(CP_UTF8);
+#endif
+
+    CliOptions options;
+    // 批量处理默认不打印每个任务的流信息
+    options.mergeOptions.verbose = false;
+    if (!parseArguments(argc, argv, options))
+    {
+        printUsage(argv[0]);
+        return 2;
+    }
+
+    if (!options.mergeOptions.verbose)
+    {
+        av_log_set_level(AV_LOG_ERROR);
+    }
 
-    // 输入视频文件路径
-    std::string videoFile = "C:\\Users\\25335\\AppData\\Roaming\\bilibili-core\\cache\\test_v.m4s";
+    std::vector<MergeJob> jobs;
+    if (!options.manifestPath.empty())
+    {
+        if (!loadManifest(options, jobs))
+        {
+            return 2;
+        }
+    }
+    else
+    {
+        MergeJob job;
+        job.videoPath = options.positional[0];
+        job.audioPath = options.positional[1];
+        job.outputPath = options.positional[2];
+        job.options = options.mergeOptions;
+        jobs.push_back(job);
+    }
+
+    std::mutex outputMutex;
+    CliSummary summary;
+    auto wallStart = std::chrono::steady_clock::now();
 
-    // 输入音频文件路径
-    std::string audioFile = "C:\\Users\\25335\\AppData\\Roaming\\bilibili-core\\cache\\test_a.m4s";
+    {
+        SchedulerLimits limits;
+        limits.workerThreads = options.jobs;
+        limits.maxConcurrentTranscodes = options.jobs;
+        MergeScheduler scheduler(limits);
 
-    // 输出合并后的视频文件路径
-    std::string outputFile = "C:\\Users\\25335\\AppData\\Roaming\\bilibili-core\\cache\\test.mp4";
+        for (auto &job : jobs)
+        {
+            std::string outputPath = job.outputPath;
+            // 命令行总是把缩略图写成文件，默认放在输出文件旁边
+            if (job.options.thumbnailInterval > 0 && job.options.thumbnailPattern.empty())
+            {
+                job.options.thumbnailPattern = outputPath + ".thumb%04d." +
+                                               (job.options.thumbnailFormat == "webp" ? "webp" : "jpg");
+            }
+            if (options.seekIndex)
+            {
+                job.options.seekIndexPath = outputPath + ".avmidx";
+            }
+            bool thumbnails = job.options.thumbnailInterval > 0;
+            job.onComplete = [&, outputPath, thumbnails](int64_t, bool success, const std::string &error, const MergeStats &stats) {
+                std::lock_guard<std::mutex> lock(outputMutex);
+                if (success)
+                {
+                    summary.succeeded++;
+                    summary.bytesRead += stats.bytesRead;
+                    summary.bytesWritten += stats.bytesWritten;
+                    summary.packetsRead += stats.packetsRead;
+                    summary.cacheHits += stats.cacheHit ? 1 : 0;
+                    summary.clonedInputs += stats.inputCloned ? 1 : 0;
+                    double seconds = std::max(stats.totalSeconds, 1e-9);
+                    std::cout << "[ok]     " << outputPath << "  " << stats.totalSeconds << "s  "
+                              << stats.bytesRead / (1024.0 * 1024.0) / seconds << " MB/s  " << stats.packetsRead
+                              << " packets";
+                    if (stats.checksumValid)
+                    {
+                        char crc[16];
+                        std::snprintf(crc, sizeof(crc), "%08x", stats.outputCrc32c);
+                        std::cout << "  crc32c " << crc;
+                    }
+                    if (stats.cacheHit)
+                    {
+                        std::cout << "  cached";
+                    }
+                    if (stats.inputCloned)
+                    {
+                        std::cout << "  cloned input (" << cloneMethodName(stats.cloneMethod) << ")";
+                    }
+                    if (stats.loudness.valid)
+                    {
+                        char loudness[96];
+                        std::snprintf(loudness, sizeof(loudness), "  %.1f LUFS  LRA %.1f LU  %.1f dBTP",
+                                      stats.loudness.integrated, stats.loudness.range, stats.loudness.truePeak);
+                        std::cout << loudness;
+                    }
+                    if (thumbnails)
+                    {
+                        std::cout << "  " << stats.thumbnails.size() << " thumbnails";
+                        if (stats.thumbnailFailures > 0)
+                        {
+                            std::cout << " (" << stats.thumbnailFailures << " failed)";
+                        }
+                    }
+                    if (stats.segmentFiles > 0)
+                    {
+                        std::cout << "  " << stats.segmentFiles << " files";
+                    }
+                    if (stats.seekIndexWritten)
+                    {
+                        std::cout << "  " << stats.seekPoints << " seek points";
+                    }
+                    if (stats.resumedFragments > 0)
+                    {
+                        std::cout << "  resumed after " << stats.resumedFragments << " fragments";
+                    }
+                    int64_t anomalies = 0;
+                    for (const auto &stream : stats.streams)
+                    {
+                        anomalies += stream.nonMonotonicDts + stream.droppedPackets + stream.gaps;
+                    }
+                    if (anomalies > 0)
+                    {
+                        std::cout << "  " << anomalies << " timestamp anomalies";
+                    }
+                    std::cout << std::endl;
+                }
+                else
+                {
+                    summary.failed++;
+                    std::cout << "[failed] " << outputPath << "  " << error << std::endl;
+                }
+            };
+            scheduler.submit(job);
+        }
+        scheduler.waitAll();
+    }
+
+    double wallSeconds =
+        std::max(std::chrono::duration<double>(std::chrono::steady_clock::now() - wallStart).count(), 1e-9);
 
-    AudioVideoMerger merger;
-    if (merger.merge(videoFile, audioFile, outputFile)) {
-        std::cout << "合并成功!" << std::endl;
-        return 0;
+    std::cout << "\n=== Summary ===" << std::endl;
+    std::cout << "Jobs: " << summary.succeeded << " succeeded, " << summary.failed << " failed" << std::endl;
+    if (!options.mergeOptions.cacheDirectory.empty())
+    {
+        std::cout << "Cache hits: " << summary.cacheHits << std::endl;
     }
-    else {
-        std::cerr << "合并失败!" << std::endl;
-        return -1;
+    if (summary.clonedInputs > 0)
+    {
+        std::cout << "Cloned inputs: " << summary.clonedInputs << std::endl;
     }
-}
\ No newline at end of file
+    std::cout << "Wall time: " << wallSeconds << " s (" << options.jobs << " parallel)" << std::endl;
+    std::cout << "Read: " << summary.bytesRead / (1024.0 * 1024.0) << " MB, written: "
+              << summary.bytesWritten / (1024.0 * 1024.0) << " MB" << std::endl;
+    std::cout << "Throughput: " << summary.bytesRead / (1024.0 * 1024.0) / wallSeconds << " MB/s, "
+              << summary.packetsRead / wallSeconds << " packets/s, "
+              << (summary.succeeded + summary.failed) / wallSeconds << " jobs/s" << std::endl;
+
+    return summary.failed == 0 ? 0 : 1;
+}
@@ -4,6 +4,8 @@
 #pragma once
 
 #include <iostream>
+#ifdef _WIN32
 #include <windows.h>
+#endif
 
 // TODO: プログラムに必要な追加ヘッダーをここで参照します。
@@ -1,19 +1,608 @@
 #include <pybind11/pybind11.h>
 #include <pybind11/stl.h>
 #include "AudioVideoMerger.h"
+#include "MergeScheduler.h"
+#include "MergeTask.h"
+#include "MediaProbe.h"
+#include "PacketTap.h"
+#include "SeekIndex.h"
 
 namespace py = pybind11;
 
+// PacketBatch内部数组或数据包负载的只读缓冲区，memoryview通过它持有整个批次
+struct PacketBuffer
+{
+    std::shared_ptr<PacketBatch> batch;
+    const void *data;
+    Py_ssize_t itemSize;
+    Py_ssize_t count;
+    std::string format;
+};
+
+template <typename T>
+static py::memoryview batchColumn(const std::shared_ptr<PacketBatch> &batch, const std::vector<T> &column)
+{
+    return py::memoryview(py::cast(PacketBuffer{batch, column.data(), (Py_ssize_t)sizeof(T),
+                                                (Py_ssize_t)column.size(), py::format_descriptor<T>::format()}));
+}
+
+static py::memoryview batchPayload(const std::shared_ptr<PacketBatch> &batch, size_t index)
+{
+    return py::memoryview(py::cast(PacketBuffer{batch, batch->getData(index), 1, batch->getSize(index),
+                                                py::format_descriptor<uint8_t>::format()}));
+}
+
+// 关键帧索引转换为字典，points为(pts, offset)元组的列表
+static py::dict seekIndexDict(const SeekIndex &index)
+{
+    py::list points;
+    for (const SeekPoint &point : index.getPoints())
+    {
+        points.append(py::make_tuple(point.pts, point.offset));
+    }
+    py::dict result;
+    result["timescale"] = index.getTimescale();
+    result["track_index"] = index.getTrackIndex();
+    result["points"] = points;
+    return result;
+}
+
+// 包装在合并线程中调用的Python回调：调用和释放引用时都持有GIL
+template <typename... Args>
+static std::function<void(Args...)> wrapPythonCallback(py::object callback)
+{
+    if (callback.is_none())
+    {
+        return nullptr;
+    }
+
+    std::shared_ptr<py::object> holder(new py::object(std::move(callback)), [](py::object *object) {
+        py::gil_scoped_acquire acquire;
+        delete object;
+    });
+    return [holder](Args... args) {
+        py::gil_scoped_acquire acquire;
+        try
+        {
+            (*holder)(args...);
+        }
+        catch (py::error_already_set &error)
+        {
+            error.discard_as_unraisable("avmerger callback");
+        }
+    };
+}
+
 PYBIND11_MODULE(avmerger, m) {
     m.doc() = "Audio Video Merger module using FFmpeg";
     
+    py::class_<MergeOptions>(m, "MergeOptions")
+        .def(py::init<>())
+        .def_readwrite("start_time", &MergeOptions::startTime,
+                       "Start time in seconds (seeks to the preceding keyframe), negative for the beginning")
+        .def_readwrite("end_time", &MergeOptions::endTime,
+                       "End time in seconds, negative for the end of the inputs")
+        .def_readwrite("rebase_timestamps", &MergeOptions::rebaseTimestamps,
+                       "Shift trimmed output so it starts at zero")
+        .def_readwrite("align_start_times", &MergeOptions::alignStartTimes,
+                       "Shift each input so its first timestamp lands at zero before applying the offsets")
+        .def_readwrite("video_offset", &MergeOptions::videoOffset,
+                       "Delay the video by this many seconds (negative to advance it)")
+        .def_readwrite("audio_offset", &MergeOptions::audioOffset,
+                       "Delay the audio by this many seconds (negative to advance it)")
+        .def_readwrite("trim_to_shortest", &MergeOptions::trimToShortest,
+                       "Stop writing at the end of the shorter input")
+        .def_readwrite("output_format", &MergeOptions::outputFormat,
+                       "Output muxer name or alias (mp4, mov, mkv, webm, ts, flv, ...), empty to infer it from the "
+                       "output file extension. Stream copy and transcode encoders follow the container's rules")
+        .def_readwrite("parallel_segments", &MergeOptions::parallelSegments,
+                       "Split the timeline at keyframes into this many segments processed in parallel (0 = off)")
+        .def_readwrite("force_transcode", &MergeOptions::forceTranscode,
+                       "Re-encode every stream even when it could be stream-copied")
+        .def_readwrite("verbose", &MergeOptions::verbose,
+                       "Print input/output stream information to stdout")
+        .def_readwrite("native_remux", &MergeOptions::nativeRemux,
+                       "Remux fMP4 (H.264/HEVC + AAC) inputs to MP4 without libavformat's muxer when possible")
+        .def_readwrite("validate_native_remux", &MergeOptions::validateNativeRemux,
+                       "Re-read natively remuxed output with libavformat and compare packet counts and sizes")
+        .def_readwrite("faststart", &MergeOptions::faststart,
+                       "Put the moov box before the media data, sized up front when the input indexes allow it")
+        .def_readwrite("checksum", &MergeOptions::checksum,
+                       "Compute CRC32C of the output file and of each stream's packets while writing, "
+                       "and count timestamp anomalies")
+        .def_readwrite("clone_unchanged_input", &MergeOptions::cloneUnchangedInput,
+                       "When one input has no streams and the other is already a non-fragmented file in the "
+                       "target container, reflink/copy it as the output instead of remuxing")
+        .def_readwrite("cache_directory", &MergeOptions::cacheDirectory,
+                       "Directory of the on-disk merge cache, empty to disable. A hit reflinks, hardlinks "
+                       "or copies the cached output instead of merging")
+        .def_readwrite("cache_max_bytes", &MergeOptions::cacheMaxBytes,
+                       "Total size of cached outputs above which the least recently used ones are evicted")
+        .def_readwrite("cache_verify_inputs", &MergeOptions::cacheVerifyInputs,
+                       "Before using a cached output, re-read the inputs and compare their full CRC32C "
+                       "(recorded during the original merge) instead of trusting the sampled fingerprint")
+        .def_readwrite("thumbnail_interval", &MergeOptions::thumbnailInterval,
+                       "Extract a thumbnail from the first video keyframe of every interval of this many "
+                       "seconds while merging (0 = off); only the selected keyframes are decoded")
+        .def_readwrite("thumbnail_width", &MergeOptions::thumbnailWidth,
+                       "Thumbnail width in pixels, height keeps the aspect ratio (0 = source size)")
+        .def_readwrite("thumbnail_format", &MergeOptions::thumbnailFormat, "\"jpeg\" or \"webp\"")
+        .def_readwrite("thumbnail_quality", &MergeOptions::thumbnailQuality, "Thumbnail quality, 0 to 100")
+        .def_readwrite("thumbnail_pattern", &MergeOptions::thumbnailPattern,
+                       "Thumbnail file name pattern (%d or %04d is the index), empty to keep the encoded "
+                       "images in MergeStats.thumbnails")
+        .def_readwrite("loudness", &MergeOptions::loudness,
+                       "Decode the audio input on a side thread while merging and measure EBU R128 loudness "
+                       "(integrated, loudness range, true peak) into MergeStats.loudness")
+        .def_readwrite("seek_index_path", &MergeOptions::seekIndexPath,
+                       "Write a keyframe index sidecar (see read_seek_index) for the output to this path, "
+                       "empty to disable. It is read from the output's sample tables, not its sample data")
+        .def_readwrite("sidx", &MergeOptions::sidx,
+                       "Fragment MP4/MOV output at keyframes and write a global sidx box at the front")
+        .def_readwrite("packaging", &MergeOptions::packaging,
+                       "\"hls\" or \"dash\" to write segments plus a playlist/manifest in the same pass; the "
+                       "output path is the .m3u8/.mpd and segment names start with its name. Empty for a single file")
+        .def_readwrite("segment_duration", &MergeOptions::segmentDuration,
+                       "Target segment duration in seconds; segments are cut at the next video keyframe")
+        .def_readwrite("segment_type", &MergeOptions::segmentType,
+                       "HLS segment container, \"fmp4\" or \"mpegts\" (DASH always uses fMP4)")
+        .def_readwrite("async_segment_writes", &MergeOptions::asyncSegmentWrites,
+                       "Write segment files on a background thread so demuxing never waits for the disk")
+        .def_readwrite("atomic_output", &MergeOptions::atomicOutput,
+                       "Write to <name>.partial.<pid>-<n>.<ext> (<name>.partial.<ext> when resuming) in the output "
+                       "directory, then fsync and rename it over the output on success, so an interrupted merge "
+                       "never leaves a truncated output")
+        .def_readwrite("resume", &MergeOptions::resume,
+                       "With sidx, continue an interrupted merge from the last complete fragment of the partial "
+                       "file instead of starting over (stream copy only, no start trim)");
+
+    py::class_<LoudnessStats>(m, "LoudnessStats")
+        .def_readonly("valid", &LoudnessStats::valid)
+        .def_readonly("integrated", &LoudnessStats::integrated, "Integrated loudness in LUFS")
+        .def_readonly("range", &LoudnessStats::range, "Loudness range in LU")
+        .def_readonly("true_peak", &LoudnessStats::truePeak, "True peak in dBTP (4x oversampled)")
+        .def_readonly("sample_peak", &LoudnessStats::samplePeak, "Sample peak in dBFS")
+        .def_readonly("samples", &LoudnessStats::samples, "Samples measured per channel")
+        .def_readonly("decode_errors", &LoudnessStats::decodeErrors);
+
+    py::class_<Thumbnail>(m, "Thumbnail")
+        .def_readonly("seconds", &Thumbnail::seconds)
+        .def_readonly("width", &Thumbnail::width)
+        .def_readonly("height", &Thumbnail::height)
+        .def_readonly("path", &Thumbnail::path)
+        .def_property_readonly("data",
+                               [](const Thumbnail &thumbnail) {
+                                   return py::bytes(reinterpret_cast<const char *>(thumbnail.data.data()),
+                                                    thumbnail.data.size());
+                               },
+                               "Encoded image when no thumbnail_pattern was given, empty otherwise");
+
+    py::class_<StreamIntegrity>(m, "StreamIntegrity")
+        .def_readonly("packets", &StreamIntegrity::packets)
+        .def_readonly("bytes", &StreamIntegrity::bytes)
+        .def_readonly("crc32c", &StreamIntegrity::crc32c)
+        .def_readonly("non_monotonic_dts", &StreamIntegrity::nonMonotonicDts)
+        .def_readonly("dropped_packets", &StreamIntegrity::droppedPackets)
+        .def_readonly("gaps", &StreamIntegrity::gaps)
+        .def_readonly("gap_seconds", &StreamIntegrity::gapSeconds);
+
+    py::class_<MergeStats>(m, "MergeStats")
+        .def_readonly("open_seconds", &MergeStats::openSeconds)
+        .def_readonly("header_seconds", &MergeStats::headerSeconds)
+        .def_readonly("packet_seconds", &MergeStats::packetSeconds)
+        .def_readonly("trailer_seconds", &MergeStats::trailerSeconds)
+        .def_readonly("total_seconds", &MergeStats::totalSeconds)
+        .def_readonly("packets_read", &MergeStats::packetsRead)
+        .def_readonly("packets_written", &MergeStats::packetsWritten)
+        .def_readonly("bytes_read", &MergeStats::bytesRead)
+        .def_readonly("bytes_written", &MergeStats::bytesWritten)
+        .def_readonly("transcoded_streams", &MergeStats::transcodedStreams)
+        .def_readonly("native_remux", &MergeStats::nativeRemux)
+        .def_readonly("video_shift_seconds", &MergeStats::videoShiftSeconds)
+        .def_readonly("audio_shift_seconds", &MergeStats::audioShiftSeconds)
+        .def_readonly("checksum_valid", &MergeStats::checksumValid)
+        .def_readonly("output_crc32c", &MergeStats::outputCrc32c)
+        .def_readonly("streams", &MergeStats::streams)
+        .def_readonly("cache_hit", &MergeStats::cacheHit)
+        .def_readonly("input_cloned", &MergeStats::inputCloned)
+        .def_property_readonly("clone_method",
+                               [](const MergeStats &stats) {
+                                   return std::string(stats.cacheHit || stats.inputCloned
+                                                          ? cloneMethodName(stats.cloneMethod) : "");
+                               },
+                               "How the output file was produced on a cache hit or cloned input "
+                               "(reflink, hardlink, copy_file_range, copy), empty otherwise")
+        .def_readonly("thumbnails", &MergeStats::thumbnails)
+        .def_readonly("thumbnail_failures", &MergeStats::thumbnailFailures)
+        .def_readonly("loudness", &MergeStats::loudness)
+        .def_readonly("seek_index_written", &MergeStats::seekIndexWritten)
+        .def_readonly("seek_points", &MergeStats::seekPoints)
+        .def_readonly("segment_files", &MergeStats::segmentFiles)
+        .def_readonly("filtered_streams", &MergeStats::filteredStreams,
+                      "Stream-copied streams converted by bitstream filters (e.g. h264_mp4toannexb, aac_adtstoasc)")
+        .def_readonly("resumed_fragments", &MergeStats::resumedFragments,
+                      "Fragments kept from an interrupted merge (0 when the merge started over)")
+        .def_readonly("resumed_bytes", &MergeStats::resumedBytes);
+
+    py::class_<PacketBuffer>(m, "PacketBuffer", py::buffer_protocol())
+        .def_buffer([](PacketBuffer &buffer) {
+            return py::buffer_info(const_cast<void *>(buffer.data), buffer.itemSize, buffer.format, 1,
+                                   {buffer.count}, {buffer.itemSize}, true);
+        });
+
+    py::class_<PacketBatch, std::shared_ptr<PacketBatch>>(m, "PacketBatch",
+                                                          "A batch of packets. Columns and payloads are read-only "
+                                                          "memoryviews into the batch, valid while any of them is alive")
+        .def("__len__", &PacketBatch::size)
+        .def_property_readonly("bytes", &PacketBatch::getBytes, "Total payload bytes")
+        .def_property_readonly("stream_index",
+                               [](const std::shared_ptr<PacketBatch> &batch) {
+                                   return batchColumn(batch, batch->getStreamIndexes());
+                               },
+                               "int32 column of stream indexes")
+        .def_property_readonly("pts",
+                               [](const std::shared_ptr<PacketBatch> &batch) { return batchColumn(batch, batch->getPts()); },
+                               "int64 column of presentation timestamps in the stream time base (INT64_MIN if unknown)")
+        .def_property_readonly("dts",
+                               [](const std::shared_ptr<PacketBatch> &batch) { return batchColumn(batch, batch->getDts()); },
+                               "int64 column of decoding timestamps in the stream time base (INT64_MIN if unknown)")
+        .def_property_readonly("duration",
+                               [](const std::shared_ptr<PacketBatch> &batch) {
+                                   return batchColumn(batch, batch->getDurations());
+                               },
+                               "int64 column of packet durations in the stream time base")
+        .def_property_readonly("flags",
+                               [](const std::shared_ptr<PacketBatch> &batch) { return batchColumn(batch, batch->getFlags()); },
+                               "int32 column of AV_PKT_FLAG_* bits (1 = keyframe)")
+        .def("payload",
+             [](const std::shared_ptr<PacketBatch> &batch, size_t index) {
+                 if (index >= batch->size())
+                 {
+                     throw py::index_error("packet index out of range");
+                 }
+                 return batchPayload(batch, index);
+             },
+             "Payload of one packet as a read-only memoryview (no copy)",
+             py::arg("index"))
+        .def("packets",
+             [](const std::shared_ptr<PacketBatch> &batch) {
+                 py::list packets;
+                 for (size_t i = 0; i < batch->size(); i++)
+                 {
+                     packets.append(py::make_tuple(batch->getStreamIndexes()[i], batch->getPts()[i],
+                                                   batch->getDts()[i], batch->getFlags()[i], batchPayload(batch, i)));
+                 }
+                 return packets;
+             },
+             "List of (stream_index, pts, dts, flags, payload) tuples, payloads are memoryviews");
+
+    py::class_<PacketTap, std::shared_ptr<PacketTap>>(m, "PacketStream",
+                                                      "Bounded queue of packet batches filled by a merge or demuxer "
+                                                      "thread. Iterating blocks without holding the GIL")
+        .def(py::init<size_t, size_t>(), py::arg("batch_packets") = 64, py::arg("max_queued_batches") = 16)
+        .def("streams",
+             [](PacketTap &tap) {
+                 std::vector<TapStream> streams;
+                 {
+                     py::gil_scoped_release release;
+                     tap.waitStreams(streams);
+                 }
+                 py::list result;
+                 for (const auto &stream : streams)
+                 {
+                     py::dict info;
+                     info["index"] = stream.index;
+                     info["media_type"] = stream.mediaType;
+                     info["codec_name"] = stream.codecName;
+                     info["time_base"] = py::make_tuple(stream.timeBaseNum, stream.timeBaseDen);
+                     result.append(info);
+                 }
+                 return result;
+             },
+             "Wait until the producer has opened its streams and describe them (empty if it failed first)")
+        .def("__iter__", [](py::object self) { return self; })
+        .def("__next__",
+             [](PacketTap &tap) {
+                 std::unique_ptr<PacketBatch> batch;
+                 {
+                     py::gil_scoped_release release;
+                     batch = tap.next();
+                 }
+                 if (!batch)
+                 {
+                     std::string error = tap.getError();
+                     if (!error.empty())
+                     {
+                         throw std::runtime_error(error);
+                     }
+                     throw py::stop_iteration();
+                 }
+                 return std::shared_ptr<PacketBatch>(std::move(batch));
+             })
+        .def("close", &PacketTap::close,
+             "Stop consuming: queued batches are dropped and the producer no longer waits for space")
+        .def_property_readonly("finished", &PacketTap::isFinished)
+        .def_property_readonly("error", &PacketTap::getError);
+
     py::class_<AudioVideoMerger>(m, "AudioVideoMerger")
         .def(py::init<>())
+        .def_static("partial_output_path", &AudioVideoMerger::partialOutputPath, py::arg("output_path"),
+                    py::arg("suffix") = "",
+                    "Temporary file a merge writes before renaming it to output_path (atomic_output); resumable "
+                    "merges use the name without suffix, others add \"<pid>-<counter>\"")
         .def("merge", &AudioVideoMerger::merge, 
              "Merge audio and video files",
              py::arg("video_path"), 
              py::arg("audio_path"), 
-             py::arg("output_path"))
+             py::arg("output_path"),
+             py::arg("options") = MergeOptions(),
+             py::call_guard<py::gil_scoped_release>())
+        .def("cancel", &AudioVideoMerger::cancel,
+             "Abort a running merge from another thread")
+        .def("set_packet_tap", &AudioVideoMerger::setPacketTap,
+             "Send every packet written by the next merge to a PacketStream (consume it from another thread)",
+             py::arg("stream"))
         .def("get_last_error", &AudioVideoMerger::getLastError, 
-             "Get last error message");
+             "Get last error message")
+        .def("get_last_stats", &AudioVideoMerger::getLastStats,
+             "Per-phase timings and packet/byte counts of the last merge",
+             py::return_value_policy::copy);
+
+    py::class_<MergeTask, std::shared_ptr<MergeTask>>(m, "MergeTask")
+        .def("cancel", &MergeTask::cancel,
+             "Request cancellation, blocked reads and writes are interrupted")
+        .def("done", &MergeTask::isDone,
+             "Whether the merge has finished")
+        .def("wait", [](MergeTask &task, py::object timeout) -> py::object {
+                 // Python对象只在持有GIL时访问
+                 bool limited = !timeout.is_none();
+                 double seconds = limited ? timeout.cast<double>() : 0.0;
+                 bool finished = true;
+                 bool success = false;
+                 {
+                     py::gil_scoped_release release;
+                     if (limited)
+                     {
+                         finished = task.waitFor(seconds);
+                     }
+                     if (finished)
+                     {
+                         success = task.wait();
+                     }
+                 }
+                 if (!finished)
+                 {
+                     return py::none();
+                 }
+                 return py::bool_(success);
+             },
+             "Wait for the merge, returns its result or None on timeout",
+             py::arg("timeout") = py::none())
+        .def_property_readonly("progress", &MergeTask::getProgress,
+                               "Last reported progress between 0 and 1")
+        .def("get_last_error", &MergeTask::getLastError,
+             "Error message once the merge has finished");
+
+    m.def("probe",
+          [](const std::string &path, const std::string &targetFormat, bool useCache, bool fast) {
+              MediaInfo info;
+              AudioVideoMerger merger;
+              bool success;
+              {
+                  py::gil_scoped_release release;
+                  success = merger.probe(path, targetFormat, info, useCache, fast);
+              }
+              if (!success)
+              {
+                  throw std::runtime_error(merger.getLastError());
+              }
+
+              py::list streams;
+              for (const auto &stream : info.streams)
+              {
+                  py::dict item;
+                  item["index"] = stream.index;
+                  item["type"] = stream.mediaType;
+                  item["codec"] = stream.codecName;
+                  item["bit_rate"] = stream.bitRate;
+                  item["duration"] = stream.durationSeconds;
+                  item["copy_compatible"] = stream.copyCompatible;
+                  if (stream.mediaType == "video")
+                  {
+                      item["width"] = stream.width;
+                      item["height"] = stream.height;
+                      item["pix_fmt"] = stream.pixelFormat;
+                      item["frame_rate"] = stream.frameRate;
+                  }
+                  else if (stream.mediaType == "audio")
+                  {
+                      item["sample_rate"] = stream.sampleRate;
+                      item["channels"] = stream.channels;
+                      item["sample_fmt"] = stream.sampleFormat;
+                  }
+                  streams.append(item);
+              }
+
+              py::dict result;
+              result["path"] = info.path;
+              result["format"] = info.formatName;
+              result["size"] = info.fileSize;
+              result["duration"] = info.durationSeconds;
+              result["bit_rate"] = info.bitRate;
+              result["target_format"] = targetFormat;
+              result["needs_transcode"] = info.transcodeStreams > 0;
+              result["streams"] = streams;
+              return result;
+          },
+          "Read stream metadata without merging. Results are cached by (path, size, mtime). "
+          "With fast=True MP4/fMP4 headers are parsed directly, falling back to libavformat",
+          py::arg("path"),
+          py::arg("target_format") = "mp4",
+          py::arg("use_cache") = true,
+          py::arg("fast") = true);
+
+    m.def("probe_cache_info",
+          []() {
+              ProbeCache &cache = ProbeCache::shared();
+              py::dict info;
+              info["hits"] = cache.getHits();
+              info["misses"] = cache.getMisses();
+              info["size"] = cache.getSize();
+              info["capacity"] = cache.getCapacity();
+              return info;
+          },
+          "Hit/miss counters and occupancy of the probe cache");
+
+    m.def("clear_probe_cache", []() { ProbeCache::shared().clear(); }, "Drop all cached probe results");
+
+    m.def("set_probe_cache_capacity", [](size_t capacity) { ProbeCache::shared().setCapacity(capacity); },
+          "Maximum number of cached probe results, 0 disables caching",
+          py::arg("capacity"));
+
+    m.def("merge_cache_info",
+          [](const std::string &directory) {
+              MergeCache &cache = MergeCache::forDirectory(directory);
+              py::dict info;
+              info["hits"] = cache.getHits();
+              info["misses"] = cache.getMisses();
+              info["size"] = cache.getSize();
+              info["total_bytes"] = cache.getTotalBytes();
+              info["max_bytes"] = cache.getMaxBytes();
+              return info;
+          },
+          "Hit/miss counters and occupancy of the merge cache in a directory",
+          py::arg("directory"));
+
+    m.def("clear_merge_cache", [](const std::string &directory) { MergeCache::forDirectory(directory).clear(); },
+          "Delete every cached output in a merge cache directory",
+          py::arg("directory"));
+
+    m.def("read_seek_index",
+          [](const std::string &path) {
+              SeekIndex index;
+              if (!index.load(path))
+              {
+                  throw std::runtime_error(index.getLastError());
+              }
+              return seekIndexDict(index);
+          },
+          "Read a keyframe index sidecar: {\"timescale\", \"track_index\", \"points\": [(pts, offset), ...]}",
+          py::arg("path"));
+
+    m.def("build_seek_index",
+          [](const std::string &path) {
+              SeekIndex index;
+              bool success;
+              {
+                  py::gil_scoped_release release;
+                  success = index.build(path);
+              }
+              if (!success)
+              {
+                  throw std::runtime_error(index.getLastError());
+              }
+              return seekIndexDict(index);
+          },
+          "Read the keyframes of the first video track of an MP4/MOV file from its sample tables",
+          py::arg("path"));
+
+    m.def("start_merge",
+          [](const std::string &videoPath, const std::string &audioPath, const std::string &outputPath,
+             const MergeOptions &options, py::object progress, double progressInterval, py::object onComplete,
+             std::shared_ptr<PacketTap> packets) {
+              auto task = MergeTask::start(videoPath, audioPath, outputPath, options,
+                                           wrapPythonCallback<double>(progress), progressInterval,
+                                           wrapPythonCallback<bool, const std::string &>(onComplete),
+                                           std::move(packets));
+              // 句柄析构会等待合并线程，而合并线程的回调需要GIL，因此析构时先释放GIL
+              return std::shared_ptr<MergeTask>(task.get(), [task](MergeTask *) mutable {
+                  py::gil_scoped_release release;
+                  task.reset();
+              });
+          },
+          "Start a merge on a background thread and return a MergeTask handle; packets written to the "
+          "output are also sent to the optional PacketStream",
+          py::arg("video_path"),
+          py::arg("audio_path"),
+          py::arg("output_path"),
+          py::arg("options") = MergeOptions(),
+          py::arg("progress") = py::none(),
+          py::arg("progress_interval") = 0.5,
+          py::arg("on_complete") = py::none(),
+          py::arg("packets") = nullptr);
+
+    m.def("iter_packets",
+          [](const std::string &path, size_t batchPackets, size_t maxQueuedBatches) {
+              auto tap = std::make_shared<PacketTap>(batchPackets, maxQueuedBatches);
+              auto demuxer = std::make_shared<PacketDemuxer>(path, tap);
+              // 解封装线程不需要GIL，但析构时要等它退出
+              return std::shared_ptr<PacketTap>(tap.get(), [tap, demuxer](PacketTap *) mutable {
+                  py::gil_scoped_release release;
+                  demuxer.reset();
+                  tap.reset();
+              });
+          },
+          "Demux a file on a background thread and return a PacketStream of its packets",
+          py::arg("path"),
+          py::arg("batch_packets") = 64,
+          py::arg("max_queued_batches") = 16);
+
+    py::class_<MergeJob>(m, "MergeJob")
+        .def(py::init<>())
+        .def_readwrite("video_path", &MergeJob::videoPath)
+        .def_readwrite("audio_path", &MergeJob::audioPath)
+        .def_readwrite("output_path", &MergeJob::outputPath)
+        .def_readwrite("options", &MergeJob::options)
+        .def_readwrite("priority", &MergeJob::priority, "Higher values run first")
+        .def_readwrite("deadline_seconds", &MergeJob::deadlineSeconds,
+                       "Deadline relative to submission, 0 for none")
+        .def_readwrite("memory_bytes", &MergeJob::memoryBytes,
+                       "Memory budget of the job, 0 to estimate it from the probe");
+
+    py::class_<SchedulerLimits>(m, "SchedulerLimits")
+        .def(py::init<>())
+        .def_readwrite("worker_threads", &SchedulerLimits::workerThreads)
+        .def_readwrite("max_concurrent_transcodes", &SchedulerLimits::maxConcurrentTranscodes)
+        .def_readwrite("max_memory_bytes", &SchedulerLimits::maxMemoryBytes)
+        .def_readwrite("max_open_files", &SchedulerLimits::maxOpenFiles)
+        .def_readwrite("retained_results", &SchedulerLimits::retainedResults,
+                       "Finished results kept for wait(), oldest dropped first, 0 keeps all");
+
+    py::class_<SchedulerMetrics>(m, "SchedulerMetrics")
+        .def_readonly("queue_depth", &SchedulerMetrics::queueDepth)
+        .def_readonly("running_jobs", &SchedulerMetrics::runningJobs)
+        .def_readonly("running_transcodes", &SchedulerMetrics::runningTranscodes)
+        .def_readonly("completed_jobs", &SchedulerMetrics::completedJobs)
+        .def_readonly("failed_jobs", &SchedulerMetrics::failedJobs)
+        .def_readonly("deadline_misses", &SchedulerMetrics::deadlineMisses)
+        .def_readonly("memory_in_use", &SchedulerMetrics::memoryInUse)
+        .def_readonly("open_files_in_use", &SchedulerMetrics::openFilesInUse)
+        .def_readonly("average_wait_seconds", &SchedulerMetrics::averageWaitSeconds)
+        .def_readonly("max_wait_seconds", &SchedulerMetrics::maxWaitSeconds);
+
+    py::class_<MergeScheduler>(m, "MergeScheduler")
+        .def(py::init<const SchedulerLimits &>(), py::arg("limits") = SchedulerLimits())
+        .def("submit", &MergeScheduler::submit,
+             "Probe and queue a merge job, returns its id",
+             py::arg("job"),
+             py::call_guard<py::gil_scoped_release>())
+        .def("wait", [](MergeScheduler &scheduler, int64_t jobId) {
+                 std::string error;
+                 bool success;
+                 {
+                     py::gil_scoped_release release;
+                     success = scheduler.wait(jobId, &error);
+                 }
+                 return py::make_tuple(success, error);
+             },
+             "Wait for a job, returns (success, error)",
+             py::arg("job_id"))
+        .def("cancel", &MergeScheduler::cancel,
+             "Cancel a queued or running job",
+             py::arg("job_id"))
+        .def("wait_all", &MergeScheduler::waitAll,
+             "Wait for every submitted job",
+             py::call_guard<py::gil_scoped_release>())
+        .def("metrics", &MergeScheduler::getMetrics,
+             "Queue depth, resource usage and wait-time metrics");
 }
@@ -7,37 +7,71 @@ from pybind11.setup_helpers import Pybind11Extension, build_ext
 from pybind11 import get_cmake_dir
 import pybind11
 
-# 获取FFmpeg路径
-ffmpeg_root = os.environ.get("FFMPEG_ROOT", "C:/Program Files/ffmpeg")
+# 只链接实际用到的FFmpeg库
+ffmpeg_components = ["avformat", "avcodec", "avutil", "swscale", "swresample"]
 
-# FFmpeg包含目录
-ffmpeg_include = os.path.join(ffmpeg_root, "include")
+# AVMERGER_LAZY_TRANSCODE_LIBS=1 时不链接swscale/swresample，第一次转码时再加载
+lazy_transcode_libs = os.environ.get("AVMERGER_LAZY_TRANSCODE_LIBS") == "1"
+link_components = [c for c in ffmpeg_components if not (lazy_transcode_libs and c in ("swscale", "swresample"))]
 
-# FFmpeg库目录
-ffmpeg_lib = os.path.join(ffmpeg_root, "lib")
 
-# FFmpeg DLL目录（Windows）
-ffmpeg_bin = os.path.join(ffmpeg_root, "bin")
+def pkg_config(*args):
+    import subprocess
+
+    output = subprocess.check_output(["pkg-config", *args] + ["lib" + c for c in ffmpeg_components])
+    return output.decode().split()
+
+
+# 获取FFmpeg路径：指定FFMPEG_ROOT或在Windows上使用预编译包，否则通过pkg-config查找
+ffmpeg_root = os.environ.get("FFMPEG_ROOT")
+if ffmpeg_root is None and sys.platform == "win32":
+    ffmpeg_root = "C:/Program Files/ffmpeg"
+
+if ffmpeg_root is not None:
+    # FFmpeg包含目录
+    ffmpeg_include = [os.path.join(ffmpeg_root, "include")]
+    # FFmpeg库目录
+    ffmpeg_lib = [os.path.join(ffmpeg_root, "lib")]
+    # FFmpeg DLL目录（Windows）
+    ffmpeg_bin = os.path.join(ffmpeg_root, "bin")
+else:
+    ffmpeg_include = [flag[2:] for flag in pkg_config("--cflags-only-I")]
+    ffmpeg_lib = [flag[2:] for flag in pkg_config("--libs-only-L")]
+    ffmpeg_bin = None
 
 ext_modules = [
     Pybind11Extension(
         "avmerger",
-        ["pybind.cpp", "AudioVideoMerger.cpp"],
+        [
+            "pybind.cpp",
+            "AudioVideoMerger.cpp",
+            "SegmentedMerger.cpp",
+            "MergeScheduler.cpp",
+            "MergeTask.cpp",
+            "TranscodeLibraries.cpp",
+            "MediaProbe.cpp",
+            "IsoBmff.cpp",
+            "NativeMp4Remuxer.cpp",
+            "SampleIndex.cpp",
+            "IntegrityCheck.cpp",
+            "FileClone.cpp",
+            "MergeCache.cpp",
+            "PacketTap.cpp",
+            "ThumbnailExtractor.cpp",
+            "LoudnessMeter.cpp",
+            "SeekIndex.cpp",
+            "SegmentWriter.cpp",
+            "ContainerRules.cpp",
+            "BitstreamFilterChain.cpp",
+            "FragmentResume.cpp",
+        ],
         include_dirs=[
             pybind11.get_include(),
-            ffmpeg_include,
-        ],
-        libraries=[
-            "avcodec",
-            "avdevice",
-            "avfilter",
-            "avformat",
-            "avutil",
-            "postproc",
-            "swresample",
-            "swscale",
-        ],
-        library_dirs=[ffmpeg_lib],
+        ]
+        + ffmpeg_include,
+        libraries=link_components + (["dl"] if lazy_transcode_libs and sys.platform.startswith("linux") else []),
+        define_macros=[("AVMERGER_LAZY_TRANSCODE_LIBS", None)] if lazy_transcode_libs else [],
+        library_dirs=ffmpeg_lib,
         cxx_std=14,
     ),
 ]
@@ -55,11 +89,8 @@ if sys.platform == "win32":
             build_lib = Path(self.build_lib)
             dll_files = [
                 "avcodec-61.dll",
-                "avdevice-61.dll",
-                "avfilter-10.dll",
                 "avformat-61.dll",
                 "avutil-59.dll",
-                "postproc-58.dll",
                 "swresample-5.dll",
                 "swscale-8.dll",
             ]
@@ -0,0 +1,162 @@
+# test_packaging.py
+# 检查HLS打包的每个分片、sidx分片MP4的每个moof都同时包含音视频，
+# MPEG-TS和Matroska输出中音视频按时间交错（两个输入交错写出）
+#   python test_packaging.py video.m4s audio.m4s [work_dir]
+import os
+import struct
+import sys
+import avmerger
+
+
+def segment_media_types(path):
+    packets = avmerger.iter_packets(path)
+    types = {stream["index"]: stream["media_type"] for stream in packets.streams()}
+    found = set()
+    for batch in packets:
+        for index in batch.stream_index:
+            found.add(types.get(index))
+    return found
+
+
+def read_boxes(data, offset, end):
+    while offset + 8 <= end:
+        size, box_type = struct.unpack(">I4s", data[offset:offset + 8])
+        header = 8
+        if size == 1:
+            size = struct.unpack(">Q", data[offset + 8:offset + 16])[0]
+            header = 16
+        elif size == 0:
+            size = end - offset
+        if size < header or offset + size > end:
+            return
+        yield box_type.decode("latin-1"), offset + header, offset + size
+        offset += size
+
+
+def fragment_tracks(path):
+    """每个moof中有样本的轨道ID"""
+    with open(path, "rb") as file:
+        data = file.read()
+    fragments = []
+    for box_type, start, end in read_boxes(data, 0, len(data)):
+        if box_type != "moof":
+            continue
+        tracks = set()
+        for child_type, child_start, child_end in read_boxes(data, start, end):
+            if child_type != "traf":
+                continue
+            track_id = None
+            samples = 0
+            for traf_type, traf_start, traf_end in read_boxes(data, child_start, child_end):
+                if traf_type == "tfhd":
+                    track_id = struct.unpack(">I", data[traf_start + 4:traf_start + 8])[0]
+                elif traf_type == "trun":
+                    samples += struct.unpack(">I", data[traf_start + 4:traf_start + 8])[0]
+            if track_id is not None and samples > 0:
+                tracks.add(track_id)
+        fragments.append(tracks)
+    return fragments
+
+
+def check_sidx(video_path, audio_path, work_dir):
+    options = avmerger.MergeOptions()
+    options.sidx = True
+    output_path = os.path.join(work_dir, "sidx.mp4")
+    merger = avmerger.AudioVideoMerger()
+    if not merger.merge(video_path, audio_path, output_path, options):
+        print(f"sidx merge failed: {merger.get_last_error()}")
+        return False
+    fragments = fragment_tracks(output_path)
+    if not fragments:
+        print("sidx output has no fragments")
+        return False
+    # 较长的输入在最后可能单独成段
+    single = [i for i, tracks in enumerate(fragments[:-1]) if len(tracks) < 2]
+    if single:
+        print(f"{len(single)} of {len(fragments)} fragments hold one track, first is #{single[0]}")
+        return False
+    print(f"All {len(fragments)} fragments contain audio and video")
+    return True
+
+
+def max_interleave_gap(path):
+    """按文件顺序读取数据包时，已读到的视频和音频时间的最大差距（秒）"""
+    packets = avmerger.iter_packets(path)
+    streams = {stream["index"]: stream for stream in packets.streams()}
+    last = {}
+    gap = 0.0
+    for batch in packets:
+        for index, dts in zip(batch.stream_index, batch.dts):
+            stream = streams.get(index)
+            if stream is None or dts == -2 ** 63:
+                continue
+            num, den = stream["time_base"]
+            last[stream["media_type"]] = dts * num / den
+            if "video" in last and "audio" in last:
+                gap = max(gap, abs(last["video"] - last["audio"]))
+    return gap if len(last) == 2 else None
+
+
+def check_containers(video_path, audio_path, work_dir):
+    success = True
+    for name in ("out.ts", "out.mkv"):
+        output_path = os.path.join(work_dir, name)
+        merger = avmerger.AudioVideoMerger()
+        if not merger.merge(video_path, audio_path, output_path):
+            print(f"{name}: merge failed: {merger.get_last_error()}")
+            success = False
+            continue
+        gap = max_interleave_gap(output_path)
+        # 按DTS交错时差距只有几帧，1秒的余量容纳B帧延迟和复用器的缓冲
+        if gap is None or gap > 1.0:
+            print(f"{name}: audio and video are not interleaved (gap {gap})")
+            success = False
+        else:
+            print(f"{name}: interleaved, max gap {gap:.3f} s")
+    return success
+
+
+def main():
+    if len(sys.argv) < 3:
+        print("Usage: python test_packaging.py <video> <audio> [work_dir]")
+        return 2
+    video_path = sys.argv[1]
+    audio_path = sys.argv[2]
+    work_dir = sys.argv[3] if len(sys.argv) > 3 else "packaging_test"
+    os.makedirs(work_dir, exist_ok=True)
+
+    # MPEG-TS分片可以单独解封装，fMP4分片需要初始化段
+    options = avmerger.MergeOptions()
+    options.packaging = "hls"
+    options.segment_type = "mpegts"
+    options.segment_duration = 2.0
+    playlist = os.path.join(work_dir, "index.m3u8")
+
+    merger = avmerger.AudioVideoMerger()
+    if not merger.merge(video_path, audio_path, playlist, options):
+        print(f"Merge failed: {merger.get_last_error()}")
+        return 1
+
+    with open(playlist) as file:
+        segments = [line.strip() for line in file if line.strip() and not line.startswith("#")]
+    if not segments:
+        print("Playlist has no segments")
+        return 1
+
+    failed = 0
+    for segment in segments:
+        types = segment_media_types(os.path.join(work_dir, segment))
+        if "video" not in types or "audio" not in types:
+            print(f"{segment}: missing {'video' if 'video' not in types else 'audio'}")
+            failed += 1
+    if failed:
+        print(f"{failed} of {len(segments)} segments lack a stream")
+        return 1
+    print(f"All {len(segments)} segments contain audio and video")
+    sidx_ok = check_sidx(video_path, audio_path, work_dir)
+    containers_ok = check_containers(video_path, audio_path, work_dir)
+    return 0 if sidx_ok and containers_ok else 1
+
+
+if __name__ == "__main__":
+    sys.exit(main())